@@ -0,0 +1,53 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <map>
+#include <string>
+
+// momo のホットパスを計測するための最小限のベンチマークハーネス。
+// 結果は 1 ケース 1 行の JSON で標準出力に書き出すので、
+// アーキテクチャやリリース毎の結果を機械的に比較できる。
+class Bench {
+ public:
+  Bench(const std::string& filter, int min_time_ms);
+
+  // op を min_time_ms 以上繰り返して 1 回あたりの時間を出力する。
+  // bytes_per_op が 0 でなければスループットも出力する
+  void Run(const std::string& name,
+           const std::string& params,
+           size_t bytes_per_op,
+           const std::function<void()>& op);
+
+  // 時間以外の計測結果 (ビットレートなど) を同じ形式で出力する
+  void Report(const std::string& name,
+              const std::string& params,
+              const std::map<std::string, double>& values);
+
+  bool Enabled(const std::string& name) const;
+
+  static std::string Arch();
+
+ private:
+  std::string filter_;
+  int64_t min_time_ns_;
+};
+
+struct BenchResolution {
+  const char* name;
+  int width;
+  int height;
+};
+
+extern const BenchResolution kBenchResolutions[4];
+
+void RunVideoBenchmarks(Bench* bench);
+void RunH264Benchmarks(Bench* bench);
+void RunSerialBenchmarks(Bench* bench);
+void RunV4L2M2MBenchmarks(Bench* bench);
+void RunHWEncoderBenchmarks(Bench* bench);
+
+#endif  // BENCH_H_
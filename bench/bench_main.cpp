@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <iostream>
+#include <nlohmann/json.hpp>
+
+#include "bench.h"
+#include "momo_version.h"
+#include "rtc_base/time_utils.h"
+
+using json = nlohmann::json;
+
+const BenchResolution kBenchResolutions[4] = {
+    {"VGA", 640, 480},
+    {"HD", 1280, 720},
+    {"FHD", 1920, 1080},
+    {"4K", 3840, 2160},
+};
+
+Bench::Bench(const std::string& filter, int min_time_ms)
+    : filter_(filter),
+      min_time_ns_(static_cast<int64_t>(min_time_ms) *
+                   rtc::kNumNanosecsPerMillisec) {}
+
+void Bench::Run(const std::string& name,
+                const std::string& params,
+                size_t bytes_per_op,
+                const std::function<void()>& op) {
+  if (!Enabled(name)) {
+    return;
+  }
+
+  // キャッシュやバッファの確保の影響を除くために 1 回空回しする
+  op();
+
+  int64_t iterations = 0;
+  int64_t start_ns = rtc::TimeNanos();
+  int64_t elapsed_ns = 0;
+  do {
+    op();
+    iterations++;
+    elapsed_ns = rtc::TimeNanos() - start_ns;
+  } while (elapsed_ns < min_time_ns_);
+
+  double ns_per_op = static_cast<double>(elapsed_ns) / iterations;
+  json result = {
+      {"name", name},
+      {"params", params},
+      {"arch", Arch()},
+      {"iterations", iterations},
+      {"ns_per_op", ns_per_op},
+  };
+  if (bytes_per_op != 0) {
+    result["mb_per_sec"] = bytes_per_op / ns_per_op * 1e9 / (1024 * 1024);
+  }
+  std::cout << result.dump() << std::endl;
+}
+
+void Bench::Report(const std::string& name,
+                   const std::string& params,
+                   const std::map<std::string, double>& values) {
+  if (!Enabled(name)) {
+    return;
+  }
+  json result = {
+      {"name", name},
+      {"params", params},
+      {"arch", Arch()},
+  };
+  for (const auto& value : values) {
+    result[value.first] = value.second;
+  }
+  std::cout << result.dump() << std::endl;
+}
+
+bool Bench::Enabled(const std::string& name) const {
+  return filter_.empty() || name.find(filter_) != std::string::npos;
+}
+
+std::string Bench::Arch() {
+#if defined(__x86_64__)
+  return "x86_64";
+#elif defined(__aarch64__)
+  return "armv8";
+#elif defined(__ARM_ARCH_7A__)
+  return "armv7";
+#elif defined(__ARM_ARCH_6__) || defined(__ARM_ARCH_6ZK__)
+  return "armv6";
+#else
+  return "unknown";
+#endif
+}
+
+int main(int argc, char* argv[]) {
+  std::string filter;
+  int min_time_ms = 1000;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (strcmp(argv[i], "--min-time-ms") == 0 && i + 1 < argc) {
+      min_time_ms = atoi(argv[++i]);
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--filter SUBSTRING] [--min-time-ms MS]" << std::endl;
+      return 1;
+    }
+  }
+
+  std::cerr << MomoVersion::GetClientName() << " " << Bench::Arch()
+            << std::endl;
+
+  Bench bench(filter, min_time_ms);
+  RunVideoBenchmarks(&bench);
+  RunH264Benchmarks(&bench);
+  RunSerialBenchmarks(&bench);
+  RunV4L2M2MBenchmarks(&bench);
+  RunHWEncoderBenchmarks(&bench);
+  return 0;
+}
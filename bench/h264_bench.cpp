@@ -0,0 +1,56 @@
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "rtc/h264_nal.h"
+
+namespace {
+
+const uint8_t kStartCode[] = {0x00, 0x00, 0x00, 0x01};
+
+void AppendNal(uint8_t header, size_t size, std::vector<uint8_t>* out) {
+  out->insert(out->end(), kStartCode, kStartCode + sizeof(kStartCode));
+  out->push_back(header);
+  // スタートコードと紛れないように 0 を含まないペイロードにする
+  uint32_t seed = static_cast<uint32_t>(out->size());
+  for (size_t i = 1; i < size; i++) {
+    seed = seed * 1103515245 + 12345;
+    out->push_back(static_cast<uint8_t>((seed >> 16) % 255 + 1));
+  }
+}
+
+// エンコーダが出力するキーフレームと同じく SPS, PPS に続けて
+// 複数のスライスを並べたアクセスユニットを作る
+std::vector<uint8_t> CreateAccessUnit(size_t frame_size, int slices) {
+  std::vector<uint8_t> au;
+  AppendNal(0x67, 16, &au);
+  AppendNal(0x68, 4, &au);
+  for (int i = 0; i < slices; i++) {
+    AppendNal(0x65, frame_size / slices, &au);
+  }
+  return au;
+}
+
+}  // namespace
+
+void RunH264Benchmarks(Bench* bench) {
+  struct Case {
+    const char* name;
+    size_t frame_size;
+    int slices;
+  };
+  const Case cases[] = {
+      {"10KB/1slice", 10 * 1024, 1},
+      {"100KB/1slice", 100 * 1024, 1},
+      {"100KB/8slices", 100 * 1024, 8},
+      {"500KB/1slice", 500 * 1024, 1},
+  };
+  for (const Case& c : cases) {
+    std::vector<uint8_t> au = CreateAccessUnit(c.frame_size, c.slices);
+    std::vector<H264NalEntry> nals;
+    bench->Run("SplitH264Nals", c.name, au.size(), [&]() {
+      nals.clear();
+      SplitH264Nals(au.data(), au.size(), &nals);
+    });
+  }
+}
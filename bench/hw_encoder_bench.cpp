@@ -0,0 +1,252 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "api/video/i420_buffer.h"
+#include "api/video/video_bitrate_allocation.h"
+#include "bench.h"
+#include "hwenc_soft/soft_encoder_backend.h"
+#include "media/base/media_constants.h"
+#include "modules/video_coding/include/video_codec_interface.h"
+#include "modules/video_coding/include/video_error_codes.h"
+#include "rtc/hw_video_encoder.h"
+#include "rtc_base/event.h"
+#include "rtc_base/thread.h"
+
+namespace {
+
+const uint32_t kBitrateBps = 1000000;
+const uint32_t kFramerate = 30;
+
+// HWVideoEncoder から出てきたフレームを数える
+class CountingSink : public webrtc::EncodedImageCallback {
+ public:
+  Result OnEncodedImage(
+      const webrtc::EncodedImage& encoded_image,
+      const webrtc::CodecSpecificInfo* codec_specific_info,
+      const webrtc::RTPFragmentationHeader* fragmentation) override {
+    frames_++;
+    bytes_ += encoded_image.size();
+    {
+      std::lock_guard<std::mutex> lock(sizes_mtx_);
+      sizes_.push_back(encoded_image.size());
+    }
+    if (encoded_image._frameType == webrtc::VideoFrameType::kVideoFrameKey) {
+      key_frames_++;
+    }
+    encoded_.Set();
+    return Result(Result::OK, encoded_image.Timestamp());
+  }
+
+  rtc::Event& encoded() { return encoded_; }
+  int frames() const { return frames_; }
+  size_t bytes() const { return bytes_; }
+  int key_frames() const { return key_frames_; }
+  // キーフレームでビットレートが跳ねていないかを見るための、
+  // フレームの大きさの標準偏差と最大
+  void SizeStats(double* stddev, double* max) {
+    std::lock_guard<std::mutex> lock(sizes_mtx_);
+    *stddev = 0;
+    *max = 0;
+    if (sizes_.empty()) {
+      return;
+    }
+    double mean = 0;
+    for (size_t size : sizes_) {
+      mean += size;
+      *max = std::max(*max, static_cast<double>(size));
+    }
+    mean /= sizes_.size();
+    double variance = 0;
+    for (size_t size : sizes_) {
+      variance += (size - mean) * (size - mean);
+    }
+    *stddev = sqrt(variance / sizes_.size());
+  }
+
+ private:
+  rtc::Event encoded_;
+  std::atomic<int> frames_{0};
+  std::atomic<size_t> bytes_{0};
+  std::atomic<int> key_frames_{0};
+  std::mutex sizes_mtx_;
+  std::vector<size_t> sizes_;
+};
+
+std::unique_ptr<HWVideoEncoder> CreateEncoder(webrtc::VideoCodecType codec,
+                                              int latency_ms,
+                                              int intra_refresh_period,
+                                              const BenchResolution& res,
+                                              CountingSink* sink) {
+  webrtc::SdpVideoFormat format(codec == webrtc::kVideoCodecVP8
+                                    ? cricket::kVp8CodecName
+                                    : cricket::kH264CodecName);
+  auto encoder = absl::make_unique<HWVideoEncoder>(
+      absl::make_unique<SoftEncoderBackend>(codec, latency_ms), format,
+      intra_refresh_period);
+  webrtc::VideoCodec settings;
+  settings.codecType = codec;
+  settings.width = res.width;
+  settings.height = res.height;
+  settings.startBitrate = kBitrateBps / 1000;
+  settings.maxFramerate = kFramerate;
+  settings.mode = webrtc::VideoCodecMode::kRealtimeVideo;
+  if (codec == webrtc::kVideoCodecVP8) {
+    *settings.VP8() = webrtc::VideoEncoder::GetDefaultVp8Settings();
+  } else {
+    *settings.H264() = webrtc::VideoEncoder::GetDefaultH264Settings();
+  }
+  if (encoder->InitEncode(&settings, 1, 1200) != WEBRTC_VIDEO_CODEC_OK) {
+    return nullptr;
+  }
+  encoder->RegisterEncodeCompleteCallback(sink);
+  webrtc::VideoBitrateAllocation allocation;
+  allocation.SetBitrate(0, 0, kBitrateBps);
+  encoder->SetRates(
+      webrtc::VideoEncoder::RateControlParameters(allocation, kFramerate));
+  return encoder;
+}
+
+// 動きのある映像にしないとエンコーダがほとんど何も出さないので、
+// フレーム毎に模様をずらす
+void FillFrame(webrtc::I420Buffer* buffer, int n) {
+  for (int y = 0; y < buffer->height(); y++) {
+    uint8_t* row = buffer->MutableDataY() + y * buffer->StrideY();
+    for (int x = 0; x < buffer->width(); x++) {
+      row[x] = static_cast<uint8_t>((x + y * 3 + n * 7) ^ (x * y >> 4));
+    }
+  }
+  memset(buffer->MutableDataU(), 128,
+         buffer->StrideU() * buffer->ChromaHeight());
+  memset(buffer->MutableDataV(), 128,
+         buffer->StrideV() * buffer->ChromaHeight());
+}
+
+webrtc::VideoFrame CreateFrame(rtc::scoped_refptr<webrtc::I420Buffer> buffer,
+                               int n) {
+  return webrtc::VideoFrame::Builder()
+      .set_video_frame_buffer(buffer)
+      .set_timestamp_rtp(static_cast<uint32_t>(n) * (90000 / kFramerate))
+      .set_timestamp_ms(n * 1000 / kFramerate)
+      .build();
+}
+
+// 1 フレーム入れてから HWVideoEncoder を通って出てくるまでの時間を計る
+void RunRoundTrip(Bench* bench,
+                  const std::string& name,
+                  webrtc::VideoCodecType codec,
+                  int latency_ms,
+                  const BenchResolution& res) {
+  CountingSink sink;
+  std::unique_ptr<HWVideoEncoder> encoder =
+      CreateEncoder(codec, latency_ms, 0, res, &sink);
+  if (!encoder) {
+    std::cerr << name << ": failed to init " << res.name << std::endl;
+    return;
+  }
+  rtc::scoped_refptr<webrtc::I420Buffer> buffer =
+      webrtc::I420Buffer::Create(res.width, res.height);
+  int n = 0;
+  bench->Run(name, res.name, res.width * res.height * 3 / 2,
+             [&encoder, &sink, &buffer, &n]() {
+               FillFrame(buffer.get(), n);
+               encoder->Encode(CreateFrame(buffer, n++), nullptr);
+               sink.encoded().Wait(1000);
+             });
+}
+
+// 実時間で 30fps のフレームを入れて、レート制御が目標に近いビットレートを
+// 出せているかと、エンコーダが同時に抱えていたフレームの数を出力する
+void RunRateControl(Bench* bench,
+                    const std::string& name,
+                    webrtc::VideoCodecType codec,
+                    int latency_ms,
+                    int intra_refresh_period,
+                    const BenchResolution& res) {
+  if (!bench->Enabled(name)) {
+    return;
+  }
+  CountingSink sink;
+  std::unique_ptr<HWVideoEncoder> encoder =
+      CreateEncoder(codec, latency_ms, intra_refresh_period, res, &sink);
+  if (!encoder) {
+    std::cerr << name << ": failed to init " << res.name << std::endl;
+    return;
+  }
+  const int kFrames = 60;
+  rtc::scoped_refptr<webrtc::I420Buffer> buffer =
+      webrtc::I420Buffer::Create(res.width, res.height);
+  int max_in_flight = 0;
+  for (int n = 0; n < kFrames; n++) {
+    FillFrame(buffer.get(), n);
+    encoder->Encode(CreateFrame(buffer, n), nullptr);
+    max_in_flight = std::max(max_in_flight, n + 1 - sink.frames());
+    rtc::Thread::SleepMs(1000 / kFramerate);
+  }
+  // 残りが出てくるのを待つ
+  while (sink.encoded().Wait(latency_ms + 500)) {
+  }
+  encoder->Release();
+
+  double seconds = static_cast<double>(kFrames) / kFramerate;
+  double size_stddev, size_max;
+  sink.SizeStats(&size_stddev, &size_max);
+  bench->Report(name, res.name,
+                {
+                    {"target_bps", kBitrateBps},
+                    {"actual_bps", sink.bytes() * 8 / seconds},
+                    {"frames", kFrames},
+                    {"encoded_frames", static_cast<double>(sink.frames())},
+                    {"key_frames", static_cast<double>(sink.key_frames())},
+                    {"max_in_flight", static_cast<double>(max_in_flight)},
+                    {"frame_size_stddev", size_stddev},
+                    {"frame_size_max", size_max},
+                });
+}
+
+}  // namespace
+
+void RunHWEncoderBenchmarks(Bench* bench) {
+  // HWVideoEncoder の共通部分を、実機の代わりにソフトウェアの
+  // バックエンドで計る。latency_ms はハードウェアの処理時間の代わり
+  const struct {
+    const char* name;
+    webrtc::VideoCodecType codec;
+  } codecs[] = {
+      {"hw_encoder/soft_vp8", webrtc::kVideoCodecVP8},
+      {"hw_encoder/soft_h264", webrtc::kVideoCodecH264},
+  };
+  const int latencies[] = {0, 10, 33};
+  for (const auto& codec : codecs) {
+    if (!SoftEncoderBackend::IsSupported(codec.codec)) {
+      std::cerr << codec.name << ": encoder not supported, skipped"
+                << std::endl;
+      continue;
+    }
+    for (int latency_ms : latencies) {
+      std::string name =
+          std::string(codec.name) + "/" + std::to_string(latency_ms) + "ms";
+      // 4K はソフトウェアでは遅すぎるので HD までにする
+      for (int i = 0; i < 2; i++) {
+        const BenchResolution& res = kBenchResolutions[i];
+        RunRoundTrip(bench, name + "/round_trip", codec.codec, latency_ms,
+                     res);
+        RunRateControl(bench, name + "/rate_control", codec.codec,
+                       latency_ms, 0, res);
+        // フレームの大きさのばらつきを、定期的なキーフレームの場合と比べる
+        RunRateControl(bench, name + "/rate_control_ir", codec.codec,
+                       latency_ms, kFramerate, res);
+      }
+    }
+  }
+}
@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "serial_data_channel/ring_buffer.h"
+#include "serial_data_channel/serial_framer.h"
+
+namespace {
+
+// SerialDataManager の既定値と同じ
+const size_t kRingBufferSize = 256 * 1024;
+const size_t kMaxFrameSize = 64 * 1024;
+
+// framer で message_length バイトのメッセージを messages 個エンコードした
+// バイト列を作る
+std::vector<uint8_t> CreateStream(SerialFramer* framer,
+                                  size_t message_length,
+                                  size_t messages) {
+  SerialRingBuffer tx(kRingBufferSize);
+  std::vector<uint8_t> message(message_length);
+  std::vector<uint8_t> stream;
+  for (size_t i = 0; i < messages; i++) {
+    for (size_t j = 0; j < message_length; j++) {
+      message[j] = static_cast<uint8_t>('a' + (i + j) % 26);
+    }
+    if (!framer->Encode(message.data(), message.size(), &tx)) {
+      return std::vector<uint8_t>();
+    }
+    size_t offset = stream.size();
+    stream.resize(offset + tx.size());
+    tx.Peek(0, &stream[offset], tx.size());
+    tx.Consume(tx.size());
+  }
+  return stream;
+}
+
+}  // namespace
+
+void RunSerialBenchmarks(Bench* bench) {
+  struct Case {
+    const char* name;
+    size_t message_length;
+    size_t messages;
+    // async_read_some で一度に受け取るバイト数
+    size_t chunk_size;
+  };
+  const Case cases[] = {
+      {"32B/64msgs/chunk64", 32, 64, 64},
+      {"32B/64msgs/chunk4096", 32, 64, 4096},
+      {"1KB/16msgs/chunk4096", 1024, 16, 4096},
+  };
+  const char* framings[] = {"newline", "length", "cobs"};
+  for (const char* framing : framings) {
+    std::unique_ptr<SerialFramer> framer =
+        SerialFramer::Create(framing, kMaxFrameSize);
+    std::string name = std::string("SerialFramer::Decode/") + framing;
+    for (const Case& c : cases) {
+      std::vector<uint8_t> data =
+          CreateStream(framer.get(), c.message_length, c.messages);
+      if (data.empty()) {
+        std::cerr << name << ": failed to encode " << c.name << std::endl;
+        continue;
+      }
+      // 受信した順にリングバッファに書き込んで、その都度取り出す
+      SerialRingBuffer rx(kRingBufferSize);
+      size_t received = 0;
+      bench->Run(name, c.name, data.size(), [&]() {
+        for (size_t offset = 0; offset < data.size();
+             offset += c.chunk_size) {
+          size_t size = std::min(c.chunk_size, data.size() - offset);
+          uint8_t* span;
+          size_t written = 0;
+          while (written < size) {
+            size_t length =
+                std::min(rx.WritableSpan(&span), size - written);
+            std::copy(data.begin() + offset + written,
+                      data.begin() + offset + written + length, span);
+            rx.Commit(length);
+            written += length;
+          }
+          framer->Decode(&rx, [&received](const uint8_t* frame,
+                                          size_t length) {
+            received += length;
+            return true;
+          });
+        }
+      });
+    }
+  }
+}
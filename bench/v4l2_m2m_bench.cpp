@@ -0,0 +1,83 @@
+#include <string>
+
+#include "bench.h"
+
+#if USE_V4L2_M2M_ENCODER
+
+#include <iostream>
+#include <memory>
+
+#include "api/video/i420_buffer.h"
+#include "hwenc_v4l2/v4l2_m2m_device.h"
+#include "rtc_base/event.h"
+
+#ifndef V4L2_PIX_FMT_FWHT
+#define V4L2_PIX_FMT_FWHT v4l2_fourcc('F', 'W', 'H', 'T')
+#endif
+
+namespace {
+
+// 1 フレーム入れてから出てくるまでの往復の時間を計る
+void RunRoundTrip(Bench* bench,
+                  const std::string& name,
+                  const std::string& device,
+                  uint32_t coded_fourcc) {
+  for (const BenchResolution& res : kBenchResolutions) {
+    V4L2M2MDevice::Config config;
+    config.coded_fourcc = coded_fourcc;
+    config.width = res.width;
+    config.height = res.height;
+    config.bitrate_bps = 2000000;
+
+    rtc::Event encoded(false, false);
+    std::unique_ptr<V4L2M2MDevice> m2m = V4L2M2MDevice::Open(
+        device, config,
+        [&encoded](const uint8_t* data, size_t size, uint64_t key,
+                   bool key_frame) { encoded.Set(); });
+    if (!m2m) {
+      std::cerr << name << ": failed to open " << device << " " << res.name
+                << std::endl;
+      continue;
+    }
+
+    rtc::scoped_refptr<webrtc::I420Buffer> frame =
+        webrtc::I420Buffer::Create(res.width, res.height);
+    webrtc::I420Buffer::SetBlack(frame);
+    uint64_t key = 0;
+    bench->Run(name, res.name, res.width * res.height * 3 / 2,
+               [&m2m, &frame, &encoded, &key]() {
+                 if (m2m->Encode(*frame, key++)) {
+                   encoded.Wait(1000);
+                 }
+               });
+  }
+}
+
+}  // namespace
+
+void RunV4L2M2MBenchmarks(Bench* bench) {
+  // 実機のエンコーダが無い環境では vicodec (modprobe vicodec multiplanar=1)
+  // を使って V4L2 周りの処理だけを計る
+  const struct {
+    const char* name;
+    uint32_t fourcc;
+  } codecs[] = {
+      {"v4l2_m2m/h264", V4L2_PIX_FMT_H264},
+      {"v4l2_m2m/vp8", V4L2_PIX_FMT_VP8},
+      {"v4l2_m2m/fwht", V4L2_PIX_FMT_FWHT},
+  };
+  for (const auto& codec : codecs) {
+    std::string device = V4L2M2MDevice::FindDevice(codec.fourcc);
+    if (device.empty()) {
+      std::cerr << codec.name << ": encoder not found, skipped" << std::endl;
+      continue;
+    }
+    RunRoundTrip(bench, codec.name, device, codec.fourcc);
+  }
+}
+
+#else
+
+void RunV4L2M2MBenchmarks(Bench* bench) {}
+
+#endif
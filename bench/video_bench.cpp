@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// libjpeg は WebRTC の third_party/libjpeg_turbo を使う
+#include <jpeglib.h>
+
+#include "api/video/i420_buffer.h"
+#include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
+#include "bench.h"
+#include "rtc/native_buffer.h"
+#include "rtc/scalable_track_source.h"
+#include "rtc_base/ref_counted_object.h"
+#include "rtc_base/time_utils.h"
+#include "third_party/libyuv/include/libyuv.h"
+
+#if defined(__linux__)
+#include "v4l2_video_capturer/v4l2_video_capturer.h"
+#endif
+#if USE_SDL2
+#include "sdl_renderer/sdl_renderer.h"
+#endif
+
+namespace {
+
+#if USE_SDL2
+// SDLRenderer のデフォルトのウィンドウサイズ
+const int kWindowWidth = 640;
+const int kWindowHeight = 480;
+#endif
+const int kJpegQuality = 85;
+
+// 圧縮率が極端にならないように、グラデーションにノイズを乗せた映像を作る
+rtc::scoped_refptr<webrtc::I420Buffer> CreateSourceFrame(int width,
+                                                         int height) {
+  rtc::scoped_refptr<webrtc::I420Buffer> buffer =
+      webrtc::I420Buffer::Create(width, height);
+  uint32_t seed = 1;
+  for (int y = 0; y < height; y++) {
+    uint8_t* row = buffer->MutableDataY() + y * buffer->StrideY();
+    for (int x = 0; x < width; x++) {
+      seed = seed * 1103515245 + 12345;
+      row[x] = static_cast<uint8_t>((x + y) / 4 + ((seed >> 16) & 0x0f));
+    }
+  }
+  for (int y = 0; y < buffer->ChromaHeight(); y++) {
+    uint8_t* u = buffer->MutableDataU() + y * buffer->StrideU();
+    uint8_t* v = buffer->MutableDataV() + y * buffer->StrideV();
+    for (int x = 0; x < buffer->ChromaWidth(); x++) {
+      u[x] = static_cast<uint8_t>(x);
+      v[x] = static_cast<uint8_t>(y);
+    }
+  }
+  return buffer;
+}
+
+std::vector<uint8_t> ToYUY2(const webrtc::I420BufferInterface& buffer) {
+  std::vector<uint8_t> yuy2(buffer.width() * buffer.height() * 2);
+  libyuv::I420ToYUY2(buffer.DataY(), buffer.StrideY(), buffer.DataU(),
+                     buffer.StrideU(), buffer.DataV(), buffer.StrideV(),
+                     yuy2.data(), buffer.width() * 2, buffer.width(),
+                     buffer.height());
+  return yuy2;
+}
+
+std::vector<uint8_t> ToMJPEG(const webrtc::I420BufferInterface& buffer) {
+  std::vector<uint8_t> rgb(buffer.width() * buffer.height() * 3);
+  libyuv::I420ToRAW(buffer.DataY(), buffer.StrideY(), buffer.DataU(),
+                    buffer.StrideU(), buffer.DataV(), buffer.StrideV(),
+                    rgb.data(), buffer.width() * 3, buffer.width(),
+                    buffer.height());
+
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+  unsigned char* out = nullptr;
+  unsigned long out_size = 0;
+  jpeg_mem_dest(&cinfo, &out, &out_size);
+  cinfo.image_width = buffer.width();
+  cinfo.image_height = buffer.height();
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, kJpegQuality, TRUE);
+  jpeg_start_compress(&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    JSAMPROW row = rgb.data() + cinfo.next_scanline * buffer.width() * 3;
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+
+  std::vector<uint8_t> jpeg(out, out + out_size);
+  free(out);
+  return jpeg;
+}
+
+std::string Params(const BenchResolution& res, const char* format) {
+  return std::string(res.name) + "/" + format;
+}
+
+class BenchVideoSource : public ScalableVideoTrackSource {};
+
+class NullSink : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+ public:
+  void OnFrame(const webrtc::VideoFrame& frame) override {}
+};
+
+// NativeBuffer::ToI420 と同じく、キャプチャしたデータをそのままの大きさで
+// I420 に変換するコスト
+void RunNativeBufferToI420(Bench* bench,
+                           const BenchResolution& res,
+                           webrtc::VideoType type,
+                           const std::vector<uint8_t>& data,
+                           const char* format) {
+  rtc::scoped_refptr<NativeBuffer> native_buffer =
+      NativeBuffer::Create(type, res.width, res.height);
+  memcpy(native_buffer->MutableData(), data.data(), data.size());
+  native_buffer->SetLength(data.size());
+  bench->Run("NativeBuffer::ToI420", Params(res, format), data.size(),
+             [&]() { native_buffer->ToI420(); });
+}
+
+#if defined(__linux__)
+// V4L2VideoCapture::CaptureProcess で I420 に変換するコスト
+void RunV4L2ConvertToI420(Bench* bench,
+                          const BenchResolution& res,
+                          webrtc::VideoType type,
+                          const std::vector<uint8_t>& data,
+                          const char* format) {
+  bench->Run("V4L2VideoCapture::ConvertToI420", Params(res, format),
+             data.size(), [&]() {
+               V4L2VideoCapture::ConvertToI420(data.data(), data.size(),
+                                               res.width, res.height, type);
+             });
+}
+#endif
+
+// 帯域推定で解像度が半分に下げられた時の
+// ScalableVideoTrackSource::OnCapturedFrame のコスト
+void RunOnCapturedFrame(Bench* bench,
+                        const BenchResolution& res,
+                        rtc::scoped_refptr<webrtc::I420Buffer> buffer) {
+  rtc::scoped_refptr<BenchVideoSource> source(
+      new rtc::RefCountedObject<BenchVideoSource>());
+  NullSink sink;
+  rtc::VideoSinkWants wants;
+  wants.max_pixel_count = res.width * res.height / 4;
+  source->AddOrUpdateSink(&sink, wants);
+
+  int64_t timestamp_us = rtc::TimeMicros();
+  bench->Run("ScalableVideoTrackSource::OnCapturedFrame",
+             Params(res, "I420_half"), 0, [&]() {
+               timestamp_us += rtc::kNumMicrosecsPerSec / 30;
+               source->OnCapturedFrame(
+                   webrtc::VideoFrame::Builder()
+                       .set_video_frame_buffer(buffer)
+                       .set_timestamp_us(timestamp_us)
+                       .set_rotation(webrtc::kVideoRotation_0)
+                       .build());
+             });
+  source->RemoveSink(&sink);
+}
+
+#if USE_SDL2
+// SDLRenderer::Sink::OnFrame で、ウィンドウに合わせて縮小してから
+// ARGB に変換するコスト
+void RunSDLConvert(Bench* bench,
+                   const BenchResolution& res,
+                   rtc::scoped_refptr<webrtc::I420Buffer> buffer) {
+  int width = kWindowWidth;
+  int height = kWindowHeight;
+  float frame_aspect = (float)res.width / (float)res.height;
+  if (frame_aspect > (float)kWindowWidth / (float)kWindowHeight) {
+    height = width / frame_aspect;
+  } else {
+    width = height * frame_aspect;
+  }
+  bool scaled = width < res.width;
+  std::unique_ptr<uint8_t[]> image(
+      scaled ? new uint8_t[width * height * 4]
+             : new uint8_t[res.width * res.height * 4]);
+  webrtc::VideoFrame frame = webrtc::VideoFrame::Builder()
+                                 .set_video_frame_buffer(buffer)
+                                 .set_rotation(webrtc::kVideoRotation_0)
+                                 .build();
+
+  bench->Run("SDLRenderer::Sink::OnFrame", Params(res, "ARGB"), 0, [&]() {
+    SDLRenderer::Sink::ConvertToARGB(frame, scaled, width, height,
+                                     image.get());
+  });
+}
+#endif
+
+}  // namespace
+
+void RunVideoBenchmarks(Bench* bench) {
+  for (const BenchResolution& res : kBenchResolutions) {
+    rtc::scoped_refptr<webrtc::I420Buffer> source =
+        CreateSourceFrame(res.width, res.height);
+    std::vector<uint8_t> yuy2 = ToYUY2(*source);
+    std::vector<uint8_t> mjpeg = ToMJPEG(*source);
+
+    RunNativeBufferToI420(bench, res, webrtc::VideoType::kMJPEG, mjpeg,
+                          "MJPEG");
+    RunNativeBufferToI420(bench, res, webrtc::VideoType::kYUY2, yuy2, "YUY2");
+#if defined(__linux__)
+    RunV4L2ConvertToI420(bench, res, webrtc::VideoType::kMJPEG, mjpeg,
+                         "MJPEG");
+    RunV4L2ConvertToI420(bench, res, webrtc::VideoType::kYUY2, yuy2, "YUY2");
+#endif
+    RunOnCapturedFrame(bench, res, source);
+#if USE_SDL2
+    RunSDLConvert(bench, res, source);
+#endif
+  }
+}
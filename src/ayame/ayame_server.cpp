@@ -1,5 +1,6 @@
 #include "ayame_server.h"
 
+#include "ayame_session.h"
 #include "util.h"
 
 AyameServer::AyameServer(boost::asio::io_context& ioc,
@@ -66,6 +67,8 @@ void AyameServer::doAccept() {
 void AyameServer::onAccept(boost::system::error_code ec) {
   if (ec) {
     MOMO_BOOST_ERROR(ec, "accept");
+  } else {
+    std::make_shared<AyameSession>(std::move(socket_), rtc_manager_)->run();
   }
 
   // Accept another connection
@@ -0,0 +1,87 @@
+#include "ayame_session.h"
+
+#include <boost/beast/http/read.hpp>
+
+#include "util.h"
+
+AyameSession::AyameSession(boost::asio::ip::tcp::socket socket,
+                           RTCManager* rtc_manager)
+    : socket_(std::move(socket)),
+      strand_(socket_.get_executor()),
+      rtc_manager_(rtc_manager) {}
+
+void AyameSession::run() {
+  doRead();
+}
+
+void AyameSession::doRead() {
+  // Make the request empty before reading,
+  // otherwise the operation behavior is undefined.
+  req_ = {};
+
+  // Read a request
+  boost::beast::http::async_read(
+      socket_, buffer_, req_,
+      boost::asio::bind_executor(
+          strand_, std::bind(&AyameSession::onRead, shared_from_this(),
+                             std::placeholders::_1, std::placeholders::_2)));
+}
+
+void AyameSession::onRead(boost::system::error_code ec,
+                          std::size_t bytes_transferred) {
+  boost::ignore_unused(bytes_transferred);
+
+  // This means they closed the connection
+  if (ec == boost::beast::http::error::end_of_stream)
+    return doClose();
+
+  if (ec)
+    return MOMO_BOOST_ERROR(ec, "read");
+
+  if (req_.method() != boost::beast::http::verb::get) {
+    sendResponse(Util::badRequest(req_, "Invalid Method"));
+    return;
+  }
+
+  if (req_.target() == "/metrics") {
+    std::shared_ptr<MetricsCollector> collector =
+        rtc_manager_->getMetricsCollector();
+    if (collector) {
+      sendResponse(Util::okText(req_, MetricsCollector::kContentType,
+                                collector->GetText()));
+    } else {
+      sendResponse(Util::notFound(req_, req_.target()));
+    }
+  } else {
+    sendResponse(Util::badRequest(req_, "Invalid Request"));
+  }
+}
+
+void AyameSession::onWrite(boost::system::error_code ec,
+                           std::size_t bytes_transferred,
+                           bool close) {
+  boost::ignore_unused(bytes_transferred);
+
+  if (ec)
+    return MOMO_BOOST_ERROR(ec, "write");
+
+  if (close) {
+    // This means we should close the connection, usually because
+    // the response indicated the "Connection: close" semantic.
+    return doClose();
+  }
+
+  // We're done with the response so delete it
+  res_ = nullptr;
+
+  // Read another request
+  doRead();
+}
+
+void AyameSession::doClose() {
+  // Send a TCP shutdown
+  boost::system::error_code ec;
+  socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_send, ec);
+
+  // At this point the connection is closed gracefully
+}
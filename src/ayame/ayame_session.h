@@ -0,0 +1,61 @@
+#ifndef AYAME_SESSION_H_
+#define AYAME_SESSION_H_
+
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <boost/beast/http/write.hpp>
+#include <functional>
+#include <memory>
+
+#include "rtc/manager.h"
+
+// Ayame モードで待ち受けている HTTP の１回のリクエストに対して答えるためのクラス。
+// 今のところ /metrics だけを返す
+class AyameSession : public std::enable_shared_from_this<AyameSession> {
+  boost::asio::ip::tcp::socket socket_;
+  boost::asio::strand<boost::asio::ip::tcp::socket::executor_type> strand_;
+  boost::beast::flat_buffer buffer_;
+  boost::beast::http::request<boost::beast::http::string_body> req_;
+  std::shared_ptr<void> res_;
+
+  RTCManager* rtc_manager_;
+
+ public:
+  AyameSession(boost::asio::ip::tcp::socket socket, RTCManager* rtc_manager);
+
+  void run();
+
+ private:
+  void doRead();
+
+  void onRead(boost::system::error_code ec, std::size_t bytes_transferred);
+  void onWrite(boost::system::error_code ec,
+               std::size_t bytes_transferred,
+               bool close);
+  void doClose();
+
+ private:
+  template <class Body, class Fields>
+  void sendResponse(boost::beast::http::response<Body, Fields> msg) {
+    auto sp = std::make_shared<boost::beast::http::response<Body, Fields>>(
+        std::move(msg));
+
+    // msg オブジェクトは書き込みが完了するまで生きている必要があるので、
+    // メンバに入れてライフタイムを延ばしてやる
+    res_ = sp;
+
+    // Write the response
+    boost::beast::http::async_write(
+        socket_, *sp,
+        boost::asio::bind_executor(
+            strand_, std::bind(&AyameSession::onWrite, shared_from_this(),
+                               std::placeholders::_1, std::placeholders::_2,
+                               sp->need_eof())));
+  }
+};
+
+#endif  // AYAME_SESSION_H_
@@ -4,11 +4,23 @@
 #include <nlohmann/json.hpp>
 
 #include "../momo_version.h"
+#include "metrics/recovery_stats.h"
+#include "metrics/startup_report.h"
 #include "url_parts.h"
+#include "rtc_base/time_utils.h"
 #include "util.h"
 
 using json = nlohmann::json;
 
+namespace {
+
+// ICE が切れてからリスタートするまで待つ時間 (秒)
+const int kIceRestartGraceSec = 2;
+// ICE リスタートしてから戻るまで待つ時間 (秒)。過ぎたら作り直す
+const int kIceRestartTimeoutSec = 10;
+
+}  // namespace
+
 bool AyameWebsocketClient::parseURL(URLParts& parts) const {
   std::string url = conn_settings_.ayame_signaling_host;
 
@@ -59,12 +71,20 @@ AyameWebsocketClient::AyameWebsocketClient(boost::asio::io_context& ioc,
       retry_count_(0),
       conn_settings_(conn_settings),
       watchdog_(ioc,
-                std::bind(&AyameWebsocketClient::onWatchdogExpired, this)) {
+                std::bind(&AyameWebsocketClient::onWatchdogExpired, this)),
+      ice_restart_watchdog_(
+          ioc,
+          std::bind(&AyameWebsocketClient::onIceRestartWatchdogExpired, this)),
+      reconnecting_(false),
+      disconnected_at_ms_(-1) {
   reset();
 }
 
 void AyameWebsocketClient::reset() {
   connection_ = nullptr;
+  prewarmed_connection_ = nullptr;
+  ice_restart_watchdog_.disable();
+  ice_restarting_ = false;
   connected_ = false;
   is_send_offer_ = false;
   has_is_exist_user_flag_ = false;
@@ -92,6 +112,7 @@ void AyameWebsocketClient::reset() {
 
 void AyameWebsocketClient::release() {
   connection_ = nullptr;
+  prewarmed_connection_ = nullptr;
 }
 
 bool AyameWebsocketClient::connect() {
@@ -137,6 +158,72 @@ void AyameWebsocketClient::onWatchdogExpired() {
   connect();
 }
 
+void AyameWebsocketClient::onIceDisconnected() {
+  if (disconnected_at_ms_ < 0) {
+    disconnected_at_ms_ = rtc::TimeMillis();
+  }
+  // 短い切断は何もしなくても戻ることが多いので、少し待ってからリスタートする
+  if (!ice_restarting_) {
+    ice_restart_watchdog_.enable(kIceRestartGraceSec);
+  }
+}
+
+void AyameWebsocketClient::onIceRestartWatchdogExpired() {
+  if (!ice_restarting_) {
+    if (startIceRestart()) {
+      return;
+    }
+  } else {
+    RTC_LOG(LS_WARNING) << __FUNCTION__ << ": ICE restart timed out";
+  }
+  fallBackToReconnect();
+}
+
+bool AyameWebsocketClient::startIceRestart() {
+  // isExistUser を返さない古い Ayame では、こちらから送ったオファーに
+  // 答えを返す流れになっていないので作り直す
+  if (!connection_ || !connected_ || !has_is_exist_user_flag_) {
+    return false;
+  }
+  RTC_LOG(LS_INFO) << __FUNCTION__;
+  ice_restarting_ = true;
+  is_send_offer_ = true;
+  RecoveryStats::CountIceRestart();
+  connection_->createOffer(true);
+  ice_restart_watchdog_.enable(kIceRestartTimeoutSec);
+  return true;
+}
+
+void AyameWebsocketClient::fallBackToReconnect() {
+  RTC_LOG(LS_INFO) << __FUNCTION__;
+  ice_restart_watchdog_.disable();
+  ice_restarting_ = false;
+  reconnecting_ = true;
+  RecoveryStats::CountReconnect();
+  // close(); で WebSocket が閉じられたら、onClose(); -> reconnectAfter(); -> onWatchdogExpired(); の順に関数が呼ばれることで
+  // WebSocket の再接続が行われる
+  close();
+}
+
+void AyameWebsocketClient::onIceRecovered() {
+  ice_restart_watchdog_.disable();
+  if (disconnected_at_ms_ >= 0) {
+    RecoveryStats::Kind kind =
+        reconnecting_ ? RecoveryStats::Kind::kReconnect
+                      : ice_restarting_ ? RecoveryStats::Kind::kIceRestart
+                                        : RecoveryStats::Kind::kSelf;
+    int64_t duration_ms = rtc::TimeMillis() - disconnected_at_ms_;
+    RTC_LOG(LS_INFO) << __FUNCTION__ << ": recovered in " << duration_ms
+                     << " ms" << (reconnecting_ ? " by reconnecting"
+                                  : ice_restarting_ ? " by ICE restart"
+                                                    : "");
+    RecoveryStats::AddRecovery(kind, duration_ms);
+  }
+  disconnected_at_ms_ = -1;
+  ice_restarting_ = false;
+  reconnecting_ = false;
+}
+
 void AyameWebsocketClient::onResolve(
     boost::system::error_code ec,
     boost::asio::ip::tcp::resolver::results_type results) {
@@ -212,12 +299,18 @@ void AyameWebsocketClient::onHandshake(boost::system::error_code ec) {
   }
 
   connected_ = true;
+  StartupReport::Mark("signaling_connected");
 
   ws_->startToRead(std::bind(&AyameWebsocketClient::onRead, this,
                              std::placeholders::_1, std::placeholders::_2,
                              std::placeholders::_3));
 
   doRegister();
+
+  // accept を待っている間に PeerConnection を作っておく
+  if (conn_settings_.prewarm_connection) {
+    prewarmed_connection_ = manager_->createPrewarmedConnection(this);
+  }
 }
 
 void AyameWebsocketClient::doRegister() {
@@ -275,6 +368,14 @@ void AyameWebsocketClient::setIceServersFromConfig(json json_message) {
 }
 
 void AyameWebsocketClient::createPeerConnection() {
+  if (prewarmed_connection_ &&
+      prewarmed_connection_->setIceServers(ice_servers_)) {
+    manager_->claimPrewarmedConnection(prewarmed_connection_);
+    connection_ = std::move(prewarmed_connection_);
+    return;
+  }
+  prewarmed_connection_ = nullptr;
+
   webrtc::PeerConnectionInterface::RTCConfiguration rtc_config;
 
   rtc_config.servers = ice_servers_;
@@ -383,6 +484,9 @@ void AyameWebsocketClient::onRead(boost::system::error_code ec,
     doSendPong();
   } else if (type == "bye") {
     RTC_LOG(LS_INFO) << __FUNCTION__ << ": bye";
+    // 相手が抜けた時は回復を待たない
+    disconnected_at_ms_ = -1;
+    reconnecting_ = false;
     connection_ = nullptr;
     close();
   }
@@ -438,13 +542,22 @@ void AyameWebsocketClient::doIceConnectionStateChange(
         kIceConnectionConnected:
       retry_count_ = 0;
       watchdog_.enable(60);
+      onIceRecovered();
       break;
-    // ice connection state が failed になったら close(); を呼んで、WebSocket 接続を閉じる
+    case webrtc::PeerConnectionInterface::IceConnectionState::
+        kIceConnectionDisconnected:
+      onIceDisconnected();
+      break;
+    // ice connection state が failed になったら、まだなら ICE リスタートを試して、
+    // だめなら close(); を呼んで WebSocket 接続を閉じる
     case webrtc::PeerConnectionInterface::IceConnectionState::
         kIceConnectionFailed:
-      // close(); で WebSocket が閉じられたら、onClose(); -> reconnectAfter(); -> onWatchdogExpired(); の順に関数が呼ばれることで
-      // WebSocket の再接続が行われる
-      close();
+      if (disconnected_at_ms_ < 0) {
+        disconnected_at_ms_ = rtc::TimeMillis();
+      }
+      if (ice_restarting_ || !startIceRestart()) {
+        fallBackToReconnect();
+      }
       break;
     default:
       break;
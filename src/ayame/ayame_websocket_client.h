@@ -31,12 +31,21 @@ class AyameWebsocketClient
 
   RTCManager* manager_;
   std::shared_ptr<RTCConnection> connection_;
+  // --prewarm-connection の時に、オファーが来る前に作っておく接続
+  std::shared_ptr<RTCConnection> prewarmed_connection_;
   ConnectionSettings conn_settings_;
 
   int retry_count_;
   webrtc::PeerConnectionInterface::IceConnectionState rtc_state_;
 
   WatchDog watchdog_;
+  // ICE が切れた後、リスタートするまでの猶予とリスタートのタイムアウトに使う
+  WatchDog ice_restart_watchdog_;
+  bool ice_restarting_;
+  // 作り直しで回復しようとしている。reset() では戻さない
+  bool reconnecting_;
+  // ICE が切れた時刻。切れていなければ -1。reset() では戻さない
+  int64_t disconnected_at_ms_;
 
   bool connected_;
   bool is_send_offer_;
@@ -72,6 +81,14 @@ class AyameWebsocketClient
   void reconnectAfter();
   void onWatchdogExpired();
 
+ private:
+  // ICE が切れたら、まず ICE リスタートで戻そうとし、戻らなければ作り直す
+  void onIceDisconnected();
+  void onIceRestartWatchdogExpired();
+  bool startIceRestart();
+  void fallBackToReconnect();
+  void onIceRecovered();
+
  private:
   void onResolve(boost::system::error_code ec,
                  boost::asio::ip::tcp::resolver::results_type results);
@@ -0,0 +1,371 @@
+#include "loopback_benchmark.h"
+
+#include <math.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <sstream>
+#include <thread>
+
+#include "api/stats/rtcstats_objects.h"
+#include "rtc/stats_callback.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/ref_counted_object.h"
+#include "rtc_base/time_utils.h"
+#include "system_wrappers/include/clock.h"
+#include "util.h"
+
+using json = nlohmann::json;
+
+namespace {
+
+const int kConnectTimeoutMs = 10000;
+const int kFirstFrameTimeoutMs = 10000;
+const int kStatsTimeoutMs = 5000;
+// 接続直後はビットレートが上がりきっていないので、少し待ってから計測する
+const int kWarmupMs = 2000;
+
+rtc::scoped_refptr<const webrtc::RTCStatsReport> GetStatsReport(
+    std::shared_ptr<RTCConnection> connection) {
+  // タイムアウトした後に結果が届いても大丈夫なように、受け取る先は共有する
+  struct Result {
+    rtc::Event event;
+    rtc::scoped_refptr<const webrtc::RTCStatsReport> report;
+  };
+  std::shared_ptr<Result> result = std::make_shared<Result>();
+  rtc::scoped_refptr<StatsCallback> callback(
+      new rtc::RefCountedObject<StatsCallback>(
+          [result](const rtc::scoped_refptr<const webrtc::RTCStatsReport>&
+                       report) {
+            result->report = report;
+            result->event.Set();
+          }));
+  connection->getConnection()->GetStats(callback.get());
+  if (!result->event.Wait(kStatsTimeoutMs)) {
+    RTC_LOG(LS_WARNING) << "Timed out waiting for stats";
+    return nullptr;
+  }
+  return result->report;
+}
+
+// ソート済みの値から最近傍順位法でパーセンタイルを求める
+int64_t Percentile(const std::vector<int64_t>& sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t rank = static_cast<size_t>(ceil(p / 100.0 * sorted.size()));
+  return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+}  // namespace
+
+LoopbackBenchmark::Peer::Peer(const std::string& name, rtc::Event* connected)
+    : name_(name), connected_(connected), remote_(nullptr) {}
+
+void LoopbackBenchmark::Peer::SetConnection(
+    std::shared_ptr<RTCConnection> connection) {
+  connection_ = connection;
+}
+
+void LoopbackBenchmark::Peer::SetRemote(Peer* remote) {
+  remote_ = remote;
+}
+
+std::shared_ptr<RTCConnection> LoopbackBenchmark::Peer::GetConnection() {
+  return connection_;
+}
+
+void LoopbackBenchmark::Peer::onIceConnectionStateChange(
+    webrtc::PeerConnectionInterface::IceConnectionState new_state) {
+  RTC_LOG(LS_INFO) << name_ << ": "
+                   << Util::iceConnectionStateToString(new_state);
+  if (connected_ != nullptr &&
+      (new_state == webrtc::PeerConnectionInterface::kIceConnectionConnected ||
+       new_state == webrtc::PeerConnectionInterface::kIceConnectionCompleted)) {
+    connected_->Set();
+  }
+}
+
+void LoopbackBenchmark::Peer::onIceCandidate(const std::string sdp_mid,
+                                             const int sdp_mlineindex,
+                                             const std::string sdp) {
+  remote_->GetConnection()->addIceCandidate(sdp_mid, sdp_mlineindex, sdp);
+}
+
+void LoopbackBenchmark::Peer::onCreateDescription(webrtc::SdpType type,
+                                                  const std::string sdp) {
+  // どちらもシグナリングスレッドで呼ばれるので、そのまま相手に渡してしまう
+  if (type == webrtc::SdpType::kOffer) {
+    remote_->GetConnection()->setOffer(sdp);
+    remote_->GetConnection()->createAnswer();
+  } else if (type == webrtc::SdpType::kAnswer) {
+    remote_->GetConnection()->setAnswer(sdp);
+  }
+}
+
+LoopbackBenchmark::LoopbackBenchmark(ConnectionSettings cs)
+    : cs_(cs), measuring_(false), frames_received_(0) {}
+
+LoopbackBenchmark::~LoopbackBenchmark() {
+  rtc::CritScope lock(&tracks_lock_);
+  for (webrtc::VideoTrackInterface* track : tracks_) {
+    track->RemoveSink(this);
+  }
+}
+
+void LoopbackBenchmark::AddTrack(webrtc::VideoTrackInterface* track) {
+  rtc::CritScope lock(&tracks_lock_);
+  tracks_.push_back(track);
+  track->AddOrUpdateSink(this, rtc::VideoSinkWants());
+}
+
+void LoopbackBenchmark::RemoveTrack(webrtc::VideoTrackInterface* track) {
+  rtc::CritScope lock(&tracks_lock_);
+  track->RemoveSink(this);
+  tracks_.erase(std::remove(tracks_.begin(), tracks_.end(), track),
+                tracks_.end());
+}
+
+void LoopbackBenchmark::OnFrame(const webrtc::VideoFrame& frame) {
+  int64_t now_ms =
+      webrtc::Clock::GetRealTimeClock()->CurrentNtpInMilliseconds();
+  // RTCP SR を受け取るまではキャプチャ時刻が推定できないので 0 以下になる
+  if (frame.ntp_time_ms() <= 0) {
+    return;
+  }
+  first_frame_.Set();
+
+  rtc::CritScope lock(&lock_);
+  if (!measuring_) {
+    return;
+  }
+  frames_received_++;
+  latencies_ms_.push_back(now_ms - frame.ntp_time_ms());
+}
+
+int LoopbackBenchmark::Run(RTCManager* rtc_manager) {
+  rtc::Event connected;
+  Peer sender("sender", &connected);
+  Peer receiver("receiver", nullptr);
+  sender.SetRemote(&receiver);
+  receiver.SetRemote(&sender);
+
+  // 同じホスト内で繋ぐので ICE サーバは不要
+  webrtc::PeerConnectionInterface::RTCConfiguration rtc_config;
+  std::shared_ptr<RTCConnection> sender_connection =
+      rtc_manager->createConnection(rtc_config, &sender);
+  std::shared_ptr<RTCConnection> receiver_connection =
+      rtc_manager->createConnection(rtc_config, &receiver);
+  if (!sender_connection || !receiver_connection) {
+    std::cerr << "failed to create connections" << std::endl;
+    return 1;
+  }
+  sender.SetConnection(sender_connection);
+  receiver.SetConnection(receiver_connection);
+
+  // 受信側からは何も送らない
+  rtc::scoped_refptr<webrtc::PeerConnectionInterface> receiver_pc =
+      receiver_connection->getConnection();
+  for (auto rtp_sender : receiver_pc->GetSenders()) {
+    receiver_pc->RemoveTrack(rtp_sender);
+  }
+
+  if (!rtc_manager->setVideoCodecPreferences(sender_connection,
+                                             cs_.benchmark_video_codec)) {
+    std::cerr << "video codec " << cs_.benchmark_video_codec
+              << " is not available" << std::endl;
+    return 1;
+  }
+
+  sender_connection->createOffer();
+  if (!connected.Wait(kConnectTimeoutMs)) {
+    std::cerr << "failed to connect loopback peers" << std::endl;
+    return 1;
+  }
+  if (!first_frame_.Wait(kFirstFrameTimeoutMs)) {
+    std::cerr << "no video frame received" << std::endl;
+    return 1;
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(kWarmupMs));
+
+  StatsSnapshot begin = GetStats(sender_connection, receiver_connection);
+  std::map<int, ThreadTimes> begin_threads = GetThreadTimes();
+  {
+    rtc::CritScope lock(&lock_);
+    measuring_ = true;
+  }
+  std::this_thread::sleep_for(std::chrono::seconds(cs_.benchmark_duration));
+  std::vector<int64_t> latencies_ms;
+  uint64_t frames_received;
+  {
+    rtc::CritScope lock(&lock_);
+    measuring_ = false;
+    latencies_ms.swap(latencies_ms_);
+    frames_received = frames_received_;
+  }
+  StatsSnapshot end = GetStats(sender_connection, receiver_connection);
+  std::map<int, ThreadTimes> end_threads = GetThreadTimes();
+
+  double elapsed_sec = (end.time_us - begin.time_us) / 1e6;
+  std::sort(latencies_ms.begin(), latencies_ms.end());
+  double latency_sum = 0;
+  for (int64_t latency : latencies_ms) {
+    latency_sum += latency;
+  }
+
+  json result;
+  result["codec"] =
+      end.codec.empty() ? cs_.benchmark_video_codec : end.codec;
+  auto size = cs_.getSize();
+  result["resolution"] = std::to_string(size.width) + "x" +
+                         std::to_string(size.height);
+  result["duration_sec"] = elapsed_sec;
+  result["frames_received"] = frames_received;
+  result["fps"] = frames_received / elapsed_sec;
+  result["latency_ms"] = {
+      {"count", latencies_ms.size()},
+      {"min", latencies_ms.empty() ? 0 : latencies_ms.front()},
+      {"mean",
+       latencies_ms.empty() ? 0.0 : latency_sum / latencies_ms.size()},
+      {"p50", Percentile(latencies_ms, 50)},
+      {"p90", Percentile(latencies_ms, 90)},
+      {"p95", Percentile(latencies_ms, 95)},
+      {"p99", Percentile(latencies_ms, 99)},
+      {"max", latencies_ms.empty() ? 0 : latencies_ms.back()},
+  };
+
+  uint32_t frames_encoded = end.frames_encoded - begin.frames_encoded;
+  uint32_t frames_decoded = end.frames_decoded - begin.frames_decoded;
+  result["encoder"] = {
+      {"frames", frames_encoded},
+      {"fps", frames_encoded / elapsed_sec},
+      {"avg_encode_time_ms",
+       frames_encoded == 0 ? 0.0
+                           : (end.total_encode_time - begin.total_encode_time) *
+                                 1000 / frames_encoded},
+  };
+  result["decoder"] = {
+      {"frames", frames_decoded},
+      {"avg_decode_time_ms",
+       frames_decoded == 0 ? 0.0
+                           : (end.total_decode_time - begin.total_decode_time) *
+                                 1000 / frames_decoded},
+  };
+  uint64_t bytes_sent = end.bytes_sent - begin.bytes_sent;
+  result["bytes_sent"] = bytes_sent;
+  result["bitrate_kbps"] = bytes_sent * 8 / elapsed_sec / 1000;
+
+  // 計測中に終了したスレッドは含まれない
+  long ticks_per_sec = sysconf(_SC_CLK_TCK);
+  json threads = json::array();
+  double cpu_total = 0;
+  for (const auto& it : end_threads) {
+    auto b = begin_threads.find(it.first);
+    uint64_t ticks = it.second.ticks -
+                     (b == begin_threads.end() ? 0 : b->second.ticks);
+    double cpu = ticks * 100.0 / ticks_per_sec / elapsed_sec;
+    cpu_total += cpu;
+    threads.push_back(
+        {{"tid", it.first}, {"name", it.second.name}, {"cpu_percent", cpu}});
+  }
+  result["threads"] = threads;
+  result["cpu_percent_total"] = cpu_total;
+
+  std::cout << result.dump(2) << std::endl;
+  return 0;
+}
+
+LoopbackBenchmark::StatsSnapshot LoopbackBenchmark::GetStats(
+    std::shared_ptr<RTCConnection> sender,
+    std::shared_ptr<RTCConnection> receiver) {
+  StatsSnapshot snapshot;
+  snapshot.time_us = rtc::TimeMicros();
+
+  rtc::scoped_refptr<const webrtc::RTCStatsReport> report =
+      GetStatsReport(sender);
+  if (report) {
+    for (const webrtc::RTCOutboundRTPStreamStats* stats :
+         report->GetStatsOfType<webrtc::RTCOutboundRTPStreamStats>()) {
+      if (!stats->media_type.is_defined() || *stats->media_type != "video") {
+        continue;
+      }
+      if (stats->bytes_sent.is_defined()) {
+        snapshot.bytes_sent += *stats->bytes_sent;
+      }
+      if (stats->frames_encoded.is_defined()) {
+        snapshot.frames_encoded += *stats->frames_encoded;
+      }
+      if (stats->total_encode_time.is_defined()) {
+        snapshot.total_encode_time += *stats->total_encode_time;
+      }
+      if (stats->codec_id.is_defined()) {
+        const webrtc::RTCStats* codec = report->Get(*stats->codec_id);
+        if (codec != nullptr) {
+          const auto& codec_stats = codec->cast_to<webrtc::RTCCodecStats>();
+          if (codec_stats.mime_type.is_defined()) {
+            snapshot.codec = *codec_stats.mime_type;
+          }
+        }
+      }
+    }
+  }
+
+  report = GetStatsReport(receiver);
+  if (report) {
+    for (const webrtc::RTCInboundRTPStreamStats* stats :
+         report->GetStatsOfType<webrtc::RTCInboundRTPStreamStats>()) {
+      if (!stats->media_type.is_defined() || *stats->media_type != "video") {
+        continue;
+      }
+      if (stats->frames_decoded.is_defined()) {
+        snapshot.frames_decoded += *stats->frames_decoded;
+      }
+      if (stats->total_decode_time.is_defined()) {
+        snapshot.total_decode_time += *stats->total_decode_time;
+      }
+    }
+  }
+  return snapshot;
+}
+
+std::map<int, LoopbackBenchmark::ThreadTimes>
+LoopbackBenchmark::GetThreadTimes() {
+  std::map<int, ThreadTimes> result;
+#if defined(__linux__)
+  boost::system::error_code ec;
+  for (boost::filesystem::directory_iterator it("/proc/self/task", ec), end;
+       !ec && it != end; it.increment(ec)) {
+    std::string tid = it->path().filename().string();
+    std::ifstream ifs(it->path().string() + "/stat");
+    std::string line;
+    if (!std::getline(ifs, line)) {
+      continue;
+    }
+    // 2 番目のフィールドのスレッド名には空白や括弧が含まれることがある
+    size_t name_begin = line.find('(');
+    size_t name_end = line.rfind(')');
+    if (name_begin == std::string::npos || name_end == std::string::npos) {
+      continue;
+    }
+    // 名前の後は state から始まり、utime と stime は 12, 13 番目
+    std::istringstream iss(line.substr(name_end + 2));
+    std::vector<std::string> fields;
+    std::string field;
+    while (fields.size() < 13 && iss >> field) {
+      fields.push_back(field);
+    }
+    if (fields.size() < 13) {
+      continue;
+    }
+    ThreadTimes& times = result[std::stoi(tid)];
+    times.name = line.substr(name_begin + 1, name_end - name_begin - 1);
+    times.ticks = std::stoull(fields[11]) + std::stoull(fields[12]);
+  }
+#endif
+  return result;
+}
@@ -0,0 +1,104 @@
+#ifndef LOOPBACK_BENCHMARK_H_
+#define LOOPBACK_BENCHMARK_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "api/media_stream_interface.h"
+#include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
+#include "connection_settings.h"
+#include "rtc/connection.h"
+#include "rtc/manager.h"
+#include "rtc/messagesender.h"
+#include "rtc/video_track_receiver.h"
+#include "rtc_base/critical_section.h"
+#include "rtc_base/event.h"
+
+// シグナリングサーバを使わずに、1 つの RTCManager から作った 2 つの
+// PeerConnection をプロセス内で繋いで、送信側の映像を受信側で受け取るまでの
+// 性能を計測する。
+//
+// キャプチャ → エンコード → ネットワークスレッド → デコード → シンク
+// までを通した遅延のパーセンタイル、フレームレート、エンコードとデコードに
+// 掛かった時間、送信バイト数、スレッド毎の CPU 使用率を JSON で出力する。
+//
+// 遅延は受信フレームの ntp_time_ms (送信側のキャプチャ時刻を RTCP SR から
+// 推定したもの) と現在時刻の差なので、同じプロセス内であれば正確に測れる。
+class LoopbackBenchmark : public VideoTrackReceiver,
+                          public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+ public:
+  explicit LoopbackBenchmark(ConnectionSettings cs);
+  ~LoopbackBenchmark();
+
+  // 計測を行って結果を標準出力に書き出す。main の戻り値を返す
+  int Run(RTCManager* rtc_manager);
+
+  void AddTrack(webrtc::VideoTrackInterface* track) override;
+  void RemoveTrack(webrtc::VideoTrackInterface* track) override;
+  void OnFrame(const webrtc::VideoFrame& frame) override;
+
+ private:
+  // 片方の PeerConnection から出たシグナリングメッセージを
+  // もう片方にそのまま渡す
+  class Peer : public RTCMessageSender {
+   public:
+    Peer(const std::string& name, rtc::Event* connected);
+    void SetConnection(std::shared_ptr<RTCConnection> connection);
+    void SetRemote(Peer* remote);
+    std::shared_ptr<RTCConnection> GetConnection();
+
+    void onIceConnectionStateChange(
+        webrtc::PeerConnectionInterface::IceConnectionState new_state) override;
+    void onIceCandidate(const std::string sdp_mid,
+                        const int sdp_mlineindex,
+                        const std::string sdp) override;
+    void onCreateDescription(webrtc::SdpType type,
+                             const std::string sdp) override;
+    void onSetDescription(webrtc::SdpType type) override {}
+
+   private:
+    std::string name_;
+    rtc::Event* connected_;
+    std::shared_ptr<RTCConnection> connection_;
+    Peer* remote_;
+  };
+
+  struct StatsSnapshot {
+    int64_t time_us = 0;
+    uint64_t bytes_sent = 0;
+    uint32_t frames_encoded = 0;
+    double total_encode_time = 0;
+    uint32_t frames_decoded = 0;
+    double total_decode_time = 0;
+    std::string codec;
+  };
+
+  struct ThreadTimes {
+    std::string name;
+    uint64_t ticks = 0;
+  };
+
+  StatsSnapshot GetStats(std::shared_ptr<RTCConnection> sender,
+                         std::shared_ptr<RTCConnection> receiver);
+  static std::map<int, ThreadTimes> GetThreadTimes();
+
+  ConnectionSettings cs_;
+
+  // OnFrame の中からは取らないこと (シンクの登録と削除でデッドロックする)
+  rtc::CriticalSection tracks_lock_;
+  std::vector<webrtc::VideoTrackInterface*> tracks_
+      RTC_GUARDED_BY(tracks_lock_);
+
+  rtc::CriticalSection lock_;
+  bool measuring_ RTC_GUARDED_BY(lock_);
+  uint64_t frames_received_ RTC_GUARDED_BY(lock_);
+  std::vector<int64_t> latencies_ms_ RTC_GUARDED_BY(lock_);
+  rtc::Event first_frame_;
+};
+
+#endif  // LOOPBACK_BENCHMARK_H_
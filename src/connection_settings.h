@@ -4,6 +4,7 @@
 #include <iostream>
 #include <nlohmann/json.hpp>
 #include <string>
+#include <vector>
 
 #include "api/rtp_parameters.h"
 
@@ -12,6 +13,8 @@ struct ConnectionSettings {
 #if USE_ROS
   bool image_compressed = false;
   std::string audio_topic_name = "";
+  // 受信した音声を配信するトピック
+  std::string audio_playout_topic_name = "";
   int audio_topic_rate = 16000;
   int audio_topic_ch = 1;
 #endif
@@ -37,6 +40,88 @@ struct ConnectionSettings {
   bool fullscreen = false;
   std::string serial_device = "";
   unsigned int serial_rate = 9600;
+  // シリアルのデータを DataChannel のメッセージに区切る方法。
+  // newline, length, cobs, raw のどれか
+  std::string serial_framing = "newline";
+  // raw の時に、この時間 (ミリ秒) データが来なければそこまでを送る
+  int serial_idle_gap = 5;
+  // DataChannel とローカルのソケットを繋ぐ設定。書式は socket_data_manager.h を参照
+  std::vector<std::string> data_channel_bridges;
+  // この UDP ポート (127.0.0.1) で受け取ったデータを、次にキャプチャした
+  // フレームのメタデータとして送る。0 なら送らない
+  int frame_metadata_port = 0;
+  // 受信したフレームのメタデータを送る先 (HOST:PORT)。空なら送らない
+  std::string frame_metadata_output = "";
+  // 送信映像の録画先。空なら録画しない
+  std::string record_dir = "";
+  // 受信映像音声の録画先。空なら録画しない
+  std::string record_remote_dir = "";
+  // 記録できるトラック (映像は IVF、音声は Opus) はデコードも再生もせずに
+  // 記録だけ行う。記録できないトラックは普通にデコードして再生する
+  bool record_remote_only = false;
+  int record_segment_duration = 60;
+  int record_segment_size = 0;
+  // カメラやマイクの代わりに使う入力ファイル
+  std::string video_input_file = "";
+  bool video_input_pattern = false;
+  bool video_input_fast = false;
+  std::string audio_input_file = "";
+  int audio_input_rate = 48000;
+  int audio_input_channels = 1;
+  // シグナリングを使わずにプロセス内で繋いで性能を計測する
+  bool benchmark_loopback = false;
+  int benchmark_duration = 10;
+  std::string benchmark_video_codec = "VP8";
+  // 映像にタイムコードを埋め込んで、受信側で遅延を計測する
+  bool timecode_stamp = false;
+  bool timecode_detect = false;
+  std::string timecode_histogram_file = "";
+  // /metrics で公開する統計情報を集める間隔 (秒)。0 なら集めない
+  int metrics_interval = 5;
+  // ログをバイナリ形式で別スレッドから書き出す
+  bool binary_log = false;
+  // バイナリログで INFO 以下のログを呼び出し元毎に 1 秒あたり何件まで残すか。0 なら制限しない
+  int log_rate_limit = 10;
+  // スレッドの CPU 割り当てとスケジューリングの設定。書式は thread_policy.h を参照
+  std::string thread_policy = "";
+  std::string thread_policy_file = "";
+  bool lock_memory = false;
+  // Pi Zero などメモリの少ない環境向けのモード。
+  // シグナリングスレッドをワーカースレッドと兼ねて、low_footprint_video_codec
+  // 以外のコーデックを使わないようにし、メモリ使用量を定期的にログに出す
+#if USE_LOW_FOOTPRINT
+  bool low_footprint = true;
+#else
+  bool low_footprint = false;
+#endif
+  // 省メモリモードで使う唯一のコーデック。
+  // H264 が使える環境ではハードウェアエンコーダを使えるように H264 にする
+#if USE_H264
+  std::string low_footprint_video_codec = "H264";
+#else
+  std::string low_footprint_video_codec = "VP8";
+#endif
+  // 使い終わったハードウェアエンコーダを作り直さずに残しておく数。
+  // 再接続や解像度が戻った時に使い回す。low_footprint の時は残さない
+  int hw_encoder_pool_size = 1;
+  // ハードウェアエンコーダで、定期的なキーフレームの代わりに
+  // このフレーム数で画面を一周するイントラリフレッシュを使う。0 なら使わない。
+  // キーフレームでビットレートが跳ねないので、帯域の狭い回線でロスが減る。
+  // ソフトウェアの VP8 と VP9 のエンコーダでは使わず、フレームの大きさの
+  // メトリクスも出ない
+  int intra_refresh_period = 0;
+  // 起動の各段階にかかった時間をログだけでなく標準エラーにも出す
+  bool startup_report = false;
+  // シグナリングサーバに繋がった時点で PeerConnection を作っておく
+  bool prewarm_connection = false;
+  // 前回の接続で落ち着いた推定帯域を覚えておくファイル。空なら使わない
+  std::string bwe_cache_file = "";
+  // 遠隔操作向けの設定。名前に反して効くのは主に相手側の受信で、
+  // 送信する映像に playout-delay 0 を付けて、相手にジッタバッファで溜めずに
+  // 表示してもらう。momo 側の受信で変わるのは SDL でデコードしたフレームを
+  // すぐ描画することだけで、momo 自身のジッタバッファは変わらない
+  // (相手の送信側の playout-delay で決まる)
+  bool low_latency_receive = false;
 
   std::string sora_signaling_host = "wss://example.com/signaling";
   std::string sora_channel_id;
@@ -112,6 +197,14 @@ struct ConnectionSettings {
        << "\n";
     os << "priority: " << cs.priority << "\n";
     os << "port: " << cs.port << "\n";
+    os << "video_input_file: " << cs.video_input_file << "\n";
+    os << "video_input_pattern: " << (cs.video_input_pattern ? "true" : "false")
+       << "\n";
+    os << "audio_input_file: " << cs.audio_input_file << "\n";
+    os << "record_dir: " << cs.record_dir << "\n";
+    os << "record_remote_dir: " << cs.record_remote_dir << "\n";
+    os << "record_remote_only: " << (cs.record_remote_only ? "true" : "false")
+       << "\n";
     os << "ayame_signaling_host: " << cs.ayame_signaling_host << "\n";
     os << "ayame_room_id: " << cs.ayame_room_id << "\n";
     os << "ayame_client_id: " << cs.ayame_client_id << "\n";
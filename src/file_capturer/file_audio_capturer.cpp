@@ -0,0 +1,66 @@
+#include "file_audio_capturer.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "rtc_base/logging.h"
+
+namespace {
+
+class RawPCMFileCapturer : public webrtc::TestAudioDeviceModule::Capturer {
+ public:
+  RawPCMFileCapturer(FILE* file,
+                     int sampling_frequency_in_hz,
+                     int num_channels)
+      : file_(file),
+        sampling_frequency_in_hz_(sampling_frequency_in_hz),
+        num_channels_(num_channels) {}
+  ~RawPCMFileCapturer() override { fclose(file_); }
+
+  int SamplingFrequency() const override { return sampling_frequency_in_hz_; }
+  int NumChannels() const override { return num_channels_; }
+
+  bool Capture(rtc::BufferT<int16_t>* buffer) override {
+    // TestAudioDeviceModule は 10ms 毎に呼び出してくる
+    const size_t samples = sampling_frequency_in_hz_ / 100 * num_channels_;
+    buffer->SetData(samples, [&](rtc::ArrayView<int16_t> data) {
+      size_t read = fread(data.data(), sizeof(int16_t), data.size(), file_);
+      if (read < data.size()) {
+        fseek(file_, 0, SEEK_SET);
+        read += fread(data.data() + read, sizeof(int16_t), data.size() - read,
+                      file_);
+      }
+      std::fill(data.begin() + read, data.end(), 0);
+      return data.size();
+    });
+    return true;
+  }
+
+ private:
+  FILE* file_;
+  const int sampling_frequency_in_hz_;
+  const int num_channels_;
+};
+
+}  // namespace
+
+std::unique_ptr<webrtc::TestAudioDeviceModule::Capturer>
+FileAudioCapturer::Create(const std::string& path,
+                          int sampling_frequency_in_hz,
+                          int num_channels) {
+  if (path.size() >= 4 &&
+      strcasecmp(path.c_str() + path.size() - 4, ".wav") == 0) {
+    return webrtc::TestAudioDeviceModule::CreateWavFileReader(path, true);
+  }
+
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    RTC_LOG(LS_ERROR) << "Failed to open " << path << ": " << strerror(errno);
+    return nullptr;
+  }
+  return std::unique_ptr<webrtc::TestAudioDeviceModule::Capturer>(
+      new RawPCMFileCapturer(file, sampling_frequency_in_hz, num_channels));
+}
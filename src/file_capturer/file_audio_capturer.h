@@ -0,0 +1,21 @@
+#ifndef FILE_AUDIO_CAPTURER_H_
+#define FILE_AUDIO_CAPTURER_H_
+
+#include <memory>
+#include <string>
+
+#include "modules/audio_device/include/test_audio_device.h"
+
+// マイクの代わりにファイルから音声を流すための
+// TestAudioDeviceModule::Capturer を作る。
+// 拡張子が .wav なら WAV、それ以外は生の PCM (符号付き 16bit リトルエンディアン)
+// として扱い、最後まで読んだら先頭に戻る。
+class FileAudioCapturer {
+ public:
+  static std::unique_ptr<webrtc::TestAudioDeviceModule::Capturer> Create(
+      const std::string& path,
+      int sampling_frequency_in_hz,
+      int num_channels);
+};
+
+#endif  // FILE_AUDIO_CAPTURER_H_
@@ -0,0 +1,410 @@
+#include "file_video_capturer.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include "api/video/video_frame.h"
+#include "rtc/native_buffer.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/ref_counted_object.h"
+#include "rtc_base/time_utils.h"
+#include "third_party/libyuv/include/libyuv.h"
+#include "thread_policy/thread_policy.h"
+
+namespace {
+
+// これ以上遅れたら追いつこうとせずに基準時刻を取り直す
+const int64_t kMaxLagUs = rtc::kNumMicrosecsPerSec;
+const int kPatternBars = 8;
+const int kPatternBoxSize = 64;
+const int kPatternCounterBits = 32;
+const int kPatternCounterBlockSize = 8;
+
+std::string ToLower(std::string s) {
+  std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+  return s;
+}
+
+bool EndsWith(const std::string& s, const std::string& suffix) {
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool ReadLine(FILE* file, std::string* line) {
+  line->clear();
+  int c;
+  while ((c = fgetc(file)) != EOF) {
+    if (c == '\n') {
+      return true;
+    }
+    line->push_back(static_cast<char>(c));
+  }
+  return false;
+}
+
+}  // namespace
+
+rtc::scoped_refptr<FileVideoCapturer> FileVideoCapturer::Create(
+    ConnectionSettings cs) {
+  rtc::scoped_refptr<FileVideoCapturer> capturer(
+      new rtc::RefCountedObject<FileVideoCapturer>());
+  if (!capturer->Init(cs)) {
+    RTC_LOG(LS_WARNING) << "Failed to create FileVideoCapturer";
+    return nullptr;
+  }
+  return capturer;
+}
+
+FileVideoCapturer::FileVideoCapturer()
+    : type_(SourceType::kPattern),
+      file_(nullptr),
+      data_offset_(0),
+      width_(0),
+      height_(0),
+      framerate_num_(30),
+      framerate_den_(1),
+      fast_(false),
+      use_native_(false),
+      frame_count_(0),
+      start_time_us_(0),
+      quit_(false) {}
+
+FileVideoCapturer::~FileVideoCapturer() {
+  Stop();
+  if (file_ != nullptr) {
+    fclose(file_);
+    file_ = nullptr;
+  }
+}
+
+bool FileVideoCapturer::useNativeBuffer() {
+  return use_native_ && type_ == SourceType::kMJPEG;
+}
+
+bool FileVideoCapturer::Init(ConnectionSettings cs) {
+  auto size = cs.getSize();
+  width_ = size.width;
+  height_ = size.height;
+  framerate_num_ = cs.framerate;
+  framerate_den_ = 1;
+  fast_ = cs.video_input_fast;
+  use_native_ = cs.use_native;
+  path_ = cs.video_input_file;
+
+  if (cs.video_input_pattern || path_.empty()) {
+    type_ = SourceType::kPattern;
+  } else {
+    std::string lower = ToLower(path_);
+    if (EndsWith(lower, ".y4m")) {
+      type_ = SourceType::kY4M;
+    } else if (EndsWith(lower, ".mjpeg") || EndsWith(lower, ".mjpg")) {
+      type_ = SourceType::kMJPEG;
+    } else {
+      type_ = SourceType::kI420;
+    }
+
+    file_ = fopen(path_.c_str(), "rb");
+    if (file_ == nullptr) {
+      RTC_LOG(LS_ERROR) << "Failed to open " << path_ << ": "
+                        << strerror(errno);
+      return false;
+    }
+    if (type_ == SourceType::kY4M && !OpenY4M()) {
+      return false;
+    }
+    if (type_ == SourceType::kMJPEG && !IndexMJPEG()) {
+      return false;
+    }
+  }
+
+  RTC_LOG(LS_INFO) << "FileVideoCapturer source="
+                   << (path_.empty() ? "pattern" : path_) << " " << width_
+                   << "x" << height_ << "@"
+                   << static_cast<double>(framerate_num_) / framerate_den_
+                   << (fast_ ? " (as fast as possible)" : "");
+
+  start_time_us_ = rtc::TimeMicros();
+  capture_thread_.reset(new rtc::PlatformThread(
+      FileVideoCapturer::CaptureThread, this, "CaptureThread",
+      rtc::kHighPriority));
+  capture_thread_->Start();
+  return true;
+}
+
+bool FileVideoCapturer::OpenY4M() {
+  std::string header;
+  if (!ReadLine(file_, &header) || header.compare(0, 9, "YUV4MPEG2") != 0) {
+    RTC_LOG(LS_ERROR) << "Invalid Y4M header: " << path_;
+    return false;
+  }
+  std::istringstream iss(header.substr(9));
+  std::string token;
+  while (iss >> token) {
+    if (token[0] == 'W') {
+      width_ = std::atoi(token.c_str() + 1);
+    } else if (token[0] == 'H') {
+      height_ = std::atoi(token.c_str() + 1);
+    } else if (token[0] == 'F') {
+      int num = 0, den = 0;
+      if (sscanf(token.c_str() + 1, "%d:%d", &num, &den) == 2 && num > 0 &&
+          den > 0) {
+        framerate_num_ = num;
+        framerate_den_ = den;
+      }
+    } else if (token[0] == 'C' && token != "C420" && token != "C420jpeg" &&
+               token != "C420paldv" && token != "C420mpeg2") {
+      // C420p10 などの 8bit でないものや 4:2:0 でないものは読めない
+      RTC_LOG(LS_ERROR) << "Unsupported Y4M colorspace " << token;
+      return false;
+    }
+  }
+  if (width_ <= 0 || height_ <= 0) {
+    RTC_LOG(LS_ERROR) << "Invalid Y4M size: " << path_;
+    return false;
+  }
+  data_offset_ = ftell(file_);
+  return true;
+}
+
+bool FileVideoCapturer::IndexMJPEG() {
+  fseek(file_, 0, SEEK_END);
+  long size = ftell(file_);
+  fseek(file_, 0, SEEK_SET);
+  if (size <= 0) {
+    return false;
+  }
+  mjpeg_data_.resize(size);
+  if (fread(mjpeg_data_.data(), 1, size, file_) != static_cast<size_t>(size)) {
+    RTC_LOG(LS_ERROR) << "Failed to read " << path_;
+    return false;
+  }
+
+  // SOI (FF D8) から EOI (FF D9) までを 1 フレームとする
+  size_t pos = 0;
+  while (pos + 4 <= mjpeg_data_.size()) {
+    if (mjpeg_data_[pos] != 0xff || mjpeg_data_[pos + 1] != 0xd8) {
+      pos++;
+      continue;
+    }
+    size_t end = pos + 2;
+    while (end + 1 < mjpeg_data_.size() &&
+           !(mjpeg_data_[end] == 0xff && mjpeg_data_[end + 1] == 0xd9)) {
+      end++;
+    }
+    if (end + 1 >= mjpeg_data_.size()) {
+      break;
+    }
+    mjpeg_frames_.push_back(std::make_pair(pos, end + 2 - pos));
+    pos = end + 2;
+  }
+  if (mjpeg_frames_.empty()) {
+    RTC_LOG(LS_ERROR) << "No JPEG frames found in " << path_;
+    return false;
+  }
+  if (libyuv::MJPGSize(mjpeg_data_.data() + mjpeg_frames_[0].first,
+                       mjpeg_frames_[0].second, &width_, &height_) != 0) {
+    RTC_LOG(LS_ERROR) << "Failed to parse JPEG size in " << path_;
+    return false;
+  }
+  RTC_LOG(LS_INFO) << "FileVideoCapturer indexed " << mjpeg_frames_.size()
+                   << " JPEG frames";
+  return true;
+}
+
+void FileVideoCapturer::Stop() {
+  if (capture_thread_) {
+    {
+      rtc::CritScope lock(&capture_lock_);
+      quit_ = true;
+    }
+    capture_thread_->Stop();
+    capture_thread_.reset();
+  }
+}
+
+void FileVideoCapturer::CaptureThread(void* obj) {
+  FileVideoCapturer* capturer = static_cast<FileVideoCapturer*>(obj);
+  ThreadPolicy::Apply("capture");
+  while (capturer->CaptureProcess()) {
+  }
+}
+
+bool FileVideoCapturer::CaptureProcess() {
+  {
+    rtc::CritScope lock(&capture_lock_);
+    if (quit_) {
+      return false;
+    }
+  }
+
+  // 高速モードでもタイムスタンプはフレームレート通りに進めて、
+  // VideoAdapter のフレームレート制限で捨てられないようにする
+  int64_t capture_time_us = start_time_us_ + FrameTimeUs(frame_count_);
+  if (!fast_) {
+    int64_t now_us = rtc::TimeMicros();
+    if (capture_time_us > now_us) {
+      usleep(capture_time_us - now_us);
+    } else if (now_us - capture_time_us > kMaxLagUs) {
+      RTC_LOG(LS_WARNING) << "FileVideoCapturer is lagging, resetting clock";
+      start_time_us_ = now_us - FrameTimeUs(frame_count_);
+      capture_time_us = now_us;
+    }
+  }
+
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer = NextFrame();
+  if (!buffer) {
+    RTC_LOG(LS_ERROR) << "FileVideoCapturer failed to read a frame";
+    return false;
+  }
+
+  webrtc::VideoFrame video_frame =
+      webrtc::VideoFrame::Builder()
+          .set_video_frame_buffer(buffer)
+          .set_timestamp_rtp(0)
+          .set_timestamp_ms(capture_time_us / rtc::kNumMicrosecsPerMillisec)
+          .set_timestamp_us(capture_time_us)
+          .set_rotation(webrtc::kVideoRotation_0)
+          .build();
+  OnCapturedFrame(video_frame);
+  frame_count_++;
+  return true;
+}
+
+int64_t FileVideoCapturer::FrameTimeUs(uint64_t frame_count) const {
+  // 1 フレーム毎の間隔を丸めると誤差が溜まるので、毎回先頭から計算する。
+  // 分母が大きくても溢れないように double で計算する
+  return static_cast<int64_t>(static_cast<double>(frame_count) *
+                              rtc::kNumMicrosecsPerSec * framerate_den_ /
+                              framerate_num_);
+}
+
+rtc::scoped_refptr<webrtc::VideoFrameBuffer> FileVideoCapturer::NextFrame() {
+  if (type_ == SourceType::kMJPEG) {
+    const std::pair<size_t, size_t>& jpeg =
+        mjpeg_frames_[frame_count_ % mjpeg_frames_.size()];
+    const uint8_t* data = mjpeg_data_.data() + jpeg.first;
+    if (useNativeBuffer()) {
+      // JPEG の大きさは分かっているので、その分だけ確保する
+      rtc::scoped_refptr<NativeBuffer> native_buffer(NativeBuffer::Create(
+          webrtc::VideoType::kMJPEG, width_, height_, jpeg.second));
+      memcpy(native_buffer->MutableData(), data, jpeg.second);
+      native_buffer->SetLength(jpeg.second);
+      return native_buffer;
+    }
+    rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer(
+        webrtc::I420Buffer::Create(width_, height_));
+    if (libyuv::ConvertToI420(
+            data, jpeg.second, i420_buffer->MutableDataY(),
+            i420_buffer->StrideY(), i420_buffer->MutableDataU(),
+            i420_buffer->StrideU(), i420_buffer->MutableDataV(),
+            i420_buffer->StrideV(), 0, 0, width_, height_, width_, height_,
+            libyuv::kRotate0, libyuv::FOURCC_MJPG) < 0) {
+      RTC_LOG(LS_ERROR) << "ConvertToI420 Failed";
+      return nullptr;
+    }
+    return i420_buffer;
+  }
+
+  rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer(
+      webrtc::I420Buffer::Create(width_, height_));
+  if (type_ == SourceType::kPattern) {
+    DrawPattern(i420_buffer.get());
+    return i420_buffer;
+  }
+
+  bool y4m = type_ == SourceType::kY4M;
+  if (!ReadI420Frame(i420_buffer.get(), y4m)) {
+    // 最後まで読んだら先頭に戻ってもう一度読む
+    fseek(file_, data_offset_, SEEK_SET);
+    if (!ReadI420Frame(i420_buffer.get(), y4m)) {
+      return nullptr;
+    }
+  }
+  return i420_buffer;
+}
+
+bool FileVideoCapturer::ReadI420Frame(webrtc::I420Buffer* buffer, bool y4m) {
+  if (y4m) {
+    std::string line;
+    if (!ReadLine(file_, &line) || line.compare(0, 5, "FRAME") != 0) {
+      return false;
+    }
+  }
+
+  const int chroma_width = (width_ + 1) / 2;
+  const int chroma_height = (height_ + 1) / 2;
+  for (int y = 0; y < height_; y++) {
+    if (fread(buffer->MutableDataY() + y * buffer->StrideY(), 1, width_,
+              file_) != static_cast<size_t>(width_)) {
+      return false;
+    }
+  }
+  for (int y = 0; y < chroma_height; y++) {
+    if (fread(buffer->MutableDataU() + y * buffer->StrideU(), 1, chroma_width,
+              file_) != static_cast<size_t>(chroma_width)) {
+      return false;
+    }
+  }
+  for (int y = 0; y < chroma_height; y++) {
+    if (fread(buffer->MutableDataV() + y * buffer->StrideV(), 1, chroma_width,
+              file_) != static_cast<size_t>(chroma_width)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void FileVideoCapturer::DrawPattern(webrtc::I420Buffer* buffer) {
+  // フレーム番号だけで決まる絵にして、何度流しても同じ結果になるようにする
+  const int chroma_width = (width_ + 1) / 2;
+  const int chroma_height = (height_ + 1) / 2;
+
+  // 縦の帯
+  for (int x = 0; x < width_; x++) {
+    buffer->MutableDataY()[x] = 16 + (x * kPatternBars / width_) * 28;
+  }
+  for (int y = 1; y < height_; y++) {
+    memcpy(buffer->MutableDataY() + y * buffer->StrideY(),
+           buffer->MutableDataY(), width_);
+  }
+  for (int x = 0; x < chroma_width; x++) {
+    int bar = x * kPatternBars / chroma_width;
+    buffer->MutableDataU()[x] = 64 + bar * 16;
+    buffer->MutableDataV()[x] = 192 - bar * 16;
+  }
+  for (int y = 1; y < chroma_height; y++) {
+    memcpy(buffer->MutableDataU() + y * buffer->StrideU(),
+           buffer->MutableDataU(), chroma_width);
+    memcpy(buffer->MutableDataV() + y * buffer->StrideV(),
+           buffer->MutableDataV(), chroma_width);
+  }
+
+  // 横に動く箱
+  const int box = std::min(kPatternBoxSize, std::min(width_, height_) / 2);
+  if (box > 0 && width_ > box) {
+    const int box_x = static_cast<int>((frame_count_ * 4) % (width_ - box));
+    const int box_y = (height_ - box) / 2;
+    for (int y = box_y; y < box_y + box; y++) {
+      memset(buffer->MutableDataY() + y * buffer->StrideY() + box_x, 235, box);
+    }
+  }
+
+  // 左上にフレーム番号をビット列で描く
+  const uint32_t counter = static_cast<uint32_t>(frame_count_);
+  for (int bit = 0; bit < kPatternCounterBits; bit++) {
+    const int bx = bit * kPatternCounterBlockSize;
+    if (bx + kPatternCounterBlockSize > width_ ||
+        kPatternCounterBlockSize > height_) {
+      break;
+    }
+    const uint8_t value = (counter >> bit) & 1 ? 235 : 16;
+    for (int y = 0; y < kPatternCounterBlockSize; y++) {
+      memset(buffer->MutableDataY() + y * buffer->StrideY() + bx, value,
+             kPatternCounterBlockSize);
+    }
+  }
+}
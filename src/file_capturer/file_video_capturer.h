@@ -0,0 +1,73 @@
+#ifndef FILE_VIDEO_CAPTURER_H_
+#define FILE_VIDEO_CAPTURER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "api/video/i420_buffer.h"
+#include "connection_settings.h"
+#include "rtc/scalable_track_source.h"
+#include "rtc_base/critical_section.h"
+#include "rtc_base/platform_thread.h"
+
+// カメラの代わりにファイルや生成したパターンを映像として流すキャプチャラ。
+// カメラの無い環境でのベンチマークや回帰テストに使う。
+//
+// 対応している入力:
+// - Y4M (8bit の 4:2:0 のみ)
+// - 生の I420 (解像度は --resolution で指定する)
+// - JPEG を連結した MJPEG シーケンス
+// - フレーム番号だけで決まるテストパターン
+//
+// 通常はフレームレートに合わせて実時間で流すが、fast を指定すると
+// 待たずにできるだけ速く流す。ファイルは最後まで行ったら先頭に戻る。
+class FileVideoCapturer : public ScalableVideoTrackSource {
+ public:
+  static rtc::scoped_refptr<FileVideoCapturer> Create(ConnectionSettings cs);
+  FileVideoCapturer();
+  ~FileVideoCapturer();
+
+  bool useNativeBuffer() override;
+
+ private:
+  enum class SourceType { kPattern, kY4M, kI420, kMJPEG };
+
+  bool Init(ConnectionSettings cs);
+  bool OpenY4M();
+  bool IndexMJPEG();
+  void Stop();
+  static void CaptureThread(void* obj);
+  bool CaptureProcess();
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> NextFrame();
+  bool ReadI420Frame(webrtc::I420Buffer* buffer, bool y4m);
+  void DrawPattern(webrtc::I420Buffer* buffer);
+  int64_t FrameTimeUs(uint64_t frame_count) const;
+
+  SourceType type_;
+  std::string path_;
+  FILE* file_;
+  long data_offset_;
+  int width_;
+  int height_;
+  // 29.97fps (30000:1001) のような値も扱えるように分数で持つ
+  int framerate_num_;
+  int framerate_den_;
+  bool fast_;
+  bool use_native_;
+  uint64_t frame_count_;
+  int64_t start_time_us_;
+
+  // MJPEG はファイル全体を読み込んで、各 JPEG の位置を覚えておく
+  std::vector<uint8_t> mjpeg_data_;
+  std::vector<std::pair<size_t, size_t>> mjpeg_frames_;
+
+  std::unique_ptr<rtc::PlatformThread> capture_thread_;
+  rtc::CriticalSection capture_lock_;
+  bool quit_ RTC_GUARDED_BY(capture_lock_);
+};
+
+#endif  // FILE_VIDEO_CAPTURER_H_
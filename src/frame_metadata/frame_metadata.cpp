@@ -0,0 +1,206 @@
+#include "frame_metadata.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "rtc_base/critical_section.h"
+
+namespace {
+
+// キャプチャしてからエンコードするまでに溜めておくフレームの数。
+// 30fps で 1 秒分あればエンコーダが詰まっていても足りる
+const size_t kPendingSlots = 32;
+
+// 書き込むスレッドが 1 つ、読み出すスレッドが複数のスロット。
+// 書き込み中は version が奇数になるので、読み出した前後で version が
+// 変わっていなければ途中で書き換えられていない
+struct Slot {
+  std::atomic<uint32_t> version{0};
+  std::atomic<int64_t> key{0};
+  FrameMetadataBlob blob;
+
+  void Write(int64_t new_key, const uint8_t* data, size_t size) {
+    uint32_t v = version.load(std::memory_order_relaxed);
+    version.store(v + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    blob.key = new_key;
+    blob.size = static_cast<uint32_t>(size);
+    memcpy(blob.data, data, size);
+    key.store(new_key, std::memory_order_relaxed);
+    version.store(v + 2, std::memory_order_release);
+  }
+
+  bool Read(FrameMetadataBlob* out) const {
+    uint32_t v = version.load(std::memory_order_acquire);
+    if (v & 1) {
+      return false;
+    }
+    out->key = blob.key;
+    out->size = std::min<uint32_t>(blob.size, FrameMetadataBlob::kMaxSize);
+    memcpy(out->data, blob.data, out->size);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return version.load(std::memory_order_relaxed) == v;
+  }
+};
+
+struct SenderState {
+  std::atomic<bool> enabled{false};
+
+  // SetNext で書き込んで、OnCapturedFrame で読み出す。key は通し番号
+  Slot next;
+  int64_t next_serial = 0;
+  // キャプチャのスレッドからしか触らない
+  int64_t attached_serial = 0;
+  FrameMetadataBlob capture_blob;
+
+  // OnCapturedFrame で書き込んで、OnEncode で読み出す。key は timestamp_us
+  Slot pending[kPendingSlots];
+  size_t pending_write = 0;
+
+  std::atomic<bool> drain_requested{false};
+
+  rtc::CriticalSection lock;
+  std::function<void()> on_outgoing RTC_GUARDED_BY(lock);
+  std::vector<FrameMetadataSender::Outgoing*> outgoing RTC_GUARDED_BY(lock);
+
+  std::atomic<uint64_t> attached{0};
+  std::atomic<uint64_t> encoded{0};
+  std::atomic<uint64_t> dropped{0};
+};
+
+SenderState& State() {
+  static SenderState* state = new SenderState();
+  return *state;
+}
+
+}  // namespace
+
+void FrameMetadataSender::Enable(std::function<void()> on_outgoing) {
+  SenderState& state = State();
+  rtc::CritScope lock(&state.lock);
+  state.on_outgoing = std::move(on_outgoing);
+  state.enabled = true;
+}
+
+void FrameMetadataSender::Disable() {
+  SenderState& state = State();
+  rtc::CritScope lock(&state.lock);
+  state.enabled = false;
+  state.on_outgoing = nullptr;
+}
+
+bool FrameMetadataSender::enabled() {
+  return State().enabled.load(std::memory_order_relaxed);
+}
+
+bool FrameMetadataSender::SetNext(const uint8_t* data, size_t size) {
+  SenderState& state = State();
+  if (size > FrameMetadataBlob::kMaxSize) {
+    state.dropped++;
+    return false;
+  }
+  state.next.Write(++state.next_serial, data, size);
+  return true;
+}
+
+void FrameMetadataSender::OnCapturedFrame(int64_t timestamp_us) {
+  SenderState& state = State();
+  if (!state.enabled.load(std::memory_order_relaxed)) {
+    return;
+  }
+  if (state.next.key.load(std::memory_order_relaxed) ==
+      state.attached_serial) {
+    return;
+  }
+  // 書き込み中だった場合は次のフレームに付ける
+  FrameMetadataBlob& blob = state.capture_blob;
+  if (!state.next.Read(&blob)) {
+    return;
+  }
+  state.attached_serial = blob.key;
+  state.pending[state.pending_write++ % kPendingSlots].Write(
+      timestamp_us, blob.data, blob.size);
+  state.attached++;
+}
+
+std::unique_ptr<FrameMetadataSender::Outgoing>
+FrameMetadataSender::AddOutgoing() {
+  SenderState& state = State();
+  std::unique_ptr<Outgoing> outgoing(new Outgoing());
+  rtc::CritScope lock(&state.lock);
+  state.outgoing.push_back(outgoing.get());
+  return outgoing;
+}
+
+void FrameMetadataSender::RemoveOutgoing(Outgoing* outgoing) {
+  SenderState& state = State();
+  rtc::CritScope lock(&state.lock);
+  state.outgoing.erase(
+      std::remove(state.outgoing.begin(), state.outgoing.end(), outgoing),
+      state.outgoing.end());
+}
+
+void FrameMetadataSender::OnEncode(Outgoing* outgoing,
+                                   int64_t timestamp_us,
+                                   uint32_t rtp_timestamp) {
+  SenderState& state = State();
+  if (!state.enabled.load(std::memory_order_relaxed)) {
+    return;
+  }
+  for (size_t i = 0; i < kPendingSlots; i++) {
+    const Slot& slot = state.pending[i];
+    if (slot.key.load(std::memory_order_relaxed) != timestamp_us) {
+      continue;
+    }
+    FrameMetadataBlob blob;
+    if (!slot.Read(&blob) || blob.key != timestamp_us) {
+      break;
+    }
+    blob.key = rtp_timestamp;
+    if (!outgoing->queue_.TryPush(blob)) {
+      state.dropped++;
+      return;
+    }
+    state.encoded++;
+    // 取り出されるまでは何度も知らせない
+    if (!state.drain_requested.exchange(true)) {
+      rtc::CritScope lock(&state.lock);
+      if (state.on_outgoing) {
+        state.on_outgoing();
+      }
+    }
+    return;
+  }
+}
+
+void FrameMetadataSender::Drain(
+    const std::function<void(const FrameMetadataBlob&)>& send) {
+  SenderState& state = State();
+  state.drain_requested = false;
+  // send は DataChannel を待つので、ロックの外で呼ぶ
+  std::vector<FrameMetadataBlob> blobs;
+  {
+    rtc::CritScope lock(&state.lock);
+    FrameMetadataBlob blob;
+    for (Outgoing* outgoing : state.outgoing) {
+      while (outgoing->queue_.TryPop(&blob)) {
+        blobs.push_back(blob);
+      }
+    }
+  }
+  for (const FrameMetadataBlob& blob : blobs) {
+    send(blob);
+  }
+}
+
+FrameMetadataSender::Stats FrameMetadataSender::GetStats() {
+  SenderState& state = State();
+  Stats stats;
+  stats.attached = state.attached.load();
+  stats.encoded = state.encoded.load();
+  stats.dropped = state.dropped.load();
+  return stats;
+}
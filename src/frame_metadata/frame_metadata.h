@@ -0,0 +1,73 @@
+#ifndef FRAME_METADATA_H_
+#define FRAME_METADATA_H_
+
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+
+#include "spsc_queue.h"
+
+// 1 フレームに付けるメタデータ。
+// 1 フレーム毎の負荷が一定になるように、大きさの上限を決めて固定長で持つ
+struct FrameMetadataBlob {
+  static const size_t kMaxSize = 256;
+
+  // 送信側のキャプチャからエンコードまではフレームの timestamp_us、
+  // それ以降は RTP タイムスタンプ
+  int64_t key = 0;
+  uint32_t size = 0;
+  uint8_t data[kMaxSize];
+};
+
+// キャプチャしたフレームにメタデータを付けて、エンコードした時の
+// RTP タイムスタンプと対応付ける。
+//
+// 入力 (SetNext) → キャプチャ (OnCapturedFrame) → エンコード (OnEncode) →
+// 送信 (Drain) の間はどこもロックを取らずに受け渡す。
+// 有効にしていない時は何もしない。
+class FrameMetadataSender {
+ public:
+  // エンコーダ毎の送信待ちのキュー。
+  // 書き込むのはエンコーダのスレッド、読み出すのは Drain を呼ぶスレッドだけ
+  class Outgoing {
+   public:
+    Outgoing() : queue_(64) {}
+
+   private:
+    friend class FrameMetadataSender;
+    SpscQueue<FrameMetadataBlob> queue_;
+  };
+
+  // 送信待ちができた時に呼ぶ関数を渡して有効にする。
+  // on_outgoing はエンコーダのスレッドから呼ばれるので、すぐに返すこと
+  static void Enable(std::function<void()> on_outgoing);
+  static void Disable();
+  static bool enabled();
+
+  // 次にキャプチャしたフレームに付けるメタデータを設定する。
+  // 1 つのスレッドからしか呼ばないこと。大きすぎる時は false を返す
+  static bool SetNext(const uint8_t* data, size_t size);
+
+  // キャプチャのスレッドから、フレームを渡す直前に呼ぶ
+  static void OnCapturedFrame(int64_t timestamp_us);
+
+  static std::unique_ptr<Outgoing> AddOutgoing();
+  static void RemoveOutgoing(Outgoing* outgoing);
+  // エンコーダのスレッドから、エンコードするフレーム毎に呼ぶ
+  static void OnEncode(Outgoing* outgoing,
+                       int64_t timestamp_us,
+                       uint32_t rtp_timestamp);
+
+  // 送信待ちのメタデータを全て取り出して send に渡す。key は RTP タイムスタンプ
+  static void Drain(const std::function<void(const FrameMetadataBlob&)>& send);
+
+  struct Stats {
+    uint64_t attached = 0;
+    uint64_t encoded = 0;
+    uint64_t dropped = 0;
+  };
+  static Stats GetStats();
+};
+
+#endif  // FRAME_METADATA_H_
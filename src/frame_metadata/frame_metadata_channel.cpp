@@ -0,0 +1,350 @@
+#include "frame_metadata_channel.h"
+
+#include <string.h>
+
+#include <iostream>
+#include <utility>
+
+#include "metrics/metrics_collector.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+#include "system_wrappers/include/clock.h"
+
+namespace {
+
+// メッセージの先頭 1 バイトで種類を見分ける
+enum MessageType : uint8_t {
+  // [RTP タイムスタンプ 4 バイト][メタデータ]
+  kMetadata = 0,
+  // [受信側の NTP ミリ秒 8 バイト]
+  kClockRequest = 1,
+  // [問い合わせの NTP ミリ秒 8 バイト][送信側の NTP ミリ秒 8 バイト]
+  kClockResponse = 2,
+};
+
+const size_t kTypeSize = 1;
+const size_t kRtpTimestampSize = 4;
+const size_t kClockSize = 8;
+const int64_t kClockRequestIntervalMs = 1000;
+// 表示に間に合わないメタデータは送り直さない
+const int kMaxPacketLifeTimeMs = 200;
+// 送信バッファがこれを超えていたら詰まっているので捨てる
+const uint64_t kMaxBufferedAmount = 64 * 1024;
+
+void WriteUint64(uint64_t value, uint8_t* data) {
+  for (size_t i = 0; i < kClockSize; i++) {
+    data[i] = static_cast<uint8_t>(value >> (8 * (kClockSize - 1 - i)));
+  }
+}
+
+uint64_t ReadUint64(const uint8_t* data) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < kClockSize; i++) {
+    value = (value << 8) | data[i];
+  }
+  return value;
+}
+
+int64_t CurrentNtpMs() {
+  return webrtc::Clock::GetRealTimeClock()->CurrentNtpInMilliseconds();
+}
+
+void SendMessage(webrtc::DataChannelInterface* channel,
+                 const uint8_t* data,
+                 size_t size) {
+  if (channel->state() == webrtc::DataChannelInterface::kOpen) {
+    channel->Send(webrtc::DataBuffer(rtc::CopyOnWriteBuffer(data, size), true));
+  }
+}
+
+}  // namespace
+
+const char* const FrameMetadataChannel::kLabel = "momo-frame-metadata";
+
+class FrameMetadataChannel::Channel : public webrtc::DataChannelObserver {
+ public:
+  Channel(FrameMetadataChannel* owner,
+          rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel)
+      : owner_(owner), data_channel_(data_channel) {
+    data_channel_->RegisterObserver(this);
+  }
+  ~Channel() { data_channel_->UnregisterObserver(); }
+
+  rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel() const {
+    return data_channel_;
+  }
+
+  void OnStateChange() override {
+    if (data_channel_->state() == webrtc::DataChannelInterface::kClosed) {
+      owner_->RemoveChannel(this);
+    }
+  }
+  void OnMessage(const webrtc::DataBuffer& buffer) override {
+    owner_->OnChannelMessage(this, buffer);
+  }
+  void OnBufferedAmountChange(uint64_t previous_amount) override {}
+
+ private:
+  FrameMetadataChannel* owner_;
+  rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel_;
+};
+
+std::shared_ptr<FrameMetadataChannel> FrameMetadataChannel::Create(
+    boost::asio::io_context& ioc,
+    int input_port,
+    FrameMetadataReceiver* receiver) {
+  std::shared_ptr<FrameMetadataChannel> channel(
+      new FrameMetadataChannel(ioc, input_port, receiver));
+  if (input_port == 0) {
+    return channel;
+  }
+  if (!channel->Open()) {
+    return nullptr;
+  }
+  // エンコーダのスレッドからは io_context に投げるだけにする
+  std::weak_ptr<FrameMetadataChannel> weak = channel;
+  FrameMetadataSender::Enable([&ioc, weak]() {
+    boost::asio::post(ioc, [weak]() {
+      auto channel = weak.lock();
+      if (channel) {
+        channel->Drain();
+      }
+    });
+  });
+  return channel;
+}
+
+FrameMetadataChannel::FrameMetadataChannel(boost::asio::io_context& ioc,
+                                           int input_port,
+                                           FrameMetadataReceiver* receiver)
+    : input_port_(input_port),
+      receiver_(receiver),
+      socket_(ioc),
+      receive_buffer_(FrameMetadataBlob::kMaxSize + 1) {}
+
+FrameMetadataChannel::~FrameMetadataChannel() {
+  if (input_port_ != 0) {
+    FrameMetadataSender::Disable();
+  }
+  boost::system::error_code ec;
+  socket_.close(ec);
+  rtc::CritScope lock(&channels_lock_);
+  channels_.clear();
+}
+
+bool FrameMetadataChannel::Open() {
+  boost::asio::ip::udp::endpoint endpoint(
+      boost::asio::ip::address_v4::loopback(), input_port_);
+  boost::system::error_code ec;
+  socket_.open(endpoint.protocol(), ec);
+  if (!ec) {
+    socket_.bind(endpoint, ec);
+  }
+  if (ec) {
+    std::cerr << "failed to bind frame metadata port " << input_port_ << ": "
+              << ec.message() << std::endl;
+    return false;
+  }
+  doReceive();
+  return true;
+}
+
+void FrameMetadataChannel::doReceive() {
+  // 上限より 1 バイト大きいバッファで受けて、大きすぎるものを見分ける
+  socket_.async_receive_from(
+      boost::asio::buffer(receive_buffer_), sender_,
+      [this](const boost::system::error_code& error, size_t length) {
+        onReceive(error, length);
+      });
+}
+
+void FrameMetadataChannel::onReceive(const boost::system::error_code& error,
+                                     size_t length) {
+  if (error == boost::asio::error::operation_aborted) {
+    return;
+  }
+  if (error) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__ << ": " << error.message();
+  } else if (!FrameMetadataSender::SetNext(receive_buffer_.data(), length)) {
+    RTC_LOG(LS_WARNING) << "Frame metadata is larger than "
+                        << FrameMetadataBlob::kMaxSize << " bytes";
+  }
+  doReceive();
+}
+
+void FrameMetadataChannel::Drain() {
+  FrameMetadataSender::Drain(
+      [this](const FrameMetadataBlob& blob) { Send(blob); });
+}
+
+void FrameMetadataChannel::Send(const FrameMetadataBlob& blob) {
+  send_buffer_.SetSize(kTypeSize + kRtpTimestampSize + blob.size);
+  uint8_t* data = send_buffer_.data();
+  uint32_t rtp_timestamp = static_cast<uint32_t>(blob.key);
+  data[0] = kMetadata;
+  data[1] = static_cast<uint8_t>(rtp_timestamp >> 24);
+  data[2] = static_cast<uint8_t>(rtp_timestamp >> 16);
+  data[3] = static_cast<uint8_t>(rtp_timestamp >> 8);
+  data[4] = static_cast<uint8_t>(rtp_timestamp);
+  memcpy(data + kTypeSize + kRtpTimestampSize, blob.data, blob.size);
+
+  // Send はシグナリングスレッドを待つので、ロックを持ったまま呼ばない
+  targets_.clear();
+  {
+    rtc::CritScope lock(&channels_lock_);
+    for (const auto& channel : channels_) {
+      targets_.push_back(channel->data_channel());
+    }
+  }
+  webrtc::DataBuffer data_buffer(send_buffer_, true);
+  for (const auto& target : targets_) {
+    if (target->state() != webrtc::DataChannelInterface::kOpen ||
+        target->buffered_amount() > kMaxBufferedAmount ||
+        !target->Send(data_buffer)) {
+      dropped_++;
+      continue;
+    }
+    sent_++;
+  }
+  targets_.clear();
+}
+
+void FrameMetadataChannel::OnDataChannel(
+    rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) {
+  AddChannel(data_channel);
+}
+
+void FrameMetadataChannel::OnConnectionCreated(
+    rtc::scoped_refptr<webrtc::PeerConnectionInterface> connection) {
+  if (input_port_ == 0) {
+    return;
+  }
+  webrtc::DataChannelInit init;
+  init.ordered = false;
+  init.maxRetransmitTime = kMaxPacketLifeTimeMs;
+  rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel =
+      connection->CreateDataChannel(kLabel, &init);
+  if (!data_channel) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": Failed to create data channel "
+                      << kLabel;
+    return;
+  }
+  AddChannel(data_channel);
+}
+
+bool FrameMetadataChannel::IsTargetDataChannel(const std::string& label) {
+  return label == kLabel;
+}
+
+void FrameMetadataChannel::AddChannel(
+    rtc::scoped_refptr<webrtc::DataChannelInterface> channel) {
+  RTC_LOG(LS_INFO) << "Frame metadata channel added";
+  rtc::CritScope lock(&channels_lock_);
+  channels_.push_back(std::unique_ptr<Channel>(new Channel(this, channel)));
+}
+
+void FrameMetadataChannel::RemoveChannel(Channel* channel) {
+  rtc::CritScope lock(&channels_lock_);
+  for (auto it = channels_.begin(); it != channels_.end(); ++it) {
+    if (it->get() == channel) {
+      channels_.erase(it);
+      return;
+    }
+  }
+}
+
+void FrameMetadataChannel::OnChannelMessage(Channel* channel,
+                                            const webrtc::DataBuffer& buffer) {
+  const uint8_t* data = buffer.data.cdata();
+  size_t length = buffer.data.size();
+  if (length < kTypeSize) {
+    return;
+  }
+  switch (data[0]) {
+    case kMetadata: {
+      if (receiver_ == nullptr || length < kTypeSize + kRtpTimestampSize) {
+        return;
+      }
+      uint32_t rtp_timestamp = (static_cast<uint32_t>(data[1]) << 24) |
+                               (static_cast<uint32_t>(data[2]) << 16) |
+                               (static_cast<uint32_t>(data[3]) << 8) | data[4];
+      receiver_->Deliver(rtp_timestamp, data + kTypeSize + kRtpTimestampSize,
+                         length - kTypeSize - kRtpTimestampSize);
+      RequestClock(channel);
+      break;
+    }
+    case kClockRequest:
+      if (input_port_ != 0 && length == kTypeSize + kClockSize) {
+        ReplyClock(channel, data + kTypeSize);
+      }
+      break;
+    case kClockResponse:
+      if (receiver_ != nullptr && length == kTypeSize + 2 * kClockSize) {
+        receiver_->OnSenderClock(
+            static_cast<int64_t>(ReadUint64(data + kTypeSize)),
+            static_cast<int64_t>(ReadUint64(data + kTypeSize + kClockSize)),
+            CurrentNtpMs());
+      }
+      break;
+  }
+}
+
+void FrameMetadataChannel::RequestClock(Channel* channel) {
+  int64_t now_ms = rtc::TimeMillis();
+  if (last_clock_request_ms_ != 0 &&
+      now_ms - last_clock_request_ms_ < kClockRequestIntervalMs) {
+    return;
+  }
+  last_clock_request_ms_ = now_ms;
+  uint8_t message[kTypeSize + kClockSize];
+  message[0] = kClockRequest;
+  WriteUint64(static_cast<uint64_t>(CurrentNtpMs()), message + kTypeSize);
+  SendMessage(channel->data_channel(), message, sizeof(message));
+}
+
+void FrameMetadataChannel::ReplyClock(Channel* channel,
+                                      const uint8_t* request) {
+  uint8_t message[kTypeSize + 2 * kClockSize];
+  message[0] = kClockResponse;
+  memcpy(message + kTypeSize, request, kClockSize);
+  WriteUint64(static_cast<uint64_t>(CurrentNtpMs()),
+              message + kTypeSize + kClockSize);
+  SendMessage(channel->data_channel(), message, sizeof(message));
+}
+
+void FrameMetadataChannel::AppendMetrics(std::string* out) {
+  FrameMetadataSender::Stats sender = FrameMetadataSender::GetStats();
+  MetricsCollector::AppendHeader(out, "momo_frame_metadata_attached_total",
+                                 "counter",
+                                 "Metadata blobs attached to captured frames");
+  MetricsCollector::AppendSample(out, "momo_frame_metadata_attached_total", "",
+                                 sender.attached);
+  MetricsCollector::AppendHeader(
+      out, "momo_frame_metadata_sent_total", "counter",
+      "Metadata blobs sent with the RTP timestamp of their frame");
+  MetricsCollector::AppendSample(out, "momo_frame_metadata_sent_total", "",
+                                 sent_.load());
+  if (receiver_ != nullptr) {
+    FrameMetadataReceiver::Stats receiver = receiver_->GetStats();
+    MetricsCollector::AppendHeader(out, "momo_frame_metadata_received_total",
+                                   "counter", "Metadata blobs received");
+    MetricsCollector::AppendSample(out, "momo_frame_metadata_received_total",
+                                   "", receiver.received);
+    MetricsCollector::AppendHeader(
+        out, "momo_frame_metadata_matched_total", "counter",
+        "Metadata blobs delivered together with a decoded frame");
+    MetricsCollector::AppendSample(out, "momo_frame_metadata_matched_total",
+                                   "", receiver.matched);
+  }
+  MetricsCollector::AppendHeader(
+      out, "momo_frame_metadata_dropped_total", "counter",
+      "Metadata blobs dropped (too large, queue full or never matched)");
+  MetricsCollector::AppendSample(out, "momo_frame_metadata_dropped_total",
+                                 "direction=\"send\"",
+                                 sender.dropped + dropped_.load());
+  if (receiver_ != nullptr) {
+    MetricsCollector::AppendSample(out, "momo_frame_metadata_dropped_total",
+                                   "direction=\"receive\"",
+                                   receiver_->GetStats().dropped);
+  }
+}
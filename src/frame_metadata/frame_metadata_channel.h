@@ -0,0 +1,89 @@
+#ifndef FRAME_METADATA_CHANNEL_H_
+#define FRAME_METADATA_CHANNEL_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "api/data_channel_interface.h"
+#include "frame_metadata.h"
+#include "frame_metadata_receiver.h"
+#include "rtc/data_manager.h"
+#include "rtc_base/copy_on_write_buffer.h"
+#include "rtc_base/critical_section.h"
+
+// フレームのメタデータを映像と一緒に送る DataChannel。
+//
+// 送信側は 127.0.0.1:input_port で受け取ったデータグラムを次にキャプチャした
+// フレームに付けて、種類 (1 バイト) とエンコードした時の RTP タイムスタンプ
+// (4 バイトのビッグエンディアン) を先頭に付けて送る。
+// 映像より遅れても意味が無いので、順序は保証せず再送も短い時間で諦める。
+//
+// 受信側は届いたメタデータを FrameMetadataReceiver に渡す。
+// また送信側の時計との差を測るために、メタデータが届いている間は
+// 1 秒毎に送信側の時計を問い合わせる。
+class FrameMetadataChannel : public RTCDataManager {
+ public:
+  static const char* const kLabel;
+
+  // input_port が 0 ならメタデータを送らない。
+  // receiver が nullptr なら届いたメタデータは捨てる
+  static std::shared_ptr<FrameMetadataChannel> Create(
+      boost::asio::io_context& ioc,
+      int input_port,
+      FrameMetadataReceiver* receiver);
+  ~FrameMetadataChannel();
+
+  void OnDataChannel(
+      rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) override;
+  void OnConnectionCreated(
+      rtc::scoped_refptr<webrtc::PeerConnectionInterface> connection) override;
+  bool IsTargetDataChannel(const std::string& label) override;
+
+  // /metrics に付けた数と突き合わせた数を書き足す
+  void AppendMetrics(std::string* out);
+
+ private:
+  class Channel;
+
+  FrameMetadataChannel(boost::asio::io_context& ioc,
+                       int input_port,
+                       FrameMetadataReceiver* receiver);
+  bool Open();
+  void doReceive();
+  void onReceive(const boost::system::error_code& error, size_t length);
+  void Drain();
+  void Send(const FrameMetadataBlob& blob);
+  void AddChannel(rtc::scoped_refptr<webrtc::DataChannelInterface> channel);
+  void RemoveChannel(Channel* channel);
+  void OnChannelMessage(Channel* channel, const webrtc::DataBuffer& buffer);
+  void RequestClock(Channel* channel);
+  void ReplyClock(Channel* channel, const uint8_t* request);
+
+  const int input_port_;
+  FrameMetadataReceiver* receiver_;
+  boost::asio::ip::udp::socket socket_;
+  boost::asio::ip::udp::endpoint sender_;
+
+  // 以下は io_context のスレッドからしか触らない
+  std::vector<uint8_t> receive_buffer_;
+  rtc::CopyOnWriteBuffer send_buffer_;
+  std::vector<rtc::scoped_refptr<webrtc::DataChannelInterface>> targets_;
+
+  // シグナリングスレッドからしか触らない
+  int64_t last_clock_request_ms_ = 0;
+
+  rtc::CriticalSection channels_lock_;
+  std::vector<std::unique_ptr<Channel>> channels_ RTC_GUARDED_BY(
+      channels_lock_);
+
+  std::atomic<uint64_t> sent_{0};
+  std::atomic<uint64_t> dropped_{0};
+};
+
+#endif  // FRAME_METADATA_CHANNEL_H_
@@ -0,0 +1,88 @@
+#include "frame_metadata_encoder_factory.h"
+
+#include "absl/memory/memory.h"
+
+FrameMetadataVideoEncoder::FrameMetadataVideoEncoder(
+    std::unique_ptr<webrtc::VideoEncoder> encoder)
+    : encoder_(std::move(encoder)),
+      outgoing_(FrameMetadataSender::AddOutgoing()) {}
+
+FrameMetadataVideoEncoder::~FrameMetadataVideoEncoder() {
+  FrameMetadataSender::RemoveOutgoing(outgoing_.get());
+}
+
+int32_t FrameMetadataVideoEncoder::InitEncode(
+    const webrtc::VideoCodec* codec_settings,
+    int32_t number_of_cores,
+    size_t max_payload_size) {
+  return encoder_->InitEncode(codec_settings, number_of_cores,
+                              max_payload_size);
+}
+
+int32_t FrameMetadataVideoEncoder::RegisterEncodeCompleteCallback(
+    webrtc::EncodedImageCallback* callback) {
+  return encoder_->RegisterEncodeCompleteCallback(callback);
+}
+
+int32_t FrameMetadataVideoEncoder::Release() {
+  return encoder_->Release();
+}
+
+int32_t FrameMetadataVideoEncoder::Encode(
+    const webrtc::VideoFrame& frame,
+    const std::vector<webrtc::VideoFrameType>* frame_types) {
+  // frame.timestamp() は送信時に RTP のランダムなオフセットが足される前の値
+  FrameMetadataSender::OnEncode(outgoing_.get(), frame.timestamp_us(),
+                                frame.timestamp());
+  return encoder_->Encode(frame, frame_types);
+}
+
+void FrameMetadataVideoEncoder::SetRates(
+    const RateControlParameters& parameters) {
+  encoder_->SetRates(parameters);
+}
+
+void FrameMetadataVideoEncoder::OnPacketLossRateUpdate(float packet_loss_rate) {
+  encoder_->OnPacketLossRateUpdate(packet_loss_rate);
+}
+
+void FrameMetadataVideoEncoder::OnRttUpdate(int64_t rtt_ms) {
+  encoder_->OnRttUpdate(rtt_ms);
+}
+
+void FrameMetadataVideoEncoder::OnLossNotification(
+    const LossNotification& loss_notification) {
+  encoder_->OnLossNotification(loss_notification);
+}
+
+webrtc::VideoEncoder::EncoderInfo FrameMetadataVideoEncoder::GetEncoderInfo()
+    const {
+  return encoder_->GetEncoderInfo();
+}
+
+FrameMetadataVideoEncoderFactory::FrameMetadataVideoEncoderFactory(
+    std::unique_ptr<webrtc::VideoEncoderFactory> factory)
+    : factory_(std::move(factory)) {}
+
+std::vector<webrtc::SdpVideoFormat>
+FrameMetadataVideoEncoderFactory::GetSupportedFormats() const {
+  return factory_->GetSupportedFormats();
+}
+
+webrtc::VideoEncoderFactory::CodecInfo
+FrameMetadataVideoEncoderFactory::QueryVideoEncoder(
+    const webrtc::SdpVideoFormat& format) const {
+  return factory_->QueryVideoEncoder(format);
+}
+
+std::unique_ptr<webrtc::VideoEncoder>
+FrameMetadataVideoEncoderFactory::CreateVideoEncoder(
+    const webrtc::SdpVideoFormat& format) {
+  std::unique_ptr<webrtc::VideoEncoder> encoder =
+      factory_->CreateVideoEncoder(format);
+  if (!encoder) {
+    return nullptr;
+  }
+  return std::unique_ptr<webrtc::VideoEncoder>(
+      absl::make_unique<FrameMetadataVideoEncoder>(std::move(encoder)));
+}
@@ -0,0 +1,58 @@
+#ifndef FRAME_METADATA_ENCODER_FACTORY_H_
+#define FRAME_METADATA_ENCODER_FACTORY_H_
+
+#include <memory>
+#include <vector>
+
+#include "api/video_codecs/sdp_video_format.h"
+#include "api/video_codecs/video_encoder.h"
+#include "api/video_codecs/video_encoder_factory.h"
+#include "frame_metadata.h"
+
+// エンコーダをラップして、エンコードするフレームの timestamp_us と
+// RTP タイムスタンプを FrameMetadataSender に知らせるエンコーダ
+class FrameMetadataVideoEncoder : public webrtc::VideoEncoder {
+ public:
+  explicit FrameMetadataVideoEncoder(
+      std::unique_ptr<webrtc::VideoEncoder> encoder);
+  ~FrameMetadataVideoEncoder() override;
+
+  // webrtc::VideoEncoder
+  int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
+                     int32_t number_of_cores,
+                     size_t max_payload_size) override;
+  int32_t RegisterEncodeCompleteCallback(
+      webrtc::EncodedImageCallback* callback) override;
+  int32_t Release() override;
+  int32_t Encode(
+      const webrtc::VideoFrame& frame,
+      const std::vector<webrtc::VideoFrameType>* frame_types) override;
+  void SetRates(const RateControlParameters& parameters) override;
+  void OnPacketLossRateUpdate(float packet_loss_rate) override;
+  void OnRttUpdate(int64_t rtt_ms) override;
+  void OnLossNotification(const LossNotification& loss_notification) override;
+  webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const override;
+
+ private:
+  std::unique_ptr<webrtc::VideoEncoder> encoder_;
+  std::unique_ptr<FrameMetadataSender::Outgoing> outgoing_;
+};
+
+// 既存のエンコーダファクトリをラップして、作ったエンコーダを
+// FrameMetadataVideoEncoder で包むファクトリ
+class FrameMetadataVideoEncoderFactory : public webrtc::VideoEncoderFactory {
+ public:
+  explicit FrameMetadataVideoEncoderFactory(
+      std::unique_ptr<webrtc::VideoEncoderFactory> factory);
+
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
+  CodecInfo QueryVideoEncoder(
+      const webrtc::SdpVideoFormat& format) const override;
+  std::unique_ptr<webrtc::VideoEncoder> CreateVideoEncoder(
+      const webrtc::SdpVideoFormat& format) override;
+
+ private:
+  std::unique_ptr<webrtc::VideoEncoderFactory> factory_;
+};
+
+#endif  // FRAME_METADATA_ENCODER_FACTORY_H_
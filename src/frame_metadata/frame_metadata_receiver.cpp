@@ -0,0 +1,283 @@
+#include "frame_metadata_receiver.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <boost/asio.hpp>
+
+#include "rtc_base/logging.h"
+
+namespace {
+
+// シグナリングスレッドから渡されて、まだ突き合わせていないメタデータの数
+const size_t kIncomingSize = 64;
+const size_t kPendingSize = 64;
+// RTCP SR から推定したキャプチャ時刻のずれをどこまで許すか (90kHz)。
+// 30fps のフレーム間隔の半分より小さくする
+const uint32_t kEstimateTolerance = 90 * 10;
+const size_t kRtpTimestampSize = 4;
+// 送信側の時計との差は、直近のこれだけの問い合わせのうち往復時間が
+// 一番短いものを使う
+const size_t kClockSamples = 8;
+
+// VideoStreamEncoder と同じ計算で、キャプチャ時刻から RTP タイムスタンプを求める
+uint32_t NtpMsToRtpTimestamp(int64_t ntp_time_ms) {
+  return 90 * static_cast<uint32_t>(ntp_time_ms);
+}
+
+}  // namespace
+
+FrameMetadataReceiver::Sink::Sink(FrameMetadataReceiver* receiver,
+                                  webrtc::VideoTrackInterface* track)
+    : incoming(kIncomingSize),
+      receiver_(receiver),
+      track_(track),
+      pending_(kPendingSize),
+      pending_write_(0),
+      has_offset_(false),
+      offset_(0),
+      misses_(0),
+      warned_(false) {
+  for (FrameMetadataBlob& blob : pending_) {
+    blob.key = -1;
+  }
+  track_->AddOrUpdateSink(this, rtc::VideoSinkWants());
+}
+
+FrameMetadataReceiver::Sink::~Sink() {
+  track_->RemoveSink(this);
+}
+
+void FrameMetadataReceiver::Sink::OnFrame(const webrtc::VideoFrame& frame) {
+  FrameMetadataBlob blob;
+  while (incoming.TryPop(&blob)) {
+    // 一杯になったら古いものから上書きする
+    FrameMetadataBlob& slot = pending_[pending_write_++ % pending_.size()];
+    if (slot.key >= 0) {
+      receiver_->dropped_++;
+      OnUnmatched();
+    }
+    slot = blob;
+  }
+
+  uint32_t rtp_timestamp = frame.timestamp();
+  FrameMetadataBlob* found = nullptr;
+  if (has_offset_) {
+    found = Find(rtp_timestamp - offset_, 0);
+  }
+  if (found == nullptr && frame.ntp_time_ms() > 0 &&
+      receiver_->has_sender_clock_.load()) {
+    // 接続し直した時などはオフセットが変わるので、推定し直す。
+    // ntp_time_ms は受信側の時計なので、送信側の時計に直してから探す
+    int64_t sender_ntp_ms =
+        frame.ntp_time_ms() + receiver_->sender_clock_offset_ms_.load();
+    found = Find(NtpMsToRtpTimestamp(sender_ntp_ms), kEstimateTolerance);
+    if (found != nullptr) {
+      offset_ = rtp_timestamp - static_cast<uint32_t>(found->key);
+      if (!has_offset_) {
+        RTC_LOG(LS_INFO) << "Frame metadata synchronized: offset=" << offset_;
+      }
+      has_offset_ = true;
+    }
+  }
+  if (found == nullptr) {
+    return;
+  }
+  misses_ = 0;
+  warned_ = false;
+  receiver_->OnMatched(track_, frame, *found);
+  found->key = -1;
+}
+
+void FrameMetadataReceiver::Sink::OnUnmatched() {
+  // 突き合わないまま一周したら一度だけ知らせる
+  if (++misses_ < kPendingSize || warned_) {
+    return;
+  }
+  warned_ = true;
+  RTC_LOG(LS_WARNING) << "Frame metadata matched no decoded frame: track="
+                      << track_->id() << " sender_clock="
+                      << (receiver_->has_sender_clock_.load() ? "known"
+                                                              : "unknown");
+}
+
+FrameMetadataBlob* FrameMetadataReceiver::Sink::Find(uint32_t rtp_timestamp,
+                                                     uint32_t tolerance) {
+  FrameMetadataBlob* found = nullptr;
+  uint32_t best = tolerance + 1;
+  for (FrameMetadataBlob& blob : pending_) {
+    if (blob.key < 0) {
+      continue;
+    }
+    int32_t diff = static_cast<int32_t>(static_cast<uint32_t>(blob.key) -
+                                        rtp_timestamp);
+    uint32_t distance = static_cast<uint32_t>(diff < 0 ? -diff : diff);
+    if (distance < best) {
+      best = distance;
+      found = &blob;
+    }
+  }
+  return found;
+}
+
+std::unique_ptr<FrameMetadataReceiver> FrameMetadataReceiver::Create(
+    VideoTrackReceiver* receiver,
+    const std::string& output) {
+  if (output.empty()) {
+    return std::unique_ptr<FrameMetadataReceiver>(
+        new FrameMetadataReceiver(receiver, -1));
+  }
+
+  size_t colon = output.rfind(':');
+  boost::system::error_code ec;
+  boost::asio::ip::address address =
+      boost::asio::ip::make_address(output.substr(0, colon), ec);
+  int port = colon == std::string::npos
+                 ? 0
+                 : atoi(output.substr(colon + 1).c_str());
+  if (ec || port <= 0 || port > 65535) {
+    RTC_LOG(LS_ERROR) << "Invalid frame metadata output: " << output;
+    return nullptr;
+  }
+  boost::asio::ip::udp::endpoint endpoint(address,
+                                          static_cast<unsigned short>(port));
+  int fd = ::socket(endpoint.protocol().family(), SOCK_DGRAM, 0);
+  if (fd < 0 || ::connect(fd, endpoint.data(), endpoint.size()) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to open frame metadata output " << output
+                      << ": " << strerror(errno);
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    return nullptr;
+  }
+  return std::unique_ptr<FrameMetadataReceiver>(
+      new FrameMetadataReceiver(receiver, fd));
+}
+
+FrameMetadataReceiver::FrameMetadataReceiver(VideoTrackReceiver* receiver,
+                                             int output_socket)
+    : receiver_(receiver), output_socket_(output_socket) {}
+
+FrameMetadataReceiver::~FrameMetadataReceiver() {
+  {
+    rtc::CritScope lock(&sinks_lock_);
+    sinks_.clear();
+  }
+  if (output_socket_ >= 0) {
+    ::close(output_socket_);
+  }
+}
+
+void FrameMetadataReceiver::AddTrack(webrtc::VideoTrackInterface* track) {
+  if (receiver_ != nullptr) {
+    receiver_->AddTrack(track);
+  }
+  std::unique_ptr<Sink> sink(new Sink(this, track));
+  rtc::CritScope lock(&sinks_lock_);
+  sinks_.push_back(std::make_pair(track, std::move(sink)));
+}
+
+void FrameMetadataReceiver::RemoveTrack(webrtc::VideoTrackInterface* track) {
+  {
+    rtc::CritScope lock(&sinks_lock_);
+    sinks_.erase(
+        std::remove_if(sinks_.begin(), sinks_.end(),
+                       [track](const std::pair<webrtc::VideoTrackInterface*,
+                                               std::unique_ptr<Sink>>& sink) {
+                         return sink.first == track;
+                       }),
+        sinks_.end());
+  }
+  if (receiver_ != nullptr) {
+    receiver_->RemoveTrack(track);
+  }
+}
+
+void FrameMetadataReceiver::Deliver(uint32_t rtp_timestamp,
+                                    const uint8_t* data,
+                                    size_t size) {
+  if (size > FrameMetadataBlob::kMaxSize) {
+    dropped_++;
+    return;
+  }
+  received_++;
+  FrameMetadataBlob blob;
+  blob.key = rtp_timestamp;
+  blob.size = static_cast<uint32_t>(size);
+  memcpy(blob.data, data, size);
+  // どのトラックのメタデータかは分からないので、全てのトラックに渡す。
+  // 違うトラックでは RTP タイムスタンプが一致しないので使われない
+  rtc::CritScope lock(&sinks_lock_);
+  for (const auto& sink : sinks_) {
+    if (!sink.second->incoming.TryPush(blob)) {
+      dropped_++;
+    }
+  }
+}
+
+void FrameMetadataReceiver::OnSenderClock(int64_t request_ms,
+                                          int64_t sender_ms,
+                                          int64_t response_ms) {
+  if (response_ms < request_ms) {
+    return;
+  }
+  // 行きと帰りが同じ時間かかったとみなす
+  ClockSample sample;
+  sample.rtt_ms = response_ms - request_ms;
+  sample.offset_ms = sender_ms - (request_ms + response_ms) / 2;
+  if (clock_samples_.size() < kClockSamples) {
+    clock_samples_.push_back(sample);
+  } else {
+    clock_samples_[clock_sample_write_++ % kClockSamples] = sample;
+  }
+  // 往復時間が短いほど混雑で片道だけ遅れた分の誤差が小さい
+  const ClockSample* best = &clock_samples_[0];
+  for (const ClockSample& s : clock_samples_) {
+    if (s.rtt_ms < best->rtt_ms) {
+      best = &s;
+    }
+  }
+  if (!has_sender_clock_.load()) {
+    RTC_LOG(LS_INFO) << "Frame metadata sender clock offset="
+                     << best->offset_ms << "ms rtt=" << best->rtt_ms << "ms";
+  }
+  sender_clock_offset_ms_ = best->offset_ms;
+  has_sender_clock_ = true;
+}
+
+void FrameMetadataReceiver::OnMatched(webrtc::VideoTrackInterface* track,
+                                      const webrtc::VideoFrame& frame,
+                                      const FrameMetadataBlob& blob) {
+  matched_++;
+  if (receiver_ != nullptr) {
+    receiver_->OnFrameMetadata(track, frame, blob.data, blob.size);
+  }
+  if (output_socket_ < 0) {
+    return;
+  }
+  uint8_t message[kRtpTimestampSize + FrameMetadataBlob::kMaxSize];
+  uint32_t rtp_timestamp = frame.timestamp();
+  message[0] = static_cast<uint8_t>(rtp_timestamp >> 24);
+  message[1] = static_cast<uint8_t>(rtp_timestamp >> 16);
+  message[2] = static_cast<uint8_t>(rtp_timestamp >> 8);
+  message[3] = static_cast<uint8_t>(rtp_timestamp);
+  memcpy(message + kRtpTimestampSize, blob.data, blob.size);
+  // デコードのスレッドを待たせないように、送れなければ捨てる
+  if (::send(output_socket_, message, kRtpTimestampSize + blob.size,
+             MSG_DONTWAIT) < 0) {
+    dropped_++;
+  }
+}
+
+FrameMetadataReceiver::Stats FrameMetadataReceiver::GetStats() {
+  Stats stats;
+  stats.received = received_.load();
+  stats.matched = matched_.load();
+  stats.dropped = dropped_.load();
+  return stats;
+}
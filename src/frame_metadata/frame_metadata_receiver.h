@@ -0,0 +1,117 @@
+#ifndef FRAME_METADATA_RECEIVER_H_
+#define FRAME_METADATA_RECEIVER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "api/media_stream_interface.h"
+#include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
+#include "frame_metadata.h"
+#include "rtc/video_track_receiver.h"
+#include "rtc_base/critical_section.h"
+#include "spsc_queue.h"
+
+// DataChannel で届いたフレームのメタデータを、デコードしたフレームと
+// RTP タイムスタンプで突き合わせて、元の VideoTrackReceiver の
+// OnFrameMetadata に渡す。
+//
+// 送信側の RTP タイムスタンプには接続毎にランダムなオフセットが足されるので、
+// 最初は RTCP SR から推定したキャプチャ時刻で大まかに探してオフセットを決め、
+// それ以降は RTP タイムスタンプが一致するものだけを渡す。
+// 推定したキャプチャ時刻は受信側の時計なので、DataChannel で測った
+// 送信側の時計との差 (OnSenderClock) で送信側の時計に直してから探す。
+// そのため相手の最初の RTCP SR と時計の差が分かるまでのフレームには
+// メタデータが付かない。
+//
+// output に HOST:PORT を指定すると、突き合わせたメタデータの先頭に
+// 受信したフレームの RTP タイムスタンプ (4 バイトのビッグエンディアン) を
+// 付けて UDP で送る。
+class FrameMetadataReceiver : public VideoTrackReceiver {
+ public:
+  struct Stats {
+    uint64_t received = 0;
+    uint64_t matched = 0;
+    uint64_t dropped = 0;
+  };
+
+  // output の書式が間違っている時は nullptr
+  static std::unique_ptr<FrameMetadataReceiver> Create(
+      VideoTrackReceiver* receiver,
+      const std::string& output);
+  ~FrameMetadataReceiver();
+
+  void AddTrack(webrtc::VideoTrackInterface* track) override;
+  void RemoveTrack(webrtc::VideoTrackInterface* track) override;
+
+  // DataChannel で届いたメタデータを渡す。シグナリングスレッドから呼ぶこと。
+  // rtp_timestamp は送信側でオフセットを足す前の値
+  void Deliver(uint32_t rtp_timestamp, const uint8_t* data, size_t size);
+  // 送信側の時計を問い合わせた結果を渡す。シグナリングスレッドから呼ぶこと。
+  // 時刻は NTP のミリ秒で、request_ms と response_ms は受信側の時計
+  void OnSenderClock(int64_t request_ms,
+                     int64_t sender_ms,
+                     int64_t response_ms);
+
+  Stats GetStats();
+
+ private:
+  class Sink : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+   public:
+    Sink(FrameMetadataReceiver* receiver, webrtc::VideoTrackInterface* track);
+    ~Sink();
+    void OnFrame(const webrtc::VideoFrame& frame) override;
+
+    // 書き込むのはシグナリングスレッド、読み出すのはデコードのスレッド
+    SpscQueue<FrameMetadataBlob> incoming;
+
+   private:
+    FrameMetadataBlob* Find(uint32_t rtp_timestamp, uint32_t tolerance);
+    void OnUnmatched();
+
+    FrameMetadataReceiver* receiver_;
+    rtc::scoped_refptr<webrtc::VideoTrackInterface> track_;
+    // 以下はデコードのスレッドからしか触らない
+    std::vector<FrameMetadataBlob> pending_;
+    size_t pending_write_;
+    bool has_offset_;
+    uint32_t offset_;
+    // 最後に突き合わせてから、突き合わないまま捨てたメタデータの数
+    size_t misses_;
+    bool warned_;
+  };
+
+  struct ClockSample {
+    int64_t rtt_ms;
+    int64_t offset_ms;
+  };
+
+  FrameMetadataReceiver(VideoTrackReceiver* receiver, int output_socket);
+  void OnMatched(webrtc::VideoTrackInterface* track,
+                 const webrtc::VideoFrame& frame,
+                 const FrameMetadataBlob& blob);
+
+  VideoTrackReceiver* receiver_;
+  const int output_socket_;
+
+  rtc::CriticalSection sinks_lock_;
+  std::vector<std::pair<webrtc::VideoTrackInterface*, std::unique_ptr<Sink>>>
+      sinks_ RTC_GUARDED_BY(sinks_lock_);
+
+  // 以下はシグナリングスレッドからしか触らない
+  std::vector<ClockSample> clock_samples_;
+  size_t clock_sample_write_ = 0;
+  // 送信側の時計から受信側の時計を引いたもの (ms)
+  std::atomic<bool> has_sender_clock_{false};
+  std::atomic<int64_t> sender_clock_offset_ms_{0};
+
+  std::atomic<uint64_t> received_{0};
+  std::atomic<uint64_t> matched_{0};
+  std::atomic<uint64_t> dropped_{0};
+};
+
+#endif  // FRAME_METADATA_RECEIVER_H_
@@ -0,0 +1,59 @@
+#ifndef FRAME_METADATA_SPSC_QUEUE_H_
+#define FRAME_METADATA_SPSC_QUEUE_H_
+
+#include <stddef.h>
+
+#include <atomic>
+#include <memory>
+
+// 書き込むスレッドと読み出すスレッドが 1 つずつの固定長キュー。
+// ロックを取らないので、映像のスレッドから呼んでも待たされない。
+// 容量は 2 のべき乗に切り上げる。
+template <typename T>
+class SpscQueue {
+ public:
+  explicit SpscQueue(size_t capacity)
+      : capacity_(RoundUp(capacity)),
+        items_(new T[capacity_]),
+        head_(0),
+        tail_(0) {}
+
+  // 一杯の時は入れずに false を返す
+  bool TryPush(const T& item) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == capacity_) {
+      return false;
+    }
+    items_[tail & (capacity_ - 1)] = item;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // 空の時は false を返す
+  bool TryPop(T* item) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    *item = items_[head & (capacity_ - 1)];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+ private:
+  static size_t RoundUp(size_t n) {
+    size_t capacity = 1;
+    while (capacity < n) {
+      capacity <<= 1;
+    }
+    return capacity;
+  }
+
+  const size_t capacity_;
+  std::unique_ptr<T[]> items_;
+  // 読み出した位置と書き込んだ位置の累積
+  std::atomic<size_t> head_;
+  std::atomic<size_t> tail_;
+};
+
+#endif  // FRAME_METADATA_SPSC_QUEUE_H_
@@ -11,97 +11,129 @@
 
 #include "jetson_h264_encoder.h"
 
-#include <limits>
+#include <string.h>
+
 #include <string>
 
-#include "common_video/libyuv/include/webrtc_libyuv.h"
 #include "nvbuf_utils.h"
 #include "rtc/native_buffer.h"
-#include "rtc_base/checks.h"
+#include "hwenc_v4l2/v4l2_h264.h"
+#include "rtc/h264_format.h"
 #include "rtc_base/logging.h"
 #include "rtc_base/time_utils.h"
-#include "system_wrappers/include/metrics.h"
-#include "third_party/libyuv/include/libyuv/convert.h"
-#include "third_party/libyuv/include/libyuv/convert_from.h"
-#include "third_party/libyuv/include/libyuv/video_common.h"
+#include "thread_policy/thread_policy.h"
 
-#define H264HWENC_HEADER_DEBUG 0
 #define INIT_ERROR(cond, desc)                 \
   if (cond) {                                  \
     RTC_LOG(LS_ERROR) << __FUNCTION__ << desc; \
-    Release();                                 \
-    return WEBRTC_VIDEO_CODEC_ERROR;           \
+    return nullptr;                            \
   }
 
 namespace {
-struct nal_entry {
-  size_t offset;
-  size_t size;
-};
 
-const int kLowH264QpThreshold = 34;
-const int kHighH264QpThreshold = 40;
+// イントラリフレッシュの時の IDR の間隔。実際には出ないくらい長くする
+const uint32_t kIntraRefreshKeyFrameInterval = 1 << 30;
+// イントラリフレッシュの時に 1 フレームを分けるスライスの数
+const int kIntraRefreshSlices = 4;
+
+void SendEOS(NvV4l2Element* element) {
+  if (element->output_plane.getStreamStatus()) {
+    struct v4l2_buffer v4l2_buf;
+    struct v4l2_plane planes[MAX_PLANES];
+    NvBuffer* buffer;
+
+    memset(&v4l2_buf, 0, sizeof(v4l2_buf));
+    memset(planes, 0, MAX_PLANES * sizeof(struct v4l2_plane));
+    v4l2_buf.m.planes = planes;
+
+    if (element->output_plane.getNumQueuedBuffers() ==
+        element->output_plane.getNumBuffers()) {
+      if (element->output_plane.dqBuffer(v4l2_buf, &buffer, NULL, 10) < 0) {
+        RTC_LOG(LS_ERROR) << "Failed to dqBuffer at encoder output_plane";
+      }
+    }
+    planes[0].bytesused = 0;
+    if (element->output_plane.qBuffer(v4l2_buf, NULL) < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to qBuffer at encoder output_plane";
+    }
+  }
+}
 
 }  // namespace
 
-JetsonH264Encoder::JetsonH264Encoder(const cricket::VideoCodec& codec)
-    : callback_(nullptr),
-      decoder_(nullptr),
-      converter_(nullptr),
-      encoder_(nullptr),
-      bitrate_adjuster_(.5, .95),
-      configured_framerate_(30),
-      configured_width_(0),
-      configured_height_(0),
+JetsonH264Pipeline::~JetsonH264Pipeline() {
+  if (encoder) {
+    if (converter) {
+      SendEOS(converter);
+    } else {
+      SendEOS(encoder);
+    }
+    encoder->capture_plane.waitForDQThread(2000);
+    encoder->capture_plane.deinitPlane();
+    encoder->output_plane.deinitPlane();
+    delete encoder;
+  }
+  if (converter) {
+    converter->capture_plane.waitForDQThread(2000);
+    delete converter;
+  }
+}
+
+JetsonH264Encoder::JetsonH264Encoder(
+    std::shared_ptr<JetsonH264PipelinePool> pool)
+    : decoder_(nullptr),
+      pool_(pool),
+      bitrate_bps_(0),
+      framerate_(30),
+      key_frame_interval_(0),
+      h264_profile_(webrtc::H264::kProfileConstrainedBaseline),
+      h264_level_(webrtc::H264::kLevel3_1),
+      intra_refresh_period_(0),
+      decode_pixfmt_(0),
+      raw_width_(0),
+      raw_height_(0),
+      width_(0),
+      height_(0),
       use_mjpeg_(false) {}
 
 JetsonH264Encoder::~JetsonH264Encoder() {
   Release();
 }
 
-int32_t JetsonH264Encoder::InitEncode(const webrtc::VideoCodec* codec_settings,
-                                      int32_t number_of_cores,
-                                      size_t max_payload_size) {
-  RTC_LOG(LS_INFO) << __FUNCTION__ << " Start";
-  RTC_DCHECK(codec_settings);
-  RTC_DCHECK_EQ(codec_settings->codecType, webrtc::kVideoCodecH264);
-
-  int32_t release_ret = Release();
-  if (release_ret != WEBRTC_VIDEO_CODEC_OK) {
-    return release_ret;
-  }
-
-  width_ = codec_settings->width;
-  height_ = codec_settings->height;
-  target_bitrate_bps_ = codec_settings->startBitrate * 1000;
-  key_frame_interval_ = codec_settings->H264().keyFrameInterval;
-  bitrate_adjuster_.SetTargetBitrateBps(target_bitrate_bps_);
-  framerate_ = codec_settings->maxFramerate;
-
-  RTC_LOG(LS_INFO) << "InitEncode " << framerate_ << "fps "
-                   << target_bitrate_bps_ << "bit/sec　"
-                   << codec_settings->maxBitrate << "kbit/sec　";
-
-  // Initialize encoded image. Default buffer size: size of unencoded data.
-  encoded_image_._completeFrame = true;
-  encoded_image_._encodedWidth = 0;
-  encoded_image_._encodedHeight = 0;
-  encoded_image_.set_size(0);
-  encoded_image_.timing_.flags =
-      webrtc::VideoSendTiming::TimingFrameFlags::kInvalid;
-  encoded_image_.content_type_ =
-      (codec_settings->mode == webrtc::VideoCodecMode::kScreensharing)
-          ? webrtc::VideoContentType::SCREENSHARE
-          : webrtc::VideoContentType::UNSPECIFIED;
-
-  decoder_ = NvJPEGDecoder::createJPEGDecoder("jpegdec");
-  INIT_ERROR(!decoder_, "Failed to createJPEGDecoder");
+std::vector<webrtc::H264::ProfileLevelId>
+JetsonH264Encoder::SupportedH264Profiles() {
+  return {
+      {webrtc::H264::kProfileHigh, webrtc::H264::kLevel5_1},
+      {webrtc::H264::kProfileMain, webrtc::H264::kLevel5_1},
+      {webrtc::H264::kProfileConstrainedBaseline, webrtc::H264::kLevel5_1},
+      {webrtc::H264::kProfileBaseline, webrtc::H264::kLevel5_1},
+  };
+}
 
-  RTC_LOG(LS_INFO) << __FUNCTION__ << " End";
-  return WEBRTC_VIDEO_CODEC_OK;
+bool JetsonH264Encoder::Configure(const Config& config,
+                                  OutputCallback callback) {
+  width_ = config.width;
+  height_ = config.height;
+  bitrate_bps_ = config.bitrate_bps;
+  framerate_ = config.framerate;
+  key_frame_interval_ = config.key_frame_interval;
+  h264_profile_ = config.h264_profile;
+  h264_level_ = config.h264_level;
+  intra_refresh_period_ = config.intra_refresh_period;
+  callback_ = callback;
+
+  if (!decoder_) {
+    decoder_ = NvJPEGDecoder::createJPEGDecoder("jpegdec");
+    if (!decoder_) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__ << "Failed to createJPEGDecoder";
+      return false;
+    }
+  }
+  // 入力の種類は前のフレームと同じだと思って、使い回せるものを探しておく
+  return JetsonConfigure(false);
 }
 
-int32_t JetsonH264Encoder::Release() {
+void JetsonH264Encoder::Release() {
   RTC_LOG(LS_INFO) << __FUNCTION__ << " Start";
   JetsonRelease();
   if (decoder_) {
@@ -109,199 +141,242 @@ int32_t JetsonH264Encoder::Release() {
     decoder_ = nullptr;
   }
   RTC_LOG(LS_INFO) << __FUNCTION__ << " End";
-  return WEBRTC_VIDEO_CODEC_OK;
 }
 
-int32_t JetsonH264Encoder::JetsonConfigure() {
-  int ret = 0;
+bool JetsonH264Encoder::JetsonConfigure(bool create) {
+  std::string key = PipelineKey();
+  // 使い回せるものがあれば、今のパイプラインを戻す前に取り出しておく
+  std::unique_ptr<JetsonH264Pipeline> pipeline;
+  if (pool_) {
+    pipeline = pool_->Acquire(key);
+  }
+  JetsonRelease();
+
+  if (pipeline) {
+    // 新しい相手のためにキーフレームから始める
+    if (pipeline->encoder->forceIDR() < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to forceIDR";
+    }
+  } else {
+    if (!create) {
+      return true;
+    }
+    pipeline = JetsonCreatePipeline();
+    if (!pipeline && pool_ && pool_->idle_count() > 0) {
+      // 残しているパイプラインがエンコーダを使い切っているかもしれない
+      pool_->Clear();
+      pipeline = JetsonCreatePipeline();
+    }
+    if (!pipeline) {
+      return false;
+    }
+  }
 
+  pipeline_ = std::move(pipeline);
+  pipeline_key_ = key;
+  // 使い回したものは前の設定のままなので設定し直す
+  SetFramerate(framerate_);
+  SetBitrate(bitrate_bps_);
+  rtc::CritScope lock(&pipeline_->callback_lock);
+  pipeline_->callback = callback_;
+  return true;
+}
+
+std::string JetsonH264Encoder::PipelineKey() const {
+  std::string key = std::to_string(width_) + "x" + std::to_string(height_) +
+                    " idr:" + std::to_string(key_frame_interval_) + " " +
+                    std::to_string(h264_profile_) + "/" +
+                    std::to_string(h264_level_) +
+                    " ir:" + std::to_string(intra_refresh_period_);
   if (use_mjpeg_) {
-    enc0_buffer_queue_ = new std::queue<NvBuffer*>;
+    key += " mjpeg " + std::to_string(decode_pixfmt_) + " " +
+           std::to_string(raw_width_) + "x" + std::to_string(raw_height_);
+  }
+  return key;
+}
 
-    converter_ = NvVideoConverter::createVideoConverter("conv");
-    INIT_ERROR(!decoder_, "Failed to createVideoConverter");
+std::unique_ptr<JetsonH264Pipeline> JetsonH264Encoder::JetsonCreatePipeline() {
+  // 途中で失敗したら、作りかけのものは pipeline のデストラクタで片付ける
+  std::unique_ptr<JetsonH264Pipeline> pipeline(new JetsonH264Pipeline());
+  int ret = 0;
 
-    ret = converter_->setOutputPlaneFormat(
-        decode_pixfmt_, raw_width_, raw_height_, V4L2_NV_BUFFER_LAYOUT_PITCH);
+  if (use_mjpeg_) {
+    pipeline->converter = NvVideoConverter::createVideoConverter("conv");
+    INIT_ERROR(!pipeline->converter, "Failed to createVideoConverter");
+    NvVideoConverter* converter = pipeline->converter;
+
+    ret = converter->setOutputPlaneFormat(decode_pixfmt_, raw_width_,
+                                          raw_height_,
+                                          V4L2_NV_BUFFER_LAYOUT_PITCH);
     INIT_ERROR(ret < 0, "Failed to converter setOutputPlaneFormat");
 
-    ret = converter_->setCapturePlaneFormat(
+    ret = converter->setCapturePlaneFormat(
         V4L2_PIX_FMT_YUV420M, width_, height_, V4L2_NV_BUFFER_LAYOUT_PITCH);
     INIT_ERROR(ret < 0, "Failed to converter setCapturePlaneFormat");
 
-    ret = converter_->output_plane.setupPlane(V4L2_MEMORY_DMABUF, 1, false,
-                                              false);
+    ret = converter->output_plane.setupPlane(V4L2_MEMORY_DMABUF, 1, false,
+                                             false);
     INIT_ERROR(ret < 0, "Failed to setupPlane at converter output_plane");
 
-    ret = converter_->capture_plane.setupPlane(V4L2_MEMORY_MMAP, 10, false,
-                                               false);
+    ret = converter->capture_plane.setupPlane(V4L2_MEMORY_MMAP, 10, false,
+                                              false);
     INIT_ERROR(ret < 0, "Failed to setupPlane at converter capture_plane");
 
-    ret = converter_->output_plane.setStreamStatus(true);
+    ret = converter->output_plane.setStreamStatus(true);
     INIT_ERROR(ret < 0, "Failed to setStreamStatus at converter output_plane");
 
-    ret = converter_->capture_plane.setStreamStatus(true);
+    ret = converter->capture_plane.setStreamStatus(true);
     INIT_ERROR(ret < 0, "Failed to setStreamStatus at converter capture_plane");
 
-    converter_->capture_plane.setDQThreadCallback(
+    converter->capture_plane.setDQThreadCallback(
         ConvertFinishedCallbackFunction);
   }
 
-  encoder_ = NvVideoEncoder::createVideoEncoder("enc0");
-  INIT_ERROR(!encoder_, "Failed to createVideoEncoder");
+  pipeline->encoder = NvVideoEncoder::createVideoEncoder("enc0");
+  INIT_ERROR(!pipeline->encoder, "Failed to createVideoEncoder");
+  NvVideoEncoder* encoder = pipeline->encoder;
 
-  ret = encoder_->setCapturePlaneFormat(V4L2_PIX_FMT_H264, width_, height_,
-                                        4 * 1024 * 1024);
+  ret = encoder->setCapturePlaneFormat(V4L2_PIX_FMT_H264, width_, height_,
+                                       4 * 1024 * 1024);
   INIT_ERROR(ret < 0, "Failed to encoder setCapturePlaneFormat");
 
-  ret = encoder_->setOutputPlaneFormat(V4L2_PIX_FMT_YUV420M, width_, height_);
+  ret = encoder->setOutputPlaneFormat(V4L2_PIX_FMT_YUV420M, width_, height_);
   INIT_ERROR(ret < 0, "Failed to encoder setOutputPlaneFormat");
 
-  ret = encoder_->setBitrate(bitrate_adjuster_.GetAdjustedBitrateBps());
+  ret = encoder->setBitrate(bitrate_bps_);
   INIT_ERROR(ret < 0, "Failed to setBitrate");
 
-  ret = encoder_->setProfile(V4L2_MPEG_VIDEO_H264_PROFILE_HIGH);
+  // Constrained Baseline は選べないが、Baseline でも FMO や ASO は使わないので
+  // Constrained Baseline の相手にそのまま送れる
+  ret = encoder->setProfile(IsH264BaselineProfile(h264_profile_)
+                                ? V4L2_MPEG_VIDEO_H264_PROFILE_BASELINE
+                                : H264ProfileToV4L2(h264_profile_));
   INIT_ERROR(ret < 0, "Failed to setProfile");
 
-  ret = encoder_->setLevel(V4L2_MPEG_VIDEO_H264_LEVEL_5_1);
+  ret = encoder->setLevel(static_cast<enum v4l2_mpeg_video_h264_level>(
+      H264LevelToV4L2(h264_level_)));
   INIT_ERROR(ret < 0, "Failed to setLevel");
 
-  ret = encoder_->setRateControlMode(V4L2_MPEG_VIDEO_BITRATE_MODE_CBR);
+  ret = encoder->setRateControlMode(V4L2_MPEG_VIDEO_BITRATE_MODE_CBR);
   INIT_ERROR(ret < 0, "Failed to setRateControlMode");
 
-  ret = encoder_->setIDRInterval(key_frame_interval_);
+  // イントラリフレッシュの時は、要求された時以外に IDR を出さない
+  uint32_t key_frame_interval = intra_refresh_period_ > 0
+                                    ? kIntraRefreshKeyFrameInterval
+                                    : key_frame_interval_;
+  ret = encoder->setIDRInterval(key_frame_interval);
   INIT_ERROR(ret < 0, "Failed to setIDRInterval");
 
-  ret = encoder_->setIFrameInterval(key_frame_interval_);
+  ret = encoder->setIFrameInterval(key_frame_interval);
   INIT_ERROR(ret < 0, "Failed to setIFrameInterval");
 
-  ret = encoder_->setFrameRate(framerate_, 1);
+  if (intra_refresh_period_ > 0) {
+    ret = encoder->setSliceIntrarefresh(intra_refresh_period_);
+    INIT_ERROR(ret < 0, "Failed to setSliceIntrarefresh");
+
+    // スライスに分けて、失ったパケットの影響をそのスライスだけにする
+    int mb_rows = (height_ + 15) / 16;
+    int mb_cols = (width_ + 15) / 16;
+    ret = encoder->setSliceLength(
+        V4L2_ENC_SLICE_LENGTH_TYPE_MBLK,
+        (mb_rows + kIntraRefreshSlices - 1) / kIntraRefreshSlices * mb_cols);
+    INIT_ERROR(ret < 0, "Failed to setSliceLength");
+  }
+
+  ret = encoder->setFrameRate(FramerateLimit(framerate_), 1);
   INIT_ERROR(ret < 0, "Failed to setFrameRate");
 
   //V4L2_ENC_HW_PRESET_ULTRAFAST が推奨値だけど MEDIUM もフレームレート出てる気がする
-  ret = encoder_->setHWPresetType(V4L2_ENC_HW_PRESET_MEDIUM);
+  ret = encoder->setHWPresetType(V4L2_ENC_HW_PRESET_MEDIUM);
   INIT_ERROR(ret < 0, "Failed to setHWPresetType");
 
-  ret = encoder_->setNumBFrames(0);
+  ret = encoder->setNumBFrames(0);
   INIT_ERROR(ret < 0, "Failed to setNumBFrames");
 
   //この設定を入れればフレームレートより画質が優先されるが動くとフレームレートが激しく落ちる
-  //ret = encoder_->setConstantQp(30);
+  //ret = encoder->setConstantQp(30);
   //INIT_ERROR(ret < 0, "Failed to setConstantQp");
 
-  ret = encoder_->setInsertSpsPpsAtIdrEnabled(true);
+  ret = encoder->setInsertSpsPpsAtIdrEnabled(true);
   INIT_ERROR(ret < 0, "Failed to setInsertSpsPpsAtIdrEnabled");
 
-  ret = encoder_->setInsertVuiEnabled(true);
+  ret = encoder->setInsertVuiEnabled(true);
   INIT_ERROR(ret < 0, "Failed to setInsertSpsPpsAtIdrEnabled");
 
   if (use_mjpeg_) {
     ret =
-        encoder_->output_plane.setupPlane(V4L2_MEMORY_DMABUF, 10, false, false);
+        encoder->output_plane.setupPlane(V4L2_MEMORY_DMABUF, 10, false, false);
     INIT_ERROR(ret < 0, "Failed to setupPlane at encoder output_plane");
   } else {
-    ret = encoder_->output_plane.setupPlane(V4L2_MEMORY_MMAP, 10, true, false);
+    ret = encoder->output_plane.setupPlane(V4L2_MEMORY_MMAP, 10, true, false);
     INIT_ERROR(ret < 0, "Failed to setupPlane at encoder output_plane");
   }
 
-  ret = encoder_->capture_plane.setupPlane(V4L2_MEMORY_MMAP, 10, true, false);
+  ret = encoder->capture_plane.setupPlane(V4L2_MEMORY_MMAP, 10, true, false);
   INIT_ERROR(ret < 0, "Failed to setupPlane at capture_plane");
 
-  ret = encoder_->subscribeEvent(V4L2_EVENT_EOS, 0, 0);
+  ret = encoder->subscribeEvent(V4L2_EVENT_EOS, 0, 0);
   INIT_ERROR(ret < 0, "Failed to subscribeEvent V4L2_EVENT_EOS");
 
-  ret = encoder_->output_plane.setStreamStatus(true);
+  ret = encoder->output_plane.setStreamStatus(true);
   INIT_ERROR(ret < 0, "Failed to setStreamStatus at encoder output_plane");
 
-  ret = encoder_->capture_plane.setStreamStatus(true);
+  ret = encoder->capture_plane.setStreamStatus(true);
   INIT_ERROR(ret < 0, "Failed to setStreamStatus at encoder capture_plane");
 
   if (use_mjpeg_) {
-    converter_->capture_plane.startDQThread(this);
+    pipeline->converter->capture_plane.startDQThread(pipeline.get());
 
-    for (uint32_t i = 0; i < converter_->capture_plane.getNumBuffers(); i++) {
+    for (uint32_t i = 0;
+         i < pipeline->converter->capture_plane.getNumBuffers(); i++) {
       struct v4l2_buffer v4l2_buf;
       struct v4l2_plane planes[MAX_PLANES];
       memset(&v4l2_buf, 0, sizeof(v4l2_buf));
       memset(planes, 0, MAX_PLANES * sizeof(struct v4l2_plane));
       v4l2_buf.index = i;
       v4l2_buf.m.planes = planes;
-      ret = converter_->capture_plane.qBuffer(v4l2_buf, NULL);
+      ret = pipeline->converter->capture_plane.qBuffer(v4l2_buf, NULL);
       INIT_ERROR(ret < 0, "Failed to qBuffer at converter capture_plane");
     }
 
-    for (uint32_t i = 0; i < encoder_->output_plane.getNumBuffers(); i++) {
-      enc0_buffer_queue_->push(encoder_->output_plane.getNthBuffer(i));
+    for (uint32_t i = 0; i < encoder->output_plane.getNumBuffers(); i++) {
+      pipeline->enc0_buffer_queue.push(encoder->output_plane.getNthBuffer(i));
     }
-    encoder_->output_plane.setDQThreadCallback(EncodeOutputCallbackFunction);
+    encoder->output_plane.setDQThreadCallback(EncodeOutputCallbackFunction);
   }
-  encoder_->capture_plane.setDQThreadCallback(EncodeFinishedCallbackFunction);
+  encoder->capture_plane.setDQThreadCallback(EncodeFinishedCallbackFunction);
   if (use_mjpeg_) {
-    encoder_->output_plane.startDQThread(this);
+    encoder->output_plane.startDQThread(pipeline.get());
   }
-  encoder_->capture_plane.startDQThread(this);
+  encoder->capture_plane.startDQThread(pipeline.get());
 
-  for (uint32_t i = 0; i < encoder_->capture_plane.getNumBuffers(); i++) {
+  for (uint32_t i = 0; i < encoder->capture_plane.getNumBuffers(); i++) {
     struct v4l2_buffer v4l2_buf;
     struct v4l2_plane planes[MAX_PLANES];
     memset(&v4l2_buf, 0, sizeof(v4l2_buf));
     memset(planes, 0, MAX_PLANES * sizeof(struct v4l2_plane));
     v4l2_buf.index = i;
     v4l2_buf.m.planes = planes;
-    ret = encoder_->capture_plane.qBuffer(v4l2_buf, NULL);
+    ret = encoder->capture_plane.qBuffer(v4l2_buf, NULL);
     INIT_ERROR(ret < 0, "Failed to qBuffer at encoder capture_plane");
   }
 
-  configured_framerate_ = framerate_;
-  configured_width_ = width_;
-  configured_height_ = height_;
-
-  return WEBRTC_VIDEO_CODEC_OK;
+  return pipeline;
 }
 
 void JetsonH264Encoder::JetsonRelease() {
-  if (!encoder_)
+  if (!pipeline_) {
     return;
-  if (converter_) {
-    SendEOS(converter_);
-  } else {
-    SendEOS(encoder_);
   }
-  encoder_->capture_plane.waitForDQThread(2000);
-  encoder_->capture_plane.deinitPlane();
-  encoder_->output_plane.deinitPlane();
-  if (converter_) {
-    delete enc0_buffer_queue_;
-  }
-  delete encoder_;
-  encoder_ = nullptr;
-  if (converter_) {
-    converter_->capture_plane.waitForDQThread(2000);
-    delete converter_;
-    converter_ = nullptr;
+  // 戻した後に出てきたフレームはこちらに渡さない
+  {
+    rtc::CritScope lock(&pipeline_->callback_lock);
+    pipeline_->callback = nullptr;
   }
-}
-
-void JetsonH264Encoder::SendEOS(NvV4l2Element* element) {
-  if (element->output_plane.getStreamStatus()) {
-    struct v4l2_buffer v4l2_buf;
-    struct v4l2_plane planes[MAX_PLANES];
-    NvBuffer* buffer;
-
-    memset(&v4l2_buf, 0, sizeof(v4l2_buf));
-    memset(planes, 0, MAX_PLANES * sizeof(struct v4l2_plane));
-    v4l2_buf.m.planes = planes;
-
-    if (element->output_plane.getNumQueuedBuffers() ==
-        element->output_plane.getNumBuffers()) {
-      if (element->output_plane.dqBuffer(v4l2_buf, &buffer, NULL, 10) < 0) {
-        RTC_LOG(LS_ERROR) << "Failed to dqBuffer at encoder output_plane";
-      }
-    }
-    planes[0].bytesused = 0;
-    if (element->output_plane.qBuffer(v4l2_buf, NULL) < 0) {
-      RTC_LOG(LS_ERROR) << "Failed to qBuffer at encoder output_plane";
-    }
+  if (pool_) {
+    pool_->Release(pipeline_key_, std::move(pipeline_));
+  } else {
+    pipeline_.reset();
   }
 }
 
@@ -310,13 +385,7 @@ bool JetsonH264Encoder::ConvertFinishedCallbackFunction(
     NvBuffer* buffer,
     NvBuffer* shared_buffer,
     void* data) {
-  return ((JetsonH264Encoder*)data)
-      ->ConvertFinishedCallback(v4l2_buf, buffer, shared_buffer);
-}
-
-bool JetsonH264Encoder::ConvertFinishedCallback(struct v4l2_buffer* v4l2_buf,
-                                                NvBuffer* buffer,
-                                                NvBuffer* shared_buffer) {
+  JetsonH264Pipeline* pipeline = (JetsonH264Pipeline*)data;
   NvBuffer* enc0_buffer;
   struct v4l2_buffer enc0_qbuf;
   struct v4l2_plane planes[MAX_PLANES];
@@ -326,13 +395,14 @@ bool JetsonH264Encoder::ConvertFinishedCallback(struct v4l2_buffer* v4l2_buf,
     return false;
   }
   {
-    std::unique_lock<std::mutex> lock(enc0_buffer_mtx_);
-    while (enc0_buffer_queue_->empty()) {
-      enc0_buffer_cond_.wait(lock, [this] { return enc0_buffer_ready_; });
-      enc0_buffer_ready_ = false;
+    std::unique_lock<std::mutex> lock(pipeline->enc0_buffer_mtx);
+    while (pipeline->enc0_buffer_queue.empty()) {
+      pipeline->enc0_buffer_cond.wait(
+          lock, [pipeline] { return pipeline->enc0_buffer_ready; });
+      pipeline->enc0_buffer_ready = false;
     }
-    enc0_buffer = enc0_buffer_queue_->front();
-    enc0_buffer_queue_->pop();
+    enc0_buffer = pipeline->enc0_buffer_queue.front();
+    pipeline->enc0_buffer_queue.pop();
   }
 
   memset(&enc0_qbuf, 0, sizeof(enc0_qbuf));
@@ -349,7 +419,7 @@ bool JetsonH264Encoder::ConvertFinishedCallback(struct v4l2_buffer* v4l2_buf,
   enc0_qbuf.timestamp.tv_sec = v4l2_buf->timestamp.tv_sec;
   enc0_qbuf.timestamp.tv_usec = v4l2_buf->timestamp.tv_usec;
 
-  if (encoder_->output_plane.qBuffer(enc0_qbuf, buffer) < 0) {
+  if (pipeline->encoder->output_plane.qBuffer(enc0_qbuf, buffer) < 0) {
     RTC_LOG(LS_ERROR) << __FUNCTION__
                       << " Failed to qBuffer at encoder output_plane";
     return false;
@@ -368,13 +438,7 @@ bool JetsonH264Encoder::EncodeOutputCallbackFunction(
     NvBuffer* buffer,
     NvBuffer* shared_buffer,
     void* data) {
-  return ((JetsonH264Encoder*)data)
-      ->EncodeOutputCallback(v4l2_buf, buffer, shared_buffer);
-}
-
-bool JetsonH264Encoder::EncodeOutputCallback(struct v4l2_buffer* v4l2_buf,
-                                             NvBuffer* buffer,
-                                             NvBuffer* shared_buffer) {
+  JetsonH264Pipeline* pipeline = (JetsonH264Pipeline*)data;
   struct v4l2_buffer conv_qbuf;
   struct v4l2_plane planes[MAX_PLANES];
 
@@ -390,15 +454,15 @@ bool JetsonH264Encoder::EncodeOutputCallback(struct v4l2_buffer* v4l2_buf,
   conv_qbuf.m.planes = planes;
 
   {
-    std::unique_lock<std::mutex> lock(enc0_buffer_mtx_);
-    if (converter_->capture_plane.qBuffer(conv_qbuf, nullptr) < 0) {
+    std::unique_lock<std::mutex> lock(pipeline->enc0_buffer_mtx);
+    if (pipeline->converter->capture_plane.qBuffer(conv_qbuf, nullptr) < 0) {
       RTC_LOG(LS_ERROR) << __FUNCTION__
                         << "Failed to qBuffer at converter capture_plane";
       return false;
     }
-    enc0_buffer_queue_->push(buffer);
-    enc0_buffer_ready_ = true;
-    enc0_buffer_cond_.notify_all();
+    pipeline->enc0_buffer_queue.push(buffer);
+    pipeline->enc0_buffer_ready = true;
+    pipeline->enc0_buffer_cond.notify_all();
   }
 
   if (conv_qbuf.m.planes[0].bytesused == 0) {
@@ -414,13 +478,8 @@ bool JetsonH264Encoder::EncodeFinishedCallbackFunction(
     NvBuffer* buffer,
     NvBuffer* shared_buffer,
     void* data) {
-  return ((JetsonH264Encoder*)data)
-      ->EncodeFinishedCallback(v4l2_buf, buffer, shared_buffer);
-}
-
-bool JetsonH264Encoder::EncodeFinishedCallback(struct v4l2_buffer* v4l2_buf,
-                                               NvBuffer* buffer,
-                                               NvBuffer* shared_buffer) {
+  JetsonH264Pipeline* pipeline = (JetsonH264Pipeline*)data;
+  ThreadPolicy::ApplyOnce("encoder", "encoder_dq");
   if (!v4l2_buf) {
     RTC_LOG(LS_INFO) << __FUNCTION__ << " v4l2_buf is null";
     return false;
@@ -430,43 +489,24 @@ bool JetsonH264Encoder::EncodeFinishedCallback(struct v4l2_buffer* v4l2_buf,
     return false;
   }
 
-  uint64_t pts = v4l2_buf->timestamp.tv_sec * rtc::kNumMicrosecsPerSec +
-                 v4l2_buf->timestamp.tv_usec;
-  RTC_LOG(LS_INFO) << __FUNCTION__ << " pts:" << pts
+  // Encode でフレームの timestamp() を入れてある
+  uint32_t timestamp = static_cast<uint32_t>(
+      v4l2_buf->timestamp.tv_sec * rtc::kNumMicrosecsPerSec +
+      v4l2_buf->timestamp.tv_usec);
+  RTC_LOG(LS_INFO) << __FUNCTION__ << " timestamp:" << timestamp
                    << " bytesused:" << buffer->planes[0].bytesused;
 
-  std::unique_ptr<FrameParams> params;
   {
-    rtc::CritScope lock(&frame_params_lock_);
-    do {
-      if (frame_params_.empty()) {
-        RTC_LOG(LS_WARNING)
-            << __FUNCTION__
-            << "Frame parameter is not found. SkipFrame pts:" << pts;
-        return true;
-      }
-      params = std::move(frame_params_.front());
-      frame_params_.pop();
-    } while (params->timestamp < pts);
-    if (params->timestamp != pts) {
-      RTC_LOG(LS_WARNING) << __FUNCTION__
-                          << "Frame parameter is not found. SkipFrame pts:"
-                          << pts;
-      return true;
+    rtc::CritScope lock(&pipeline->callback_lock);
+    // pool に戻っている間に出てきたものは捨てる
+    if (pipeline->callback) {
+      pipeline->callback(buffer->planes[0].data, buffer->planes[0].bytesused,
+                         timestamp,
+                         (v4l2_buf->flags & V4L2_BUF_FLAG_KEYFRAME) != 0);
     }
   }
 
-  encoded_image_._encodedWidth = params->width;
-  encoded_image_._encodedHeight = params->height;
-  encoded_image_.capture_time_ms_ = params->render_time_ms;
-  encoded_image_.ntp_time_ms_ = params->ntp_time_ms;
-  encoded_image_.SetTimestamp(pts / rtc::kNumMicrosecsPerMillisec);
-  encoded_image_.rotation_ = params->rotation;
-  encoded_image_.SetColorSpace(params->color_space);
-
-  SendFrame(buffer->planes[0].data, buffer->planes[0].bytesused);
-
-  if (encoder_->capture_plane.qBuffer(*v4l2_buf, NULL) < 0) {
+  if (pipeline->encoder->capture_plane.qBuffer(*v4l2_buf, NULL) < 0) {
     RTC_LOG(LS_ERROR) << __FUNCTION__ << "Failed to qBuffer at capture_plane";
     return false;
   }
@@ -474,76 +514,41 @@ bool JetsonH264Encoder::EncodeFinishedCallback(struct v4l2_buffer* v4l2_buf,
   return true;
 }
 
-int32_t JetsonH264Encoder::RegisterEncodeCompleteCallback(
-    webrtc::EncodedImageCallback* callback) {
-  callback_ = callback;
-  return WEBRTC_VIDEO_CODEC_OK;
-}
-
-void JetsonH264Encoder::SetRates(const RateControlParameters& parameters) {
-  if (encoder_ == nullptr)
-    return;
-  if (parameters.bitrate.get_sum_bps() <= 0 || parameters.framerate_fps <= 0)
-    return;
-
-  RTC_LOG(LS_INFO) << __FUNCTION__ << " framerate:" << parameters.framerate_fps
-                   << " bitrate:" << parameters.bitrate.get_sum_bps();
-  framerate_ = parameters.framerate_fps;
-  target_bitrate_bps_ = parameters.bitrate.get_sum_bps();
-  bitrate_adjuster_.SetTargetBitrateBps(target_bitrate_bps_);
-  return;
-}
-
-void JetsonH264Encoder::SetFramerate(uint32_t framerate) {
+uint32_t JetsonH264Encoder::FramerateLimit(uint32_t framerate) const {
   if (width_ <= 1920 && height_ <= 1080 && framerate > 60) {
-    framerate = 60;
+    return 60;
   } else if (framerate > 30) {
-    framerate = 30;
+    return 30;
   }
-  if (configured_framerate_ == framerate) {
+  return framerate;
+}
+
+void JetsonH264Encoder::SetFramerate(uint32_t framerate) {
+  framerate_ = framerate;
+  if (!pipeline_) {
     return;
   }
+  framerate = FramerateLimit(framerate);
   RTC_LOG(LS_INFO) << __FUNCTION__ << " " << framerate << "fps";
-  if (encoder_->setFrameRate(framerate, 1) < 0) {
-    RTC_LOG(LS_ERROR) << "Failed to set bitrate";
-    return;
+  if (pipeline_->encoder->setFrameRate(framerate, 1) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to set framerate";
   }
-  configured_framerate_ = framerate;
 }
 
-void JetsonH264Encoder::SetBitrateBps(uint32_t bitrate_bps) {
-  if (bitrate_bps < 300000 || configured_bitrate_bps_ == bitrate_bps) {
+void JetsonH264Encoder::SetBitrate(uint32_t bitrate_bps) {
+  bitrate_bps_ = bitrate_bps;
+  if (!pipeline_ || bitrate_bps < 300000) {
     return;
   }
   RTC_LOG(LS_INFO) << __FUNCTION__ << " " << bitrate_bps << "bit/sec";
-  if (encoder_->setBitrate(bitrate_bps) < 0) {
+  if (pipeline_->encoder->setBitrate(bitrate_bps) < 0) {
     RTC_LOG(LS_ERROR) << "Failed to setBitrate";
-    return;
   }
-  configured_bitrate_bps_ = bitrate_bps;
-}
-
-webrtc::VideoEncoder::EncoderInfo JetsonH264Encoder::GetEncoderInfo() const {
-  EncoderInfo info;
-  info.supports_native_handle = true;
-  info.implementation_name = "Jetson H264";
-  info.scaling_settings =
-      VideoEncoder::ScalingSettings(kLowH264QpThreshold, kHighH264QpThreshold);
-  info.is_hardware_accelerated = true;
-  info.has_internal_source = false;
-  return info;
 }
 
-int32_t JetsonH264Encoder::Encode(
+HWEncoderBackend::EncodeResult JetsonH264Encoder::Encode(
     const webrtc::VideoFrame& input_frame,
-    const std::vector<webrtc::VideoFrameType>* frame_types) {
-  if (!callback_) {
-    RTC_LOG(LS_WARNING)
-        << "InitEncode() has been called, but a callback function "
-        << "has not been set with RegisterEncodeCompleteCallback()";
-    return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
-  }
-
+    bool force_key_frame) {
   int fd = 0;
   rtc::scoped_refptr<webrtc::VideoFrameBuffer> frame_buffer =
       input_frame.video_frame_buffer();
@@ -556,49 +561,26 @@ int32_t JetsonH264Encoder::Encode(
                                    raw_width_, raw_height_);
     if (ret < 0) {
       RTC_LOG(LS_ERROR) << "Failed to decodeToFd";
-      return WEBRTC_VIDEO_CODEC_ERROR;
+      return EncodeResult::kError;
     }
   } else {
     use_mjpeg_ = false;
   }
 
-  if (frame_buffer->width() != configured_width_ ||
-      frame_buffer->height() != configured_height_) {
-    RTC_LOG(LS_INFO) << "Encoder reinitialized from " << configured_width_
-                     << "x" << configured_height_ << " to "
-                     << frame_buffer->width() << "x" << frame_buffer->height()
-                     << " framerate:" << framerate_;
-    JetsonRelease();
-    if (JetsonConfigure() != WEBRTC_VIDEO_CODEC_OK) {
+  // 解像度は HWVideoEncoder が見ているので、ここでは入力が MJPEG かどうかや
+  // その解像度が変わった時に作り直す。作ったばかりのものはキーフレームから始まる
+  if (!pipeline_ || PipelineKey() != pipeline_key_) {
+    RTC_LOG(LS_INFO) << "Jetson pipeline reinitialized for " << PipelineKey();
+    if (!JetsonConfigure(true)) {
       RTC_LOG(LS_ERROR) << "Failed to JetsonConfigure";
-      return WEBRTC_VIDEO_CODEC_ERROR;
+      return EncodeResult::kError;
     }
-  }
-
-  bool force_key_frame = false;
-  if (frame_types != nullptr) {
-    RTC_DCHECK_EQ(frame_types->size(), static_cast<size_t>(1));
-    if ((*frame_types)[0] == webrtc::VideoFrameType::kEmptyFrame) {
-      return WEBRTC_VIDEO_CODEC_OK;
-    }
-    if ((*frame_types)[0] == webrtc::VideoFrameType::kVideoFrameKey) {
-      if (encoder_->forceIDR() < 0) {
-        RTC_LOG(LS_ERROR) << "Failed to forceIDR";
-      }
+  } else if (force_key_frame) {
+    if (pipeline_->encoder->forceIDR() < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to forceIDR";
     }
   }
 
-  SetFramerate(framerate_);
-  SetBitrateBps(bitrate_adjuster_.GetAdjustedBitrateBps());
-  {
-    rtc::CritScope lock(&frame_params_lock_);
-    frame_params_.push(absl::make_unique<FrameParams>(
-        frame_buffer->width(), frame_buffer->height(),
-        input_frame.render_time_ms(), input_frame.ntp_time_ms(),
-        input_frame.timestamp_us(), input_frame.rotation(),
-        input_frame.color_space()));
-  }
-
   struct v4l2_buffer v4l2_buf;
   struct v4l2_plane planes[MAX_PLANES];
 
@@ -606,13 +588,16 @@ int32_t JetsonH264Encoder::Encode(
   memset(planes, 0, sizeof(planes));
   v4l2_buf.m.planes = planes;
 
+  NvVideoConverter* converter = pipeline_->converter;
+  NvVideoEncoder* encoder = pipeline_->encoder;
   if (use_mjpeg_) {
     NvBuffer* buffer;
-    if (converter_->output_plane.getNumQueuedBuffers() ==
-        converter_->output_plane.getNumBuffers()) {
-      if (converter_->output_plane.dqBuffer(v4l2_buf, &buffer, NULL, 10) < 0) {
+    if (converter->output_plane.getNumQueuedBuffers() ==
+        converter->output_plane.getNumBuffers()) {
+      if (converter->output_plane.dqBuffer(v4l2_buf, &buffer, NULL, 10) < 0) {
+        // 変換器が詰まっているので、このフレームは捨てる
         RTC_LOG(LS_ERROR) << "Failed to dqBuffer at converter output_plane";
-        return WEBRTC_VIDEO_CODEC_ERROR;
+        return EncodeResult::kDropped;
       }
     }
 
@@ -622,32 +607,33 @@ int32_t JetsonH264Encoder::Encode(
 
     v4l2_buf.flags |= V4L2_BUF_FLAG_TIMESTAMP_COPY;
     v4l2_buf.timestamp.tv_sec =
-        input_frame.timestamp_us() / rtc::kNumMicrosecsPerSec;
+        input_frame.timestamp() / rtc::kNumMicrosecsPerSec;
     v4l2_buf.timestamp.tv_usec =
-        input_frame.timestamp_us() % rtc::kNumMicrosecsPerSec;
+        input_frame.timestamp() % rtc::kNumMicrosecsPerSec;
 
-    if (converter_->output_plane.qBuffer(v4l2_buf, nullptr) < 0) {
+    if (converter->output_plane.qBuffer(v4l2_buf, nullptr) < 0) {
       RTC_LOG(LS_ERROR) << "Failed to qBuffer at converter output_plane";
-      return WEBRTC_VIDEO_CODEC_ERROR;
+      return EncodeResult::kError;
     }
   } else {
     NvBuffer* buffer;
 
     RTC_LOG(LS_INFO) << __FUNCTION__ << " output_plane.getNumBuffers: "
-                     << encoder_->output_plane.getNumBuffers()
+                     << encoder->output_plane.getNumBuffers()
                      << " output_plane.getNumQueuedBuffers: "
-                     << encoder_->output_plane.getNumQueuedBuffers();
+                     << encoder->output_plane.getNumQueuedBuffers();
 
-    if (encoder_->output_plane.getNumQueuedBuffers() ==
-        encoder_->output_plane.getNumBuffers()) {
-      if (encoder_->output_plane.dqBuffer(v4l2_buf, &buffer, NULL, 10) < 0) {
+    if (encoder->output_plane.getNumQueuedBuffers() ==
+        encoder->output_plane.getNumBuffers()) {
+      if (encoder->output_plane.dqBuffer(v4l2_buf, &buffer, NULL, 10) < 0) {
+        // エンコーダが詰まっているので、このフレームは捨てる
         RTC_LOG(LS_ERROR) << "Failed to dqBuffer at encoder output_plane";
-        return WEBRTC_VIDEO_CODEC_ERROR;
+        return EncodeResult::kDropped;
       }
     } else {
-      buffer = encoder_->output_plane.getNthBuffer(
-          encoder_->output_plane.getNumQueuedBuffers());
-      v4l2_buf.index = encoder_->output_plane.getNumQueuedBuffers();
+      buffer = encoder->output_plane.getNthBuffer(
+          encoder->output_plane.getNumQueuedBuffers());
+      v4l2_buf.index = encoder->output_plane.getNumQueuedBuffers();
     }
 
     rtc::scoped_refptr<const webrtc::I420BufferInterface> i420_buffer =
@@ -680,81 +666,23 @@ int32_t JetsonH264Encoder::Encode(
 
     v4l2_buf.flags |= V4L2_BUF_FLAG_TIMESTAMP_COPY;
     v4l2_buf.timestamp.tv_sec =
-        input_frame.timestamp_us() / rtc::kNumMicrosecsPerSec;
+        input_frame.timestamp() / rtc::kNumMicrosecsPerSec;
     v4l2_buf.timestamp.tv_usec =
-        input_frame.timestamp_us() % rtc::kNumMicrosecsPerSec;
+        input_frame.timestamp() % rtc::kNumMicrosecsPerSec;
 
     for (int i = 0; i < MAX_PLANES; i++) {
       if (NvBufferMemSyncForDevice(buffer->planes[i].fd, i,
                                    (void**)&buffer->planes[i].data) < 0) {
         RTC_LOG(LS_ERROR) << "Failed to NvBufferMemSyncForDevice";
-        return WEBRTC_VIDEO_CODEC_ERROR;
+        return EncodeResult::kError;
       }
     }
 
-    if (encoder_->output_plane.qBuffer(v4l2_buf, nullptr) < 0) {
+    if (encoder->output_plane.qBuffer(v4l2_buf, nullptr) < 0) {
       RTC_LOG(LS_ERROR) << "Failed to qBuffer at encoder output_plane";
-      return WEBRTC_VIDEO_CODEC_ERROR;
+      return EncodeResult::kError;
     }
   }
 
-  return WEBRTC_VIDEO_CODEC_OK;
-}
-
-int32_t JetsonH264Encoder::SendFrame(unsigned char* buffer, size_t size) {
-  encoded_image_.set_buffer(buffer, size);
-  encoded_image_.set_size(size);
-  encoded_image_._frameType = webrtc::VideoFrameType::kVideoFrameDelta;
-
-  uint8_t zero_count = 0;
-  size_t nal_start_idx = 0;
-  std::vector<nal_entry> nals;
-  for (size_t i = 0; i < size; i++) {
-    uint8_t data = buffer[i];
-    if ((i != 0) && (i == nal_start_idx)) {
-      if ((data & 0x1F) == 0x05) {
-        encoded_image_._frameType = webrtc::VideoFrameType::kVideoFrameKey;
-      }
-    }
-    if (data == 0x01 && zero_count == 3) {
-      if (nal_start_idx != 0) {
-        nals.push_back({nal_start_idx, i - nal_start_idx + 1 - 4});
-      }
-      nal_start_idx = i + 1;
-    }
-    if (data == 0x00) {
-      zero_count++;
-    } else {
-      zero_count = 0;
-    }
-  }
-  if (nal_start_idx != 0) {
-    nals.push_back({nal_start_idx, size - nal_start_idx});
-  }
-
-  webrtc::RTPFragmentationHeader frag_header;
-  frag_header.VerifyAndAllocateFragmentationHeader(nals.size());
-  for (size_t i = 0; i < nals.size(); i++) {
-    frag_header.fragmentationOffset[i] = nals[i].offset;
-    frag_header.fragmentationLength[i] = nals[i].size;
-  }
-
-  webrtc::CodecSpecificInfo codec_specific;
-  codec_specific.codecType = webrtc::kVideoCodecH264;
-  codec_specific.codecSpecific.H264.packetization_mode =
-      webrtc::H264PacketizationMode::NonInterleaved;
-
-  h264_bitstream_parser_.ParseBitstream(buffer, size);
-  h264_bitstream_parser_.GetLastSliceQp(&encoded_image_.qp_);
-  RTC_LOG(LS_INFO) << __FUNCTION__ << " last slice qp:" << encoded_image_.qp_;
-
-  webrtc::EncodedImageCallback::Result result =
-      callback_->OnEncodedImage(encoded_image_, &codec_specific, &frag_header);
-  if (result.error != webrtc::EncodedImageCallback::Result::OK) {
-    RTC_LOG(LS_ERROR) << __FUNCTION__
-                      << " OnEncodedImage failed error:" << result.error;
-    return WEBRTC_VIDEO_CODEC_ERROR;
-  }
-  bitrate_adjuster_.Update(size);
-  return WEBRTC_VIDEO_CODEC_OK;
+  return EncodeResult::kOk;
 }
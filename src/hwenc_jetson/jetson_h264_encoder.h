@@ -14,120 +14,101 @@
 
 #include <linux/videodev2.h>
 
-#include <chrono>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <queue>
+#include <string>
+#include <vector>
 
 #include "NvJpegDecoder.h"
 #include "NvVideoConverter.h"
 #include "NvVideoEncoder.h"
-#include "api/video_codecs/video_encoder.h"
-#include "common_video/h264/h264_bitstream_parser.h"
-#include "common_video/include/bitrate_adjuster.h"
-#include "modules/video_coding/codecs/h264/include/h264.h"
+#include "media/base/h264_profile_level_id.h"
+#include "rtc/hw_encoder_backend.h"
+#include "rtc/hw_encoder_pool.h"
 #include "rtc_base/critical_section.h"
 
-class ProcessThread;
+// Jetson の変換器とエンコーダ一式。
+// 作り直さずに使い回せるように JetsonH264Encoder から切り離してある。
+// エンコードしたものは callback に渡し、callback が無い間に出てきたものは捨てる。
+struct JetsonH264Pipeline {
+  ~JetsonH264Pipeline();
 
-class JetsonH264Encoder : public webrtc::VideoEncoder {
+  NvVideoConverter* converter = nullptr;
+  NvVideoEncoder* encoder = nullptr;
+  // 変換器からエンコーダに渡せる、空いているエンコーダの入力バッファ
+  std::mutex enc0_buffer_mtx;
+  std::condition_variable enc0_buffer_cond;
+  bool enc0_buffer_ready = false;
+  std::queue<NvBuffer*> enc0_buffer_queue;
+
+  rtc::CriticalSection callback_lock;
+  HWEncoderBackend::OutputCallback callback RTC_GUARDED_BY(callback_lock);
+};
+
+typedef HWEncoderPool<JetsonH264Pipeline> JetsonH264PipelinePool;
+
+// Jetson のハードウェアエンコーダを使う H264 のバックエンド。
+// HWVideoEncoder に渡して使う。
+// pool を渡すと、使い終わったパイプラインを壊さずに pool に戻して使い回す
+class JetsonH264Encoder : public HWEncoderBackend {
  public:
-  explicit JetsonH264Encoder(const cricket::VideoCodec& codec);
+  explicit JetsonH264Encoder(std::shared_ptr<JetsonH264PipelinePool> pool);
   ~JetsonH264Encoder() override;
 
-  int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
-                     int32_t number_of_cores,
-                     size_t max_payload_size) override;
-  int32_t RegisterEncodeCompleteCallback(
-      webrtc::EncodedImageCallback* callback) override;
-  int32_t Release() override;
-  int32_t Encode(
-      const webrtc::VideoFrame& frame,
-      const std::vector<webrtc::VideoFrameType>* frame_types) override;
-  void SetRates(const RateControlParameters& parameters) override;
-  webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const override;
+  // 4K30 と 1080p60 を出せるので、どのプロファイルもレベル 5.1 まで
+  static std::vector<webrtc::H264::ProfileLevelId> SupportedH264Profiles();
 
- private:
-  struct FrameParams {
-    FrameParams(int32_t w,
-                int32_t h,
-                int64_t rtms,
-                int64_t ntpms,
-                int64_t ts,
-                webrtc::VideoRotation r,
-                absl::optional<webrtc::ColorSpace> c)
-        : width(w),
-          height(h),
-          render_time_ms(rtms),
-          ntp_time_ms(ntpms),
-          timestamp(ts),
-          rotation(r),
-          color_space(c) {}
+  bool Configure(const Config& config, OutputCallback callback) override;
+  void Release() override;
+  EncodeResult Encode(const webrtc::VideoFrame& frame,
+                      bool force_key_frame) override;
+  void SetBitrate(uint32_t bitrate_bps) override;
+  void SetFramerate(uint32_t framerate) override;
+  const char* ImplementationName() const override { return "Jetson H264"; }
+  bool SupportsNativeHandle() const override { return true; }
 
-    int32_t width;
-    int32_t height;
-    int64_t render_time_ms;
-    int64_t ntp_time_ms;
-    int64_t timestamp;
-    webrtc::VideoRotation rotation;
-    absl::optional<webrtc::ColorSpace> color_space;
-  };
-
-  int32_t JetsonConfigure();
+ private:
+  // 入力が MJPEG かどうかはフレームが来るまで分からないので、
+  // create が false の時は使い回せるものがあった時だけ用意する
+  bool JetsonConfigure(bool create);
+  std::unique_ptr<JetsonH264Pipeline> JetsonCreatePipeline();
+  std::string PipelineKey() const;
   void JetsonRelease();
-  void SendEOS(NvV4l2Element* element);
+  // 解像度ごとにエンコーダが出せるフレームレートに抑える
+  uint32_t FramerateLimit(uint32_t framerate) const;
+  // 以下の 3 つは data に JetsonH264Pipeline を渡す
   static bool ConvertFinishedCallbackFunction(struct v4l2_buffer* v4l2_buf,
                                               NvBuffer* buffer,
                                               NvBuffer* shared_buffer,
                                               void* data);
-  bool ConvertFinishedCallback(struct v4l2_buffer* v4l2_buf,
-                               NvBuffer* buffer,
-                               NvBuffer* shared_buffer);
   static bool EncodeOutputCallbackFunction(struct v4l2_buffer* v4l2_buf,
                                            NvBuffer* buffer,
                                            NvBuffer* shared_buffer,
                                            void* data);
-  bool EncodeOutputCallback(struct v4l2_buffer* v4l2_buf,
-                            NvBuffer* buffer,
-                            NvBuffer* shared_buffer);
   static bool EncodeFinishedCallbackFunction(struct v4l2_buffer* v4l2_buf,
                                              NvBuffer* buffer,
                                              NvBuffer* shared_buffer,
                                              void* data);
-  bool EncodeFinishedCallback(struct v4l2_buffer* v4l2_buf,
-                              NvBuffer* buffer,
-                              NvBuffer* shared_buffer);
-  void SetFramerate(uint32_t framerate);
-  void SetBitrateBps(uint32_t bitrate_bps);
-  int32_t SendFrame(unsigned char* buffer, size_t size);
 
-  webrtc::EncodedImageCallback* callback_;
   NvJPEGDecoder* decoder_;
-  NvVideoConverter* converter_;
-  NvVideoEncoder* encoder_;
-  webrtc::BitrateAdjuster bitrate_adjuster_;
+  std::shared_ptr<JetsonH264PipelinePool> pool_;
+  std::unique_ptr<JetsonH264Pipeline> pipeline_;
+  std::string pipeline_key_;
+  OutputCallback callback_;
+  uint32_t bitrate_bps_;
   uint32_t framerate_;
-  int32_t configured_framerate_;
-  uint32_t target_bitrate_bps_;
-  uint32_t configured_bitrate_bps_;
   int key_frame_interval_;
+  webrtc::H264::Profile h264_profile_;
+  webrtc::H264::Level h264_level_;
+  int intra_refresh_period_;
   uint32_t decode_pixfmt_;
   uint32_t raw_width_;
   uint32_t raw_height_;
   int32_t width_;
   int32_t height_;
-  int32_t configured_width_;
-  int32_t configured_height_;
   bool use_mjpeg_;
-
-  webrtc::H264BitstreamParser h264_bitstream_parser_;
-
-  rtc::CriticalSection frame_params_lock_;
-  std::queue<std::unique_ptr<FrameParams>> frame_params_;
-  std::mutex enc0_buffer_mtx_;
-  std::condition_variable enc0_buffer_cond_;
-  bool enc0_buffer_ready_ = false;
-  std::queue<NvBuffer*>* enc0_buffer_queue_;
-  webrtc::EncodedImage encoded_image_;
 };
 
 #endif  // Jetson_H264_ENCODER_H_
@@ -20,6 +20,7 @@
 #include "rtc_base/time_utils.h"
 #include "system_wrappers/include/metrics.h"
 #include "third_party/libyuv/include/libyuv/convert.h"
+#include "thread_policy/thread_policy.h"
 
 #define INIT_ERROR(cond, desc)                 \
   if (cond) {                                  \
@@ -184,6 +185,7 @@ bool JetsonVideoDecoder::JetsonRelease() {
 
 void JetsonVideoDecoder::CaptureLoopFunction(void* obj) {
   JetsonVideoDecoder* _this = static_cast<JetsonVideoDecoder*>(obj);
+  ThreadPolicy::Apply("decoder");
   _this->CaptureLoop();
 }
 
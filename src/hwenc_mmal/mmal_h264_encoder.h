@@ -23,103 +23,82 @@ extern "C" {
 #include "interface/vcos/vcos.h"
 }
 
-#include <chrono>
 #include <memory>
-#include <mutex>
-#include <queue>
+#include <string>
+#include <vector>
 
-#include "api/video_codecs/video_encoder.h"
-#include "common_video/h264/h264_bitstream_parser.h"
-#include "common_video/include/bitrate_adjuster.h"
-#include "modules/video_coding/codecs/h264/include/h264.h"
+#include "media/base/h264_profile_level_id.h"
+#include "rtc/hw_encoder_backend.h"
+#include "rtc/hw_encoder_pool.h"
 #include "rtc_base/critical_section.h"
 
-class ProcessThread;
+// MMAL のコンポーネントと、それを繋ぐコネクションやバッファプール一式。
+// 作り直さずに使い回せるように MMALH264Encoder から切り離してある。
+// エンコードしたものは callback に渡し、callback が無い間に出てきたものは捨てる。
+struct MMALH264Pipeline {
+  ~MMALH264Pipeline();
 
-class MMALH264Encoder : public webrtc::VideoEncoder {
+  MMAL_COMPONENT_T* decoder = nullptr;
+  MMAL_COMPONENT_T* resizer = nullptr;
+  MMAL_COMPONENT_T* encoder = nullptr;
+  MMAL_CONNECTION_T* conn1 = nullptr;
+  MMAL_CONNECTION_T* conn2 = nullptr;
+  MMAL_POOL_T* pool_in = nullptr;
+  MMAL_POOL_T* pool_out = nullptr;
+  int32_t stride_width = 0;
+  int32_t stride_height = 0;
+
+  rtc::CriticalSection callback_lock;
+  HWEncoderBackend::OutputCallback callback RTC_GUARDED_BY(callback_lock);
+};
+
+typedef HWEncoderPool<MMALH264Pipeline> MMALH264PipelinePool;
+
+// MMAL を使う H264 のバックエンド。HWVideoEncoder に渡して使う。
+// pool を渡すと、使い終わったパイプラインを壊さずに pool に戻して使い回す
+class MMALH264Encoder : public HWEncoderBackend {
  public:
-  explicit MMALH264Encoder(const cricket::VideoCodec& codec);
+  explicit MMALH264Encoder(std::shared_ptr<MMALH264PipelinePool> pool);
   ~MMALH264Encoder() override;
 
-  int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
-                     int32_t number_of_cores,
-                     size_t max_payload_size) override;
-  int32_t RegisterEncodeCompleteCallback(
-      webrtc::EncodedImageCallback* callback) override;
-  int32_t Release() override;
-  int32_t Encode(
-      const webrtc::VideoFrame& frame,
-      const std::vector<webrtc::VideoFrameType>* frame_types) override;
-  void SetRates(const RateControlParameters& parameters) override;
-  webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const override;
+  // VideoCore IV は 1080p30 までなので、どのプロファイルもレベル 4.0 まで
+  static std::vector<webrtc::H264::ProfileLevelId> SupportedH264Profiles();
 
- private:
-  struct FrameParams {
-    FrameParams(int32_t w,
-                int32_t h,
-                int64_t rtms,
-                int64_t ntpms,
-                int64_t ts,
-                webrtc::VideoRotation r,
-                absl::optional<webrtc::ColorSpace> c)
-        : width(w),
-          height(h),
-          render_time_ms(rtms),
-          ntp_time_ms(ntpms),
-          timestamp(ts),
-          rotation(r),
-          color_space(c) {}
+  bool Configure(const Config& config, OutputCallback callback) override;
+  void Release() override;
+  EncodeResult Encode(const webrtc::VideoFrame& frame,
+                      bool force_key_frame) override;
+  void SetBitrate(uint32_t bitrate_bps) override;
+  void SetFramerate(uint32_t framerate) override {}
+  const char* ImplementationName() const override { return "MMAL H264"; }
+  bool SupportsNativeHandle() const override { return true; }
 
-    int32_t width;
-    int32_t height;
-    int64_t render_time_ms;
-    int64_t ntp_time_ms;
-    int64_t timestamp;
-    webrtc::VideoRotation rotation;
-    absl::optional<webrtc::ColorSpace> color_space;
-  };
-
-  int32_t MMALConfigure();
+ private:
+  // 入力の種類はフレームが来るまで分からないので、
+  // create が false の時は使い回せるものがあった時だけ用意する
+  bool MMALConfigure(bool create);
+  std::unique_ptr<MMALH264Pipeline> MMALCreatePipeline();
+  std::string PipelineKey() const;
   void MMALRelease();
   static void MMALInputCallbackFunction(MMAL_PORT_T* port,
                                         MMAL_BUFFER_HEADER_T* buffer);
-  void MMALInputCallback(MMAL_PORT_T* port, MMAL_BUFFER_HEADER_T* buffer);
   static void MMALOutputCallbackFunction(MMAL_PORT_T* port,
                                          MMAL_BUFFER_HEADER_T* buffer);
-  void MMALOutputCallback(MMAL_PORT_T* port, MMAL_BUFFER_HEADER_T* buffer);
-  void SetBitrateBps(uint32_t bitrate_bps);
-  int32_t SendFrame(unsigned char* buffer, size_t size);
 
-  std::mutex mtx_;
-  webrtc::EncodedImageCallback* callback_;
-  MMAL_COMPONENT_T* decoder_;
-  MMAL_COMPONENT_T* resizer_;
-  MMAL_COMPONENT_T* encoder_;
-  MMAL_CONNECTION_T* conn1_;
-  MMAL_CONNECTION_T* conn2_;
-  MMAL_POOL_T* pool_in_;
-  MMAL_POOL_T* pool_out_;
-  webrtc::BitrateAdjuster bitrate_adjuster_;
-  uint32_t target_bitrate_bps_;
-  uint32_t configured_bitrate_bps_;
+  std::shared_ptr<MMALH264PipelinePool> pool_;
+  std::unique_ptr<MMALH264Pipeline> pipeline_;
+  std::string pipeline_key_;
+  OutputCallback callback_;
+  uint32_t bitrate_bps_;
+  webrtc::H264::Profile h264_profile_;
+  webrtc::H264::Level h264_level_;
+  int intra_refresh_period_;
   int32_t raw_width_;
   int32_t raw_height_;
   int32_t width_;
   int32_t height_;
-  int32_t configured_width_;
-  int32_t configured_height_;
-  int32_t stride_width_;
-  int32_t stride_height_;
   bool use_native_;
   bool use_decoder_;
-
-  webrtc::H264BitstreamParser h264_bitstream_parser_;
-
-  rtc::CriticalSection frame_params_lock_;
-  std::queue<std::unique_ptr<FrameParams>> frame_params_;
-  webrtc::EncodedImage encoded_image_;
-  std::unique_ptr<uint8_t[]> encoded_image_buffer_;
-  size_t encoded_buffer_length_;
 };
 
 #endif  // MMAL_H264_ENCODER_H_
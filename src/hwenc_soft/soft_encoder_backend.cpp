@@ -0,0 +1,216 @@
+#include "soft_encoder_backend.h"
+
+#include <chrono>
+#include <vector>
+
+#include "api/video/video_bitrate_allocation.h"
+#include "media/base/codec.h"
+#include "media/base/media_constants.h"
+#include "modules/video_coding/codecs/h264/include/h264.h"
+#include "modules/video_coding/codecs/vp8/include/vp8.h"
+#include "modules/video_coding/include/video_error_codes.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+
+SoftEncoderBackend::SoftEncoderBackend(webrtc::VideoCodecType codec_type,
+                                       int latency_ms,
+                                       size_t max_queue)
+    : codec_type_(codec_type),
+      latency_ms_(latency_ms),
+      max_queue_(max_queue),
+      quit_(false),
+      bitrate_bps_(0),
+      framerate_(30),
+      rates_changed_(false) {}
+
+SoftEncoderBackend::~SoftEncoderBackend() {
+  Release();
+}
+
+bool SoftEncoderBackend::IsSupported(webrtc::VideoCodecType codec_type) {
+  switch (codec_type) {
+    case webrtc::kVideoCodecVP8:
+      return true;
+    case webrtc::kVideoCodecH264:
+      return webrtc::H264Encoder::IsSupported();
+    default:
+      return false;
+  }
+}
+
+bool SoftEncoderBackend::Configure(const Config& config,
+                                   OutputCallback callback) {
+  Release();
+
+  if (codec_type_ == webrtc::kVideoCodecVP8) {
+    encoder_ = webrtc::VP8Encoder::Create();
+  } else if (codec_type_ == webrtc::kVideoCodecH264 &&
+             webrtc::H264Encoder::IsSupported()) {
+    encoder_ = webrtc::H264Encoder::Create(
+        cricket::VideoCodec(cricket::kH264CodecName));
+  }
+  if (!encoder_) {
+    RTC_LOG(LS_ERROR) << "Unsupported codec type: " << codec_type_;
+    return false;
+  }
+
+  webrtc::VideoCodec codec;
+  codec.codecType = codec_type_;
+  codec.width = config.width;
+  codec.height = config.height;
+  codec.startBitrate = config.bitrate_bps / 1000;
+  codec.maxFramerate = config.framerate;
+  codec.qpMax = 56;
+  codec.mode = webrtc::VideoCodecMode::kRealtimeVideo;
+  if (codec_type_ == webrtc::kVideoCodecVP8) {
+    *codec.VP8() = webrtc::VideoEncoder::GetDefaultVp8Settings();
+    // WebRTC の libvpx のラッパーからはイントラリフレッシュを設定できないので、
+    // 定期的なキーフレームを止めるだけにする。キーフレームの大きさには
+    // ラッパーが上限を付けている
+    codec.VP8()->keyFrameInterval =
+        config.intra_refresh_period > 0 ? 0 : config.key_frame_interval;
+  } else {
+    *codec.H264() = webrtc::VideoEncoder::GetDefaultH264Settings();
+    codec.H264()->keyFrameInterval = config.key_frame_interval;
+  }
+  encoder_->RegisterEncodeCompleteCallback(this);
+  if (encoder_->InitEncode(&codec, 1, 1200) != WEBRTC_VIDEO_CODEC_OK) {
+    RTC_LOG(LS_ERROR) << "Failed to InitEncode " << ImplementationName();
+    encoder_.reset();
+    return false;
+  }
+  ApplyRates(config.bitrate_bps, config.framerate);
+  callback_ = callback;
+
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    quit_ = false;
+    bitrate_bps_ = config.bitrate_bps;
+    framerate_ = config.framerate;
+    rates_changed_ = false;
+  }
+  worker_thread_.reset(new rtc::PlatformThread(
+      SoftEncoderBackend::WorkerThread, this, "SoftEncoder",
+      rtc::kHighPriority));
+  worker_thread_->Start();
+  return true;
+}
+
+void SoftEncoderBackend::Release() {
+  if (worker_thread_) {
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      quit_ = true;
+      tasks_.clear();
+    }
+    cond_.notify_all();
+    worker_thread_->Stop();
+    worker_thread_.reset();
+  }
+  if (encoder_) {
+    encoder_->Release();
+    encoder_.reset();
+  }
+  callback_ = nullptr;
+}
+
+HWEncoderBackend::EncodeResult SoftEncoderBackend::Encode(
+    const webrtc::VideoFrame& frame,
+    bool force_key_frame) {
+  if (!worker_thread_) {
+    return EncodeResult::kError;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (tasks_.size() >= max_queue_) {
+      return EncodeResult::kDropped;
+    }
+    tasks_.push_back(
+        Task{frame, force_key_frame, rtc::TimeMillis() + latency_ms_});
+  }
+  cond_.notify_one();
+  return EncodeResult::kOk;
+}
+
+void SoftEncoderBackend::SetBitrate(uint32_t bitrate_bps) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  bitrate_bps_ = bitrate_bps;
+  rates_changed_ = true;
+}
+
+void SoftEncoderBackend::SetFramerate(uint32_t framerate) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  framerate_ = framerate;
+  rates_changed_ = true;
+}
+
+const char* SoftEncoderBackend::ImplementationName() const {
+  return codec_type_ == webrtc::kVideoCodecH264 ? "Soft H264" : "Soft VP8";
+}
+
+webrtc::EncodedImageCallback::Result SoftEncoderBackend::OnEncodedImage(
+    const webrtc::EncodedImage& encoded_image,
+    const webrtc::CodecSpecificInfo* codec_specific_info,
+    const webrtc::RTPFragmentationHeader* fragmentation) {
+  if (callback_) {
+    bool key_frame =
+        encoded_image._frameType == webrtc::VideoFrameType::kVideoFrameKey;
+    callback_(encoded_image.data(), encoded_image.size(),
+              encoded_image.Timestamp(), key_frame);
+  }
+  return Result(Result::OK, encoded_image.Timestamp());
+}
+
+void SoftEncoderBackend::WorkerThread(void* obj) {
+  static_cast<SoftEncoderBackend*>(obj)->WorkerProcess();
+}
+
+void SoftEncoderBackend::WorkerProcess() {
+  while (true) {
+    uint32_t bitrate_bps = 0;
+    uint32_t framerate = 0;
+    bool rates_changed = false;
+    std::unique_lock<std::mutex> lock(mtx_);
+    cond_.wait(lock, [this] { return quit_ || !tasks_.empty(); });
+    if (quit_) {
+      return;
+    }
+    // ハードウェアの処理時間の代わりに、積まれてから latency_ms 待つ
+    int64_t wait_ms = tasks_.front().ready_ms - rtc::TimeMillis();
+    if (wait_ms > 0) {
+      cond_.wait_for(lock, std::chrono::milliseconds(wait_ms),
+                     [this] { return quit_; });
+      if (quit_) {
+        return;
+      }
+    }
+    Task task = tasks_.front();
+    tasks_.pop_front();
+    if (rates_changed_) {
+      bitrate_bps = bitrate_bps_;
+      framerate = framerate_;
+      rates_changed = true;
+      rates_changed_ = false;
+    }
+    lock.unlock();
+
+    if (rates_changed) {
+      ApplyRates(bitrate_bps, framerate);
+    }
+    std::vector<webrtc::VideoFrameType> frame_types(
+        1, task.force_key_frame ? webrtc::VideoFrameType::kVideoFrameKey
+                                : webrtc::VideoFrameType::kVideoFrameDelta);
+    int32_t ret = encoder_->Encode(task.frame, &frame_types);
+    if (ret != WEBRTC_VIDEO_CODEC_OK) {
+      RTC_LOG(LS_WARNING) << ImplementationName()
+                          << " failed to encode: " << ret;
+    }
+  }
+}
+
+void SoftEncoderBackend::ApplyRates(uint32_t bitrate_bps, uint32_t framerate) {
+  webrtc::VideoBitrateAllocation allocation;
+  allocation.SetBitrate(0, 0, bitrate_bps);
+  encoder_->SetRates(webrtc::VideoEncoder::RateControlParameters(
+      allocation, static_cast<double>(framerate)));
+}
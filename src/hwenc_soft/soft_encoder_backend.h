@@ -0,0 +1,75 @@
+#ifndef SOFT_ENCODER_BACKEND_H_
+#define SOFT_ENCODER_BACKEND_H_
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#include "api/video_codecs/video_encoder.h"
+#include "rtc/hw_encoder_backend.h"
+#include "rtc_base/platform_thread.h"
+
+// ハードウェアエンコーダの代わりに WebRTC のソフトウェアエンコーダを使う
+// バックエンド。
+//
+// ハードウェアエンコーダと同じように、Encode はキューに積むだけで、
+// 別スレッドで latency_ms 待ってからエンコードして OutputCallback を呼ぶ。
+// 実機が無い x86 の環境で HWVideoEncoder を計測、確認するために使う。
+class SoftEncoderBackend : public HWEncoderBackend,
+                           public webrtc::EncodedImageCallback {
+ public:
+  // max_queue 以上のフレームが溜まったら、詰まったものとして捨てる
+  SoftEncoderBackend(webrtc::VideoCodecType codec_type,
+                     int latency_ms,
+                     size_t max_queue = 4);
+  ~SoftEncoderBackend() override;
+
+  static bool IsSupported(webrtc::VideoCodecType codec_type);
+
+  bool Configure(const Config& config, OutputCallback callback) override;
+  void Release() override;
+  EncodeResult Encode(const webrtc::VideoFrame& frame,
+                      bool force_key_frame) override;
+  void SetBitrate(uint32_t bitrate_bps) override;
+  void SetFramerate(uint32_t framerate) override;
+  const char* ImplementationName() const override;
+  bool IsHardwareAccelerated() const override { return false; }
+
+  // webrtc::EncodedImageCallback
+  // ワーカースレッドの encoder_->Encode から呼ばれる
+  Result OnEncodedImage(
+      const webrtc::EncodedImage& encoded_image,
+      const webrtc::CodecSpecificInfo* codec_specific_info,
+      const webrtc::RTPFragmentationHeader* fragmentation) override;
+
+ private:
+  struct Task {
+    webrtc::VideoFrame frame;
+    bool force_key_frame;
+    int64_t ready_ms;
+  };
+
+  static void WorkerThread(void* obj);
+  void WorkerProcess();
+  void ApplyRates(uint32_t bitrate_bps, uint32_t framerate);
+
+  const webrtc::VideoCodecType codec_type_;
+  const int latency_ms_;
+  const size_t max_queue_;
+
+  std::mutex mtx_;
+  std::condition_variable cond_;
+  std::deque<Task> tasks_;
+  bool quit_;
+  uint32_t bitrate_bps_;
+  uint32_t framerate_;
+  bool rates_changed_;
+
+  // 以下はワーカースレッドが動いている間はワーカースレッドだけが触る
+  std::unique_ptr<webrtc::VideoEncoder> encoder_;
+  OutputCallback callback_;
+  std::unique_ptr<rtc::PlatformThread> worker_thread_;
+};
+
+#endif  // SOFT_ENCODER_BACKEND_H_
@@ -0,0 +1,71 @@
+#ifndef V4L2_H264_H_
+#define V4L2_H264_H_
+
+#include <linux/videodev2.h>
+#include <stdint.h>
+
+#include "media/base/h264_profile_level_id.h"
+
+// WebRTC の H264 のプロファイルとレベルと、V4L2 のコントロールの値の変換。
+// Jetson の NvVideoEncoder も同じ値を使うので、ヘッダだけで済ませる
+
+inline int32_t H264ProfileToV4L2(webrtc::H264::Profile profile) {
+  switch (profile) {
+    case webrtc::H264::kProfileHigh:
+    case webrtc::H264::kProfileConstrainedHigh:
+      return V4L2_MPEG_VIDEO_H264_PROFILE_HIGH;
+    case webrtc::H264::kProfileMain:
+      return V4L2_MPEG_VIDEO_H264_PROFILE_MAIN;
+    case webrtc::H264::kProfileBaseline:
+      return V4L2_MPEG_VIDEO_H264_PROFILE_BASELINE;
+    default:
+      return V4L2_MPEG_VIDEO_H264_PROFILE_CONSTRAINED_BASELINE;
+  }
+}
+
+struct V4L2H264Level {
+  webrtc::H264::Level level;
+  int32_t v4l2_level;
+};
+
+// 5.2 は古いカーネルのヘッダに無いので 5.1 までにする
+const V4L2H264Level kV4L2H264Levels[] = {
+    {webrtc::H264::kLevel1, V4L2_MPEG_VIDEO_H264_LEVEL_1_0},
+    {webrtc::H264::kLevel1_b, V4L2_MPEG_VIDEO_H264_LEVEL_1B},
+    {webrtc::H264::kLevel1_1, V4L2_MPEG_VIDEO_H264_LEVEL_1_1},
+    {webrtc::H264::kLevel1_2, V4L2_MPEG_VIDEO_H264_LEVEL_1_2},
+    {webrtc::H264::kLevel1_3, V4L2_MPEG_VIDEO_H264_LEVEL_1_3},
+    {webrtc::H264::kLevel2, V4L2_MPEG_VIDEO_H264_LEVEL_2_0},
+    {webrtc::H264::kLevel2_1, V4L2_MPEG_VIDEO_H264_LEVEL_2_1},
+    {webrtc::H264::kLevel2_2, V4L2_MPEG_VIDEO_H264_LEVEL_2_2},
+    {webrtc::H264::kLevel3, V4L2_MPEG_VIDEO_H264_LEVEL_3_0},
+    {webrtc::H264::kLevel3_1, V4L2_MPEG_VIDEO_H264_LEVEL_3_1},
+    {webrtc::H264::kLevel3_2, V4L2_MPEG_VIDEO_H264_LEVEL_3_2},
+    {webrtc::H264::kLevel4, V4L2_MPEG_VIDEO_H264_LEVEL_4_0},
+    {webrtc::H264::kLevel4_1, V4L2_MPEG_VIDEO_H264_LEVEL_4_1},
+    {webrtc::H264::kLevel4_2, V4L2_MPEG_VIDEO_H264_LEVEL_4_2},
+    {webrtc::H264::kLevel5, V4L2_MPEG_VIDEO_H264_LEVEL_5_0},
+    {webrtc::H264::kLevel5_1, V4L2_MPEG_VIDEO_H264_LEVEL_5_1},
+};
+
+// 5.1 より上は 5.1 にする
+inline int32_t H264LevelToV4L2(webrtc::H264::Level level) {
+  for (const V4L2H264Level& l : kV4L2H264Levels) {
+    if (l.level == level) {
+      return l.v4l2_level;
+    }
+  }
+  return V4L2_MPEG_VIDEO_H264_LEVEL_5_1;
+}
+
+// 知らない値なら 5.1 より上だと見なす
+inline webrtc::H264::Level V4L2ToH264Level(int32_t v4l2_level) {
+  for (const V4L2H264Level& l : kV4L2H264Levels) {
+    if (l.v4l2_level == v4l2_level) {
+      return l.level;
+    }
+  }
+  return webrtc::H264::kLevel5_1;
+}
+
+#endif  // V4L2_H264_H_
@@ -0,0 +1,651 @@
+#include "v4l2_m2m_device.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <map>
+
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+#include "third_party/libyuv/include/libyuv.h"
+#include "thread_policy/thread_policy.h"
+
+namespace {
+
+const int kNumInputBuffers = 4;
+const int kNumCaptureBuffers = 4;
+// キューが空で POLLERR が返ってくる時に、やり直すまで待つ時間
+const int kPollErrorWaitMs = 10;
+
+// ドライバが受け付けるか順番に試す生の映像の形式。
+// I420 からそのままコピーできるものを先に試す
+const uint32_t kRawFormats[] = {V4L2_PIX_FMT_YUV420M, V4L2_PIX_FMT_YUV420,
+                                V4L2_PIX_FMT_NV12M, V4L2_PIX_FMT_NV12};
+
+// EINTR の時はやり直す
+int Ioctl(int fd, unsigned long request, void* arg) {
+  int ret;
+  do {
+    ret = ioctl(fd, request, arg);
+  } while (ret < 0 && errno == EINTR);
+  return ret;
+}
+
+bool SupportsFormat(int fd, enum v4l2_buf_type type, uint32_t fourcc) {
+  struct v4l2_fmtdesc fmt;
+  memset(&fmt, 0, sizeof(fmt));
+  fmt.type = type;
+  while (Ioctl(fd, VIDIOC_ENUM_FMT, &fmt) == 0) {
+    if (fmt.pixelformat == fourcc) {
+      return true;
+    }
+    fmt.index++;
+  }
+  return false;
+}
+
+std::string FourccToString(uint32_t fourcc) {
+  char s[5] = {static_cast<char>(fourcc & 0xff),
+               static_cast<char>((fourcc >> 8) & 0xff),
+               static_cast<char>((fourcc >> 16) & 0xff),
+               static_cast<char>((fourcc >> 24) & 0xff), '\0'};
+  return s;
+}
+
+}  // namespace
+
+std::string V4L2M2MDevice::FindDevice(uint32_t coded_fourcc) {
+  static rtc::CriticalSection lock;
+  static std::map<uint32_t, std::string> found;
+  rtc::CritScope cs(&lock);
+  auto it = found.find(coded_fourcc);
+  if (it != found.end()) {
+    return it->second;
+  }
+
+  std::string result;
+  char device[32];
+  for (int n = 0; n < 64 && result.empty(); n++) {
+    sprintf(device, "/dev/video%d", n);
+    int fd = open(device, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+      continue;
+    }
+    struct v4l2_capability cap;
+    memset(&cap, 0, sizeof(cap));
+    if (Ioctl(fd, VIDIOC_QUERYCAP, &cap) == 0) {
+      uint32_t caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS)
+                          ? cap.device_caps
+                          : cap.capabilities;
+      bool m2m = (caps & V4L2_CAP_VIDEO_M2M_MPLANE) != 0 ||
+                 ((caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE) != 0 &&
+                  (caps & V4L2_CAP_VIDEO_OUTPUT_MPLANE) != 0);
+      // デコーダは OUTPUT キューの方がエンコードした形式になるので、
+      // CAPTURE キューから出てくるものだけ見ればエンコーダだと分かる
+      if (m2m && (caps & V4L2_CAP_STREAMING) != 0 &&
+          SupportsFormat(fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE,
+                         coded_fourcc)) {
+        RTC_LOG(LS_INFO) << "V4L2 M2M encoder: " << device
+                         << ", card=" << (const char*)cap.card
+                         << ", format=" << FourccToString(coded_fourcc);
+        result = device;
+      }
+    }
+    close(fd);
+  }
+  found[coded_fourcc] = result;
+  return result;
+}
+
+std::vector<int32_t> V4L2M2MDevice::QueryMenu(const std::string& device,
+                                              uint32_t id) {
+  std::vector<int32_t> values;
+  int fd = open(device.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd == -1) {
+    return values;
+  }
+  struct v4l2_queryctrl ctrl;
+  memset(&ctrl, 0, sizeof(ctrl));
+  ctrl.id = id;
+  if (Ioctl(fd, VIDIOC_QUERYCTRL, &ctrl) == 0 &&
+      ctrl.type == V4L2_CTRL_TYPE_MENU &&
+      (ctrl.flags & V4L2_CTRL_FLAG_DISABLED) == 0) {
+    // 範囲の中でも選べない値は VIDIOC_QUERYMENU が失敗する
+    for (int32_t i = ctrl.minimum; i <= ctrl.maximum; i++) {
+      struct v4l2_querymenu menu;
+      memset(&menu, 0, sizeof(menu));
+      menu.id = id;
+      menu.index = i;
+      if (Ioctl(fd, VIDIOC_QUERYMENU, &menu) == 0) {
+        values.push_back(i);
+      }
+    }
+  }
+  close(fd);
+  return values;
+}
+
+std::unique_ptr<V4L2M2MDevice> V4L2M2MDevice::Open(const std::string& device,
+                                                   const Config& config,
+                                                   OutputCallback callback) {
+  int fd = open(device.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd == -1) {
+    RTC_LOG(LS_ERROR) << "Failed to open " << device << ": "
+                      << strerror(errno);
+    return nullptr;
+  }
+  std::unique_ptr<V4L2M2MDevice> m2m(new V4L2M2MDevice(fd, callback));
+  if (m2m->wakeup_fd_ == -1 || !m2m->Configure(config)) {
+    RTC_LOG(LS_ERROR) << "Failed to configure " << device;
+    return nullptr;
+  }
+  return m2m;
+}
+
+V4L2M2MDevice::V4L2M2MDevice(int fd, OutputCallback callback)
+    : fd_(fd),
+      wakeup_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      callback_(callback),
+      raw_fourcc_(0),
+      raw_height_(0) {
+  memset(raw_bytesperline_, 0, sizeof(raw_bytesperline_));
+  memset(raw_sizeimage_, 0, sizeof(raw_sizeimage_));
+  output_.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  output_.memory = V4L2_MEMORY_MMAP;
+  output_.num_planes = 0;
+  capture_.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  capture_.memory = V4L2_MEMORY_MMAP;
+  capture_.num_planes = 0;
+}
+
+V4L2M2MDevice::~V4L2M2MDevice() {
+  if (poll_thread_) {
+    uint64_t value = 1;
+    if (write(wakeup_fd_, &value, sizeof(value)) < 0) {
+      RTC_LOG(LS_WARNING) << "Failed to wake up the poll thread";
+    }
+    poll_thread_->Stop();
+    poll_thread_.reset();
+  }
+  // STREAMOFF で全てのバッファがデバイスから戻ってくる
+  enum v4l2_buf_type type = output_.type;
+  Ioctl(fd_, VIDIOC_STREAMOFF, &type);
+  type = capture_.type;
+  Ioctl(fd_, VIDIOC_STREAMOFF, &type);
+  DeallocateBuffers(&output_);
+  DeallocateBuffers(&capture_);
+  if (wakeup_fd_ != -1) {
+    close(wakeup_fd_);
+  }
+  close(fd_);
+}
+
+bool V4L2M2MDevice::Configure(const Config& config) {
+  config_ = config;
+  output_.memory = config.input_memory;
+
+  // ステートフルなエンコーダは CAPTURE キューの形式を先に決める
+  if (!SetCodedFormat(config) || !SetRawFormat(config)) {
+    return false;
+  }
+  if (!SetFramerate(config.framerate)) {
+    RTC_LOG(LS_INFO) << "V4L2 M2M encoder does not support framerate";
+  }
+  if (config.bitrate_bps > 0 && !SetBitrate(config.bitrate_bps)) {
+    RTC_LOG(LS_INFO) << "V4L2 M2M encoder does not support bitrate";
+  }
+  for (const auto& control : config.controls) {
+    if (!SetControl(control.first, control.second)) {
+      RTC_LOG(LS_INFO) << "V4L2 M2M encoder does not support control "
+                       << control.first << "=" << control.second;
+    }
+  }
+
+  struct v4l2_event_subscription sub;
+  memset(&sub, 0, sizeof(sub));
+  sub.type = V4L2_EVENT_EOS;
+  Ioctl(fd_, VIDIOC_SUBSCRIBE_EVENT, &sub);
+
+  if (!AllocateBuffers(&output_, kNumInputBuffers) ||
+      !AllocateBuffers(&capture_, kNumCaptureBuffers)) {
+    return false;
+  }
+  for (size_t i = 0; i < capture_.buffers.size(); i++) {
+    if (!QueueCaptureBuffer(i)) {
+      return false;
+    }
+  }
+  {
+    rtc::CritScope lock(&free_lock_);
+    for (size_t i = 0; i < output_.buffers.size(); i++) {
+      free_inputs_.push_back(i);
+    }
+  }
+
+  enum v4l2_buf_type type = output_.type;
+  if (Ioctl(fd_, VIDIOC_STREAMON, &type) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to start OUTPUT stream: " << strerror(errno);
+    return false;
+  }
+  type = capture_.type;
+  if (Ioctl(fd_, VIDIOC_STREAMON, &type) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to start CAPTURE stream: "
+                      << strerror(errno);
+    return false;
+  }
+
+  poll_thread_.reset(new rtc::PlatformThread(
+      &V4L2M2MDevice::PollThread, this, "V4L2M2MPoll", rtc::kHighPriority));
+  poll_thread_->Start();
+
+  RTC_LOG(LS_INFO) << "V4L2 M2M encoder started: " << config.width << "x"
+                   << config.height << " "
+                   << FourccToString(raw_fourcc_) << " -> "
+                   << FourccToString(config.coded_fourcc);
+  return true;
+}
+
+bool V4L2M2MDevice::SetCodedFormat(const Config& config) {
+  struct v4l2_format fmt;
+  memset(&fmt, 0, sizeof(fmt));
+  fmt.type = capture_.type;
+  fmt.fmt.pix_mp.width = config.width;
+  fmt.fmt.pix_mp.height = config.height;
+  fmt.fmt.pix_mp.pixelformat = config.coded_fourcc;
+  fmt.fmt.pix_mp.field = V4L2_FIELD_ANY;
+  fmt.fmt.pix_mp.num_planes = 1;
+  // ドライバが決めない時に使う、エンコードした 1 フレームの最大の大きさ
+  fmt.fmt.pix_mp.plane_fmt[0].sizeimage = config.width * config.height * 3 / 2;
+  if (Ioctl(fd_, VIDIOC_S_FMT, &fmt) < 0 ||
+      fmt.fmt.pix_mp.pixelformat != config.coded_fourcc) {
+    RTC_LOG(LS_ERROR) << "Failed to set CAPTURE format "
+                      << FourccToString(config.coded_fourcc);
+    return false;
+  }
+  capture_.num_planes = fmt.fmt.pix_mp.num_planes;
+  return true;
+}
+
+bool V4L2M2MDevice::SetRawFormat(const Config& config) {
+  for (uint32_t fourcc : kRawFormats) {
+    struct v4l2_format fmt;
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = output_.type;
+    fmt.fmt.pix_mp.width = config.width;
+    fmt.fmt.pix_mp.height = config.height;
+    fmt.fmt.pix_mp.pixelformat = fourcc;
+    fmt.fmt.pix_mp.field = V4L2_FIELD_ANY;
+    if (Ioctl(fd_, VIDIOC_S_FMT, &fmt) < 0 ||
+        fmt.fmt.pix_mp.pixelformat != fourcc) {
+      continue;
+    }
+    if (static_cast<int>(fmt.fmt.pix_mp.width) < config.width ||
+        static_cast<int>(fmt.fmt.pix_mp.height) < config.height) {
+      RTC_LOG(LS_ERROR) << "V4L2 M2M encoder does not support "
+                        << config.width << "x" << config.height;
+      return false;
+    }
+    raw_fourcc_ = fourcc;
+    raw_height_ = fmt.fmt.pix_mp.height;
+    output_.num_planes = fmt.fmt.pix_mp.num_planes;
+    for (int i = 0; i < output_.num_planes; i++) {
+      raw_bytesperline_[i] = fmt.fmt.pix_mp.plane_fmt[i].bytesperline;
+      raw_sizeimage_[i] = fmt.fmt.pix_mp.plane_fmt[i].sizeimage;
+    }
+    return true;
+  }
+  RTC_LOG(LS_ERROR) << "V4L2 M2M encoder does not accept any YUV420 format";
+  return false;
+}
+
+bool V4L2M2MDevice::AllocateBuffers(Queue* queue, int count) {
+  struct v4l2_requestbuffers req;
+  memset(&req, 0, sizeof(req));
+  req.count = count;
+  req.type = queue->type;
+  req.memory = queue->memory;
+  if (Ioctl(fd_, VIDIOC_REQBUFS, &req) < 0 || req.count == 0) {
+    RTC_LOG(LS_ERROR) << "Failed to request buffers: " << strerror(errno);
+    return false;
+  }
+  queue->buffers.resize(req.count);
+  if (queue->memory != V4L2_MEMORY_MMAP) {
+    return true;
+  }
+
+  for (uint32_t i = 0; i < req.count; i++) {
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    struct v4l2_buffer buf;
+    memset(planes, 0, sizeof(planes));
+    memset(&buf, 0, sizeof(buf));
+    buf.type = queue->type;
+    buf.memory = queue->memory;
+    buf.index = i;
+    buf.length = queue->num_planes;
+    buf.m.planes = planes;
+    if (Ioctl(fd_, VIDIOC_QUERYBUF, &buf) < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to query buffer: " << strerror(errno);
+      return false;
+    }
+    for (uint32_t p = 0; p < buf.length; p++) {
+      void* start = mmap(NULL, planes[p].length, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd_, planes[p].m.mem_offset);
+      if (start == MAP_FAILED) {
+        RTC_LOG(LS_ERROR) << "Failed to mmap buffer: " << strerror(errno);
+        return false;
+      }
+      queue->buffers[i].planes.push_back({start, planes[p].length});
+    }
+  }
+  return true;
+}
+
+void V4L2M2MDevice::DeallocateBuffers(Queue* queue) {
+  if (queue->buffers.empty()) {
+    return;
+  }
+  for (Buffer& buffer : queue->buffers) {
+    for (Plane& plane : buffer.planes) {
+      munmap(plane.start, plane.length);
+    }
+  }
+  queue->buffers.clear();
+
+  struct v4l2_requestbuffers req;
+  memset(&req, 0, sizeof(req));
+  req.count = 0;
+  req.type = queue->type;
+  req.memory = queue->memory;
+  Ioctl(fd_, VIDIOC_REQBUFS, &req);
+}
+
+bool V4L2M2MDevice::QueueCaptureBuffer(int index) {
+  struct v4l2_plane planes[VIDEO_MAX_PLANES];
+  struct v4l2_buffer buf;
+  memset(planes, 0, sizeof(planes));
+  memset(&buf, 0, sizeof(buf));
+  buf.type = capture_.type;
+  buf.memory = capture_.memory;
+  buf.index = index;
+  buf.length = capture_.num_planes;
+  buf.m.planes = planes;
+  if (Ioctl(fd_, VIDIOC_QBUF, &buf) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to queue CAPTURE buffer: "
+                      << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+bool V4L2M2MDevice::QueueOutputBuffer(int index,
+                                      uint64_t key,
+                                      const std::vector<size_t>& bytesused,
+                                      const std::vector<int>* fds) {
+  struct v4l2_plane planes[VIDEO_MAX_PLANES];
+  struct v4l2_buffer buf;
+  memset(planes, 0, sizeof(planes));
+  memset(&buf, 0, sizeof(buf));
+  buf.type = output_.type;
+  buf.memory = output_.memory;
+  buf.index = index;
+  buf.length = output_.num_planes;
+  buf.m.planes = planes;
+  // タイムスタンプはエンコードしたデータにそのままコピーされる
+  buf.timestamp.tv_sec = key / rtc::kNumMicrosecsPerSec;
+  buf.timestamp.tv_usec = key % rtc::kNumMicrosecsPerSec;
+  for (int p = 0; p < output_.num_planes; p++) {
+    planes[p].bytesused = bytesused[p];
+    if (fds != nullptr) {
+      planes[p].m.fd = (*fds)[p];
+      planes[p].length = bytesused[p];
+    } else {
+      planes[p].length = output_.buffers[index].planes[p].length;
+    }
+  }
+  if (Ioctl(fd_, VIDIOC_QBUF, &buf) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to queue OUTPUT buffer: " << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+int V4L2M2MDevice::AcquireInput() {
+  rtc::CritScope lock(&free_lock_);
+  if (free_inputs_.empty()) {
+    return -1;
+  }
+  int index = free_inputs_.back();
+  free_inputs_.pop_back();
+  return index;
+}
+
+void V4L2M2MDevice::ReleaseInput(int index) {
+  rtc::CritScope lock(&free_lock_);
+  free_inputs_.push_back(index);
+}
+
+bool V4L2M2MDevice::Encode(const webrtc::I420BufferInterface& frame,
+                           uint64_t key) {
+  if (output_.memory != V4L2_MEMORY_MMAP) {
+    return false;
+  }
+  int index = AcquireInput();
+  if (index < 0) {
+    return false;
+  }
+  CopyI420(frame, index);
+  std::vector<size_t> bytesused(raw_sizeimage_,
+                                raw_sizeimage_ + output_.num_planes);
+  if (!QueueOutputBuffer(index, key, bytesused, nullptr)) {
+    ReleaseInput(index);
+    return false;
+  }
+  return true;
+}
+
+bool V4L2M2MDevice::EncodeDmabuf(const std::vector<int>& fds,
+                                 const std::vector<size_t>& bytesused,
+                                 uint64_t key) {
+  if (output_.memory != V4L2_MEMORY_DMABUF ||
+      static_cast<int>(fds.size()) != output_.num_planes ||
+      bytesused.size() != fds.size()) {
+    return false;
+  }
+  int index = AcquireInput();
+  if (index < 0) {
+    return false;
+  }
+  if (!QueueOutputBuffer(index, key, bytesused, &fds)) {
+    ReleaseInput(index);
+    return false;
+  }
+  return true;
+}
+
+void V4L2M2MDevice::CopyI420(const webrtc::I420BufferInterface& frame,
+                             int index) {
+  const Buffer& buffer = output_.buffers[index];
+  uint8_t* plane0 = static_cast<uint8_t*>(buffer.planes[0].start);
+  int width = frame.width();
+  int height = frame.height();
+  int stride0 = raw_bytesperline_[0];
+  switch (raw_fourcc_) {
+    case V4L2_PIX_FMT_YUV420M:
+      libyuv::I420Copy(frame.DataY(), frame.StrideY(), frame.DataU(),
+                       frame.StrideU(), frame.DataV(), frame.StrideV(), plane0,
+                       stride0, static_cast<uint8_t*>(buffer.planes[1].start),
+                       raw_bytesperline_[1],
+                       static_cast<uint8_t*>(buffer.planes[2].start),
+                       raw_bytesperline_[2], width, height);
+      break;
+    case V4L2_PIX_FMT_YUV420: {
+      // 1 つのプレーンに Y, U, V の順で並んでいる
+      uint8_t* u = plane0 + stride0 * raw_height_;
+      uint8_t* v = u + (stride0 / 2) * ((raw_height_ + 1) / 2);
+      libyuv::I420Copy(frame.DataY(), frame.StrideY(), frame.DataU(),
+                       frame.StrideU(), frame.DataV(), frame.StrideV(), plane0,
+                       stride0, u, stride0 / 2, v, stride0 / 2, width, height);
+      break;
+    }
+    case V4L2_PIX_FMT_NV12M:
+      libyuv::I420ToNV12(frame.DataY(), frame.StrideY(), frame.DataU(),
+                         frame.StrideU(), frame.DataV(), frame.StrideV(),
+                         plane0, stride0,
+                         static_cast<uint8_t*>(buffer.planes[1].start),
+                         raw_bytesperline_[1], width, height);
+      break;
+    case V4L2_PIX_FMT_NV12:
+      libyuv::I420ToNV12(frame.DataY(), frame.StrideY(), frame.DataU(),
+                         frame.StrideU(), frame.DataV(), frame.StrideV(),
+                         plane0, stride0, plane0 + stride0 * raw_height_,
+                         stride0, width, height);
+      break;
+  }
+}
+
+void V4L2M2MDevice::SetCallback(OutputCallback callback) {
+  rtc::CritScope lock(&callback_lock_);
+  callback_ = callback;
+}
+
+bool V4L2M2MDevice::SetBitrate(int bitrate_bps) {
+  return SetControl(V4L2_CID_MPEG_VIDEO_BITRATE, bitrate_bps);
+}
+
+bool V4L2M2MDevice::SetFramerate(int framerate) {
+  struct v4l2_streamparm parm;
+  memset(&parm, 0, sizeof(parm));
+  parm.type = output_.type;
+  parm.parm.output.timeperframe.numerator = 1;
+  parm.parm.output.timeperframe.denominator = framerate;
+  if (Ioctl(fd_, VIDIOC_S_PARM, &parm) == 0) {
+    return true;
+  }
+  // CAPTURE キューでしか受け付けないドライバもある
+  memset(&parm, 0, sizeof(parm));
+  parm.type = capture_.type;
+  parm.parm.capture.timeperframe.numerator = 1;
+  parm.parm.capture.timeperframe.denominator = framerate;
+  return Ioctl(fd_, VIDIOC_S_PARM, &parm) == 0;
+}
+
+bool V4L2M2MDevice::ForceKeyFrame() {
+  return SetControl(V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME, 1);
+}
+
+bool V4L2M2MDevice::SetControl(uint32_t id, int32_t value) {
+  struct v4l2_control ctrl;
+  memset(&ctrl, 0, sizeof(ctrl));
+  ctrl.id = id;
+  ctrl.value = value;
+  return Ioctl(fd_, VIDIOC_S_CTRL, &ctrl) == 0;
+}
+
+void V4L2M2MDevice::PollThread(void* obj) {
+  static_cast<V4L2M2MDevice*>(obj)->PollProcess();
+}
+
+void V4L2M2MDevice::PollProcess() {
+  ThreadPolicy::Apply("encoder");
+  while (true) {
+    struct pollfd fds[2];
+    fds[0].fd = fd_;
+    fds[0].events = POLLIN | POLLOUT | POLLPRI;
+    fds[0].revents = 0;
+    fds[1].fd = wakeup_fd_;
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      RTC_LOG(LS_ERROR) << "Failed to poll V4L2 M2M device: "
+                        << strerror(errno);
+      return;
+    }
+    if (fds[1].revents & POLLIN) {
+      return;
+    }
+    if (fds[0].revents & POLLERR) {
+      // どちらのキューにもバッファが無い時にも返ってくるので、少し待つ
+      if (poll(&fds[1], 1, kPollErrorWaitMs) > 0) {
+        return;
+      }
+      continue;
+    }
+    if (fds[0].revents & POLLPRI) {
+      DequeueEvents();
+    }
+    if (fds[0].revents & POLLOUT) {
+      while (DequeueOutput()) {
+      }
+    }
+    if (fds[0].revents & POLLIN) {
+      while (DequeueCapture()) {
+      }
+    }
+  }
+}
+
+bool V4L2M2MDevice::DequeueOutput() {
+  struct v4l2_plane planes[VIDEO_MAX_PLANES];
+  struct v4l2_buffer buf;
+  memset(planes, 0, sizeof(planes));
+  memset(&buf, 0, sizeof(buf));
+  buf.type = output_.type;
+  buf.memory = output_.memory;
+  buf.length = output_.num_planes;
+  buf.m.planes = planes;
+  if (Ioctl(fd_, VIDIOC_DQBUF, &buf) < 0) {
+    return false;
+  }
+  ReleaseInput(buf.index);
+  return true;
+}
+
+bool V4L2M2MDevice::DequeueCapture() {
+  struct v4l2_plane planes[VIDEO_MAX_PLANES];
+  struct v4l2_buffer buf;
+  memset(planes, 0, sizeof(planes));
+  memset(&buf, 0, sizeof(buf));
+  buf.type = capture_.type;
+  buf.memory = capture_.memory;
+  buf.length = capture_.num_planes;
+  buf.m.planes = planes;
+  if (Ioctl(fd_, VIDIOC_DQBUF, &buf) < 0) {
+    return false;
+  }
+
+  const struct v4l2_plane& plane = planes[0];
+  if ((buf.flags & V4L2_BUF_FLAG_ERROR) == 0 &&
+      plane.bytesused > plane.data_offset) {
+    const uint8_t* data =
+        static_cast<const uint8_t*>(capture_.buffers[buf.index].planes[0].start) +
+        plane.data_offset;
+    uint64_t key =
+        static_cast<uint64_t>(buf.timestamp.tv_sec) * rtc::kNumMicrosecsPerSec +
+        buf.timestamp.tv_usec;
+    rtc::CritScope lock(&callback_lock_);
+    if (callback_) {
+      callback_(data, plane.bytesused - plane.data_offset, key,
+                (buf.flags & V4L2_BUF_FLAG_KEYFRAME) != 0);
+    }
+  }
+  QueueCaptureBuffer(buf.index);
+  return true;
+}
+
+void V4L2M2MDevice::DequeueEvents() {
+  struct v4l2_event event;
+  memset(&event, 0, sizeof(event));
+  while (Ioctl(fd_, VIDIOC_DQEVENT, &event) == 0) {
+    RTC_LOG(LS_INFO) << "V4L2 M2M event: " << event.type;
+  }
+}
@@ -0,0 +1,144 @@
+#ifndef V4L2_M2M_DEVICE_H_
+#define V4L2_M2M_DEVICE_H_
+
+#include <linux/videodev2.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "api/video/video_frame_buffer.h"
+#include "rtc_base/critical_section.h"
+#include "rtc_base/platform_thread.h"
+
+// V4L2 の memory-to-memory エンコーダを操作する。
+//
+// 生の映像を入れる OUTPUT キューと、エンコードしたデータが出てくる
+// CAPTURE キューはどちらもマルチプレーンで扱う。
+// CAPTURE キューは MMAP、OUTPUT キューは MMAP か DMABUF を選べる。
+//
+// 入力したバッファに付けた key は、エンコードしたデータにそのまま付いて出てくる。
+// 終わったバッファはデバイスの poll で待つスレッドが取り出して、
+// OUTPUT キューのものは再利用できるように戻し、CAPTURE キューのものは
+// OutputCallback に渡してからキューに戻す。
+//
+// 特定のコーデックに依存しないので、vicodec (modprobe vicodec multiplanar=1)
+// の FWHT を使って、実機が無くても動作を確認できる。
+class V4L2M2MDevice {
+ public:
+  struct Config {
+    // エンコードした後の形式 (V4L2_PIX_FMT_H264 など)
+    uint32_t coded_fourcc = 0;
+    int width = 0;
+    int height = 0;
+    int framerate = 30;
+    // 0 ならビットレートを設定しない
+    int bitrate_bps = 0;
+    // OUTPUT キューのメモリの種類。V4L2_MEMORY_MMAP か V4L2_MEMORY_DMABUF
+    enum v4l2_memory input_memory = V4L2_MEMORY_MMAP;
+    // ストリームを始める前に設定するコントロール。対応していなければ無視する
+    std::vector<std::pair<uint32_t, int32_t>> controls;
+  };
+
+  // エンコードしたデータを渡す。poll のスレッドから呼ばれる
+  typedef std::function<
+      void(const uint8_t* data, size_t size, uint64_t key, bool key_frame)>
+      OutputCallback;
+
+  // coded_fourcc にエンコードできる /dev/video* を探す。見つからなければ空。
+  // 結果は覚えておいて、2 回目以降はデバイスを開かない
+  static std::string FindDevice(uint32_t coded_fourcc);
+
+  // device のメニューのコントロール id で選べる値。
+  // コントロールが無ければ空
+  static std::vector<int32_t> QueryMenu(const std::string& device,
+                                        uint32_t id);
+
+  // 失敗したら nullptr
+  static std::unique_ptr<V4L2M2MDevice> Open(const std::string& device,
+                                             const Config& config,
+                                             OutputCallback callback);
+  ~V4L2M2MDevice();
+
+  // ドライバが受け付けた生の映像の形式 (V4L2_PIX_FMT_YUV420M など)
+  uint32_t raw_fourcc() const { return raw_fourcc_; }
+
+  // 空いている入力バッファに I420 の映像をコピーしてエンコードする。
+  // 空いているバッファが無ければ false を返すので、そのフレームは捨てる
+  bool Encode(const webrtc::I420BufferInterface& frame, uint64_t key);
+  // DMABUF の場合。プレーン毎の fd と使っているバイト数を渡す。
+  // fd はエンコードが終わるまで閉じないこと
+  bool EncodeDmabuf(const std::vector<int>& fds,
+                    const std::vector<size_t>& bytesused,
+                    uint64_t key);
+
+  // エンコードしたデータを渡す先を変える。nullptr なら捨てる。
+  // 呼び出し中のコールバックがあれば、それが終わるまで待つ
+  void SetCallback(OutputCallback callback);
+
+  // 以下はデバイスが対応していなければ false を返す
+  bool SetBitrate(int bitrate_bps);
+  bool SetFramerate(int framerate);
+  bool ForceKeyFrame();
+  bool SetControl(uint32_t id, int32_t value);
+
+ private:
+  struct Plane {
+    void* start;
+    size_t length;
+  };
+  struct Buffer {
+    std::vector<Plane> planes;
+  };
+  struct Queue {
+    enum v4l2_buf_type type;
+    enum v4l2_memory memory;
+    int num_planes;
+    std::vector<Buffer> buffers;
+  };
+
+  V4L2M2MDevice(int fd, OutputCallback callback);
+  bool Configure(const Config& config);
+  bool SetRawFormat(const Config& config);
+  bool SetCodedFormat(const Config& config);
+  bool AllocateBuffers(Queue* queue, int count);
+  void DeallocateBuffers(Queue* queue);
+  bool QueueCaptureBuffer(int index);
+  bool QueueOutputBuffer(int index,
+                         uint64_t key,
+                         const std::vector<size_t>& bytesused,
+                         const std::vector<int>* fds);
+  int AcquireInput();
+  void ReleaseInput(int index);
+  void CopyI420(const webrtc::I420BufferInterface& frame, int index);
+
+  static void PollThread(void* obj);
+  void PollProcess();
+  bool DequeueOutput();
+  bool DequeueCapture();
+  void DequeueEvents();
+
+  const int fd_;
+  const int wakeup_fd_;
+  rtc::CriticalSection callback_lock_;
+  OutputCallback callback_ RTC_GUARDED_BY(callback_lock_);
+  Config config_;
+
+  uint32_t raw_fourcc_;
+  int raw_height_;
+  uint32_t raw_bytesperline_[VIDEO_MAX_PLANES];
+  uint32_t raw_sizeimage_[VIDEO_MAX_PLANES];
+  Queue output_;
+  Queue capture_;
+
+  rtc::CriticalSection free_lock_;
+  std::vector<int> free_inputs_ RTC_GUARDED_BY(free_lock_);
+
+  std::unique_ptr<rtc::PlatformThread> poll_thread_;
+};
+
+#endif  // V4L2_M2M_DEVICE_H_
@@ -0,0 +1,237 @@
+#include "v4l2_m2m_video_encoder.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "rtc/h264_format.h"
+#include "rtc_base/logging.h"
+#include "v4l2_h264.h"
+
+namespace {
+
+// キーフレームは WebRTC から要求された時に出せばいいので、間隔は長くしておく
+const int kKeyFrameInterval = 500;
+// イントラリフレッシュの時は実際には出ないくらい長くする。
+// 範囲外の値はドライバの最大値に丸められる
+const int kIntraRefreshKeyFrameInterval = 1 << 30;
+// イントラリフレッシュの時に 1 フレームを分けるスライスの数
+const int kIntraRefreshSlices = 4;
+
+uint32_t CodedFourcc(webrtc::VideoCodecType codec_type) {
+  return codec_type == webrtc::kVideoCodecH264 ? V4L2_PIX_FMT_H264
+                                               : V4L2_PIX_FMT_VP8;
+}
+
+bool Contains(const std::vector<int32_t>& values, int32_t value) {
+  return std::find(values.begin(), values.end(), value) != values.end();
+}
+
+}  // namespace
+
+V4L2M2MVideoEncoder::V4L2M2MVideoEncoder(
+    webrtc::VideoCodecType codec_type,
+    const std::string& device,
+    std::shared_ptr<V4L2M2MDevicePool> pool)
+    : codec_type_(codec_type), device_(device), pool_(pool) {}
+
+V4L2M2MVideoEncoder::~V4L2M2MVideoEncoder() {
+  Release();
+}
+
+std::string V4L2M2MVideoEncoder::FindDevice(
+    webrtc::VideoCodecType codec_type) {
+  return V4L2M2MDevice::FindDevice(CodedFourcc(codec_type));
+}
+
+std::vector<webrtc::H264::ProfileLevelId>
+V4L2M2MVideoEncoder::SupportedH264Profiles(const std::string& device) {
+  std::vector<int32_t> profiles =
+      V4L2M2MDevice::QueryMenu(device, V4L2_CID_MPEG_VIDEO_H264_PROFILE);
+  std::vector<int32_t> levels =
+      V4L2M2MDevice::QueryMenu(device, V4L2_CID_MPEG_VIDEO_H264_LEVEL);
+  // 分からなければ今までどおり Baseline の 3.1 だけにしておく
+  webrtc::H264::Level level =
+      levels.empty() ? webrtc::H264::kLevel3_1 : V4L2ToH264Level(levels.back());
+
+  std::vector<webrtc::H264::ProfileLevelId> result;
+  if (Contains(profiles, V4L2_MPEG_VIDEO_H264_PROFILE_HIGH)) {
+    result.emplace_back(webrtc::H264::kProfileHigh, level);
+  }
+  if (Contains(profiles, V4L2_MPEG_VIDEO_H264_PROFILE_MAIN)) {
+    result.emplace_back(webrtc::H264::kProfileMain, level);
+  }
+  result.emplace_back(webrtc::H264::kProfileConstrainedBaseline, level);
+  result.emplace_back(webrtc::H264::kProfileBaseline, level);
+  return result;
+}
+
+bool V4L2M2MVideoEncoder::Configure(const Config& config,
+                                    OutputCallback callback) {
+  std::string pool_key = std::string(codec_type_ == webrtc::kVideoCodecH264
+                                         ? "H264 "
+                                         : "VP8 ") +
+                         device_ + " " + std::to_string(config.width) + "x" +
+                         std::to_string(config.height);
+  if (codec_type_ == webrtc::kVideoCodecH264) {
+    pool_key += " " + std::to_string(config.h264_profile) + "/" +
+                std::to_string(config.h264_level);
+  }
+  pool_key += " ir:" + std::to_string(config.intra_refresh_period);
+  auto m2m_callback = [callback](const uint8_t* data, size_t size,
+                                 uint64_t key, bool key_frame) {
+    callback(data, size, static_cast<uint32_t>(key), key_frame);
+  };
+
+  // 使い回せるものがあれば、今のデバイスを戻す前に取り出しておく
+  std::unique_ptr<V4L2M2MDevice> m2m;
+  if (pool_) {
+    m2m = pool_->Acquire(pool_key);
+  }
+  Release();
+
+  if (m2m) {
+    // 新しい相手のためにキーフレームから始める。
+    // ビットレートとフレームレートは HWVideoEncoder が設定し直す
+    m2m->ForceKeyFrame();
+    m2m->SetCallback(m2m_callback);
+  } else {
+    m2m = Open(config, m2m_callback);
+    if (!m2m && pool_ && pool_->idle_count() > 0) {
+      // 残しているデバイスがハードウェアを使い切っているかもしれない
+      pool_->Clear();
+      m2m = Open(config, m2m_callback);
+    }
+    if (!m2m) {
+      return false;
+    }
+  }
+
+  m2m_ = std::move(m2m);
+  m2m_key_ = pool_key;
+  return true;
+}
+
+std::unique_ptr<V4L2M2MDevice> V4L2M2MVideoEncoder::Open(
+    const Config& config,
+    V4L2M2MDevice::OutputCallback callback) {
+  V4L2M2MDevice::Config m2m_config;
+  m2m_config.coded_fourcc = CodedFourcc(codec_type_);
+  m2m_config.width = config.width;
+  m2m_config.height = config.height;
+  m2m_config.framerate = config.framerate;
+  m2m_config.bitrate_bps = config.bitrate_bps;
+  m2m_config.controls.push_back(std::make_pair(
+      V4L2_CID_MPEG_VIDEO_BITRATE_MODE, V4L2_MPEG_VIDEO_BITRATE_MODE_CBR));
+  int key_frame_interval = config.intra_refresh_period > 0
+                               ? kIntraRefreshKeyFrameInterval
+                               : kKeyFrameInterval;
+  m2m_config.controls.push_back(
+      std::make_pair(V4L2_CID_MPEG_VIDEO_GOP_SIZE, key_frame_interval));
+  if (config.intra_refresh_period > 0) {
+    int mb_cols = (config.width + 15) / 16;
+    int mb_rows = (config.height + 15) / 16;
+    // 古いドライバは 1 フレームで更新するマクロブロックの数で、
+    // 新しいドライバは全体を更新するまでのフレーム数で指定する
+    m2m_config.controls.push_back(std::make_pair(
+        V4L2_CID_MPEG_VIDEO_CYCLIC_INTRA_REFRESH_MB,
+        (mb_cols * mb_rows + config.intra_refresh_period - 1) /
+            config.intra_refresh_period));
+#ifdef V4L2_CID_MPEG_VIDEO_INTRA_REFRESH_PERIOD
+    m2m_config.controls.push_back(
+        std::make_pair(V4L2_CID_MPEG_VIDEO_INTRA_REFRESH_PERIOD,
+                       config.intra_refresh_period));
+#endif
+    if (codec_type_ == webrtc::kVideoCodecH264) {
+      // スライスに分けて、失ったパケットの影響をそのスライスだけにする
+      m2m_config.controls.push_back(
+          std::make_pair(V4L2_CID_MPEG_VIDEO_MULTI_SLICE_MODE,
+                         V4L2_MPEG_VIDEO_MULTI_SLICE_MODE_MAX_MB));
+      m2m_config.controls.push_back(std::make_pair(
+          V4L2_CID_MPEG_VIDEO_MULTI_SLICE_MAX_MB,
+          (mb_rows + kIntraRefreshSlices - 1) / kIntraRefreshSlices *
+              mb_cols));
+    }
+  }
+  if (codec_type_ == webrtc::kVideoCodecH264) {
+    bool baseline = IsH264BaselineProfile(config.h264_profile);
+    int32_t profile = H264ProfileToV4L2(config.h264_profile);
+    if (baseline) {
+      // Constrained Baseline を選べないデバイスでは Baseline にする。
+      // FMO や ASO を使うエンコーダは無いので、そのまま送れる
+      std::vector<int32_t> profiles = V4L2M2MDevice::QueryMenu(
+          device_, V4L2_CID_MPEG_VIDEO_H264_PROFILE);
+      if (!Contains(profiles, profile)) {
+        profile = V4L2_MPEG_VIDEO_H264_PROFILE_BASELINE;
+      }
+    }
+    m2m_config.controls.push_back(
+        std::make_pair(V4L2_CID_MPEG_VIDEO_H264_PROFILE, profile));
+    m2m_config.controls.push_back(std::make_pair(
+        V4L2_CID_MPEG_VIDEO_H264_LEVEL, H264LevelToV4L2(config.h264_level)));
+    // Main と High では CABAC を、High では 8x8 変換も使う
+    m2m_config.controls.push_back(std::make_pair(
+        V4L2_CID_MPEG_VIDEO_H264_ENTROPY_MODE,
+        baseline ? V4L2_MPEG_VIDEO_H264_ENTROPY_MODE_CAVLC
+                 : V4L2_MPEG_VIDEO_H264_ENTROPY_MODE_CABAC));
+    m2m_config.controls.push_back(
+        std::make_pair(V4L2_CID_MPEG_VIDEO_H264_8X8_TRANSFORM,
+                       profile == V4L2_MPEG_VIDEO_H264_PROFILE_HIGH ? 1 : 0));
+    m2m_config.controls.push_back(
+        std::make_pair(V4L2_CID_MPEG_VIDEO_H264_I_PERIOD, key_frame_interval));
+    // SPS と PPS を毎回 IDR の前に付けてもらう
+    m2m_config.controls.push_back(
+        std::make_pair(V4L2_CID_MPEG_VIDEO_REPEAT_SEQ_HEADER, 1));
+    m2m_config.controls.push_back(
+        std::make_pair(V4L2_CID_MPEG_VIDEO_HEADER_MODE,
+                       V4L2_MPEG_VIDEO_HEADER_MODE_JOINED_WITH_1ST_FRAME));
+#ifdef V4L2_CID_MPEG_VIDEO_PREPEND_SPSPPS_TO_IDR
+    m2m_config.controls.push_back(
+        std::make_pair(V4L2_CID_MPEG_VIDEO_PREPEND_SPSPPS_TO_IDR, 1));
+#endif
+  }
+
+  return V4L2M2MDevice::Open(device_, m2m_config, callback);
+}
+
+void V4L2M2MVideoEncoder::Release() {
+  if (!m2m_) {
+    return;
+  }
+  // 戻した後に出てきたフレームはこちらに渡さない
+  m2m_->SetCallback(nullptr);
+  if (pool_) {
+    pool_->Release(m2m_key_, std::move(m2m_));
+  } else {
+    // poll スレッドが止まってから片付ける
+    m2m_.reset();
+  }
+}
+
+HWEncoderBackend::EncodeResult V4L2M2MVideoEncoder::Encode(
+    const webrtc::VideoFrame& frame,
+    bool force_key_frame) {
+  if (force_key_frame && !m2m_->ForceKeyFrame()) {
+    RTC_LOG(LS_WARNING) << "Failed to request key frame";
+  }
+  rtc::scoped_refptr<webrtc::I420BufferInterface> i420_buffer =
+      frame.video_frame_buffer()->ToI420();
+  if (!m2m_->Encode(*i420_buffer, frame.timestamp())) {
+    return EncodeResult::kDropped;
+  }
+  return EncodeResult::kOk;
+}
+
+void V4L2M2MVideoEncoder::SetBitrate(uint32_t bitrate_bps) {
+  // 対応していないデバイスでは失敗するが、HWVideoEncoder が覚えているので
+  // 毎回 ioctl を呼ぶことはない
+  m2m_->SetBitrate(bitrate_bps);
+}
+
+void V4L2M2MVideoEncoder::SetFramerate(uint32_t framerate) {
+  m2m_->SetFramerate(framerate);
+}
+
+const char* V4L2M2MVideoEncoder::ImplementationName() const {
+  return codec_type_ == webrtc::kVideoCodecH264 ? "V4L2 M2M H264"
+                                                : "V4L2 M2M VP8";
+}
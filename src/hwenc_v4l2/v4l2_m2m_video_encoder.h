@@ -0,0 +1,54 @@
+#ifndef V4L2_M2M_VIDEO_ENCODER_H_
+#define V4L2_M2M_VIDEO_ENCODER_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "media/base/h264_profile_level_id.h"
+#include "rtc/hw_encoder_backend.h"
+#include "rtc/hw_encoder_pool.h"
+#include "v4l2_m2m_device.h"
+
+typedef HWEncoderPool<V4L2M2MDevice> V4L2M2MDevicePool;
+
+// V4L2 の memory-to-memory エンコーダを使う H264 と VP8 のバックエンド。
+// HWVideoEncoder に渡して使う。
+// device は V4L2M2MDevice::FindDevice で見つけたもの。
+// pool を渡すと、使い終わったデバイスを閉じずに pool に戻して使い回す。
+class V4L2M2MVideoEncoder : public HWEncoderBackend {
+ public:
+  V4L2M2MVideoEncoder(webrtc::VideoCodecType codec_type,
+                      const std::string& device,
+                      std::shared_ptr<V4L2M2MDevicePool> pool);
+  ~V4L2M2MVideoEncoder() override;
+
+  // codec_type をエンコードできるデバイス。無ければ空
+  static std::string FindDevice(webrtc::VideoCodecType codec_type);
+  // device が H264 で選べるプロファイルと、それぞれで出せる最大のレベル
+  static std::vector<webrtc::H264::ProfileLevelId> SupportedH264Profiles(
+      const std::string& device);
+
+  bool Configure(const Config& config, OutputCallback callback) override;
+  void Release() override;
+  EncodeResult Encode(const webrtc::VideoFrame& frame,
+                      bool force_key_frame) override;
+  void SetBitrate(uint32_t bitrate_bps) override;
+  void SetFramerate(uint32_t framerate) override;
+  const char* ImplementationName() const override;
+
+ private:
+  std::unique_ptr<V4L2M2MDevice> Open(const Config& config,
+                                      V4L2M2MDevice::OutputCallback callback);
+
+  const webrtc::VideoCodecType codec_type_;
+  const std::string device_;
+  std::shared_ptr<V4L2M2MDevicePool> pool_;
+
+  std::unique_ptr<V4L2M2MDevice> m2m_;
+  std::string m2m_key_;
+};
+
+#endif  // V4L2_M2M_VIDEO_ENCODER_H_
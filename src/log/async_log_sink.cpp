@@ -0,0 +1,301 @@
+#include "async_log_sink.h"
+
+#include <string.h>
+
+#include <boost/filesystem.hpp>
+
+#include "rtc_base/platform_thread_types.h"
+#include "rtc_base/time_utils.h"
+
+namespace {
+
+// 書き込みスレッドがリングバッファを見に行く間隔
+const int kFlushIntervalMs = 50;
+
+// FNV-1a
+uint32_t HashCallSite(const char* data, size_t size) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= static_cast<uint8_t>(data[i]);
+    hash *= 16777619u;
+  }
+  // 0 は空きスロットの印に使うので避ける
+  return hash == 0 ? 1 : hash;
+}
+
+}  // namespace
+
+AsyncLogSink::AsyncLogSink(const std::string& dir,
+                           const std::string& prefix,
+                           size_t max_file_size,
+                           size_t max_files,
+                           int rate_limit_per_sec)
+    : dir_(dir),
+      prefix_(prefix),
+      max_file_size_(max_file_size),
+      max_files_(max_files < 1 ? 1 : max_files),
+      rate_limit_per_sec_(rate_limit_per_sec),
+      slots_(new Slot[kRingSize]),
+      enqueue_pos_(0),
+      dequeue_pos_(0),
+      dropped_(0),
+      rate_limits_(new RateLimitEntry[kRateLimitSlots]),
+      file_(nullptr),
+      file_size_(0),
+      quit_(false) {
+  static_assert((kRingSize & (kRingSize - 1)) == 0,
+                "kRingSize must be a power of 2");
+  for (size_t i = 0; i < kRingSize; i++) {
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  for (size_t i = 0; i < kRateLimitSlots; i++) {
+    rate_limits_[i].key.store(0, std::memory_order_relaxed);
+    rate_limits_[i].window_start_ms.store(0, std::memory_order_relaxed);
+    rate_limits_[i].count.store(0, std::memory_order_relaxed);
+    rate_limits_[i].suppressed.store(0, std::memory_order_relaxed);
+  }
+}
+
+AsyncLogSink::~AsyncLogSink() {
+  if (writer_thread_) {
+    quit_.store(true);
+    wakeup_.Set();
+    writer_thread_->Stop();
+    writer_thread_.reset();
+  }
+  if (file_ != nullptr) {
+    // 止まるまでの間に入ったものも書いておく
+    Drain();
+    fclose(file_);
+    file_ = nullptr;
+  }
+}
+
+bool AsyncLogSink::Init() {
+  boost::system::error_code ec;
+  boost::filesystem::create_directories(dir_, ec);
+  if (!OpenFile()) {
+    return false;
+  }
+  writer_thread_.reset(new rtc::PlatformThread(
+      AsyncLogSink::WriterThread, this, "AsyncLogWriter", rtc::kLowPriority));
+  writer_thread_->Start();
+  return true;
+}
+
+void AsyncLogSink::OnLogMessage(const std::string& message) {
+  OnLogMessage(message, rtc::LS_INFO);
+}
+
+void AsyncLogSink::OnLogMessage(const std::string& message,
+                                rtc::LoggingSeverity severity) {
+  uint32_t suppressed = 0;
+  if (severity <= rtc::LS_INFO && !AllowCallSite(message, &suppressed)) {
+    return;
+  }
+  if (!Push(message, severity, suppressed)) {
+    dropped_.fetch_add(1 + suppressed, std::memory_order_relaxed);
+  }
+}
+
+bool AsyncLogSink::AllowCallSite(const std::string& message,
+                                 uint32_t* suppressed) {
+  if (rate_limit_per_sec_ <= 0) {
+    return true;
+  }
+
+  // RTC_LOG のメッセージには "(file.cc:123): " が入っているので、
+  // これを呼び出し元の識別に使う
+  size_t end = message.find("): ");
+  if (end == std::string::npos) {
+    return true;
+  }
+  size_t begin = message.rfind('(', end);
+  if (begin == std::string::npos) {
+    return true;
+  }
+  uint32_t key = HashCallSite(message.data() + begin, end - begin);
+
+  // 空いているか同じ呼び出し元のエントリを探す。見つからなければ制限しない
+  RateLimitEntry* entry = nullptr;
+  for (size_t i = 0; i < 16; i++) {
+    RateLimitEntry& e = rate_limits_[(key + i) & (kRateLimitSlots - 1)];
+    uint32_t current = e.key.load(std::memory_order_acquire);
+    if (current == 0) {
+      uint32_t expected = 0;
+      if (e.key.compare_exchange_strong(expected, key) || expected == key) {
+        entry = &e;
+        break;
+      }
+    } else if (current == key) {
+      entry = &e;
+      break;
+    }
+  }
+  if (entry == nullptr) {
+    return true;
+  }
+
+  // 1 秒毎の窓で数える。複数のスレッドから同時に来た時は多少ずれてもいい
+  int64_t now_ms = rtc::TimeMillis();
+  int64_t window_start_ms =
+      entry->window_start_ms.load(std::memory_order_relaxed);
+  if (now_ms - window_start_ms >= 1000 &&
+      entry->window_start_ms.compare_exchange_strong(window_start_ms,
+                                                     now_ms)) {
+    entry->count.store(0, std::memory_order_relaxed);
+  }
+  uint32_t count = entry->count.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (count > static_cast<uint32_t>(rate_limit_per_sec_)) {
+    entry->suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  *suppressed = entry->suppressed.exchange(0, std::memory_order_relaxed);
+  return true;
+}
+
+// 複数の書き込み側と 1 つの読み出し側で使う有界キュー。
+// 各スロットの sequence でスロットが書き込み可能か読み出し可能かを表す。
+bool AsyncLogSink::Push(const std::string& message,
+                        rtc::LoggingSeverity severity,
+                        uint32_t suppressed) {
+  Slot* slot;
+  size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+  for (;;) {
+    slot = &slots_[pos & (kRingSize - 1)];
+    size_t sequence = slot->sequence.load(std::memory_order_acquire);
+    intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+    if (diff == 0) {
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // 一杯
+      return false;
+    } else {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+
+  // 末尾の改行は書き出す必要が無いので落とす
+  size_t size = message.size();
+  while (size > 0 && message[size - 1] == '\n') {
+    size--;
+  }
+  if (size > kMaxMessageSize) {
+    size = kMaxMessageSize;
+  }
+  memcpy(slot->data, message.data(), size);
+  slot->header.length = static_cast<uint32_t>(size);
+  slot->header.thread_id = static_cast<uint32_t>(rtc::CurrentThreadId());
+  slot->header.time_us = rtc::TimeUTCMicros();
+  slot->header.suppressed = suppressed;
+  slot->header.severity = static_cast<uint8_t>(severity);
+  memset(slot->header.reserved, 0, sizeof(slot->header.reserved));
+  slot->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+bool AsyncLogSink::Pop(BinaryLogRecordHeader* header, char* data) {
+  Slot* slot = &slots_[dequeue_pos_ & (kRingSize - 1)];
+  size_t sequence = slot->sequence.load(std::memory_order_acquire);
+  if (sequence != dequeue_pos_ + 1) {
+    return false;
+  }
+  *header = slot->header;
+  memcpy(data, slot->data, header->length);
+  slot->sequence.store(dequeue_pos_ + kRingSize, std::memory_order_release);
+  dequeue_pos_++;
+  return true;
+}
+
+void AsyncLogSink::WriterThread(void* obj) {
+  static_cast<AsyncLogSink*>(obj)->WriterProcess();
+}
+
+void AsyncLogSink::WriterProcess() {
+  while (!quit_.load()) {
+    // 書き込み側からは起こさないので、一定間隔でまとめて書き出す
+    if (Drain() == 0) {
+      wakeup_.Wait(kFlushIntervalMs);
+    }
+  }
+}
+
+size_t AsyncLogSink::Drain() {
+  size_t count = 0;
+  BinaryLogRecordHeader header;
+  char data[kMaxMessageSize];
+  while (Pop(&header, data)) {
+    WriteRecord(header, data);
+    count++;
+  }
+
+  uint32_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+  if (dropped > 0) {
+    std::string message = "AsyncLogSink: dropped " + std::to_string(dropped) +
+                          " messages because the buffer was full";
+    header.length = static_cast<uint32_t>(message.size());
+    header.thread_id = static_cast<uint32_t>(rtc::CurrentThreadId());
+    header.time_us = rtc::TimeUTCMicros();
+    header.suppressed = 0;
+    header.severity = static_cast<uint8_t>(rtc::LS_WARNING);
+    memset(header.reserved, 0, sizeof(header.reserved));
+    WriteRecord(header, message.data());
+    count++;
+  }
+
+  if (count > 0 && file_ != nullptr) {
+    fflush(file_);
+  }
+  return count;
+}
+
+void AsyncLogSink::WriteRecord(const BinaryLogRecordHeader& header,
+                               const char* data) {
+  if (file_ == nullptr) {
+    return;
+  }
+  if (max_file_size_ > 0 && file_size_ >= max_file_size_) {
+    Rotate();
+    if (file_ == nullptr) {
+      return;
+    }
+  }
+  fwrite(&header, sizeof(header), 1, file_);
+  fwrite(data, 1, header.length, file_);
+  file_size_ += sizeof(header) + header.length;
+}
+
+bool AsyncLogSink::OpenFile() {
+  std::string path = FilePath(0);
+  file_ = fopen(path.c_str(), "wb");
+  if (file_ == nullptr) {
+    RTC_LOG(LS_ERROR) << "Failed to open log file: " << path;
+    return false;
+  }
+  fwrite(kBinaryLogMagic, 1, sizeof(kBinaryLogMagic), file_);
+  fwrite(&kBinaryLogVersion, sizeof(kBinaryLogVersion), 1, file_);
+  file_size_ = sizeof(kBinaryLogMagic) + sizeof(kBinaryLogVersion);
+  return true;
+}
+
+void AsyncLogSink::Rotate() {
+  fclose(file_);
+  file_ = nullptr;
+
+  // _0 が一番新しくなるように後ろへずらす
+  boost::system::error_code ec;
+  boost::filesystem::remove(FilePath(max_files_ - 1), ec);
+  for (size_t i = max_files_ - 1; i > 0; i--) {
+    boost::filesystem::rename(FilePath(i - 1), FilePath(i), ec);
+  }
+  OpenFile();
+}
+
+std::string AsyncLogSink::FilePath(size_t index) const {
+  return (boost::filesystem::path(dir_) /
+          (prefix_ + "_" + std::to_string(index) + ".blog"))
+      .string();
+}
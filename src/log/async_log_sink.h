@@ -0,0 +1,103 @@
+#ifndef ASYNC_LOG_SINK_H_
+#define ASYNC_LOG_SINK_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "binary_log_format.h"
+#include "rtc_base/event.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/platform_thread.h"
+
+// RTC_LOG の出力をバイナリ形式でファイルに書き出すシンク。
+//
+// OnLogMessage ではロックを取らずにリングバッファへ詰めるだけで、
+// ファイルへの書き込みは専用のスレッドでまとめて行う。
+// エンコーダのスレッドなどフレーム毎にログを出す場所で、ディスクの書き込みを
+// 待たないようにするためのもの。
+//
+// INFO 以下のログは呼び出し元 (ファイル名と行番号) 毎に 1 秒あたりの件数を
+// 制限して、捨てた件数は次に書き出すレコードに記録する。
+// リングバッファが一杯の時も捨てて、捨てた件数を別のレコードとして書き出す。
+//
+// ファイルは <dir>/<prefix>_0.blog に書き込み、max_file_size を超えたら
+// _1, _2, ... とずらして max_files 個まで残す。
+// 読む時は momo_log_decode でテキストに戻す。
+class AsyncLogSink : public rtc::LogSink {
+ public:
+  AsyncLogSink(const std::string& dir,
+               const std::string& prefix,
+               size_t max_file_size,
+               size_t max_files,
+               int rate_limit_per_sec);
+  ~AsyncLogSink() override;
+
+  // ファイルを開いて書き込みスレッドを開始する
+  bool Init();
+
+  void OnLogMessage(const std::string& message) override;
+  void OnLogMessage(const std::string& message,
+                    rtc::LoggingSeverity severity) override;
+
+ private:
+  // 1 レコードに入るメッセージの最大長。これより長いものは切り詰める
+  static const size_t kMaxMessageSize = 488;
+  // リングバッファのスロット数。2 の累乗にすること
+  static const size_t kRingSize = 1024;
+  // 呼び出し元毎のレート制限を覚えておく数
+  static const size_t kRateLimitSlots = 256;
+
+  struct Slot {
+    std::atomic<size_t> sequence;
+    BinaryLogRecordHeader header;
+    char data[kMaxMessageSize];
+  };
+
+  struct RateLimitEntry {
+    std::atomic<uint32_t> key;
+    std::atomic<int64_t> window_start_ms;
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> suppressed;
+  };
+
+  bool AllowCallSite(const std::string& message, uint32_t* suppressed);
+  bool Push(const std::string& message,
+            rtc::LoggingSeverity severity,
+            uint32_t suppressed);
+  bool Pop(BinaryLogRecordHeader* header, char* data);
+
+  static void WriterThread(void* obj);
+  void WriterProcess();
+  size_t Drain();
+  void WriteRecord(const BinaryLogRecordHeader& header, const char* data);
+  bool OpenFile();
+  void Rotate();
+  std::string FilePath(size_t index) const;
+
+  const std::string dir_;
+  const std::string prefix_;
+  const size_t max_file_size_;
+  const size_t max_files_;
+  const int rate_limit_per_sec_;
+
+  std::unique_ptr<Slot[]> slots_;
+  std::atomic<size_t> enqueue_pos_;
+  // 書き込みスレッドからしか触らない
+  size_t dequeue_pos_;
+  std::atomic<uint32_t> dropped_;
+
+  std::unique_ptr<RateLimitEntry[]> rate_limits_;
+
+  FILE* file_;
+  size_t file_size_;
+
+  std::atomic<bool> quit_;
+  rtc::Event wakeup_;
+  std::unique_ptr<rtc::PlatformThread> writer_thread_;
+};
+
+#endif  // ASYNC_LOG_SINK_H_
@@ -0,0 +1,32 @@
+#ifndef BINARY_LOG_FORMAT_H_
+#define BINARY_LOG_FORMAT_H_
+
+#include <stdint.h>
+
+// AsyncLogSink が書き出すバイナリログの形式。
+// デコーダ (tools/log_decode.cpp) からも使うので webrtc には依存させない。
+//
+// ファイルの先頭に kBinaryLogMagic (8 バイト) とバージョン (uint32_t) があり、
+// その後に BinaryLogRecordHeader とメッセージ本体 (length バイト) が続く。
+// 値はすべてリトルエンディアンで、ホストのバイトオーダーのまま書き出している。
+
+static const char kBinaryLogMagic[8] = {'M', 'O', 'M', 'O', 'B', 'L', 'O', 'G'};
+static const uint32_t kBinaryLogVersion = 1;
+
+struct BinaryLogRecordHeader {
+  // メッセージ本体のバイト数
+  uint32_t length;
+  uint32_t thread_id;
+  // UNIX 時刻 (マイクロ秒)
+  int64_t time_us;
+  // このレコードの前に、同じ呼び出し元からレート制限で捨てたログの数
+  uint32_t suppressed;
+  // rtc::LoggingSeverity の値
+  uint8_t severity;
+  uint8_t reserved[3];
+};
+
+static_assert(sizeof(BinaryLogRecordHeader) == 24,
+              "BinaryLogRecordHeader must not have padding");
+
+#endif  // BINARY_LOG_FORMAT_H_
@@ -4,6 +4,7 @@
 #include <atomic>
 #include <condition_variable>
 #include <csignal>
+#include <future>
 #include <iostream>
 #include <string>
 #include <thread>
@@ -12,10 +13,15 @@
 #include "rtc_base/log_sinks.h"
 
 #if USE_ROS
+#if MOMO_NODELET
+#include "ros/momo_nodelet.h"
+#endif
 #include "ros/ros_log_sink.h"
 #include "ros/ros_video_capture.h"
 #include "signal_listener.h"
 #else
+#include "file_capturer/file_video_capturer.h"
+#include "log/async_log_sink.h"
 #if defined(__APPLE__)
 #include "mac_helper/mac_capturer.h"
 #elif defined(__linux__)
@@ -26,7 +32,10 @@
 #endif
 
 #ifndef _MSC_VER
+#include "frame_metadata/frame_metadata_channel.h"
+#include "frame_metadata/frame_metadata_receiver.h"
 #include "serial_data_channel/serial_data_manager.h"
+#include "socket_data_channel/socket_data_manager.h"
 #endif
 
 #if USE_SDL2
@@ -34,15 +43,25 @@
 #endif
 
 #include "ayame/ayame_server.h"
+#include "benchmark/loopback_benchmark.h"
 #include "connection_settings.h"
+#include "metrics/memory_reporter.h"
+#include "metrics/startup_report.h"
 #include "p2p/p2p_server.h"
 #include "rtc/manager.h"
 #include "sora/sora_server.h"
+#include "thread_policy/thread_policy.h"
+#include "timecode/timecode_latency_receiver.h"
 #include "util.h"
 
 const size_t kDefaultMaxLogFileSize = 10 * 1024 * 1024;
 
+#if MOMO_NODELET
+// nodelet の場合は main を持たず、MomoNodelet が別スレッドから呼ぶ
+int MomoMain(int argc, char* argv[]) {
+#else
 int main(int argc, char* argv[]) {
+#endif
   ConnectionSettings cs;
 
   bool is_daemon = false;
@@ -51,8 +70,11 @@ int main(int argc, char* argv[]) {
   bool use_sora = false;
   int log_level = rtc::LS_NONE;
 
-  Util::parseArgs(argc, argv, is_daemon, use_test, use_ayame, use_sora,
-                  log_level, cs);
+  if (!Util::parseArgs(argc, argv, is_daemon, use_test, use_ayame, use_sora,
+                       log_level, cs)) {
+    return 1;
+  }
+  StartupReport::SetPrint(cs.startup_report);
 
 #ifndef _MSC_VER
   if (is_daemon) {
@@ -71,18 +93,42 @@ int main(int argc, char* argv[]) {
   std::unique_ptr<rtc::LogSink> log_sink(new ROSLogSink());
   rtc::LogMessage::AddLogToStream(log_sink.get(), rtc::LS_INFO);
 #else
-  std::unique_ptr<rtc::FileRotatingLogSink> log_sink(
-      new rtc::FileRotatingLogSink("./", "webrtc_logs", kDefaultMaxLogFileSize,
-                                   10));
-  if (!log_sink->Init()) {
-    RTC_LOG(LS_ERROR) << __FUNCTION__ << "Failed to open log file";
-    log_sink.reset();
-    return 1;
+  std::unique_ptr<rtc::LogSink> log_sink;
+  if (cs.binary_log) {
+    std::unique_ptr<AsyncLogSink> async_log_sink(
+        new AsyncLogSink("./", "momo_log", kDefaultMaxLogFileSize, 10,
+                         cs.log_rate_limit));
+    if (!async_log_sink->Init()) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__ << "Failed to open log file";
+      return 1;
+    }
+    log_sink = std::move(async_log_sink);
+  } else {
+    std::unique_ptr<rtc::FileRotatingLogSink> file_log_sink(
+        new rtc::FileRotatingLogSink("./", "webrtc_logs",
+                                     kDefaultMaxLogFileSize, 10));
+    if (!file_log_sink->Init()) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__ << "Failed to open log file";
+      return 1;
+    }
+    log_sink = std::move(file_log_sink);
   }
   rtc::LogMessage::AddLogToStream(log_sink.get(), rtc::LS_INFO);
 #endif
 
-  auto capturer = ([&]() -> rtc::scoped_refptr<ScalableVideoTrackSource> {
+  {
+    std::string error;
+    if (!ThreadPolicy::Init(cs.thread_policy, cs.thread_policy_file,
+                            cs.lock_memory, &error)) {
+      std::cerr << "invalid thread policy: " << error << std::endl;
+      return 1;
+    }
+  }
+  StartupReport::Mark("args_parsed");
+
+  // デバイスの検索とキャプチャの開始は、RTCManager が PeerConnectionFactory を
+  // 作っている間に別スレッドで進める
+  auto create_capturer = [&]() -> rtc::scoped_refptr<ScalableVideoTrackSource> {
     if (cs.no_video) {
       return nullptr;
     }
@@ -91,6 +137,10 @@ int main(int argc, char* argv[]) {
     rtc::scoped_refptr<ROSVideoCapture> capturer(
         new rtc::RefCountedObject<ROSVideoCapture>(cs));
 #else  // USE_ROS
+    if (cs.video_input_pattern || !cs.video_input_file.empty()) {
+      return FileVideoCapturer::Create(cs);
+    }
+
     auto size = cs.getSize();
 #if defined(__APPLE__)
     rtc::scoped_refptr<MacCapturer> capturer = MacCapturer::Create(
@@ -103,43 +153,147 @@ int main(int argc, char* argv[]) {
         DeviceVideoCapturer::Create(size.width, size.height, cs.framerate);
 #endif
 #endif  // USE_ROS
+    if (capturer) {
+      StartupReport::Mark("capturer_ready");
+    }
     return capturer;
-  })();
+  };
+  std::future<rtc::scoped_refptr<ScalableVideoTrackSource>> capturer =
+      std::async(std::launch::async, create_capturer);
 
-  if (!capturer && !cs.no_video) {
-    std::cerr << "failed to create capturer" << std::endl;
-    return 1;
+  if (cs.benchmark_loopback) {
+    std::unique_ptr<LoopbackBenchmark> benchmark(new LoopbackBenchmark(cs));
+    std::unique_ptr<RTCManager> rtc_manager(
+        new RTCManager(cs, std::move(capturer), benchmark.get()));
+    if (!rtc_manager->hasVideoSource() && !cs.no_video) {
+      std::cerr << "failed to create capturer" << std::endl;
+      rtc_manager = nullptr;
+      rtc::LogMessage::RemoveLogToStream(log_sink.get());
+      return 1;
+    }
+    ThreadPolicy::Report();
+    int ret = benchmark->Run(rtc_manager.get());
+    rtc_manager = nullptr;
+    rtc::LogMessage::RemoveLogToStream(log_sink.get());
+    return ret;
   }
 
+  VideoTrackReceiver* receiver = nullptr;
 #if USE_SDL2
   std::unique_ptr<SDLRenderer> sdl_renderer = nullptr;
   if (cs.use_sdl) {
     sdl_renderer.reset(
-        new SDLRenderer(cs.window_width, cs.window_height, cs.fullscreen));
+        new SDLRenderer(cs.window_width, cs.window_height, cs.fullscreen,
+                        cs.low_latency_receive));
+    receiver = sdl_renderer.get();
+  }
+#endif
+
+  std::unique_ptr<TimecodeLatencyReceiver> timecode_receiver = nullptr;
+  if (cs.timecode_detect) {
+    timecode_receiver.reset(
+        new TimecodeLatencyReceiver(receiver, cs.timecode_histogram_file));
+    receiver = timecode_receiver.get();
+  }
+
+  std::unique_ptr<FrameMetadataReceiver> frame_metadata_receiver = nullptr;
+  if (!cs.frame_metadata_output.empty()) {
+    frame_metadata_receiver =
+        FrameMetadataReceiver::Create(receiver, cs.frame_metadata_output);
+    if (!frame_metadata_receiver) {
+      rtc::LogMessage::RemoveLogToStream(log_sink.get());
+      return 1;
+    }
+    receiver = frame_metadata_receiver.get();
   }
 
-  std::unique_ptr<RTCManager> rtc_manager(new RTCManager(
-      cs, std::move(capturer), sdl_renderer.get()));
-#else
   std::unique_ptr<RTCManager> rtc_manager(
-      new RTCManager(cs, std::move(capturer), nullptr));
-#endif
+      new RTCManager(cs, std::move(capturer), receiver));
+  if (!rtc_manager->hasVideoSource() && !cs.no_video) {
+    std::cerr << "failed to create capturer" << std::endl;
+    rtc_manager = nullptr;
+    rtc::LogMessage::RemoveLogToStream(log_sink.get());
+    return 1;
+  }
+  ThreadPolicy::Report();
+  rtc_manager->startBandwidthWarmStart(use_sora    ? cs.sora_signaling_host
+                                       : use_ayame ? cs.ayame_signaling_host
+                                                   : "p2p");
 
   {
     boost::asio::io_context ioc{1};
 
+    // フレームのメタデータと名前で指定した DataChannel はソケットに、
+    // それ以外はシリアルに繋ぐ
+    RTCDataManagerDispatcher data_manager_dispatcher;
+    std::shared_ptr<FrameMetadataChannel> frame_metadata_channel;
+    if (cs.frame_metadata_port != 0 || frame_metadata_receiver) {
+      frame_metadata_channel = FrameMetadataChannel::Create(
+          ioc, cs.frame_metadata_port, frame_metadata_receiver.get());
+      if (!frame_metadata_channel) {
+        return 1;
+      }
+      data_manager_dispatcher.Add(frame_metadata_channel.get());
+      if (rtc_manager->getMetricsCollector()) {
+        std::weak_ptr<FrameMetadataChannel> weak = frame_metadata_channel;
+        rtc_manager->getMetricsCollector()->AddProvider(
+            [weak](std::string* out) {
+              auto frame_metadata_channel = weak.lock();
+              if (frame_metadata_channel) {
+                frame_metadata_channel->AppendMetrics(out);
+              }
+            });
+      }
+    }
+    std::shared_ptr<SocketDataManager> socket_data_manager;
+    if (!cs.data_channel_bridges.empty()) {
+      socket_data_manager =
+          SocketDataManager::Create(ioc, cs.data_channel_bridges);
+      if (!socket_data_manager) {
+        return 1;
+      }
+      data_manager_dispatcher.Add(socket_data_manager.get());
+      if (rtc_manager->getMetricsCollector()) {
+        std::weak_ptr<SocketDataManager> weak = socket_data_manager;
+        rtc_manager->getMetricsCollector()->AddProvider(
+            [weak](std::string* out) {
+              auto socket_data_manager = weak.lock();
+              if (socket_data_manager) {
+                socket_data_manager->AppendMetrics(out);
+              }
+            });
+      }
+    }
+
     std::unique_ptr<RTCDataManager> data_manager = nullptr;
     if (!cs.serial_device.empty()) {
-      data_manager = SerialDataManager::Create(ioc, cs.serial_device, cs.serial_rate);
+      data_manager =
+          SerialDataManager::Create(ioc, cs.serial_device, cs.serial_rate,
+                                    cs.serial_framing, cs.serial_idle_gap);
       if (!data_manager) {
         return 1;
       }
-      rtc_manager->SetDataManager(data_manager.get());
+      data_manager_dispatcher.Add(data_manager.get());
+    }
+    if (!data_manager_dispatcher.empty()) {
+      rtc_manager->SetDataManager(&data_manager_dispatcher);
     }
 
+    // 省メモリモードでは安定した後のメモリ使用量を確認できるようにする
+    std::unique_ptr<MemoryReporter> memory_reporter;
+    if (cs.low_footprint) {
+      memory_reporter.reset(new MemoryReporter(ioc, 30));
+      memory_reporter->Start();
+    }
+
+#if MOMO_NODELET
+    // シグナルは nodelet manager のものなので、アンロードされたら止める
+    MomoNodelet::SetStopHandler([&ioc]() { ioc.stop(); });
+#else
     boost::asio::signal_set signals(ioc, SIGINT, SIGTERM);
     signals.async_wait(
         [&](const boost::system::error_code&, int) { ioc.stop(); });
+#endif
 
     if (use_sora) {
       const boost::asio::ip::tcp::endpoint endpoint{
@@ -182,6 +336,9 @@ int main(int argc, char* argv[]) {
     }
 #else
     ioc.run();
+#endif
+#if MOMO_NODELET
+    MomoNodelet::SetStopHandler(nullptr);
 #endif
   }
 
@@ -190,6 +347,12 @@ int main(int argc, char* argv[]) {
   sdl_renderer = nullptr;
 #endif
   rtc_manager = nullptr;
+  frame_metadata_receiver = nullptr;
+  timecode_receiver = nullptr;
+
+  // バイナリログはここで書き込みスレッドを止めて、残りを書き出す
+  rtc::LogMessage::RemoveLogToStream(log_sink.get());
+  log_sink = nullptr;
 
   return 0;
 }
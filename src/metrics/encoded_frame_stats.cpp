@@ -0,0 +1,138 @@
+#include "encoded_frame_stats.h"
+
+#include <math.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "metrics/metrics_collector.h"
+#include "rtc_base/critical_section.h"
+
+namespace {
+
+// 30fps で 10 秒分
+const size_t kWindowFrames = 300;
+
+struct Window {
+  std::string implementation;
+  std::deque<size_t> sizes;
+  double sum = 0;
+  double sum_squares = 0;
+  uint64_t frames = 0;
+  uint64_t key_frames = 0;
+};
+
+rtc::CriticalSection g_lock;
+// 同じ実装のエンコーダが同時に複数あっても混ざらないように、id ごとに持つ
+std::map<int, Window> g_windows;
+int g_next_id = 0;
+
+std::string Label(int id, const Window& window) {
+  return "implementation=\"" + window.implementation + "\",encoder=\"" +
+         std::to_string(id) + "\"";
+}
+
+}  // namespace
+
+int EncodedFrameStats::AddEncoder(const std::string& implementation) {
+  rtc::CritScope lock(&g_lock);
+  int id = ++g_next_id;
+  g_windows[id].implementation = implementation;
+  return id;
+}
+
+void EncodedFrameStats::RemoveEncoder(int id) {
+  rtc::CritScope lock(&g_lock);
+  g_windows.erase(id);
+}
+
+void EncodedFrameStats::AddFrame(int id, size_t size, bool key_frame) {
+  rtc::CritScope lock(&g_lock);
+  auto it = g_windows.find(id);
+  if (it == g_windows.end()) {
+    return;
+  }
+  Window& window = it->second;
+  window.frames++;
+  if (key_frame) {
+    window.key_frames++;
+  }
+  window.sizes.push_back(size);
+  window.sum += size;
+  window.sum_squares += static_cast<double>(size) * size;
+  if (window.sizes.size() > kWindowFrames) {
+    double old = window.sizes.front();
+    window.sizes.pop_front();
+    window.sum -= old;
+    window.sum_squares -= old * old;
+  }
+}
+
+void EncodedFrameStats::AppendMetrics(std::string* out) {
+  rtc::CritScope lock(&g_lock);
+  if (g_windows.empty()) {
+    return;
+  }
+  MetricsCollector::AppendHeader(out, "momo_encoded_frames_total", "counter",
+                                 "Frames encoded by the video encoder");
+  for (const auto& w : g_windows) {
+    MetricsCollector::AppendSample(out, "momo_encoded_frames_total",
+                                   Label(w.first, w.second), w.second.frames);
+  }
+  MetricsCollector::AppendHeader(out, "momo_encoded_key_frames_total",
+                                 "counter",
+                                 "Key frames encoded by the video encoder");
+  for (const auto& w : g_windows) {
+    MetricsCollector::AppendSample(out, "momo_encoded_key_frames_total",
+                                   Label(w.first, w.second),
+                                   w.second.key_frames);
+  }
+
+  // 同じ名前のサンプルは HELP と TYPE の後にまとめて並べる必要がある
+  struct Summary {
+    std::string label;
+    double mean;
+    double stddev;
+    double max;
+  };
+  std::vector<Summary> summaries;
+  for (const auto& w : g_windows) {
+    const Window& window = w.second;
+    if (window.sizes.empty()) {
+      continue;
+    }
+    double n = window.sizes.size();
+    double mean = window.sum / n;
+    // 引き算の誤差で僅かに負になることがある
+    double variance = std::max(0.0, window.sum_squares / n - mean * mean);
+    double max_size =
+        *std::max_element(window.sizes.begin(), window.sizes.end());
+    summaries.push_back(
+        {Label(w.first, window), mean, sqrt(variance), max_size});
+  }
+
+  MetricsCollector::AppendHeader(
+      out, "momo_encoded_frame_size_mean_bytes", "gauge",
+      "Mean encoded frame size over the last 300 frames");
+  for (const Summary& summary : summaries) {
+    MetricsCollector::AppendSample(out, "momo_encoded_frame_size_mean_bytes",
+                                   summary.label, summary.mean);
+  }
+  MetricsCollector::AppendHeader(
+      out, "momo_encoded_frame_size_stddev_bytes", "gauge",
+      "Standard deviation of encoded frame size over the last 300 frames");
+  for (const Summary& summary : summaries) {
+    MetricsCollector::AppendSample(out, "momo_encoded_frame_size_stddev_bytes",
+                                   summary.label, summary.stddev);
+  }
+  MetricsCollector::AppendHeader(
+      out, "momo_encoded_frame_size_max_bytes", "gauge",
+      "Largest encoded frame size over the last 300 frames");
+  for (const Summary& summary : summaries) {
+    MetricsCollector::AppendSample(out, "momo_encoded_frame_size_max_bytes",
+                                   summary.label, summary.max);
+  }
+}
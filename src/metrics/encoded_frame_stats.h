@@ -0,0 +1,27 @@
+#ifndef ENCODED_FRAME_STATS_H_
+#define ENCODED_FRAME_STATS_H_
+
+#include <stddef.h>
+
+#include <string>
+
+// エンコードしたフレームの大きさのばらつき。
+// キーフレームでビットレートが跳ねていないかを見るために、
+// エンコーダごとに直近のフレームの大きさの平均、標準偏差、最大を
+// /metrics で公開する。
+// 今のところ HWVideoEncoder だけが記録していて、ソフトウェアの VP8 や VP9 の
+// エンコーダの分は出ない。
+class EncodedFrameStats {
+ public:
+  // エンコーダを作った時に呼んで、返ってきた id を AddFrame に渡す
+  static int AddEncoder(const std::string& implementation);
+  // エンコーダを破棄する時に呼ぶ。そのエンコーダの分は出さなくなる
+  static void RemoveEncoder(int id);
+  // エンコードスレッドから呼ぶ
+  static void AddFrame(int id, size_t size, bool key_frame);
+
+  // Prometheus のテキスト形式で書き足す
+  static void AppendMetrics(std::string* out);
+};
+
+#endif  // ENCODED_FRAME_STATS_H_
@@ -0,0 +1,55 @@
+#include "memory_reporter.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtc_base/logging.h"
+
+MemoryReporter::MemoryReporter(boost::asio::io_context& ioc, int interval_sec)
+    : timer_(ioc), interval_sec_(interval_sec) {}
+
+void MemoryReporter::Start() {
+  Schedule();
+}
+
+bool MemoryReporter::Get(size_t* rss_bytes, size_t* peak_bytes) {
+#if defined(__linux__)
+  FILE* fp = fopen("/proc/self/status", "r");
+  if (fp == nullptr) {
+    return false;
+  }
+  char line[256];
+  size_t rss_kb = 0;
+  size_t peak_kb = 0;
+  while (fgets(line, sizeof(line), fp) != nullptr) {
+    if (strncmp(line, "VmRSS:", 6) == 0) {
+      rss_kb = strtoul(line + 6, nullptr, 10);
+    } else if (strncmp(line, "VmHWM:", 6) == 0) {
+      peak_kb = strtoul(line + 6, nullptr, 10);
+    }
+  }
+  fclose(fp);
+  *rss_bytes = rss_kb * 1024;
+  *peak_bytes = peak_kb * 1024;
+  return rss_kb > 0;
+#else
+  return false;
+#endif
+}
+
+void MemoryReporter::Schedule() {
+  timer_.expires_from_now(boost::posix_time::seconds(interval_sec_));
+  timer_.async_wait([this](const boost::system::error_code& ec) {
+    if (ec == boost::asio::error::operation_aborted) {
+      return;
+    }
+
+    size_t rss_bytes, peak_bytes;
+    if (Get(&rss_bytes, &peak_bytes)) {
+      RTC_LOG(LS_INFO) << "Memory usage: rss=" << rss_bytes / 1024
+                       << "KB peak=" << peak_bytes / 1024 << "KB";
+    }
+    Schedule();
+  });
+}
@@ -0,0 +1,26 @@
+#ifndef MEMORY_REPORTER_H_
+#define MEMORY_REPORTER_H_
+
+#include <stddef.h>
+
+#include <boost/asio.hpp>
+
+// プロセスの常駐メモリ (RSS) を一定間隔でログに出す。
+// 起動直後はメモリが増えていくので、安定した後の値を見るためのもの。
+class MemoryReporter {
+ public:
+  MemoryReporter(boost::asio::io_context& ioc, int interval_sec);
+
+  void Start();
+
+  // /proc/self/status から今の RSS とピークの RSS を読む。Linux 以外では false
+  static bool Get(size_t* rss_bytes, size_t* peak_bytes);
+
+ private:
+  void Schedule();
+
+  boost::asio::deadline_timer timer_;
+  const int interval_sec_;
+};
+
+#endif  // MEMORY_REPORTER_H_
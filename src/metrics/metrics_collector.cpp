@@ -0,0 +1,324 @@
+#include "metrics_collector.h"
+
+#include <stdio.h>
+
+#include "api/stats/rtcstats_objects.h"
+#include "rtc/stats_callback.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/ref_counted_object.h"
+#include "rtc_base/time_utils.h"
+
+constexpr const char* MetricsCollector::kContentType;
+
+namespace {
+
+struct FamilyInfo {
+  const char* name;
+  const char* type;
+  const char* help;
+};
+
+// MetricsCollector::Family と同じ順番に並べること
+const FamilyInfo kFamilies[] = {
+    {"momo_video_frames_encoded_total", "counter", "Frames encoded"},
+    {"momo_video_encode_fps", "gauge", "Encoded frames per second"},
+    {"momo_video_encode_qp", "gauge", "Average QP of encoded frames"},
+    {"momo_video_bytes_sent_total", "counter", "Video payload bytes sent"},
+    {"momo_video_send_bitrate_bps", "gauge", "Video send bitrate"},
+    {"momo_video_nack_received_total", "counter", "NACKs received"},
+    {"momo_video_pli_received_total", "counter", "PLIs received"},
+    {"momo_video_fir_received_total", "counter", "FIRs received"},
+    {"momo_video_frames_decoded_total", "counter", "Frames decoded"},
+    {"momo_video_decode_fps", "gauge", "Decoded frames per second"},
+    {"momo_video_decode_qp", "gauge", "Average QP of decoded frames"},
+    {"momo_video_bytes_received_total", "counter",
+     "Video payload bytes received"},
+    {"momo_video_receive_bitrate_bps", "gauge", "Video receive bitrate"},
+    {"momo_video_packets_lost_total", "counter", "Video packets lost"},
+    {"momo_video_nack_sent_total", "counter", "NACKs sent"},
+    {"momo_video_pli_sent_total", "counter", "PLIs sent"},
+    {"momo_video_frames_dropped_total", "counter",
+     "Received frames dropped before rendering"},
+    {"momo_video_jitter_buffer_delay_seconds", "gauge",
+     "Average jitter buffer delay of received frames"},
+    {"momo_video_jitter_buffer_delay_current_seconds", "gauge",
+     "Average jitter buffer delay of frames emitted since the last collection"},
+    {"momo_round_trip_time_seconds", "gauge",
+     "Current round trip time of the nominated candidate pair"},
+    {"momo_connections", "gauge", "Live peer connections"},
+};
+
+template <typename T>
+double Value(const webrtc::RTCStatsMember<T>& member) {
+  return member.is_defined() ? static_cast<double>(*member) : 0;
+}
+
+}  // namespace
+
+MetricsCollector::MetricsCollector(rtc::Thread* thread,
+                                   int interval_ms,
+                                   ConnectionsGetter connections_getter)
+    : thread_(thread),
+      interval_ms_(interval_ms),
+      connections_getter_(std::move(connections_getter)),
+      running_(false),
+      round_(0),
+      pending_(0),
+      connection_count_(0),
+      families_(kNumFamilies) {
+  static_assert(sizeof(kFamilies) / sizeof(kFamilies[0]) == kNumFamilies,
+                "kFamilies must match MetricsCollector::Family");
+}
+
+MetricsCollector::~MetricsCollector() {}
+
+void MetricsCollector::AddProvider(Provider provider) {
+  thread_->Invoke<void>(RTC_FROM_HERE,
+                        [this, &provider]() { providers_.push_back(provider); });
+}
+
+void MetricsCollector::Start() {
+  thread_->Invoke<void>(RTC_FROM_HERE, [this]() {
+    if (running_) {
+      return;
+    }
+    running_ = true;
+    thread_->Post(RTC_FROM_HERE, this);
+  });
+}
+
+void MetricsCollector::Stop() {
+  thread_->Invoke<void>(RTC_FROM_HERE, [this]() {
+    running_ = false;
+    thread_->Clear(this);
+  });
+}
+
+std::string MetricsCollector::GetText() {
+  rtc::CritScope lock(&text_lock_);
+  return text_;
+}
+
+void MetricsCollector::AppendSample(std::string* out,
+                                    const std::string& name,
+                                    const std::string& labels,
+                                    double value) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.10g", value);
+  out->append(name);
+  if (!labels.empty()) {
+    out->append("{");
+    out->append(labels);
+    out->append("}");
+  }
+  out->append(" ");
+  out->append(buf);
+  out->append("\n");
+}
+
+void MetricsCollector::AppendHeader(std::string* out,
+                                    const std::string& name,
+                                    const char* type,
+                                    const char* help) {
+  out->append("# HELP " + name + " " + help + "\n");
+  out->append("# TYPE " + name + " " + type + "\n");
+}
+
+void MetricsCollector::OnMessage(rtc::Message* msg) {
+  if (!running_) {
+    return;
+  }
+  Collect();
+  thread_->PostDelayed(RTC_FROM_HERE, interval_ms_, this);
+}
+
+void MetricsCollector::Collect() {
+  // 前回の収集が終わっていなくても新しく始める。古い結果は捨てる
+  round_++;
+  for (std::string& family : families_) {
+    family.clear();
+  }
+  next_counters_.clear();
+
+  Connections connections = connections_getter_();
+  connection_count_ = static_cast<int>(connections.size());
+  pending_ = connection_count_;
+  if (pending_ == 0) {
+    Publish();
+    return;
+  }
+
+  std::weak_ptr<MetricsCollector> weak_self = shared_from_this();
+  int round = round_;
+  for (const auto& connection : connections) {
+    int connection_id = connection.first;
+    rtc::scoped_refptr<StatsCallback> callback(
+        new rtc::RefCountedObject<StatsCallback>(
+            [weak_self, round, connection_id](
+                const rtc::scoped_refptr<const webrtc::RTCStatsReport>&
+                    report) {
+              auto self = weak_self.lock();
+              if (self) {
+                self->OnStatsDelivered(round, connection_id, report);
+              }
+            }));
+    connection.second->getConnection()->GetStats(callback.get());
+  }
+}
+
+void MetricsCollector::OnStatsDelivered(
+    int round,
+    int connection_id,
+    const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report) {
+  if (round != round_ || !running_) {
+    return;
+  }
+  // 届いた接続から順に整形しておく
+  FormatReport(connection_id, report);
+  if (--pending_ == 0) {
+    Publish();
+  }
+}
+
+void MetricsCollector::FormatReport(
+    int connection_id,
+    const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report) {
+  const int64_t now_us = rtc::TimeMicros();
+  const std::string id = std::to_string(connection_id);
+  const std::string connection_label = "connection=\"" + id + "\"";
+
+  // 前回からの差分で fps、ビットレート、平均 QP を求める
+  auto add_rates = [&](const std::string& key, const std::string& labels,
+                       const Counters& current, Family fps, Family bitrate,
+                       Family qp) {
+    auto prev = counters_.find(key);
+    next_counters_[key] = current;
+    if (prev == counters_.end() || current.time_us <= prev->second.time_us) {
+      return;
+    }
+    double elapsed_sec = (current.time_us - prev->second.time_us) / 1e6;
+    double frames = current.frames - prev->second.frames;
+    AddSample(fps, labels, frames / elapsed_sec);
+    AddSample(bitrate, labels,
+              (current.bytes - prev->second.bytes) * 8 / elapsed_sec);
+    if (frames > 0) {
+      AddSample(qp, labels, (current.qp_sum - prev->second.qp_sum) / frames);
+    }
+  };
+
+  for (const webrtc::RTCOutboundRTPStreamStats* stats :
+       report->GetStatsOfType<webrtc::RTCOutboundRTPStreamStats>()) {
+    if (!stats->media_type.is_defined() || *stats->media_type != "video") {
+      continue;
+    }
+    std::string ssrc =
+        std::to_string(static_cast<uint32_t>(Value(stats->ssrc)));
+    std::string labels = connection_label + ",ssrc=\"" + ssrc + "\"";
+    Counters current;
+    current.time_us = now_us;
+    current.frames = Value(stats->frames_encoded);
+    current.bytes = Value(stats->bytes_sent);
+    current.qp_sum = Value(stats->qp_sum);
+    AddSample(kFramesEncoded, labels, current.frames);
+    AddSample(kBytesSent, labels, current.bytes);
+    AddSample(kNackReceived, labels, Value(stats->nack_count));
+    AddSample(kPliReceived, labels, Value(stats->pli_count));
+    AddSample(kFirReceived, labels, Value(stats->fir_count));
+    add_rates("out:" + id + ":" + ssrc, labels, current, kEncodeFps,
+              kSendBitrate, kEncodeQp);
+  }
+
+  for (const webrtc::RTCInboundRTPStreamStats* stats :
+       report->GetStatsOfType<webrtc::RTCInboundRTPStreamStats>()) {
+    if (!stats->media_type.is_defined() || *stats->media_type != "video") {
+      continue;
+    }
+    std::string ssrc =
+        std::to_string(static_cast<uint32_t>(Value(stats->ssrc)));
+    std::string labels = connection_label + ",ssrc=\"" + ssrc + "\"";
+    Counters current;
+    current.time_us = now_us;
+    current.frames = Value(stats->frames_decoded);
+    current.bytes = Value(stats->bytes_received);
+    current.qp_sum = Value(stats->qp_sum);
+    AddSample(kFramesDecoded, labels, current.frames);
+    AddSample(kBytesReceived, labels, current.bytes);
+    AddSample(kPacketsLost, labels, Value(stats->packets_lost));
+    AddSample(kNackSent, labels, Value(stats->nack_count));
+    AddSample(kPliSent, labels, Value(stats->pli_count));
+    add_rates("in:" + id + ":" + ssrc, labels, current, kDecodeFps,
+              kReceiveBitrate, kDecodeQp);
+  }
+
+  for (const webrtc::RTCMediaStreamTrackStats* stats :
+       report->GetStatsOfType<webrtc::RTCMediaStreamTrackStats>()) {
+    if (!stats->kind.is_defined() || *stats->kind != "video" ||
+        !stats->remote_source.is_defined() || !*stats->remote_source) {
+      continue;
+    }
+    std::string labels = connection_label + ",track=\"" +
+                         (stats->track_identifier.is_defined()
+                              ? *stats->track_identifier
+                              : stats->id()) +
+                         "\"";
+    AddSample(kFramesDropped, labels, Value(stats->frames_dropped));
+    double emitted = Value(stats->jitter_buffer_emitted_count);
+    if (emitted > 0) {
+      AddSample(kJitterBufferDelay, labels,
+                Value(stats->jitter_buffer_delay) / emitted);
+    }
+    // 累積の平均では接続直後の値が残るので、今の遅延は差分から求める。
+    // 相手の送信側が playout-delay を 0 にしているかはこちらで確認する
+    std::string key = "track:" + id + ":" + stats->id();
+    Counters current;
+    current.time_us = now_us;
+    current.frames = emitted;
+    current.delay = Value(stats->jitter_buffer_delay);
+    auto prev = counters_.find(key);
+    next_counters_[key] = current;
+    if (prev != counters_.end() && current.frames > prev->second.frames) {
+      AddSample(kJitterBufferDelayCurrent, labels,
+                (current.delay - prev->second.delay) /
+                    (current.frames - prev->second.frames));
+    }
+  }
+
+  for (const webrtc::RTCIceCandidatePairStats* stats :
+       report->GetStatsOfType<webrtc::RTCIceCandidatePairStats>()) {
+    if (!stats->nominated.is_defined() || !*stats->nominated ||
+        !stats->current_round_trip_time.is_defined()) {
+      continue;
+    }
+    AddSample(kRoundTripTime, connection_label,
+              *stats->current_round_trip_time);
+  }
+}
+
+void MetricsCollector::AddSample(Family family,
+                                 const std::string& labels,
+                                 double value) {
+  AppendSample(&families_[family], kFamilies[family].name, labels, value);
+}
+
+void MetricsCollector::Publish() {
+  AddSample(kConnections, "", connection_count_);
+  counters_.swap(next_counters_);
+  next_counters_.clear();
+
+  // 同じメトリクスの行はまとめて書き出す必要があるので、ここで連結する
+  std::string text;
+  for (int i = 0; i < kNumFamilies; i++) {
+    if (families_[i].empty()) {
+      continue;
+    }
+    AppendHeader(&text, kFamilies[i].name, kFamilies[i].type,
+                 kFamilies[i].help);
+    text.append(families_[i]);
+  }
+  for (const Provider& provider : providers_) {
+    provider(&text);
+  }
+
+  rtc::CritScope lock(&text_lock_);
+  text_.swap(text);
+}
@@ -0,0 +1,126 @@
+#ifndef METRICS_COLLECTOR_H_
+#define METRICS_COLLECTOR_H_
+
+#include <stdint.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "api/stats/rtc_stats_report.h"
+#include "rtc/connection.h"
+#include "rtc_base/critical_section.h"
+#include "rtc_base/message_handler.h"
+#include "rtc_base/thread.h"
+
+// 全ての RTCConnection の GetStats を一定間隔で集めて、
+// Prometheus のテキスト形式に整形しておくクラス。
+//
+// 収集と整形は指定したスレッド (シグナリングスレッド) で、統計情報が
+// 届いた接続から順に行う。/metrics のリクエストでは整形済みの文字列を
+// 返すだけなので、接続数が多くても io_context を止めない。
+class MetricsCollector
+    : public rtc::MessageHandler,
+      public std::enable_shared_from_this<MetricsCollector> {
+ public:
+  typedef std::vector<std::pair<int, std::shared_ptr<RTCConnection>>>
+      Connections;
+  typedef std::function<Connections()> ConnectionsGetter;
+  // 追加のメトリクスを out に書き足す関数。収集スレッドで呼ばれる
+  typedef std::function<void(std::string* out)> Provider;
+
+  // /metrics のレスポンスの Content-Type
+  static constexpr const char* kContentType = "text/plain; version=0.0.4";
+
+  MetricsCollector(rtc::Thread* thread,
+                   int interval_ms,
+                   ConnectionsGetter connections_getter);
+  ~MetricsCollector() override;
+
+  void AddProvider(Provider provider);
+  void Start();
+  void Stop();
+
+  // 最後に集めたメトリクスを返す。どのスレッドから呼んでもいい
+  std::string GetText();
+
+  // Prometheus の 1 行を書き出す便利関数
+  static void AppendSample(std::string* out,
+                           const std::string& name,
+                           const std::string& labels,
+                           double value);
+  static void AppendHeader(std::string* out,
+                           const std::string& name,
+                           const char* type,
+                           const char* help);
+
+ private:
+  enum Family {
+    kFramesEncoded,
+    kEncodeFps,
+    kEncodeQp,
+    kBytesSent,
+    kSendBitrate,
+    kNackReceived,
+    kPliReceived,
+    kFirReceived,
+    kFramesDecoded,
+    kDecodeFps,
+    kDecodeQp,
+    kBytesReceived,
+    kReceiveBitrate,
+    kPacketsLost,
+    kNackSent,
+    kPliSent,
+    kFramesDropped,
+    kJitterBufferDelay,
+    kJitterBufferDelayCurrent,
+    kRoundTripTime,
+    kConnections,
+    kNumFamilies,
+  };
+
+  // 前回の収集時の累積値。差分から fps やビットレートを求める
+  struct Counters {
+    int64_t time_us = 0;
+    double frames = 0;
+    double bytes = 0;
+    double qp_sum = 0;
+    // ジッタバッファに居た時間の合計 (秒)
+    double delay = 0;
+  };
+
+  void OnMessage(rtc::Message* msg) override;
+  void Collect();
+  void OnStatsDelivered(
+      int round,
+      int connection_id,
+      const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report);
+  void FormatReport(
+      int connection_id,
+      const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report);
+  void AddSample(Family family, const std::string& labels, double value);
+  void Publish();
+
+  rtc::Thread* thread_;
+  const int interval_ms_;
+  ConnectionsGetter connections_getter_;
+  std::vector<Provider> providers_;
+
+  // 以下は thread_ からしか触らない
+  bool running_;
+  int round_;
+  int pending_;
+  int connection_count_;
+  std::vector<std::string> families_;
+  std::map<std::string, Counters> counters_;
+  std::map<std::string, Counters> next_counters_;
+
+  rtc::CriticalSection text_lock_;
+  std::string text_ RTC_GUARDED_BY(text_lock_);
+};
+
+#endif  // METRICS_COLLECTOR_H_
@@ -0,0 +1,68 @@
+#include "recovery_stats.h"
+
+#include "metrics/metrics_collector.h"
+#include "rtc_base/critical_section.h"
+
+namespace {
+
+const char* const kKindNames[] = {"self", "ice_restart", "reconnect"};
+const int kKindCount = 3;
+
+rtc::CriticalSection g_lock;
+uint64_t g_ice_restarts = 0;
+uint64_t g_reconnects = 0;
+uint64_t g_recoveries[kKindCount] = {};
+double g_recovery_seconds[kKindCount] = {};
+double g_last_recovery_seconds = 0;
+
+}  // namespace
+
+void RecoveryStats::CountIceRestart() {
+  rtc::CritScope lock(&g_lock);
+  g_ice_restarts++;
+}
+
+void RecoveryStats::CountReconnect() {
+  rtc::CritScope lock(&g_lock);
+  g_reconnects++;
+}
+
+void RecoveryStats::AddRecovery(Kind kind, int64_t duration_ms) {
+  int index = static_cast<int>(kind);
+  rtc::CritScope lock(&g_lock);
+  g_recoveries[index]++;
+  g_recovery_seconds[index] += duration_ms / 1000.0;
+  g_last_recovery_seconds = duration_ms / 1000.0;
+}
+
+void RecoveryStats::AppendMetrics(std::string* out) {
+  rtc::CritScope lock(&g_lock);
+  MetricsCollector::AppendHeader(out, "momo_ice_restarts_total", "counter",
+                                 "ICE restarts attempted after a disconnect");
+  MetricsCollector::AppendSample(out, "momo_ice_restarts_total", "",
+                                 g_ice_restarts);
+  MetricsCollector::AppendHeader(out, "momo_reconnects_total", "counter",
+                                 "Full signaling and PeerConnection reconnects");
+  MetricsCollector::AppendSample(out, "momo_reconnects_total", "",
+                                 g_reconnects);
+  MetricsCollector::AppendHeader(out, "momo_recoveries_total", "counter",
+                                 "Recoveries from ICE disconnects");
+  for (int i = 0; i < kKindCount; i++) {
+    MetricsCollector::AppendSample(out, "momo_recoveries_total",
+                                   std::string("kind=\"") + kKindNames[i] +
+                                       "\"",
+                                   g_recoveries[i]);
+  }
+  MetricsCollector::AppendHeader(out, "momo_recovery_seconds_total", "counter",
+                                 "Time spent recovering from ICE disconnects");
+  for (int i = 0; i < kKindCount; i++) {
+    MetricsCollector::AppendSample(out, "momo_recovery_seconds_total",
+                                   std::string("kind=\"") + kKindNames[i] +
+                                       "\"",
+                                   g_recovery_seconds[i]);
+  }
+  MetricsCollector::AppendHeader(out, "momo_last_recovery_seconds", "gauge",
+                                 "Time taken by the last recovery");
+  MetricsCollector::AppendSample(out, "momo_last_recovery_seconds", "",
+                                 g_last_recovery_seconds);
+}
@@ -0,0 +1,30 @@
+#ifndef RECOVERY_STATS_H_
+#define RECOVERY_STATS_H_
+
+#include <stdint.h>
+
+#include <string>
+
+// ICE が切れてから映像が戻るまでの回復の統計。
+// シグナリングのクライアントが数えて、/metrics で公開する。
+class RecoveryStats {
+ public:
+  enum class Kind {
+    // 何もしなくても ICE が戻った
+    kSelf,
+    // ICE リスタートで戻った
+    kIceRestart,
+    // WebSocket と PeerConnection を作り直して戻った
+    kReconnect,
+  };
+
+  static void CountIceRestart();
+  static void CountReconnect();
+  // 切れてから戻るまでにかかった時間を記録する
+  static void AddRecovery(Kind kind, int64_t duration_ms);
+
+  // Prometheus のテキスト形式で書き足す
+  static void AppendMetrics(std::string* out);
+};
+
+#endif  // RECOVERY_STATS_H_
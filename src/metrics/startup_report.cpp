@@ -0,0 +1,112 @@
+#include "startup_report.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <set>
+
+#include "rtc_base/critical_section.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+
+namespace {
+
+rtc::CriticalSection g_lock;
+bool g_print = false;
+std::set<std::string>* g_marked = nullptr;
+// 起動時刻が取れない環境では最初に呼ばれた時刻を基準にする
+int64_t g_first_mark_ms = -1;
+
+#if defined(__linux__)
+// CLOCK_BOOTTIME で見た今の時刻。OS の起動からの経過時間になる
+int64_t BootTimeMillis() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_BOOTTIME, &ts) != 0) {
+    return -1;
+  }
+  return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+// プロセスが開始した時刻を OS の起動からの経過時間で返す
+int64_t ProcessStartBootTimeMillis() {
+  FILE* fp = fopen("/proc/self/stat", "r");
+  if (fp == nullptr) {
+    return -1;
+  }
+  char buf[1024];
+  size_t size = fread(buf, 1, sizeof(buf) - 1, fp);
+  fclose(fp);
+  buf[size] = '\0';
+
+  // 2 番目のフィールドのコマンド名には空白が入りうるので、最後の ')' から数える。
+  // starttime は 22 番目のフィールド
+  char* p = strrchr(buf, ')');
+  if (p == nullptr) {
+    return -1;
+  }
+  unsigned long long start_ticks = 0;
+  int field = 2;
+  char* saveptr = nullptr;
+  for (char* token = strtok_r(p + 1, " ", &saveptr); token != nullptr;
+       token = strtok_r(nullptr, " ", &saveptr)) {
+    if (++field == 22) {
+      start_ticks = strtoull(token, nullptr, 10);
+      break;
+    }
+  }
+  long ticks_per_sec = sysconf(_SC_CLK_TCK);
+  if (start_ticks == 0 || ticks_per_sec <= 0) {
+    return -1;
+  }
+  return static_cast<int64_t>(start_ticks * 1000 / ticks_per_sec);
+}
+#endif
+
+}  // namespace
+
+void StartupReport::SetPrint(bool print) {
+  rtc::CritScope lock(&g_lock);
+  g_print = print;
+}
+
+void StartupReport::Mark(const std::string& phase) {
+  int64_t now_ms = rtc::TimeMillis();
+  int64_t boot_ms = -1;
+  int64_t process_ms = -1;
+#if defined(__linux__)
+  static const int64_t start_boot_ms = ProcessStartBootTimeMillis();
+  boot_ms = BootTimeMillis();
+  if (start_boot_ms >= 0 && boot_ms >= 0) {
+    process_ms = boot_ms - start_boot_ms;
+  }
+#endif
+
+  rtc::CritScope lock(&g_lock);
+  if (g_marked == nullptr) {
+    g_marked = new std::set<std::string>();
+  }
+  if (!g_marked->insert(phase).second) {
+    return;
+  }
+  if (g_first_mark_ms < 0) {
+    g_first_mark_ms = now_ms;
+  }
+  if (process_ms < 0) {
+    process_ms = now_ms - g_first_mark_ms;
+  }
+
+  RTC_LOG(LS_INFO) << "Startup: phase=" << phase
+                   << " since_process_start_ms=" << process_ms
+                   << " since_boot_ms=" << boot_ms;
+  if (g_print) {
+    std::cerr << "startup: " << phase << " " << process_ms << " ms";
+    if (boot_ms >= 0) {
+      std::cerr << " (" << boot_ms << " ms since boot)";
+    }
+    std::cerr << std::endl;
+  }
+}
@@ -0,0 +1,17 @@
+#ifndef STARTUP_REPORT_H_
+#define STARTUP_REPORT_H_
+
+#include <string>
+
+// 起動から最初のフレームを送るまでの各段階にかかった時間を記録する。
+// 時間はプロセスの開始時刻 (Linux では /proc/self/stat の starttime) からの
+// 経過時間で、Linux では OS の起動からの経過時間も一緒に出す。
+class StartupReport {
+ public:
+  // --startup-report が指定された時は、ログだけでなく標準エラーにも出す
+  static void SetPrint(bool print);
+  // 段階の名前と経過時間をログに出す。同じ名前は最初の 1 回だけ記録する
+  static void Mark(const std::string& phase);
+};
+
+#endif  // STARTUP_REPORT_H_
@@ -9,13 +9,18 @@ using json = nlohmann::json;
 using IceConnectionState = webrtc::PeerConnectionInterface::IceConnectionState;
 
 P2PConnection::P2PConnection(RTCManager* rtc_manager,
-                             std::function<void(std::string)> send)
+                             std::function<void(std::string)> send,
+                             bool prewarm)
     : _send(send) {
   webrtc::PeerConnectionInterface::RTCConfiguration rtc_config;
   webrtc::PeerConnectionInterface::IceServers servers;
   webrtc::PeerConnectionInterface::IceServer ice_server;
   ice_server.uri = "stun:stun.l.google.com:19302";
   servers.push_back(ice_server);
+  if (prewarm) {
+    _connection = rtc_manager->createPrewarmedConnection(this, servers);
+    return;
+  }
   rtc_config.servers = servers;
   _connection = rtc_manager->createConnection(rtc_config, this);
 }
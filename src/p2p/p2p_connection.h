@@ -11,7 +11,10 @@
 
 class P2PConnection : public RTCMessageSender {
  public:
-  P2PConnection(RTCManager* rtc_manager, std::function<void(std::string)> send);
+  // prewarm が true の時は、オファーが来る前に ICE の候補を集め始めておく
+  P2PConnection(RTCManager* rtc_manager,
+                std::function<void(std::string)> send,
+                bool prewarm = false);
   ~P2PConnection() {}
 
   webrtc::PeerConnectionInterface::IceConnectionState getRTCConnectionState() {
@@ -67,6 +67,20 @@ void P2PSession::onRead(boost::system::error_code ec,
     }
   }
 
+  // Prometheus 用の統計情報
+  if (req_.method() == boost::beast::http::verb::get &&
+      req_.target() == "/metrics") {
+    std::shared_ptr<MetricsCollector> collector =
+        rtc_manager_->getMetricsCollector();
+    if (collector) {
+      sendResponse(Util::okText(req_, MetricsCollector::kContentType,
+                                collector->GetText()));
+    } else {
+      sendResponse(Util::notFound(req_, req_.target()));
+    }
+    return;
+  }
+
   handleRequest();
 }
 
@@ -55,6 +55,18 @@ void P2PWebsocketSession::onAccept(boost::system::error_code ec) {
   ws_->startToRead(std::bind(&P2PWebsocketSession::onRead, shared_from_this(),
                              std::placeholders::_1, std::placeholders::_2,
                              std::placeholders::_3));
+
+  // ブラウザがオファーを作っている間に PeerConnection を作っておく
+  if (conn_settings_.prewarm_connection) {
+    spare_connection_ =
+        std::make_shared<P2PConnection>(rtc_manager_, makeSendFunction(), true);
+  }
+}
+
+std::function<void(std::string)> P2PWebsocketSession::makeSendFunction() {
+  return std::bind([](P2PWebsocketSession* session,
+                      std::string str) { session->ws_->sendText(str); },
+                   this, std::placeholders::_1);
 }
 
 void P2PWebsocketSession::onRead(boost::system::error_code ec,
@@ -95,10 +107,15 @@ void P2PWebsocketSession::onRead(boost::system::error_code ec,
       return;
     }
 
-    auto send = std::bind([](P2PWebsocketSession* session,
-                             std::string str) { session->ws_->sendText(str); },
-                          this, std::placeholders::_1);
-    connection_ = std::make_shared<P2PConnection>(rtc_manager_, send);
+    if (spare_connection_ && spare_connection_->getRTCConnection()) {
+      connection_ = std::move(spare_connection_);
+      rtc_manager_->claimPrewarmedConnection(
+          connection_->getRTCConnection());
+    } else {
+      spare_connection_ = nullptr;
+      connection_ =
+          std::make_shared<P2PConnection>(rtc_manager_, makeSendFunction());
+    }
     std::shared_ptr<RTCConnection> rtc_conn = connection_->getRTCConnection();
     rtc_conn->setOffer(sdp);
   } else if (type == "answer") {
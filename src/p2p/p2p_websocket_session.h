@@ -7,6 +7,7 @@
 #include <boost/beast/http/string_body.hpp>
 #include <boost/system/error_code.hpp>
 #include <cstdlib>
+#include <functional>
 #include <memory>
 #include <string>
 
@@ -24,6 +25,8 @@ class P2PWebsocketSession
   RTCManager* rtc_manager_;
   ConnectionSettings conn_settings_;
   std::shared_ptr<P2PConnection> connection_;
+  // --prewarm-connection の時に、オファーが来る前に作っておく予備の接続
+  std::shared_ptr<P2PConnection> spare_connection_;
 
  public:
   P2PWebsocketSession(RTCManager* rtc_manager,
@@ -39,6 +42,7 @@ class P2PWebsocketSession
   void doAccept(
       boost::beast::http::request<boost::beast::http::string_body> req);
   void onAccept(boost::system::error_code ec);
+  std::function<void(std::string)> makeSendFunction();
 
   void onRead(boost::system::error_code ec,
               std::size_t bytes_transferred,
@@ -0,0 +1,77 @@
+#include "ivf_format.h"
+
+#include <unistd.h>
+
+#include "rtc_base/logging.h"
+
+namespace {
+
+const size_t kIvfFileHeaderSize = 32;
+const size_t kIvfFrameCountOffset = 24;
+
+void AppendLE(std::vector<uint8_t>* out, uint64_t v, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    out->push_back((v >> (8 * i)) & 0xff);
+  }
+}
+
+}  // namespace
+
+const uint32_t IVFFormat::kClockRate;
+
+IVFFormat::IVFFormat(const std::string& codec_name) {
+  std::string fourcc = "    ";
+  if (codec_name == "VP8") {
+    fourcc = "VP80";
+  } else if (codec_name == "VP9") {
+    fourcc = "VP90";
+  } else if (codec_name == "H264") {
+    fourcc = "H264";
+  } else if (codec_name == "AV1X" || codec_name == "AV1") {
+    fourcc = "AV01";
+  }
+  fourcc_ = static_cast<uint32_t>(fourcc[0]) |
+            (static_cast<uint32_t>(fourcc[1]) << 8) |
+            (static_cast<uint32_t>(fourcc[2]) << 16) |
+            (static_cast<uint32_t>(fourcc[3]) << 24);
+}
+
+bool IVFFormat::IsSupported(const std::string& codec_name) {
+  return codec_name == "VP8" || codec_name == "VP9" || codec_name == "H264" ||
+         codec_name == "AV1X" || codec_name == "AV1";
+}
+
+std::string IVFFormat::Extension() const {
+  return "ivf";
+}
+
+void IVFFormat::AppendHeader(const SegmentWriter::Frame& first_frame,
+                             std::vector<uint8_t>* out) {
+  out->insert(out->end(), {'D', 'K', 'I', 'F'});
+  AppendLE(out, 0, 2);
+  AppendLE(out, kIvfFileHeaderSize, 2);
+  AppendLE(out, fourcc_, 4);
+  AppendLE(out, first_frame.width, 2);
+  AppendLE(out, first_frame.height, 2);
+  AppendLE(out, kClockRate, 4);
+  AppendLE(out, 1, 4);
+  // フレーム数はセグメントを閉じる時に埋める
+  AppendLE(out, 0, 4);
+  AppendLE(out, 0, 4);
+}
+
+void IVFFormat::AppendFrame(const SegmentWriter::Frame& frame,
+                            uint64_t pts,
+                            std::vector<uint8_t>* out) {
+  AppendLE(out, frame.data.size(), 4);
+  AppendLE(out, pts, 8);
+  out->insert(out->end(), frame.data.begin(), frame.data.end());
+}
+
+void IVFFormat::FinishSegment(int fd, uint32_t frame_count) {
+  std::vector<uint8_t> count;
+  AppendLE(&count, frame_count, 4);
+  if (pwrite(fd, count.data(), count.size(), kIvfFrameCountOffset) < 0) {
+    RTC_LOG(LS_WARNING) << "IVFFormat failed to update frame count";
+  }
+}
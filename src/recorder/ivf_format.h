@@ -0,0 +1,33 @@
+#ifndef IVF_FORMAT_H_
+#define IVF_FORMAT_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "segment_writer.h"
+
+// VP8/VP9/H.264 の映像を IVF で書き出す。タイムベースは RTP と同じ 90kHz
+class IVFFormat : public SegmentWriter::Format {
+ public:
+  static const uint32_t kClockRate = 90000;
+
+  explicit IVFFormat(const std::string& codec_name);
+
+  // IVF に入れられるコーデックかどうか
+  static bool IsSupported(const std::string& codec_name);
+
+  std::string Extension() const override;
+  void AppendHeader(const SegmentWriter::Frame& first_frame,
+                    std::vector<uint8_t>* out) override;
+  void AppendFrame(const SegmentWriter::Frame& frame,
+                   uint64_t pts,
+                   std::vector<uint8_t>* out) override;
+  void FinishSegment(int fd, uint32_t frame_count) override;
+
+ private:
+  uint32_t fourcc_;
+};
+
+#endif  // IVF_FORMAT_H_
@@ -0,0 +1,184 @@
+#include "ogg_opus_format.h"
+
+#include <unistd.h>
+
+#include "rtc_base/logging.h"
+
+namespace {
+
+const uint8_t kOggHeaderTypeBeginOfStream = 0x02;
+const uint8_t kOggHeaderTypeEndOfStream = 0x04;
+const size_t kOggHeaderTypeOffset = 5;
+const size_t kOggCrcOffset = 22;
+
+void AppendLE(std::vector<uint8_t>* out, uint64_t v, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    out->push_back((v >> (8 * i)) & 0xff);
+  }
+}
+
+// Ogg の CRC は多項式 0x04c11db7 で反転無し、初期値 0
+struct OggCrcTable {
+  OggCrcTable() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t r = i << 24;
+      for (int j = 0; j < 8; j++) {
+        r = (r & 0x80000000) ? (r << 1) ^ 0x04c11db7 : (r << 1);
+      }
+      table[i] = r;
+    }
+  }
+  uint32_t table[256];
+};
+
+uint32_t OggCrc(const uint8_t* data, size_t size) {
+  static const OggCrcTable crc_table;
+  const uint32_t* table = crc_table.table;
+  uint32_t crc = 0;
+  for (size_t i = 0; i < size; i++) {
+    crc = (crc << 8) ^ table[((crc >> 24) & 0xff) ^ data[i]];
+  }
+  return crc;
+}
+
+// CRC のフィールドを 0 にしてページ全体から計算し直す
+void UpdateOggCrc(uint8_t* page, size_t size) {
+  for (int i = 0; i < 4; i++) {
+    page[kOggCrcOffset + i] = 0;
+  }
+  uint32_t crc = OggCrc(page, size);
+  for (int i = 0; i < 4; i++) {
+    page[kOggCrcOffset + i] = (crc >> (8 * i)) & 0xff;
+  }
+}
+
+}  // namespace
+
+const uint32_t OggOpusFormat::kClockRate;
+
+OggOpusFormat::OggOpusFormat(int channels)
+    : channels_(channels),
+      serial_(0),
+      page_sequence_(0),
+      segment_bytes_(0),
+      last_page_offset_(0) {}
+
+int OggOpusFormat::PacketDuration(const uint8_t* data, size_t size) {
+  if (size < 1) {
+    return 0;
+  }
+  // フレームの長さ。48kHz で 2.5ms が 120 サンプル
+  int config = data[0] >> 3;
+  int frame_samples;
+  if (config < 12) {
+    // SILK: 10, 20, 40, 60ms
+    static const int kSilk[] = {480, 960, 1920, 2880};
+    frame_samples = kSilk[config & 3];
+  } else if (config < 16) {
+    // Hybrid: 10, 20ms
+    frame_samples = (config & 1) ? 960 : 480;
+  } else {
+    // CELT: 2.5, 5, 10, 20ms
+    frame_samples = 120 << (config & 3);
+  }
+  int frames;
+  switch (data[0] & 3) {
+    case 0:
+      frames = 1;
+      break;
+    case 1:
+    case 2:
+      frames = 2;
+      break;
+    default:
+      if (size < 2) {
+        return 0;
+      }
+      frames = data[1] & 0x3f;
+      break;
+  }
+  // 1 パケットは 120ms まで
+  int samples = frames * frame_samples;
+  return samples > 5760 ? 0 : samples;
+}
+
+std::string OggOpusFormat::Extension() const {
+  return "opus";
+}
+
+void OggOpusFormat::AppendHeader(const SegmentWriter::Frame& first_frame,
+                                 std::vector<uint8_t>* out) {
+  // セグメント毎に別の論理ストリームにする
+  serial_++;
+  page_sequence_ = 0;
+  segment_bytes_ = 0;
+  last_page_.clear();
+
+  std::vector<uint8_t> head = {'O', 'p', 'u', 's', 'H', 'e', 'a', 'd'};
+  head.push_back(1);
+  head.push_back(static_cast<uint8_t>(channels_));
+  AppendLE(&head, 0, 2);
+  AppendLE(&head, kClockRate, 4);
+  AppendLE(&head, 0, 2);
+  head.push_back(0);
+  AppendPage(head.data(), head.size(), kOggHeaderTypeBeginOfStream, 0, out);
+
+  const std::string vendor = "momo";
+  std::vector<uint8_t> tags = {'O', 'p', 'u', 's', 'T', 'a', 'g', 's'};
+  AppendLE(&tags, vendor.size(), 4);
+  tags.insert(tags.end(), vendor.begin(), vendor.end());
+  AppendLE(&tags, 0, 4);
+  AppendPage(tags.data(), tags.size(), 0, 0, out);
+}
+
+void OggOpusFormat::AppendFrame(const SegmentWriter::Frame& frame,
+                                uint64_t pts,
+                                std::vector<uint8_t>* out) {
+  // グラニュールポジションはページ内の最後のサンプルの位置
+  AppendPage(frame.data.data(), frame.data.size(), 0, pts + frame.duration,
+             out);
+}
+
+void OggOpusFormat::FinishSegment(int fd, uint32_t frame_count) {
+  if (last_page_.empty()) {
+    return;
+  }
+  last_page_[kOggHeaderTypeOffset] |= kOggHeaderTypeEndOfStream;
+  UpdateOggCrc(last_page_.data(), last_page_.size());
+  if (pwrite(fd, last_page_.data(), last_page_.size(), last_page_offset_) <
+      0) {
+    RTC_LOG(LS_WARNING) << "OggOpusFormat failed to set end of stream";
+  }
+  last_page_.clear();
+}
+
+void OggOpusFormat::AppendPage(const uint8_t* data,
+                               size_t size,
+                               uint8_t header_type,
+                               uint64_t granule_position,
+                               std::vector<uint8_t>* out) {
+  size_t page_start = out->size();
+  out->insert(out->end(), {'O', 'g', 'g', 'S'});
+  out->push_back(0);
+  out->push_back(header_type);
+  AppendLE(out, granule_position, 8);
+  AppendLE(out, serial_, 4);
+  AppendLE(out, page_sequence_++, 4);
+  AppendLE(out, 0, 4);
+  // 255 バイト毎に区切るレーシング値。最後が 255 未満になるようにする
+  size_t segments = size / 255 + 1;
+  out->push_back(static_cast<uint8_t>(segments));
+  for (size_t i = 0; i < segments - 1; i++) {
+    out->push_back(255);
+  }
+  out->push_back(static_cast<uint8_t>(size % 255));
+  out->insert(out->end(), data, data + size);
+
+  size_t page_size = out->size() - page_start;
+  UpdateOggCrc(out->data() + page_start, page_size);
+
+  // EOS を付けるために最後のページを覚えておく
+  last_page_offset_ = segment_bytes_;
+  last_page_.assign(out->begin() + page_start, out->end());
+  segment_bytes_ += page_size;
+}
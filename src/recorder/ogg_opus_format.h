@@ -0,0 +1,49 @@
+#ifndef OGG_OPUS_FORMAT_H_
+#define OGG_OPUS_FORMAT_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "segment_writer.h"
+
+// Opus のパケットを Ogg Opus (RFC 7845) で書き出す。
+// 1 パケット 1 ページで書くので、途中で切れてもそれまでのページは再生できる。
+// セグメントを閉じる時に最後のページを書き換えて EOS を付ける
+class OggOpusFormat : public SegmentWriter::Format {
+ public:
+  static const uint32_t kClockRate = 48000;
+
+  explicit OggOpusFormat(int channels);
+
+  // パケットの TOC バイト (RFC 6716 3.1) から 48kHz でのサンプル数を求める。
+  // デコーダを作らずにグラニュールポジションを進めるために使う。
+  // 壊れたパケットなら 0 を返す
+  static int PacketDuration(const uint8_t* data, size_t size);
+
+  std::string Extension() const override;
+  void AppendHeader(const SegmentWriter::Frame& first_frame,
+                    std::vector<uint8_t>* out) override;
+  void AppendFrame(const SegmentWriter::Frame& frame,
+                   uint64_t pts,
+                   std::vector<uint8_t>* out) override;
+  void FinishSegment(int fd, uint32_t frame_count) override;
+
+ private:
+  void AppendPage(const uint8_t* data,
+                  size_t size,
+                  uint8_t header_type,
+                  uint64_t granule_position,
+                  std::vector<uint8_t>* out);
+
+  int channels_;
+  uint32_t serial_;
+  uint32_t page_sequence_;
+  // セグメント先頭からの書き出したバイト数と、最後のページの位置と内容
+  uint64_t segment_bytes_;
+  uint64_t last_page_offset_;
+  std::vector<uint8_t> last_page_;
+};
+
+#endif  // OGG_OPUS_FORMAT_H_
@@ -0,0 +1,187 @@
+#include "recording_audio_decoder_factory.h"
+
+#include <algorithm>
+
+#include <boost/filesystem.hpp>
+
+#include "absl/strings/match.h"
+#include "rtc_base/logging.h"
+
+#include "ogg_opus_format.h"
+#include "segment_writer.h"
+
+namespace {
+
+// Opus の 20ms 分のサンプル数。パケットから長さが取れなかった時に使う
+const int kDefaultOpusPacketDuration = 960;
+
+// ParsePayload でパケットを横取りして記録するデコーダ。
+// ParsePayload が返すフレームは元のデコーダを直接参照しているので、
+// デコード処理そのものは元のデコーダで行われる。
+class RecordingAudioDecoder : public webrtc::AudioDecoder {
+ public:
+  RecordingAudioDecoder(std::unique_ptr<webrtc::AudioDecoder> decoder,
+                        std::unique_ptr<SegmentWriter> writer)
+      : decoder_(std::move(decoder)), writer_(std::move(writer)) {}
+
+  std::vector<ParseResult> ParsePayload(rtc::Buffer&& payload,
+                                        uint32_t timestamp) override {
+    int duration = decoder_->PacketDuration(payload.data(), payload.size());
+    writer_->Push(payload.data(), payload.size(), timestamp,
+                  duration > 0 ? duration : kDefaultOpusPacketDuration, 0, 0,
+                  true);
+    return decoder_->ParsePayload(std::move(payload), timestamp);
+  }
+  void Reset() override { decoder_->Reset(); }
+  int ErrorCode() override { return decoder_->ErrorCode(); }
+  int PacketDuration(const uint8_t* encoded,
+                     size_t encoded_len) const override {
+    return decoder_->PacketDuration(encoded, encoded_len);
+  }
+  int PacketDurationRedundant(const uint8_t* encoded,
+                              size_t encoded_len) const override {
+    return decoder_->PacketDurationRedundant(encoded, encoded_len);
+  }
+  bool PacketHasFec(const uint8_t* encoded, size_t encoded_len) const override {
+    return decoder_->PacketHasFec(encoded, encoded_len);
+  }
+  bool HasDecodePlc() const override { return decoder_->HasDecodePlc(); }
+  size_t DecodePlc(size_t num_frames, int16_t* decoded) override {
+    return decoder_->DecodePlc(num_frames, decoded);
+  }
+  int SampleRateHz() const override { return decoder_->SampleRateHz(); }
+  size_t Channels() const override { return decoder_->Channels(); }
+
+ protected:
+  int DecodeInternal(const uint8_t* encoded,
+                     size_t encoded_len,
+                     int sample_rate_hz,
+                     int16_t* decoded,
+                     SpeechType* speech_type) override {
+    // ParsePayload で返したフレームは元のデコーダでデコードされるので、
+    // ここが呼ばれることはない
+    return -1;
+  }
+
+ private:
+  std::unique_ptr<webrtc::AudioDecoder> decoder_;
+  std::unique_ptr<SegmentWriter> writer_;
+};
+
+// 記録だけを行うデコーダ。Opus のデコーダは作らず、
+// NetEq には届いたパケットの長さ分の無音を返す
+class RecordOnlyAudioDecoder : public webrtc::AudioDecoder {
+ public:
+  RecordOnlyAudioDecoder(size_t channels, std::unique_ptr<SegmentWriter> writer)
+      : channels_(channels), writer_(std::move(writer)) {}
+
+  std::vector<ParseResult> ParsePayload(rtc::Buffer&& payload,
+                                        uint32_t timestamp) override {
+    int duration = PacketDuration(payload.data(), payload.size());
+    writer_->Push(payload.data(), payload.size(), timestamp,
+                  duration > 0 ? duration : kDefaultOpusPacketDuration, 0, 0,
+                  true);
+    return AudioDecoder::ParsePayload(std::move(payload), timestamp);
+  }
+  void Reset() override {}
+  int PacketDuration(const uint8_t* encoded,
+                     size_t encoded_len) const override {
+    return OggOpusFormat::PacketDuration(encoded, encoded_len);
+  }
+  int SampleRateHz() const override { return OggOpusFormat::kClockRate; }
+  size_t Channels() const override { return channels_; }
+
+ protected:
+  int DecodeInternal(const uint8_t* encoded,
+                     size_t encoded_len,
+                     int sample_rate_hz,
+                     int16_t* decoded,
+                     SpeechType* speech_type) override {
+    int duration = PacketDuration(encoded, encoded_len);
+    if (duration <= 0) {
+      duration = kDefaultOpusPacketDuration;
+    }
+    size_t samples = static_cast<size_t>(duration) * channels_;
+    std::fill(decoded, decoded + samples, 0);
+    *speech_type = kSpeech;
+    return static_cast<int>(samples);
+  }
+
+ private:
+  const size_t channels_;
+  std::unique_ptr<SegmentWriter> writer_;
+};
+
+}  // namespace
+
+RecordingAudioDecoderFactory::RecordingAudioDecoderFactory(
+    rtc::scoped_refptr<webrtc::AudioDecoderFactory> factory,
+    const std::string& dir,
+    int segment_duration_sec,
+    size_t segment_size_bytes,
+    bool record_only)
+    : factory_(factory),
+      dir_(dir),
+      segment_duration_sec_(segment_duration_sec),
+      segment_size_bytes_(segment_size_bytes),
+      record_only_(record_only),
+      decoder_count_(0) {
+  boost::system::error_code ec;
+  boost::filesystem::create_directories(dir_, ec);
+  if (ec) {
+    RTC_LOG(LS_ERROR) << "Failed to create record directory " << dir_ << ": "
+                      << ec.message();
+  }
+}
+
+std::vector<webrtc::AudioCodecSpec>
+RecordingAudioDecoderFactory::GetSupportedDecoders() {
+  return factory_->GetSupportedDecoders();
+}
+
+bool RecordingAudioDecoderFactory::IsSupportedDecoder(
+    const webrtc::SdpAudioFormat& format) {
+  return factory_->IsSupportedDecoder(format);
+}
+
+std::unique_ptr<webrtc::AudioDecoder>
+RecordingAudioDecoderFactory::MakeAudioDecoder(
+    const webrtc::SdpAudioFormat& format,
+    absl::optional<webrtc::AudioCodecPairId> codec_pair_id) {
+  // Ogg に入れられるのは Opus だけなので、それ以外はそのまま返す
+  if (!absl::EqualsIgnoreCase(format.name, "opus")) {
+    RTC_LOG(LS_INFO) << "Remote audio stream " << format.name
+                     << " can not be recorded, decoding only";
+    return factory_->MakeAudioDecoder(format, codec_pair_id);
+  }
+
+  std::unique_ptr<webrtc::AudioDecoder> decoder;
+  size_t channels;
+  if (record_only_) {
+    // Opus のデコーダと同じく、stereo=1 の時だけ 2ch にする
+    auto stereo = format.parameters.find("stereo");
+    channels =
+        stereo != format.parameters.end() && stereo->second == "1" ? 2 : 1;
+  } else {
+    decoder = factory_->MakeAudioDecoder(format, codec_pair_id);
+    if (!decoder) {
+      return nullptr;
+    }
+    channels = decoder->Channels();
+  }
+
+  std::string prefix = "recv_opus_" + std::to_string(decoder_count_++);
+  RTC_LOG(LS_INFO) << "Recording remote audio stream to " << prefix
+                   << (record_only_ ? " without decoding" : "");
+  std::unique_ptr<SegmentWriter> writer(new SegmentWriter(
+      std::unique_ptr<SegmentWriter::Format>(
+          new OggOpusFormat(static_cast<int>(channels))),
+      dir_, prefix, OggOpusFormat::kClockRate, segment_duration_sec_,
+      segment_size_bytes_));
+  if (record_only_) {
+    return std::unique_ptr<webrtc::AudioDecoder>(
+        new RecordOnlyAudioDecoder(channels, std::move(writer)));
+  }
+  return std::unique_ptr<webrtc::AudioDecoder>(
+      new RecordingAudioDecoder(std::move(decoder), std::move(writer)));
+}
@@ -0,0 +1,43 @@
+#ifndef RECORDING_AUDIO_DECODER_FACTORY_H_
+#define RECORDING_AUDIO_DECODER_FACTORY_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "api/audio_codecs/audio_decoder.h"
+#include "api/audio_codecs/audio_decoder_factory.h"
+#include "api/scoped_refptr.h"
+
+// 既存のオーディオデコーダファクトリをラップして、受信した Opus のパケットを
+// デコードせずに Ogg Opus で記録するファクトリ。
+// 記録するかどうかはトラック毎のコーデックで決めて、Opus 以外のトラックは
+// 記録せずに普通にデコードして再生する。
+// record_only の場合、記録するトラックは Opus のデコーダを作らずに
+// 記録だけを行い、再生側には無音を渡す。
+class RecordingAudioDecoderFactory : public webrtc::AudioDecoderFactory {
+ public:
+  RecordingAudioDecoderFactory(
+      rtc::scoped_refptr<webrtc::AudioDecoderFactory> factory,
+      const std::string& dir,
+      int segment_duration_sec,
+      size_t segment_size_bytes,
+      bool record_only);
+
+  std::vector<webrtc::AudioCodecSpec> GetSupportedDecoders() override;
+  bool IsSupportedDecoder(const webrtc::SdpAudioFormat& format) override;
+  std::unique_ptr<webrtc::AudioDecoder> MakeAudioDecoder(
+      const webrtc::SdpAudioFormat& format,
+      absl::optional<webrtc::AudioCodecPairId> codec_pair_id) override;
+
+ private:
+  rtc::scoped_refptr<webrtc::AudioDecoderFactory> factory_;
+  const std::string dir_;
+  const int segment_duration_sec_;
+  const size_t segment_size_bytes_;
+  const bool record_only_;
+  std::atomic<int> decoder_count_;
+};
+
+#endif  // RECORDING_AUDIO_DECODER_FACTORY_H_
@@ -0,0 +1,80 @@
+#include "recording_video_decoder.h"
+
+#include "modules/video_coding/include/video_error_codes.h"
+
+RecordingVideoDecoder::RecordingVideoDecoder(
+    std::unique_ptr<webrtc::VideoDecoder> decoder,
+    std::unique_ptr<SegmentWriter> writer)
+    : decoder_(std::move(decoder)),
+      writer_(std::move(writer)),
+      width_(0),
+      height_(0) {}
+
+RecordingVideoDecoder::~RecordingVideoDecoder() {}
+
+int32_t RecordingVideoDecoder::InitDecode(
+    const webrtc::VideoCodec* codec_settings,
+    int32_t number_of_cores) {
+  if (codec_settings != nullptr) {
+    width_ = codec_settings->width;
+    height_ = codec_settings->height;
+  }
+  if (!decoder_) {
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+  return decoder_->InitDecode(codec_settings, number_of_cores);
+}
+
+int32_t RecordingVideoDecoder::Decode(const webrtc::EncodedImage& input_image,
+                                      bool missing_frames,
+                                      int64_t render_time_ms) {
+  // 解像度はキーフレームにしか入っていないので覚えておく
+  if (input_image._encodedWidth != 0 && input_image._encodedHeight != 0) {
+    width_ = input_image._encodedWidth;
+    height_ = input_image._encodedHeight;
+  }
+  writer_->Push(
+      input_image.data(), input_image.size(), input_image.Timestamp(), 0,
+      width_, height_,
+      input_image._frameType == webrtc::VideoFrameType::kVideoFrameKey);
+
+  int32_t result = WEBRTC_VIDEO_CODEC_OK;
+  if (decoder_) {
+    result = decoder_->Decode(input_image, missing_frames, render_time_ms);
+  }
+  // セグメントの頭出しのためのキーフレームは送信側に要求してもらう。
+  // 要求は一度返したら消えるので、PLI を送り続けることはない
+  if (result == WEBRTC_VIDEO_CODEC_OK && writer_->ConsumeKeyFrameRequest()) {
+    return WEBRTC_VIDEO_CODEC_OK_REQUEST_KEYFRAME;
+  }
+  return result;
+}
+
+int32_t RecordingVideoDecoder::RegisterDecodeCompleteCallback(
+    webrtc::DecodedImageCallback* callback) {
+  if (!decoder_) {
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+  return decoder_->RegisterDecodeCompleteCallback(callback);
+}
+
+int32_t RecordingVideoDecoder::Release() {
+  if (!decoder_) {
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+  return decoder_->Release();
+}
+
+bool RecordingVideoDecoder::PrefersLateDecoding() const {
+  if (!decoder_) {
+    return true;
+  }
+  return decoder_->PrefersLateDecoding();
+}
+
+const char* RecordingVideoDecoder::ImplementationName() const {
+  if (!decoder_) {
+    return "RecordOnly";
+  }
+  return decoder_->ImplementationName();
+}
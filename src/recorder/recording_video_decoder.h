@@ -0,0 +1,35 @@
+#ifndef RECORDING_VIDEO_DECODER_H_
+#define RECORDING_VIDEO_DECODER_H_
+
+#include <memory>
+
+#include "api/video_codecs/video_decoder.h"
+#include "segment_writer.h"
+
+// 受信したフレームをデパケタイズ後、デコード前の状態で SegmentWriter に渡すデコーダ。
+// decoder が nullptr の場合は記録だけを行い、デコードは一切しない。
+class RecordingVideoDecoder : public webrtc::VideoDecoder {
+ public:
+  RecordingVideoDecoder(std::unique_ptr<webrtc::VideoDecoder> decoder,
+                        std::unique_ptr<SegmentWriter> writer);
+  ~RecordingVideoDecoder() override;
+
+  int32_t InitDecode(const webrtc::VideoCodec* codec_settings,
+                     int32_t number_of_cores) override;
+  int32_t Decode(const webrtc::EncodedImage& input_image,
+                 bool missing_frames,
+                 int64_t render_time_ms) override;
+  int32_t RegisterDecodeCompleteCallback(
+      webrtc::DecodedImageCallback* callback) override;
+  int32_t Release() override;
+  bool PrefersLateDecoding() const override;
+  const char* ImplementationName() const override;
+
+ private:
+  std::unique_ptr<webrtc::VideoDecoder> decoder_;
+  std::unique_ptr<SegmentWriter> writer_;
+  int width_;
+  int height_;
+};
+
+#endif  // RECORDING_VIDEO_DECODER_H_
@@ -0,0 +1,66 @@
+#include "recording_video_decoder_factory.h"
+
+#include <boost/filesystem.hpp>
+
+#include "absl/memory/memory.h"
+#include "rtc_base/logging.h"
+
+#include "ivf_format.h"
+#include "recording_video_decoder.h"
+#include "segment_writer.h"
+
+RecordingVideoDecoderFactory::RecordingVideoDecoderFactory(
+    std::unique_ptr<webrtc::VideoDecoderFactory> factory,
+    const std::string& dir,
+    int segment_duration_sec,
+    size_t segment_size_bytes,
+    bool record_only)
+    : factory_(std::move(factory)),
+      dir_(dir),
+      segment_duration_sec_(segment_duration_sec),
+      segment_size_bytes_(segment_size_bytes),
+      record_only_(record_only),
+      decoder_count_(0) {
+  boost::system::error_code ec;
+  boost::filesystem::create_directories(dir_, ec);
+  if (ec) {
+    RTC_LOG(LS_ERROR) << "Failed to create record directory " << dir_ << ": "
+                      << ec.message();
+  }
+}
+
+std::vector<webrtc::SdpVideoFormat>
+RecordingVideoDecoderFactory::GetSupportedFormats() const {
+  return factory_->GetSupportedFormats();
+}
+
+std::unique_ptr<webrtc::VideoDecoder>
+RecordingVideoDecoderFactory::CreateVideoDecoder(
+    const webrtc::SdpVideoFormat& format) {
+  if (!IVFFormat::IsSupported(format.name)) {
+    RTC_LOG(LS_INFO) << "Remote video stream " << format.name
+                     << " can not be recorded, decoding only";
+    return factory_->CreateVideoDecoder(format);
+  }
+
+  std::unique_ptr<webrtc::VideoDecoder> decoder;
+  if (!record_only_) {
+    decoder = factory_->CreateVideoDecoder(format);
+    if (!decoder) {
+      return nullptr;
+    }
+  }
+
+  // デコーダは受信ストリーム毎に作られるので、ストリーム毎に別のファイルになる
+  std::string prefix =
+      "recv_" + format.name + "_" + std::to_string(decoder_count_++);
+  RTC_LOG(LS_INFO) << "Recording remote video stream to " << prefix
+                   << (record_only_ ? " without decoding" : "");
+  std::unique_ptr<SegmentWriter> writer(new SegmentWriter(
+      std::unique_ptr<SegmentWriter::Format>(new IVFFormat(format.name)), dir_,
+      prefix, IVFFormat::kClockRate, segment_duration_sec_,
+      segment_size_bytes_));
+  return std::unique_ptr<webrtc::VideoDecoder>(
+      absl::make_unique<RecordingVideoDecoder>(std::move(decoder),
+                                               std::move(writer)));
+}
@@ -0,0 +1,42 @@
+#ifndef RECORDING_VIDEO_DECODER_FACTORY_H_
+#define RECORDING_VIDEO_DECODER_FACTORY_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "api/video_codecs/sdp_video_format.h"
+#include "api/video_codecs/video_decoder.h"
+#include "api/video_codecs/video_decoder_factory.h"
+
+// 既存のデコーダファクトリをラップして、受信ストリーム毎に
+// デコード前のフレームをファイルに記録するファクトリ。
+// 記録するかどうかはトラック毎のコーデックで決めて、IVF に入れられない
+// トラックは記録せずに普通にデコードする。
+// record_only の場合、記録するトラックはデコーダを作らずに記録だけを行う。
+class RecordingVideoDecoderFactory : public webrtc::VideoDecoderFactory {
+ public:
+  RecordingVideoDecoderFactory(
+      std::unique_ptr<webrtc::VideoDecoderFactory> factory,
+      const std::string& dir,
+      int segment_duration_sec,
+      size_t segment_size_bytes,
+      bool record_only);
+  virtual ~RecordingVideoDecoderFactory() {}
+
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
+
+  std::unique_ptr<webrtc::VideoDecoder> CreateVideoDecoder(
+      const webrtc::SdpVideoFormat& format) override;
+
+ private:
+  std::unique_ptr<webrtc::VideoDecoderFactory> factory_;
+  const std::string dir_;
+  const int segment_duration_sec_;
+  const size_t segment_size_bytes_;
+  const bool record_only_;
+  std::atomic<int> decoder_count_;
+};
+
+#endif  // RECORDING_VIDEO_DECODER_FACTORY_H_
@@ -0,0 +1,86 @@
+#include "recording_video_encoder.h"
+
+#include "modules/video_coding/include/video_error_codes.h"
+
+RecordingVideoEncoder::RecordingVideoEncoder(
+    std::unique_ptr<webrtc::VideoEncoder> encoder,
+    std::unique_ptr<SegmentWriter> writer)
+    : encoder_(std::move(encoder)),
+      writer_(std::move(writer)),
+      callback_(nullptr) {}
+
+RecordingVideoEncoder::~RecordingVideoEncoder() {}
+
+int32_t RecordingVideoEncoder::InitEncode(
+    const webrtc::VideoCodec* codec_settings,
+    int32_t number_of_cores,
+    size_t max_payload_size) {
+  return encoder_->InitEncode(codec_settings, number_of_cores,
+                              max_payload_size);
+}
+
+int32_t RecordingVideoEncoder::RegisterEncodeCompleteCallback(
+    webrtc::EncodedImageCallback* callback) {
+  callback_ = callback;
+  return encoder_->RegisterEncodeCompleteCallback(callback ? this : nullptr);
+}
+
+int32_t RecordingVideoEncoder::Release() {
+  return encoder_->Release();
+}
+
+int32_t RecordingVideoEncoder::Encode(
+    const webrtc::VideoFrame& frame,
+    const std::vector<webrtc::VideoFrameType>* frame_types) {
+  // 録画側がセグメントの頭出しのためにキーフレームを欲しがっている。
+  // 要求はここで消費するので、キーフレームを強制するのは一度だけ
+  if (writer_->ConsumeKeyFrameRequest()) {
+    std::vector<webrtc::VideoFrameType> key_frame_types(
+        frame_types ? frame_types->size() : 1,
+        webrtc::VideoFrameType::kVideoFrameKey);
+    return encoder_->Encode(frame, &key_frame_types);
+  }
+  return encoder_->Encode(frame, frame_types);
+}
+
+void RecordingVideoEncoder::SetRates(const RateControlParameters& parameters) {
+  encoder_->SetRates(parameters);
+}
+
+void RecordingVideoEncoder::OnPacketLossRateUpdate(float packet_loss_rate) {
+  encoder_->OnPacketLossRateUpdate(packet_loss_rate);
+}
+
+void RecordingVideoEncoder::OnRttUpdate(int64_t rtt_ms) {
+  encoder_->OnRttUpdate(rtt_ms);
+}
+
+void RecordingVideoEncoder::OnLossNotification(
+    const LossNotification& loss_notification) {
+  encoder_->OnLossNotification(loss_notification);
+}
+
+webrtc::VideoEncoder::EncoderInfo RecordingVideoEncoder::GetEncoderInfo()
+    const {
+  return encoder_->GetEncoderInfo();
+}
+
+webrtc::EncodedImageCallback::Result RecordingVideoEncoder::OnEncodedImage(
+    const webrtc::EncodedImage& encoded_image,
+    const webrtc::CodecSpecificInfo* codec_specific_info,
+    const webrtc::RTPFragmentationHeader* fragmentation) {
+  // サイマルキャストや空間レイヤーがある場合は一番下のレイヤーだけを記録する
+  if (encoded_image.SpatialIndex().value_or(0) == 0) {
+    writer_->Push(encoded_image.data(), encoded_image.size(),
+                  encoded_image.Timestamp(), 0, encoded_image._encodedWidth,
+                  encoded_image._encodedHeight,
+                  encoded_image._frameType ==
+                      webrtc::VideoFrameType::kVideoFrameKey);
+  }
+  return callback_->OnEncodedImage(encoded_image, codec_specific_info,
+                                   fragmentation);
+}
+
+void RecordingVideoEncoder::OnDroppedFrame(DropReason reason) {
+  callback_->OnDroppedFrame(reason);
+}
@@ -0,0 +1,49 @@
+#ifndef RECORDING_VIDEO_ENCODER_H_
+#define RECORDING_VIDEO_ENCODER_H_
+
+#include <memory>
+#include <vector>
+
+#include "api/video_codecs/video_encoder.h"
+#include "segment_writer.h"
+
+// エンコーダをラップして、出力されたビットストリームをそのまま
+// SegmentWriter に渡すエンコーダ。
+// 送信経路と同じフレームを記録するので再エンコードは行わない。
+class RecordingVideoEncoder : public webrtc::VideoEncoder,
+                              public webrtc::EncodedImageCallback {
+ public:
+  RecordingVideoEncoder(std::unique_ptr<webrtc::VideoEncoder> encoder,
+                        std::unique_ptr<SegmentWriter> writer);
+  ~RecordingVideoEncoder() override;
+
+  // webrtc::VideoEncoder
+  int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
+                     int32_t number_of_cores,
+                     size_t max_payload_size) override;
+  int32_t RegisterEncodeCompleteCallback(
+      webrtc::EncodedImageCallback* callback) override;
+  int32_t Release() override;
+  int32_t Encode(
+      const webrtc::VideoFrame& frame,
+      const std::vector<webrtc::VideoFrameType>* frame_types) override;
+  void SetRates(const RateControlParameters& parameters) override;
+  void OnPacketLossRateUpdate(float packet_loss_rate) override;
+  void OnRttUpdate(int64_t rtt_ms) override;
+  void OnLossNotification(const LossNotification& loss_notification) override;
+  webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const override;
+
+  // webrtc::EncodedImageCallback
+  webrtc::EncodedImageCallback::Result OnEncodedImage(
+      const webrtc::EncodedImage& encoded_image,
+      const webrtc::CodecSpecificInfo* codec_specific_info,
+      const webrtc::RTPFragmentationHeader* fragmentation) override;
+  void OnDroppedFrame(DropReason reason) override;
+
+ private:
+  std::unique_ptr<webrtc::VideoEncoder> encoder_;
+  std::unique_ptr<SegmentWriter> writer_;
+  webrtc::EncodedImageCallback* callback_;
+};
+
+#endif  // RECORDING_VIDEO_ENCODER_H_
@@ -0,0 +1,60 @@
+#include "recording_video_encoder_factory.h"
+
+#include <boost/filesystem.hpp>
+
+#include "absl/memory/memory.h"
+#include "rtc_base/logging.h"
+
+#include "ivf_format.h"
+#include "recording_video_encoder.h"
+#include "segment_writer.h"
+
+RecordingVideoEncoderFactory::RecordingVideoEncoderFactory(
+    std::unique_ptr<webrtc::VideoEncoderFactory> factory,
+    const std::string& dir,
+    int segment_duration_sec,
+    size_t segment_size_bytes)
+    : factory_(std::move(factory)),
+      dir_(dir),
+      segment_duration_sec_(segment_duration_sec),
+      segment_size_bytes_(segment_size_bytes),
+      encoder_count_(0) {
+  boost::system::error_code ec;
+  boost::filesystem::create_directories(dir_, ec);
+  if (ec) {
+    RTC_LOG(LS_ERROR) << "Failed to create record directory " << dir_ << ": "
+                      << ec.message();
+  }
+}
+
+std::vector<webrtc::SdpVideoFormat>
+RecordingVideoEncoderFactory::GetSupportedFormats() const {
+  return factory_->GetSupportedFormats();
+}
+
+webrtc::VideoEncoderFactory::CodecInfo
+RecordingVideoEncoderFactory::QueryVideoEncoder(
+    const webrtc::SdpVideoFormat& format) const {
+  return factory_->QueryVideoEncoder(format);
+}
+
+std::unique_ptr<webrtc::VideoEncoder>
+RecordingVideoEncoderFactory::CreateVideoEncoder(
+    const webrtc::SdpVideoFormat& format) {
+  std::unique_ptr<webrtc::VideoEncoder> encoder =
+      factory_->CreateVideoEncoder(format);
+  if (!encoder) {
+    return nullptr;
+  }
+
+  // 接続毎にエンコーダが作られるので、番号を付けてファイル名が被らないようにする
+  std::string prefix =
+      "send_" + format.name + "_" + std::to_string(encoder_count_++);
+  std::unique_ptr<SegmentWriter> writer(new SegmentWriter(
+      std::unique_ptr<SegmentWriter::Format>(new IVFFormat(format.name)), dir_,
+      prefix, IVFFormat::kClockRate, segment_duration_sec_,
+      segment_size_bytes_));
+  return std::unique_ptr<webrtc::VideoEncoder>(
+      absl::make_unique<RecordingVideoEncoder>(std::move(encoder),
+                                               std::move(writer)));
+}
@@ -0,0 +1,40 @@
+#ifndef RECORDING_VIDEO_ENCODER_FACTORY_H_
+#define RECORDING_VIDEO_ENCODER_FACTORY_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "api/video_codecs/sdp_video_format.h"
+#include "api/video_codecs/video_encoder.h"
+#include "api/video_codecs/video_encoder_factory.h"
+
+// 既存のエンコーダファクトリをラップして、生成したエンコーダの出力を
+// ファイルに記録するファクトリ
+class RecordingVideoEncoderFactory : public webrtc::VideoEncoderFactory {
+ public:
+  RecordingVideoEncoderFactory(
+      std::unique_ptr<webrtc::VideoEncoderFactory> factory,
+      const std::string& dir,
+      int segment_duration_sec,
+      size_t segment_size_bytes);
+  virtual ~RecordingVideoEncoderFactory() {}
+
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
+
+  CodecInfo QueryVideoEncoder(
+      const webrtc::SdpVideoFormat& format) const override;
+
+  std::unique_ptr<webrtc::VideoEncoder> CreateVideoEncoder(
+      const webrtc::SdpVideoFormat& format) override;
+
+ private:
+  std::unique_ptr<webrtc::VideoEncoderFactory> factory_;
+  const std::string dir_;
+  const int segment_duration_sec_;
+  const size_t segment_size_bytes_;
+  std::atomic<int> encoder_count_;
+};
+
+#endif  // RECORDING_VIDEO_ENCODER_FACTORY_H_
@@ -0,0 +1,362 @@
+#include "segment_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+
+namespace {
+
+// 書き込み待ちのフレームの合計サイズの上限。これを超えたら捨てる
+const size_t kMaxQueuedBytes = 16 * 1024 * 1024;
+// 再利用のために取っておくフレームの数の上限
+const size_t kMaxFreeFrames = 64;
+// サイズ指定が無い場合に確保しておくファイル領域
+const size_t kDefaultPreallocateBytes = 64 * 1024 * 1024;
+const int kWriterWaitMs = 100;
+// キーフレームが来るまでの間、要求を出し直す間隔。
+// エンコーダやネットワークの遅延の間に何度も要求してキーフレームが
+// 続けて出てしまわないように、これより短い間隔では要求しない
+const int64_t kKeyFrameRequestIntervalMs = 1000;
+// I/O エラーの後に再試行するまでの間隔。失敗が続く度に倍にしていく
+const int64_t kInitialRetryIntervalMs = 1000;
+const int64_t kMaxRetryIntervalMs = 60 * 1000;
+
+}  // namespace
+
+SegmentWriter::SegmentWriter(std::unique_ptr<Format> format,
+                             const std::string& dir,
+                             const std::string& prefix,
+                             uint32_t clock_rate,
+                             int segment_duration_sec,
+                             size_t segment_size_bytes)
+    : format_(std::move(format)),
+      dir_(dir),
+      prefix_(prefix),
+      segment_duration_(static_cast<int64_t>(segment_duration_sec) *
+                        clock_rate),
+      segment_size_bytes_(segment_size_bytes),
+      queued_bytes_(0),
+      waiting_key_frame_(true),
+      quit_(false),
+      dropped_frames_(0),
+      last_key_frame_request_ms_(rtc::TimeMillis()),
+      retry_at_ms_(0),
+      key_frame_requested_(true),
+      io_errors_(0),
+      fd_(-1),
+      segment_index_(0),
+      segment_width_(0),
+      segment_height_(0),
+      segment_frames_(0),
+      segment_bytes_(0),
+      segment_start_pts_(0),
+      pts_(0),
+      last_timestamp_(0),
+      has_last_timestamp_(false) {
+  writer_thread_.reset(new rtc::PlatformThread(
+      SegmentWriter::WriterThread, this, "RecorderThread", rtc::kLowPriority));
+  writer_thread_->Start();
+}
+
+SegmentWriter::~SegmentWriter() {
+  {
+    rtc::CritScope lock(&queue_lock_);
+    quit_ = true;
+  }
+  wakeup_.Set();
+  writer_thread_->Stop();
+  writer_thread_.reset();
+  RTC_LOG(LS_INFO) << "SegmentWriter " << prefix_
+                   << " dropped frames: " << dropped_frames_;
+}
+
+bool SegmentWriter::Push(const uint8_t* data,
+                         size_t size,
+                         uint32_t timestamp,
+                         uint32_t duration,
+                         int width,
+                         int height,
+                         bool key_frame) {
+  std::unique_ptr<Frame> frame;
+  {
+    rtc::CritScope lock(&queue_lock_);
+    if (quit_) {
+      return false;
+    }
+    if (IsBackingOff()) {
+      return false;
+    }
+    // 一度でも捨てたら次のキーフレームまでは参照が壊れているので書かない
+    if (waiting_key_frame_ && !key_frame) {
+      RequestKeyFrame();
+      return false;
+    }
+    if (queued_bytes_ + size > kMaxQueuedBytes) {
+      if (dropped_frames_ % 100 == 0) {
+        RTC_LOG(LS_WARNING) << "SegmentWriter " << prefix_
+                            << " queue is full, dropping frames";
+      }
+      dropped_frames_++;
+      waiting_key_frame_ = true;
+      RequestKeyFrame();
+      return false;
+    }
+    waiting_key_frame_ = false;
+    queued_bytes_ += size;
+    if (!free_frames_.empty()) {
+      frame = std::move(free_frames_.back());
+      free_frames_.pop_back();
+    }
+  }
+
+  // 再利用したフレームは容量が足りていればメモリ確保は起こらない
+  if (!frame) {
+    frame.reset(new Frame());
+  }
+  frame->data.assign(data, data + size);
+  frame->timestamp = timestamp;
+  frame->duration = duration;
+  frame->width = width;
+  frame->height = height;
+  frame->key_frame = key_frame;
+
+  {
+    rtc::CritScope lock(&queue_lock_);
+    queue_.push_back(std::move(frame));
+  }
+  wakeup_.Set();
+  return true;
+}
+
+bool SegmentWriter::ConsumeKeyFrameRequest() {
+  return key_frame_requested_.exchange(false);
+}
+
+void SegmentWriter::RequestKeyFrame() {
+  // 書き込めない間にキーフレームを要求しても、送受信の映像を乱すだけになる
+  if (IsBackingOff()) {
+    return;
+  }
+  int64_t now = rtc::TimeMillis();
+  if (now - last_key_frame_request_ms_ < kKeyFrameRequestIntervalMs) {
+    return;
+  }
+  last_key_frame_request_ms_ = now;
+  key_frame_requested_ = true;
+}
+
+bool SegmentWriter::IsBackingOff() {
+  if (retry_at_ms_ == 0) {
+    return false;
+  }
+  if (rtc::TimeMillis() < retry_at_ms_) {
+    return true;
+  }
+  retry_at_ms_ = 0;
+  return false;
+}
+
+void SegmentWriter::OnIOError(const std::string& message) {
+  CloseSegment();
+  int64_t interval =
+      std::min(kInitialRetryIntervalMs << std::min(io_errors_, 6),
+               kMaxRetryIntervalMs);
+  // 失敗が続いている間はログを溢れさせない
+  if (io_errors_ == 0) {
+    RTC_LOG(LS_ERROR) << "SegmentWriter " << prefix_ << " " << message
+                      << ", stop recording and retry in " << interval
+                      << " ms";
+  } else {
+    RTC_LOG(LS_VERBOSE) << "SegmentWriter " << prefix_ << " " << message
+                        << ", retry in " << interval << " ms";
+  }
+  io_errors_++;
+
+  rtc::CritScope lock(&queue_lock_);
+  retry_at_ms_ = rtc::TimeMillis() + interval;
+  // 再開する時はキーフレームから書く
+  waiting_key_frame_ = true;
+}
+
+void SegmentWriter::WriterThread(void* obj) {
+  SegmentWriter* writer = static_cast<SegmentWriter*>(obj);
+  while (writer->WriterProcess()) {
+  }
+}
+
+bool SegmentWriter::WriterProcess() {
+  wakeup_.Wait(kWriterWaitMs);
+
+  bool quit = false;
+  while (true) {
+    std::unique_ptr<Frame> frame;
+    {
+      rtc::CritScope lock(&queue_lock_);
+      quit = quit_;
+      if (queue_.empty()) {
+        break;
+      }
+      frame = std::move(queue_.front());
+      queue_.pop_front();
+      queued_bytes_ -= frame->data.size();
+    }
+
+    WriteFrame(*frame);
+
+    rtc::CritScope lock(&queue_lock_);
+    if (free_frames_.size() < kMaxFreeFrames) {
+      free_frames_.push_back(std::move(frame));
+    }
+  }
+
+  if (quit) {
+    CloseSegment();
+    return false;
+  }
+  return true;
+}
+
+void SegmentWriter::WriteFrame(const Frame& frame) {
+  // RTP タイムスタンプの一周を考慮して単調増加する pts に変換する
+  if (has_last_timestamp_) {
+    pts_ += static_cast<uint32_t>(frame.timestamp - last_timestamp_);
+  }
+  last_timestamp_ = frame.timestamp;
+  has_last_timestamp_ = true;
+
+  if (fd_ >= 0) {
+    bool roll =
+        (segment_duration_ > 0 &&
+         pts_ - segment_start_pts_ >=
+             static_cast<uint64_t>(segment_duration_)) ||
+        (segment_size_bytes_ > 0 &&
+         segment_bytes_ + frame.data.size() > segment_size_bytes_) ||
+        frame.width != segment_width_ || frame.height != segment_height_;
+    // セグメントは必ずキーフレームから始める
+    if (roll) {
+      if (frame.key_frame) {
+        CloseSegment();
+      } else {
+        rtc::CritScope lock(&queue_lock_);
+        RequestKeyFrame();
+      }
+    }
+  }
+
+  if (fd_ < 0) {
+    {
+      rtc::CritScope lock(&queue_lock_);
+      // エラーの前にキューに積まれていたフレームは捨てる
+      if (IsBackingOff()) {
+        return;
+      }
+      if (!frame.key_frame) {
+        RequestKeyFrame();
+        return;
+      }
+    }
+    if (!OpenSegment(frame)) {
+      return;
+    }
+  }
+
+  write_buffer_.clear();
+  format_->AppendFrame(frame, pts_ - segment_start_pts_, &write_buffer_);
+
+  if (!WriteAll(write_buffer_.data(), write_buffer_.size())) {
+    OnIOError(std::string("failed to write frame: ") + strerror(errno));
+    return;
+  }
+  segment_bytes_ += write_buffer_.size();
+  segment_frames_++;
+  if (io_errors_ > 0) {
+    RTC_LOG(LS_INFO) << "SegmentWriter " << prefix_ << " recovered after "
+                     << io_errors_ << " errors";
+    io_errors_ = 0;
+  }
+}
+
+bool SegmentWriter::OpenSegment(const Frame& frame) {
+  time_t now = time(nullptr);
+  struct tm tm;
+  localtime_r(&now, &tm);
+  char date[32];
+  strftime(date, sizeof(date), "%Y%m%d_%H%M%S", &tm);
+  std::string path = dir_ + "/" + prefix_ + "_" + date + "_" +
+                     std::to_string(segment_index_++) + "." +
+                     format_->Extension();
+
+  fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    OnIOError("failed to open " + path + ": " + strerror(errno));
+    return false;
+  }
+
+#if defined(__linux__)
+  // フレーム毎のブロック確保を避けるために先に領域を確保しておく。
+  // ファイルサイズは変えないので途中で止まってもゴミは残らない
+  size_t preallocate_bytes = segment_size_bytes_ > 0
+                                 ? segment_size_bytes_
+                                 : kDefaultPreallocateBytes;
+  if (fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, preallocate_bytes) < 0) {
+    RTC_LOG(LS_VERBOSE) << "SegmentWriter fallocate failed: "
+                        << strerror(errno);
+  }
+#endif
+
+  segment_width_ = frame.width;
+  segment_height_ = frame.height;
+  segment_frames_ = 0;
+  segment_start_pts_ = pts_;
+
+  std::vector<uint8_t> header;
+  format_->AppendHeader(frame, &header);
+  if (!WriteAll(header.data(), header.size())) {
+    std::string error = strerror(errno);
+    close(fd_);
+    fd_ = -1;
+    OnIOError("failed to write header: " + error);
+    return false;
+  }
+  segment_bytes_ = header.size();
+
+  RTC_LOG(LS_INFO) << "SegmentWriter opened " << path;
+  return true;
+}
+
+void SegmentWriter::CloseSegment() {
+  if (fd_ < 0) {
+    return;
+  }
+  format_->FinishSegment(fd_, segment_frames_);
+  // 余分に確保した領域を解放する
+  if (ftruncate(fd_, segment_bytes_) < 0) {
+    RTC_LOG(LS_WARNING) << "SegmentWriter ftruncate failed: "
+                        << strerror(errno);
+  }
+  close(fd_);
+  fd_ = -1;
+}
+
+bool SegmentWriter::WriteAll(const void* data, size_t size) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  while (size > 0) {
+    ssize_t n = write(fd_, p, size);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
@@ -0,0 +1,121 @@
+#ifndef SEGMENT_WRITER_H_
+#define SEGMENT_WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rtc_base/critical_section.h"
+#include "rtc_base/event.h"
+#include "rtc_base/platform_thread.h"
+
+// 符号化済みのフレームをセグメント分割したファイルに書き出す。
+// コンテナは IVF や Ogg のようにフレームを追記していくだけの形式を想定していて、
+// 途中で電源が落ちてもそれまでに書いたフレームは再生できる。
+//
+// Push はエンコーダやデコーダのスレッドから呼ばれることを想定していて、
+// フレームをコピーしてキューに積むだけでディスク I/O は一切行わない。
+// 書き込みは専用スレッドで行い、キューが溢れた場合はフレームを捨てる。
+// ファイルの作成や書き込みに失敗した場合は、間隔を空けながら再試行し、
+// その間はフレームを捨ててキーフレームも要求しない。
+class SegmentWriter {
+ public:
+  struct Frame {
+    std::vector<uint8_t> data;
+    uint32_t timestamp;
+    uint32_t duration;
+    int width;
+    int height;
+    bool key_frame;
+  };
+
+  // コンテナ毎の書き出し処理。書き込みスレッドからのみ呼ばれる
+  class Format {
+   public:
+    virtual ~Format() {}
+    virtual std::string Extension() const = 0;
+    // セグメントの先頭に書くヘッダを out に追加する
+    virtual void AppendHeader(const Frame& first_frame,
+                              std::vector<uint8_t>* out) = 0;
+    // フレームを out に追加する。pts はセグメント先頭からの相対値
+    virtual void AppendFrame(const Frame& frame,
+                             uint64_t pts,
+                             std::vector<uint8_t>* out) = 0;
+    // セグメントを閉じる前にヘッダを書き換える必要があれば行う
+    virtual void FinishSegment(int fd, uint32_t frame_count) {}
+  };
+
+  SegmentWriter(std::unique_ptr<Format> format,
+                const std::string& dir,
+                const std::string& prefix,
+                uint32_t clock_rate,
+                int segment_duration_sec,
+                size_t segment_size_bytes);
+  ~SegmentWriter();
+
+  bool Push(const uint8_t* data,
+            size_t size,
+            uint32_t timestamp,
+            uint32_t duration,
+            int width,
+            int height,
+            bool key_frame);
+
+  // セグメントの切り替えや欠落からの復帰のためにキーフレームが欲しい時に
+  // true を返す。要求は一度返したら消えるので、呼び出し側は true が返ってきたら
+  // 必ずキーフレームを要求すること
+  bool ConsumeKeyFrameRequest();
+
+ private:
+  static void WriterThread(void* obj);
+  bool WriterProcess();
+  void WriteFrame(const Frame& frame);
+  void RequestKeyFrame() RTC_EXCLUSIVE_LOCKS_REQUIRED(queue_lock_);
+  bool IsBackingOff() RTC_EXCLUSIVE_LOCKS_REQUIRED(queue_lock_);
+  void OnIOError(const std::string& message);
+  bool OpenSegment(const Frame& frame);
+  void CloseSegment();
+  bool WriteAll(const void* data, size_t size);
+
+  std::unique_ptr<Format> format_;
+  const std::string dir_;
+  const std::string prefix_;
+  const int64_t segment_duration_;
+  const size_t segment_size_bytes_;
+
+  rtc::CriticalSection queue_lock_;
+  std::deque<std::unique_ptr<Frame>> queue_ RTC_GUARDED_BY(queue_lock_);
+  std::vector<std::unique_ptr<Frame>> free_frames_ RTC_GUARDED_BY(queue_lock_);
+  size_t queued_bytes_ RTC_GUARDED_BY(queue_lock_);
+  bool waiting_key_frame_ RTC_GUARDED_BY(queue_lock_);
+  bool quit_ RTC_GUARDED_BY(queue_lock_);
+  uint64_t dropped_frames_ RTC_GUARDED_BY(queue_lock_);
+  int64_t last_key_frame_request_ms_ RTC_GUARDED_BY(queue_lock_);
+  // I/O エラーの後、この時刻までは書き込みを再試行しない。0 ならエラー無し
+  int64_t retry_at_ms_ RTC_GUARDED_BY(queue_lock_);
+  std::atomic<bool> key_frame_requested_;
+  rtc::Event wakeup_;
+  std::unique_ptr<rtc::PlatformThread> writer_thread_;
+
+  // 以下は書き込みスレッドからのみ触る
+  std::vector<uint8_t> write_buffer_;
+  // 続けて失敗した回数
+  int io_errors_;
+  int fd_;
+  int segment_index_;
+  int segment_width_;
+  int segment_height_;
+  uint32_t segment_frames_;
+  size_t segment_bytes_;
+  uint64_t segment_start_pts_;
+  uint64_t pts_;
+  uint32_t last_timestamp_;
+  bool has_last_timestamp_;
+};
+
+#endif  // SEGMENT_WRITER_H_
@@ -0,0 +1,72 @@
+#ifndef AUDIO_RING_BUFFER_H_
+#define AUDIO_RING_BUFFER_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+// 書き込むスレッドと読み出すスレッドが 1 つずつの、サンプル単位のリングバッファ。
+// ROS のコールバックと 10ms 毎に取り出すスレッドの間で、ロックを取らずに受け渡す。
+// 容量は 2 のべき乗に切り上げる。
+class AudioRingBuffer {
+ public:
+  explicit AudioRingBuffer(size_t capacity)
+      : capacity_(RoundUp(capacity)),
+        data_(new int16_t[capacity_]),
+        head_(0),
+        tail_(0) {}
+
+  size_t capacity() const { return capacity_; }
+  // どちらのスレッドから呼んでもいいが、相手のスレッドが動いていると
+  // 呼んだ直後に変わっている
+  size_t size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+
+  // 書き込むスレッドから呼ぶ。入るだけ書き込んで、書き込んだサンプル数を返す
+  size_t Write(const int16_t* data, size_t length) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t space = capacity_ - (tail - head_.load(std::memory_order_acquire));
+    length = std::min(length, space);
+    size_t pos = tail & (capacity_ - 1);
+    size_t first = std::min(length, capacity_ - pos);
+    memcpy(&data_[pos], data, first * sizeof(int16_t));
+    memcpy(&data_[0], data + first, (length - first) * sizeof(int16_t));
+    tail_.store(tail + length, std::memory_order_release);
+    return length;
+  }
+
+  // 読み出すスレッドから呼ぶ。取り出せるだけ取り出して、取り出したサンプル数を返す
+  size_t Read(int16_t* data, size_t length) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t available = tail_.load(std::memory_order_acquire) - head;
+    length = std::min(length, available);
+    size_t pos = head & (capacity_ - 1);
+    size_t first = std::min(length, capacity_ - pos);
+    memcpy(data, &data_[pos], first * sizeof(int16_t));
+    memcpy(data + first, &data_[0], (length - first) * sizeof(int16_t));
+    head_.store(head + length, std::memory_order_release);
+    return length;
+  }
+
+ private:
+  static size_t RoundUp(size_t n) {
+    size_t capacity = 1;
+    while (capacity < n) {
+      capacity <<= 1;
+    }
+    return capacity;
+  }
+
+  const size_t capacity_;
+  std::unique_ptr<int16_t[]> data_;
+  // 読み出した位置と書き込んだ位置の累積
+  std::atomic<size_t> head_;
+  std::atomic<size_t> tail_;
+};
+
+#endif  // AUDIO_RING_BUFFER_H_
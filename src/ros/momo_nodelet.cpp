@@ -0,0 +1,77 @@
+#include "momo_nodelet.h"
+
+#include <mutex>
+
+#include "pluginlib/class_list_macros.h"
+
+namespace {
+
+std::mutex g_mutex;
+MomoNodelet* g_instance = nullptr;
+bool g_stopped = false;
+std::function<void()> g_stop_handler;
+
+}  // namespace
+
+MomoNodelet::~MomoNodelet() {
+  {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_stopped = true;
+    if (g_stop_handler) {
+      g_stop_handler();
+    }
+  }
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  std::lock_guard<std::mutex> lock(g_mutex);
+  g_instance = nullptr;
+}
+
+void MomoNodelet::onInit() {
+  {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (g_instance != nullptr) {
+      NODELET_ERROR("momo nodelet is already running in this manager");
+      return;
+    }
+    g_instance = this;
+    g_stopped = false;
+  }
+  // onInit はすぐに返す必要があるので、momo 本体は別スレッドで動かす
+  // デストラクタで join するので this は終了まで有効
+  thread_ = std::thread([this]() {
+    char name[] = "momo";
+    char* argv[] = {name, nullptr};
+    int ret = MomoMain(1, argv);
+    if (ret != 0) {
+      NODELET_ERROR("momo nodelet exited with %d", ret);
+    }
+  });
+}
+
+ros::NodeHandle MomoNodelet::GetNodeHandle() {
+  std::lock_guard<std::mutex> lock(g_mutex);
+  return g_instance->getNodeHandle();
+}
+
+ros::NodeHandle MomoNodelet::GetPrivateNodeHandle() {
+  std::lock_guard<std::mutex> lock(g_mutex);
+  return g_instance->getPrivateNodeHandle();
+}
+
+ros::NodeHandle MomoNodelet::GetMTNodeHandle() {
+  std::lock_guard<std::mutex> lock(g_mutex);
+  return g_instance->getMTNodeHandle();
+}
+
+void MomoNodelet::SetStopHandler(std::function<void()> handler) {
+  std::lock_guard<std::mutex> lock(g_mutex);
+  g_stop_handler = std::move(handler);
+  // 設定する前にアンロードされていた場合はすぐに止める
+  if (g_stopped && g_stop_handler) {
+    g_stop_handler();
+  }
+}
+
+PLUGINLIB_EXPORT_CLASS(MomoNodelet, nodelet::Nodelet)
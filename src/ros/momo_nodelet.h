@@ -0,0 +1,40 @@
+#ifndef MOMO_NODELET_H_
+#define MOMO_NODELET_H_
+
+#include <functional>
+#include <thread>
+
+#include "nodelet/nodelet.h"
+#include "ros/ros.h"
+
+// momo を nodelet として nodelet manager のプロセスの中で動かす。
+// カメラのドライバも同じ manager で動かせば、画像はシリアライズされずに
+// shared_ptr のまま届く。
+//
+// momo_nodelet.xml を ROS パッケージに置いて、package.xml で
+//   <export><nodelet plugin="${prefix}/momo_nodelet.xml"/></export>
+// のように指定して使う。1 つの manager で動かせる momo は 1 つだけ。
+class MomoNodelet : public nodelet::Nodelet {
+ public:
+  ~MomoNodelet() override;
+
+  // momo の中から nodelet の NodeHandle を使うための関数。
+  // onInit より後でしか呼べない
+  static ros::NodeHandle GetNodeHandle();
+  static ros::NodeHandle GetPrivateNodeHandle();
+  // 購読のコールバックを manager のワーカースレッドで呼ばせる NodeHandle
+  static ros::NodeHandle GetMTNodeHandle();
+
+  // アンロードされた時に呼ぶ関数を設定する。nullptr で解除する
+  static void SetStopHandler(std::function<void()> handler);
+
+ private:
+  void onInit() override;
+
+  std::thread thread_;
+};
+
+// main.cpp の main の代わり。nodelet の時は MomoNodelet のスレッドから呼ばれる
+int MomoMain(int argc, char* argv[]);
+
+#endif  // MOMO_NODELET_H_
@@ -10,30 +10,66 @@
 
 #include "ros_audio_device.h"
 
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "metrics/metrics_collector.h"
+#include "ros_node.h"
 #include "rtc_base/checks.h"
 #include "rtc_base/logging.h"
-#include "system_wrappers/include/sleep.h"
+#include "thread_policy/thread_policy.h"
+
+namespace {
+
+const int64_t kTickUs = 10 * rtc::kNumMicrosecsPerMillisec;
+// これ以上遅れたら追いつこうとせず、今から数え直す
+const int64_t kMaxLagUs = 50 * rtc::kNumMicrosecsPerMillisec;
+// 録音側のリングバッファに溜められる長さ
+const int kRecordingBufferMs = 1000;
+// 取り出し始めるまでに最低限溜めておく長さ
+const int kMinPrebufferMs = 20;
+// 溜まっている量の平均を取る速さ。10ms 毎に更新するので 1 秒程度で追従する
+const double kFillSmoothing = 0.01;
+// 取り出し始めてから、溜まっている量の基準を決めるまでの回数
+const int kFillBaselineTicks = 100;
+// 基準からこれ以上ずれたら 1 サンプルずつ捨てるか増やす
+const int kDriftSlackMs = 10;
+// 受信した音声はこの回数分まとめて配信する
+const int kPlayoutTicksPerMessage = 2;
+
+std::atomic<uint64_t> g_underruns(0);
+std::atomic<uint64_t> g_overrun_samples(0);
+std::atomic<uint64_t> g_drift_dropped(0);
+std::atomic<uint64_t> g_drift_inserted(0);
+std::atomic<uint64_t> g_playout_dropped(0);
+std::atomic<double> g_buffered_ms(0);
+
+// 次の 10ms の区切りまで待つ。止める時は false を返す
+bool WaitNextTick(rtc::Event* stop_event, int64_t* next_us) {
+  *next_us += kTickUs;
+  int64_t now_us = rtc::TimeMicros();
+  if (now_us - *next_us > kMaxLagUs) {
+    *next_us = now_us;
+  }
+  int64_t wait_ms =
+      (*next_us - now_us + rtc::kNumMicrosecsPerMillisec - 1) /
+      rtc::kNumMicrosecsPerMillisec;
+  return !stop_event->Wait(static_cast<int>(std::max<int64_t>(wait_ms, 0)));
+}
 
-const int kPlayoutFixedSampleRate = 8000;
-const size_t kPlayoutNumChannels = 1;
-const size_t kPlayoutBufferSize =
-    kPlayoutFixedSampleRate / 100 * kPlayoutNumChannels * 2;
+}  // namespace
 
 ROSAudioDevice::ROSAudioDevice(ConnectionSettings conn_settings)
     : _conn_settings(conn_settings),
       _ptrAudioBuffer(NULL),
-      _recordingBuffer(NULL),
-      _playoutBuffer(NULL),
-      _recordingFramesLeft(0),
-      _playoutFramesLeft(0),
-      _recordingBufferSizeIn10MS(0),
       _recordingFramesIn10MS(0),
-      _writtenBufferSize(0),
       _playoutFramesIn10MS(0),
+      _recordingTargetFrames(0),
+      _spinner(nullptr),
       _playing(false),
-      _recording(false),
-      _lastCallPlayoutMillis(0),
-      _lastCallRecordMillis(0) {}
+      _recording(false) {}
 
 ROSAudioDevice::~ROSAudioDevice() {
   Terminate();
@@ -49,6 +85,7 @@ webrtc::AudioDeviceGeneric::InitStatus ROSAudioDevice::Init() {
 }
 
 int32_t ROSAudioDevice::Terminate() {
+  StopPlayout();
   StopRecording();
   return 0;
 }
@@ -139,11 +176,13 @@ int32_t ROSAudioDevice::InitPlayout() {
     return -1;
   }
 
-  _playoutFramesIn10MS = static_cast<size_t>(kPlayoutFixedSampleRate / 100);
+  // 購読するトピックと同じ形式で配信する
+  _playoutFramesIn10MS =
+      static_cast<size_t>(_conn_settings.audio_topic_rate / 100);
 
   if (_ptrAudioBuffer) {
-    _ptrAudioBuffer->SetPlayoutSampleRate(kPlayoutFixedSampleRate);
-    _ptrAudioBuffer->SetPlayoutChannels(kPlayoutNumChannels);
+    _ptrAudioBuffer->SetPlayoutSampleRate(_conn_settings.audio_topic_rate);
+    _ptrAudioBuffer->SetPlayoutChannels(_conn_settings.audio_topic_ch);
   }
   return 0;
 }
@@ -187,17 +226,12 @@ int32_t ROSAudioDevice::StartPlayout() {
     return 0;
   }
 
-  _playing = true;
-  _playoutFramesLeft = 0;
-
-  if (!_playoutBuffer) {
-    _playoutBuffer = new int8_t[kPlayoutBufferSize];
-  }
-  if (!_playoutBuffer) {
-    _playing = false;
-    return -1;
-  }
+  ros::NodeHandle nh = ROSNode::SubscribeNodeHandle();
+  _pub = nh.advertise<audio_common_msgs::AudioData>(
+      _conn_settings.audio_playout_topic_name, 10);
 
+  _playing = true;
+  _playStopEvent.Reset();
   _ptrThreadPlay.reset(new rtc::PlatformThread(
       PlayThreadFunc, this, "webrtc_audio_module_play_thread",
       rtc::kRealtimePriority));
@@ -208,21 +242,17 @@ int32_t ROSAudioDevice::StartPlayout() {
 }
 
 int32_t ROSAudioDevice::StopPlayout() {
-  {
-    rtc::CritScope lock(&_critSect);
-    _playing = false;
+  if (!_playing) {
+    return 0;
   }
+  _playing = false;
+  _playStopEvent.Set();
 
   if (_ptrThreadPlay) {
     _ptrThreadPlay->Stop();
     _ptrThreadPlay.reset();
   }
-
-  rtc::CritScope lock(&_critSect);
-
-  _playoutFramesLeft = 0;
-  delete[] _playoutBuffer;
-  _playoutBuffer = NULL;
+  _pub.shutdown();
 
   RTC_LOG(LS_INFO) << __FUNCTION__ << " Stopped playout capture";
   return 0;
@@ -236,23 +266,30 @@ int32_t ROSAudioDevice::StartRecording() {
   if (_recording) {
     return -1;
   }
+
+  _recordingRing.reset(new AudioRingBuffer(
+      static_cast<size_t>(_conn_settings.audio_topic_rate) *
+      _conn_settings.audio_topic_ch * kRecordingBufferMs / 1000));
+  _recordingTargetFrames = static_cast<size_t>(
+      _conn_settings.audio_topic_rate * kMinPrebufferMs / 1000);
   _recording = true;
 
-  // Make sure we only create the buffer once.
-  _recordingBufferSizeIn10MS =
-      _recordingFramesIn10MS * _conn_settings.audio_topic_ch * 2;
-  if (!_recordingBuffer) {
-    _recordingBuffer = new int8_t[_recordingBufferSizeIn10MS];
-  }
+  _recStopEvent.Reset();
+  _ptrThreadRec.reset(new rtc::PlatformThread(
+      RecThreadFunc, this, "webrtc_audio_module_rec_thread",
+      rtc::kRealtimePriority));
+  _ptrThreadRec->Start();
 
-  ros::NodeHandle nh;
+  // スピナーが一時的に遅れても捨てないように、何通か溜められるようにする
+  ros::NodeHandle nh = ROSNode::SubscribeNodeHandle();
   _sub = nh.subscribe<audio_common_msgs::AudioData>(
-      _conn_settings.audio_topic_name, 1,
+      _conn_settings.audio_topic_name, 10,
       boost::bind(&ROSAudioDevice::RecROSCallback, this, _1));
 
-  _writtenBufferSize = 0;
-  _spinner = new ros::AsyncSpinner(1);
-  _spinner->start();
+  if (ROSNode::NeedsSpinner()) {
+    _spinner = new ros::AsyncSpinner(1);
+    _spinner->start();
+  }
 
   RTC_LOG(LS_INFO) << __FUNCTION__ << " Started recording";
 
@@ -260,24 +297,25 @@ int32_t ROSAudioDevice::StartRecording() {
 }
 
 int32_t ROSAudioDevice::StopRecording() {
-  {
-    rtc::CritScope lock(&_critSect);
-    if (!_recording) {
-      return -1;
-    }
-    _recording = false;
+  if (!_recording) {
+    return -1;
   }
+  _recording = false;
 
+  // コールバックが終わってからリングバッファを消す
   if (_spinner) {
     _spinner->stop();
+    delete _spinner;
+    _spinner = nullptr;
   }
+  _sub.shutdown();
 
-  rtc::CritScope lock(&_critSect);
-  _recordingFramesLeft = 0;
-  if (_recordingBuffer) {
-    delete[] _recordingBuffer;
-    _recordingBuffer = NULL;
+  _recStopEvent.Set();
+  if (_ptrThreadRec) {
+    _ptrThreadRec->Stop();
+    _ptrThreadRec.reset();
   }
+  _recordingRing.reset();
 
   RTC_LOG(LS_INFO) << __FUNCTION__ << " Stopped recording";
   return 0;
@@ -368,15 +406,16 @@ int32_t ROSAudioDevice::MicrophoneMute(bool& enabled) const {
 }
 
 int32_t ROSAudioDevice::StereoPlayoutIsAvailable(bool& available) {
-  available = true;
+  available = _conn_settings.audio_topic_ch == 2;
   return 0;
 }
+
 int32_t ROSAudioDevice::SetStereoPlayout(bool enable) {
-  return 0;
+  return ((_conn_settings.audio_topic_ch == 2) == enable) ? 0 : -1;
 }
 
 int32_t ROSAudioDevice::StereoPlayout(bool& enabled) const {
-  enabled = true;
+  enabled = _conn_settings.audio_topic_ch == 2;
   return 0;
 }
 
@@ -430,62 +469,167 @@ void ROSAudioDevice::PlayThreadFunc(void* pThis) {
   (static_cast<ROSAudioDevice*>(pThis)->PlayThreadProcess());
 }
 
+void ROSAudioDevice::RecThreadFunc(void* pThis) {
+  (static_cast<ROSAudioDevice*>(pThis)->RecThreadProcess());
+}
+
 void ROSAudioDevice::PlayThreadProcess() {
-  if (!_playing) {
-    return;
+  ThreadPolicy::Apply("ros");
+  const size_t channels = _conn_settings.audio_topic_ch;
+  const size_t chunk_bytes = _playoutFramesIn10MS * channels * sizeof(int16_t);
+  std::vector<int8_t> chunk(chunk_bytes);
+  audio_common_msgs::AudioData msg;
+  msg.data.reserve(chunk_bytes * kPlayoutTicksPerMessage);
+
+  int64_t next_us = rtc::TimeMicros();
+  while (_playing && WaitNextTick(&_playStopEvent, &next_us)) {
+    _ptrAudioBuffer->RequestPlayoutData(_playoutFramesIn10MS);
+    size_t frames = _ptrAudioBuffer->GetPlayoutData(chunk.data());
+    RTC_DCHECK_EQ(_playoutFramesIn10MS, frames);
+    msg.data.insert(msg.data.end(), chunk.begin(), chunk.end());
+    if (msg.data.size() < chunk_bytes * kPlayoutTicksPerMessage) {
+      continue;
+    }
+    // publish はキューに積むだけなので、このスレッドを待たせない。
+    // 誰も購読していなければシリアライズもしない
+    if (_pub.getNumSubscribers() > 0) {
+      _pub.publish(msg);
+    } else {
+      g_playout_dropped += msg.data.size() / sizeof(int16_t);
+    }
+    msg.data.clear();
   }
-  int64_t currentTime = rtc::TimeMillis();
-  _critSect.Enter();
+}
 
-  if (_lastCallPlayoutMillis == 0 ||
-      currentTime - _lastCallPlayoutMillis >= 5) {
-    _critSect.Leave();
-    _ptrAudioBuffer->RequestPlayoutData(_playoutFramesIn10MS);
-    _critSect.Enter();
+void ROSAudioDevice::RecThreadProcess() {
+  ThreadPolicy::Apply("ros");
+  const size_t channels = _conn_settings.audio_topic_ch;
+  const size_t frames_in_10ms = _recordingFramesIn10MS;
+  const double frames_per_ms = _conn_settings.audio_topic_rate / 1000.0;
+  const double slack_frames = kDriftSlackMs * frames_per_ms;
+  // 時計のずれを吸収する時は 1 フレーム多く読むことがある
+  std::vector<int16_t> chunk((frames_in_10ms + 1) * channels);
+
+  bool prebuffering = true;
+  double average_frames = 0;
+  double baseline_frames = 0;
+  int ticks = 0;
+
+  int64_t next_us = rtc::TimeMicros();
+  while (_recording && WaitNextTick(&_recStopEvent, &next_us)) {
+    size_t available = _recordingRing->size() / channels;
+    g_buffered_ms = available / frames_per_ms;
+    if (prebuffering) {
+      if (available < _recordingTargetFrames) {
+        continue;
+      }
+      prebuffering = false;
+      average_frames = available;
+      ticks = 0;
+    }
 
-    _playoutFramesLeft = _ptrAudioBuffer->GetPlayoutData(_playoutBuffer);
-    RTC_DCHECK_EQ(_playoutFramesIn10MS, _playoutFramesLeft);
-    _lastCallPlayoutMillis = currentTime;
-  }
-  _playoutFramesLeft = 0;
-  _critSect.Leave();
+    size_t read_frames = frames_in_10ms;
+    bool repeat_last = false;
+    if (available < frames_in_10ms) {
+      // 足りない分は無音で埋めて、もう一度溜まるまで待つ
+      g_underruns++;
+      prebuffering = true;
+      read_frames = available;
+    } else {
+      average_frames += (available - average_frames) * kFillSmoothing;
+      if (++ticks == kFillBaselineTicks) {
+        baseline_frames = average_frames;
+      } else if (ticks > kFillBaselineTicks) {
+        if (average_frames > baseline_frames + slack_frames) {
+          // 送信側の時計が速いので 1 フレーム捨てる
+          read_frames = frames_in_10ms + 1;
+          g_drift_dropped++;
+          average_frames -= 1;
+        } else if (average_frames < baseline_frames - slack_frames) {
+          // 送信側の時計が遅いので最後のフレームを繰り返す
+          read_frames = frames_in_10ms - 1;
+          repeat_last = true;
+          g_drift_inserted++;
+          average_frames += 1;
+        }
+      }
+    }
 
-  int64_t deltaTimeMillis = rtc::TimeMillis() - currentTime;
-  if (deltaTimeMillis < 5) {
-    webrtc::SleepMs(5 - deltaTimeMillis);
+    size_t read = _recordingRing->Read(chunk.data(), read_frames * channels);
+    if (read < frames_in_10ms * channels) {
+      if (repeat_last && read >= channels) {
+        memcpy(&chunk[read], &chunk[read - channels],
+               channels * sizeof(int16_t));
+        read += channels;
+      }
+      memset(&chunk[read], 0,
+             (frames_in_10ms * channels - read) * sizeof(int16_t));
+    }
+    _ptrAudioBuffer->SetRecordedBuffer(chunk.data(), frames_in_10ms);
+    _ptrAudioBuffer->DeliverRecordedData();
   }
 }
 
 bool ROSAudioDevice::RecROSCallback(
     const audio_common_msgs::AudioDataConstPtr& msg) {
-  size_t copyedDataSize = 0;
-  _critSect.Enter();
-  while (_recording && copyedDataSize != msg->data.size()) {
-    RTC_LOG(LS_VERBOSE) << "RecROSCallback _recordingBufferSizeIn10MS:"
-                        << _recordingBufferSizeIn10MS << " _writtenBufferSize"
-                        << _writtenBufferSize << " msg->data.size()"
-                        << msg->data.size() << " copyedDataSize"
-                        << copyedDataSize;
-    if (_recordingBufferSizeIn10MS - _writtenBufferSize <=
-        msg->data.size() - copyedDataSize) {
-      memcpy(_recordingBuffer + _writtenBufferSize, &msg->data[copyedDataSize],
-             _recordingBufferSizeIn10MS - _writtenBufferSize);
-      copyedDataSize += _recordingBufferSizeIn10MS - _writtenBufferSize;
-      _writtenBufferSize = 0;
-      _ptrAudioBuffer->SetRecordedBuffer(_recordingBuffer,
-                                         _recordingFramesIn10MS);
-      _critSect.Leave();
-      _ptrAudioBuffer->DeliverRecordedData();
-      webrtc::SleepMs(10);
-      _critSect.Enter();
-    } else {
-      memcpy(_recordingBuffer + _writtenBufferSize, &msg->data[copyedDataSize],
-             msg->data.size() - copyedDataSize);
-      _writtenBufferSize += msg->data.size() - copyedDataSize;
-      copyedDataSize += msg->data.size() - copyedDataSize;
-    }
+  ThreadPolicy::ApplyOnce("ros", "ros_spinner");
+  if (!_recording) {
+    return true;
+  }
+  const size_t channels = _conn_settings.audio_topic_ch;
+  size_t frames = msg->data.size() / sizeof(int16_t) / channels;
+  if (frames == 0) {
+    return true;
+  }
+
+  // 1 通のメッセージが届く間隔より多く溜めておかないと、毎回アンダーランする
+  size_t target = frames + _recordingFramesIn10MS;
+  if (target > _recordingTargetFrames &&
+      target * channels <= _recordingRing->capacity() / 2) {
+    _recordingTargetFrames = target;
   }
-  _critSect.Leave();
 
+  // チャンネルがずれないように、フレーム単位で入るだけ書き込む
+  size_t space = (_recordingRing->capacity() - _recordingRing->size()) /
+                 channels * channels;
+  size_t samples = frames * channels;
+  size_t written = _recordingRing->Write(
+      reinterpret_cast<const int16_t*>(msg->data.data()),
+      std::min(samples, space));
+  if (written < samples) {
+    g_overrun_samples += samples - written;
+  }
   return true;
 }
+
+void ROSAudioDevice::AppendMetrics(std::string* out) {
+  MetricsCollector::AppendHeader(out, "momo_ros_audio_underruns_total",
+                                 "counter",
+                                 "Times the ROS audio topic ran dry");
+  MetricsCollector::AppendSample(out, "momo_ros_audio_underruns_total", "",
+                                 g_underruns.load());
+  MetricsCollector::AppendHeader(
+      out, "momo_ros_audio_overrun_samples_total", "counter",
+      "Samples from the ROS audio topic dropped because the buffer was full");
+  MetricsCollector::AppendSample(out, "momo_ros_audio_overrun_samples_total",
+                                 "", g_overrun_samples.load());
+  MetricsCollector::AppendHeader(
+      out, "momo_ros_audio_drift_frames_total", "counter",
+      "Frames dropped or repeated to follow the publisher clock");
+  MetricsCollector::AppendSample(out, "momo_ros_audio_drift_frames_total",
+                                 "action=\"dropped\"",
+                                 g_drift_dropped.load());
+  MetricsCollector::AppendSample(out, "momo_ros_audio_drift_frames_total",
+                                 "action=\"inserted\"",
+                                 g_drift_inserted.load());
+  MetricsCollector::AppendHeader(out, "momo_ros_audio_buffered_ms", "gauge",
+                                 "Audio buffered from the ROS audio topic");
+  MetricsCollector::AppendSample(out, "momo_ros_audio_buffered_ms", "",
+                                 g_buffered_ms.load());
+  MetricsCollector::AppendHeader(
+      out, "momo_ros_audio_playout_dropped_samples_total", "counter",
+      "Received audio samples not published because nobody subscribed");
+  MetricsCollector::AppendSample(
+      out, "momo_ros_audio_playout_dropped_samples_total", "",
+      g_playout_dropped.load());
+}
@@ -11,17 +11,28 @@
 #ifndef ROS_AUDIO_DEVICE_H_
 #define ROS_AUDIO_DEVICE_H_
 
+#include <atomic>
 #include <memory>
+#include <string>
 
 #include "audio_common_msgs/AudioData.h"
+#include "audio_ring_buffer.h"
 #include "connection_settings.h"
 #include "modules/audio_device/audio_device_generic.h"
 #include "ros/ros.h"
 #include "rtc_base/critical_section.h"
+#include "rtc_base/event.h"
 #include "rtc_base/platform_thread.h"
 #include "rtc_base/system/file_wrapper.h"
 #include "rtc_base/time_utils.h"
 
+// ROS のトピックを入出力にするオーディオデバイス。
+//
+// 購読したトピックのサンプルはコールバックでリングバッファに書き込むだけにして、
+// 10ms 毎に起きるスレッドが取り出して WebRTC に渡す。
+// 送信側とこちらの時計のずれは、溜まっている量を見て 1 サンプルずつ
+// 捨てるか増やすかして吸収する。
+// 受信した音声も 10ms 毎に起きるスレッドで取り出して、トピックに配信する。
 class ROSAudioDevice : public webrtc::AudioDeviceGeneric {
  public:
   ROSAudioDevice(ConnectionSettings conn_settings);
@@ -118,37 +129,44 @@ class ROSAudioDevice : public webrtc::AudioDeviceGeneric {
   int GetRecordAudioParameters(webrtc::AudioParameters* params) const override;
 #endif  // WEBRTC_IOS
 
+  // /metrics にアンダーランなどの数を書き足す
+  static void AppendMetrics(std::string* out);
+
  private:
   static void PlayThreadFunc(void*);
+  static void RecThreadFunc(void*);
   bool RecROSCallback(const audio_common_msgs::AudioDataConstPtr& msg);
   void PlayThreadProcess();
+  void RecThreadProcess();
 
   ConnectionSettings _conn_settings;
 
   int32_t _playout_index;
   int32_t _record_index;
   webrtc::AudioDeviceBuffer* _ptrAudioBuffer;
-  int8_t* _recordingBuffer;  // In bytes.
-  int8_t* _playoutBuffer;    // In bytes.
-  uint32_t _recordingFramesLeft;
-  uint32_t _playoutFramesLeft;
   rtc::CriticalSection _critSect;
 
-  size_t _recordingBufferSizeIn10MS;
   size_t _recordingFramesIn10MS;
-  size_t _writtenBufferSize;
   size_t _playoutFramesIn10MS;
 
+  // 書き込むのは ROS のコールバック、読み出すのは録音スレッド
+  std::unique_ptr<AudioRingBuffer> _recordingRing;
+  // 録音スレッドが取り出し始めるまでに溜めておくフレーム数。
+  // 届くメッセージの大きさに合わせてコールバックが増やす
+  std::atomic<size_t> _recordingTargetFrames;
+
   ros::AsyncSpinner* _spinner;
   ros::Subscriber _sub;
+  ros::Publisher _pub;
 
   // TODO(pbos): Make plain members instead of pointers and stop resetting them.
   std::unique_ptr<rtc::PlatformThread> _ptrThreadPlay;
+  std::unique_ptr<rtc::PlatformThread> _ptrThreadRec;
+  rtc::Event _playStopEvent;
+  rtc::Event _recStopEvent;
 
-  bool _playing;
-  bool _recording;
-  int64_t _lastCallPlayoutMillis;
-  int64_t _lastCallRecordMillis;
+  std::atomic<bool> _playing;
+  std::atomic<bool> _recording;
 };
 
 #endif
@@ -0,0 +1,33 @@
+#ifndef ROS_NODE_H_
+#define ROS_NODE_H_
+
+#include "ros/ros.h"
+
+#if MOMO_NODELET
+#include "momo_nodelet.h"
+#endif
+
+// 単体のノードと nodelet のどちらで動いているかの違いを吸収する。
+class ROSNode {
+ public:
+  // トピックの購読と配信に使う NodeHandle
+  static ros::NodeHandle SubscribeNodeHandle() {
+#if MOMO_NODELET
+    return MomoNodelet::GetMTNodeHandle();
+#else
+    return ros::NodeHandle();
+#endif
+  }
+
+  // 購読のコールバックを呼ぶスピナーを自分で作る必要があるか。
+  // nodelet の場合は manager のワーカースレッドが呼ぶので作らない
+  static bool NeedsSpinner() {
+#if MOMO_NODELET
+    return false;
+#else
+    return true;
+#endif
+  }
+};
+
+#endif  // ROS_NODE_H_
@@ -4,12 +4,27 @@
 #include <unistd.h>
 
 #include "api/video/i420_buffer.h"
+#include "rtc/native_buffer.h"
 #include "rtc_base/log_sinks.h"
+#include "ros_node.h"
 #include "sensor_msgs/image_encodings.h"
+#include "thread_policy/thread_policy.h"
 #include "third_party/libyuv/include/libyuv.h"
 
-ROSVideoCapture::ROSVideoCapture(ConnectionSettings cs) {
-  ros::NodeHandle nh;
+namespace {
+
+// エンコーダに渡している間も含めて、これだけあれば足りる
+const int kMaxPooledBuffers = 8;
+
+}  // namespace
+
+ROSVideoCapture::ROSVideoCapture(ConnectionSettings cs)
+    : use_native_(cs.use_native && cs.image_compressed),
+      spinner_(nullptr),
+      buffer_pool_(false, kMaxPooledBuffers) {
+  // nodelet で同じ manager のノードから届く画像は、シリアライズされずに
+  // 送信側の shared_ptr のまま渡される
+  ros::NodeHandle nh = ROSNode::SubscribeNodeHandle();
   if (cs.image_compressed) {
     sub_ = nh.subscribe<sensor_msgs::CompressedImage>(
         cs.camera_name, 1,
@@ -20,8 +35,10 @@ ROSVideoCapture::ROSVideoCapture(ConnectionSettings cs) {
         boost::bind(&ROSVideoCapture::ROSCallbackRaw, this, _1));
   }
 
-  spinner_ = new ros::AsyncSpinner(1);
-  spinner_->start();
+  if (ROSNode::NeedsSpinner()) {
+    spinner_ = new ros::AsyncSpinner(1);
+    spinner_->start();
+  }
 }
 
 ROSVideoCapture::~ROSVideoCapture() {
@@ -29,7 +46,14 @@ ROSVideoCapture::~ROSVideoCapture() {
 }
 
 void ROSVideoCapture::Destroy() {
-  spinner_->stop();
+  if (spinner_) {
+    spinner_->stop();
+  }
+  sub_.shutdown();
+}
+
+bool ROSVideoCapture::useNativeBuffer() {
+  return use_native_;
 }
 
 void ROSVideoCapture::ROSCallbackRaw(const sensor_msgs::ImageConstPtr& image) {
@@ -46,6 +70,11 @@ void ROSVideoCapture::ROSCallbackCompressed(
     RTC_LOG(LS_ERROR) << "MJPGSize Failed";
     return;
   }
+  if (use_native_) {
+    ROSCallbackNative(image->header.stamp, image->data.data(),
+                      image->data.size(), width, height);
+    return;
+  }
   ROSCallback(image->header.stamp, image->data.data(), image->data.size(),
               width, height, libyuv::FOURCC_MJPG);
 }
@@ -69,9 +98,14 @@ void ROSVideoCapture::ROSCallback(ros::Time ros_time,
                                   int src_width,
                                   int src_height,
                                   uint32_t fourcc) {
-  rtc::scoped_refptr<webrtc::I420Buffer> dst_buffer(
-      webrtc::I420Buffer::Create(src_width, src_height));
-  dst_buffer->InitializeData();
+  ThreadPolicy::ApplyOnce("ros", "ros_spinner");
+  // 全ての画素を書き込むので、0 で埋めておく必要は無い
+  rtc::scoped_refptr<webrtc::I420Buffer> dst_buffer =
+      buffer_pool_.CreateBuffer(src_width, src_height);
+  if (!dst_buffer) {
+    RTC_LOG(LS_WARNING) << "No free buffer in the pool, dropping a frame";
+    return;
+  }
 
   if (libyuv::ConvertToI420(
           sample, sample_size, dst_buffer.get()->MutableDataY(),
@@ -90,4 +124,26 @@ void ROSVideoCapture::ROSCallback(ros::Time ros_time,
           .set_timestamp_us((int64_t)(ros_time.toNSec() / 1000))
           .build();
   OnCapturedFrame(captureFrame);
-}
\ No newline at end of file
+}
+
+void ROSVideoCapture::ROSCallbackNative(ros::Time ros_time,
+                                        const uint8_t* sample,
+                                        size_t sample_size,
+                                        int src_width,
+                                        int src_height) {
+  ThreadPolicy::ApplyOnce("ros", "ros_spinner");
+  // JPEG はデコードせずにそのまま HW エンコーダに渡す。
+  // メッセージの寿命は ROS が決めるので、JPEG の大きさだけコピーする
+  rtc::scoped_refptr<NativeBuffer> native_buffer(NativeBuffer::Create(
+      webrtc::VideoType::kMJPEG, src_width, src_height, sample_size));
+  memcpy(native_buffer->MutableData(), sample, sample_size);
+  native_buffer->SetLength(sample_size);
+
+  webrtc::VideoFrame captureFrame =
+      webrtc::VideoFrame::Builder()
+          .set_video_frame_buffer(native_buffer)
+          .set_rotation(webrtc::kVideoRotation_0)
+          .set_timestamp_us((int64_t)(ros_time.toNSec() / 1000))
+          .build();
+  OnCapturedFrame(captureFrame);
+}
@@ -1,6 +1,7 @@
 #ifndef ROS_VIDEO_CAPTURE_H_
 #define ROS_VIDEO_CAPTURE_H_
 
+#include "common_video/include/i420_buffer_pool.h"
 #include "connection_settings.h"
 #include "ros/ros.h"
 #include "rtc/scalable_track_source.h"
@@ -18,6 +19,9 @@ class ROSVideoCapture : public ScalableVideoTrackSource {
   void ROSCallbackRaw(const sensor_msgs::ImageConstPtr& image);
   void ROSCallbackCompressed(const sensor_msgs::CompressedImageConstPtr& image);
 
+  // --use-native で JPEG を受け取る場合は、デコードせずに HW エンコーダに渡す
+  bool useNativeBuffer() override;
+
  private:
   static uint32_t ConvertEncodingType(const std::string encoding);
   void ROSCallback(ros::Time ros_time,
@@ -26,9 +30,17 @@ class ROSVideoCapture : public ScalableVideoTrackSource {
                    int src_width,
                    int src_height,
                    uint32_t fourcc);
+  void ROSCallbackNative(ros::Time ros_time,
+                         const uint8_t* sample,
+                         size_t sample_size,
+                         int src_width,
+                         int src_height);
 
+  const bool use_native_;
   ros::AsyncSpinner* spinner_;
   ros::Subscriber sub_;
+  // 変換先のバッファを使い回す。購読のコールバックからしか触らない
+  webrtc::I420BufferPool buffer_pool_;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,338 @@
+#include "bandwidth_warm_start.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include <algorithm>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <sstream>
+
+#include "api/stats/rtcstats_objects.h"
+#include "metrics/metrics_collector.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/ref_counted_object.h"
+#include "rtc_base/time_utils.h"
+#include "stats_callback.h"
+#include "url_parts.h"
+
+namespace {
+
+// 推定帯域を見る間隔
+const int kPollIntervalMs = 2000;
+// 最初の推定値からこの時間の最大値を、落ち着いた推定帯域とみなす
+const int64_t kRampUpWindowMs = 30000;
+// ファイルに書き出す間隔
+const int64_t kSaveIntervalMs = 30000;
+// これより古いキャッシュは使わない
+const int64_t kMaxEntryAgeSec = 24 * 60 * 60;
+
+// 前回の値そのままだと混雑している時に溢れるので少し下げて始める
+const double kStartRatio = 0.8;
+// RTT が大きい時は前回と経路が違う可能性が高いのでさらに半分にする
+const int64_t kHighRttMs = 300;
+const int kMinStartBitrateBps = 300 * 1000;
+const int kMaxStartBitrateBps = 10 * 1000 * 1000;
+const int kMinBitrateBps = 30 * 1000;
+
+// デフォルトルートのインタフェース名。分からなければ空
+std::string DefaultRouteInterface() {
+  std::ifstream ifs("/proc/net/route");
+  std::string line;
+  // 1 行目はヘッダ
+  std::getline(ifs, line);
+  while (std::getline(ifs, line)) {
+    std::istringstream iss(line);
+    std::string iface, destination;
+    if (iss >> iface >> destination && destination == "00000000") {
+      return iface;
+    }
+  }
+  return "";
+}
+
+}  // namespace
+
+BandwidthWarmStart::BandwidthWarmStart(rtc::Thread* thread,
+                                       const std::string& cache_file,
+                                       const std::string& signaling_host,
+                                       int max_bitrate_kbps)
+    : thread_(thread),
+      cache_file_(cache_file),
+      signaling_host_(signaling_host),
+      max_bitrate_kbps_(max_bitrate_kbps),
+      running_(false),
+      dirty_(false),
+      last_save_ms_(0),
+      warm_starts_(0),
+      last_start_bitrate_bps_(0),
+      last_ramp_up_seconds_(-1) {}
+
+BandwidthWarmStart::~BandwidthWarmStart() {}
+
+void BandwidthWarmStart::Start() {
+  thread_->Invoke<void>(RTC_FROM_HERE, [this]() {
+    if (running_) {
+      return;
+    }
+    Load();
+    running_ = true;
+    last_save_ms_ = rtc::TimeMillis();
+    thread_->PostDelayed(RTC_FROM_HERE, kPollIntervalMs, this);
+  });
+}
+
+void BandwidthWarmStart::Stop() {
+  thread_->Invoke<void>(RTC_FROM_HERE, [this]() {
+    if (!running_) {
+      return;
+    }
+    running_ = false;
+    thread_->Clear(this);
+    tracked_.clear();
+    Save();
+  });
+}
+
+void BandwidthWarmStart::Attach(std::shared_ptr<RTCConnection> connection) {
+  thread_->Invoke<void>(RTC_FROM_HERE, [this, connection]() {
+    if (!running_) {
+      return;
+    }
+    std::shared_ptr<Tracked> tracked = std::make_shared<Tracked>();
+    tracked->connection = connection;
+    tracked->key = MakeKey();
+    tracked_.push_back(tracked);
+
+    webrtc::BitrateSettings settings;
+    settings.min_bitrate_bps = kMinBitrateBps;
+    int max_bitrate_bps = max_bitrate_kbps_ * 1000;
+    if (max_bitrate_bps > 0) {
+      settings.max_bitrate_bps = std::max(max_bitrate_bps, kMinBitrateBps);
+    }
+
+    int64_t start_bps = 0;
+    auto it = entries_.find(tracked->key);
+    if (it != entries_.end() &&
+        time(nullptr) - it->second.updated_at < kMaxEntryAgeSec) {
+      start_bps = static_cast<int64_t>(it->second.bitrate_bps * kStartRatio);
+      if (it->second.rtt_ms > kHighRttMs) {
+        start_bps /= 2;
+      }
+      start_bps = std::min<int64_t>(
+          std::max<int64_t>(start_bps, kMinStartBitrateBps),
+          kMaxStartBitrateBps);
+      if (max_bitrate_bps > 0) {
+        start_bps = std::min<int64_t>(start_bps, max_bitrate_bps);
+      }
+      settings.start_bitrate_bps = static_cast<int>(start_bps);
+    }
+
+    webrtc::RTCError error =
+        connection->getConnection()->SetBitrate(settings);
+    if (!error.ok()) {
+      RTC_LOG(LS_WARNING) << __FUNCTION__
+                          << ": SetBitrate failed: " << error.message();
+      return;
+    }
+    if (start_bps > 0) {
+      RTC_LOG(LS_INFO) << __FUNCTION__ << ": Start bitrate " << start_bps
+                       << " bps for " << tracked->key << " (cached "
+                       << it->second.bitrate_bps << " bps, rtt "
+                       << it->second.rtt_ms << " ms)";
+      rtc::CritScope lock(&stats_lock_);
+      warm_starts_++;
+      last_start_bitrate_bps_ = start_bps;
+    }
+  });
+}
+
+void BandwidthWarmStart::AppendMetrics(std::string* out) {
+  rtc::CritScope lock(&stats_lock_);
+  MetricsCollector::AppendHeader(out, "momo_bwe_warm_starts_total", "counter",
+                                 "Connections started from a cached estimate");
+  MetricsCollector::AppendSample(out, "momo_bwe_warm_starts_total", "",
+                                 warm_starts_);
+  if (last_start_bitrate_bps_ > 0) {
+    MetricsCollector::AppendHeader(out, "momo_bwe_start_bitrate_bps", "gauge",
+                                   "Start bitrate of the last warm start");
+    MetricsCollector::AppendSample(out, "momo_bwe_start_bitrate_bps", "",
+                                   last_start_bitrate_bps_);
+  }
+  if (last_ramp_up_seconds_ >= 0) {
+    MetricsCollector::AppendHeader(
+        out, "momo_bwe_rampup_seconds", "gauge",
+        "Time for the last connection to reach 90% of its bandwidth estimate");
+    MetricsCollector::AppendSample(out, "momo_bwe_rampup_seconds", "",
+                                   last_ramp_up_seconds_);
+  }
+}
+
+void BandwidthWarmStart::OnMessage(rtc::Message* msg) {
+  if (!running_) {
+    return;
+  }
+  Poll();
+  if (dirty_ && rtc::TimeMillis() - last_save_ms_ >= kSaveIntervalMs) {
+    Save();
+  }
+  thread_->PostDelayed(RTC_FROM_HERE, kPollIntervalMs, this);
+}
+
+void BandwidthWarmStart::Poll() {
+  std::weak_ptr<BandwidthWarmStart> weak_self = shared_from_this();
+  auto it = tracked_.begin();
+  while (it != tracked_.end()) {
+    std::shared_ptr<RTCConnection> connection = (*it)->connection.lock();
+    if (!connection) {
+      it = tracked_.erase(it);
+      continue;
+    }
+    std::shared_ptr<Tracked> tracked = *it;
+    rtc::scoped_refptr<StatsCallback> callback(
+        new rtc::RefCountedObject<StatsCallback>(
+            [weak_self, tracked](
+                const rtc::scoped_refptr<const webrtc::RTCStatsReport>&
+                    report) {
+              auto self = weak_self.lock();
+              if (self) {
+                self->OnStatsDelivered(tracked, report);
+              }
+            }));
+    connection->getConnection()->GetStats(callback.get());
+    ++it;
+  }
+}
+
+void BandwidthWarmStart::OnStatsDelivered(
+    std::shared_ptr<Tracked> tracked,
+    const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report) {
+  if (!running_) {
+    return;
+  }
+  double bitrate_bps = 0;
+  double rtt_sec = 0;
+  for (const webrtc::RTCIceCandidatePairStats* stats :
+       report->GetStatsOfType<webrtc::RTCIceCandidatePairStats>()) {
+    if (!stats->nominated.is_defined() || !*stats->nominated ||
+        !stats->available_outgoing_bitrate.is_defined()) {
+      continue;
+    }
+    bitrate_bps = *stats->available_outgoing_bitrate;
+    if (stats->current_round_trip_time.is_defined()) {
+      rtt_sec = *stats->current_round_trip_time;
+    }
+  }
+  if (bitrate_bps <= 0) {
+    return;
+  }
+
+  int64_t now_ms = rtc::TimeMillis();
+  if (tracked->connected_ms < 0) {
+    tracked->connected_ms = now_ms;
+  }
+
+  if (!tracked->ramped_up) {
+    tracked->samples.push_back(std::make_pair(now_ms, bitrate_bps));
+    if (now_ms - tracked->connected_ms < kRampUpWindowMs) {
+      return;
+    }
+    // 窓の中の最大値の 9 割に最初に届いた時刻を立ち上がりとする
+    double max_bps = 0;
+    for (const auto& sample : tracked->samples) {
+      max_bps = std::max(max_bps, sample.second);
+    }
+    int64_t ramp_up_ms = 0;
+    for (const auto& sample : tracked->samples) {
+      if (sample.second >= max_bps * 0.9) {
+        ramp_up_ms = sample.first - tracked->connected_ms;
+        break;
+      }
+    }
+    tracked->ramped_up = true;
+    tracked->samples.clear();
+    RTC_LOG(LS_INFO) << __FUNCTION__ << ": Bandwidth estimate ramped up to "
+                     << static_cast<int64_t>(max_bps) << " bps in "
+                     << ramp_up_ms << " ms for " << tracked->key;
+    rtc::CritScope lock(&stats_lock_);
+    last_ramp_up_seconds_ = ramp_up_ms / 1000.0;
+  }
+
+  // 落ち着いた後はその時々の推定値を覚えておく
+  Entry& entry = entries_[tracked->key];
+  entry.bitrate_bps = static_cast<int64_t>(bitrate_bps);
+  entry.rtt_ms = static_cast<int64_t>(rtt_sec * 1000);
+  entry.updated_at = time(nullptr);
+  dirty_ = true;
+}
+
+void BandwidthWarmStart::Load() {
+  std::ifstream ifs(cache_file_);
+  if (!ifs) {
+    return;
+  }
+  nlohmann::json json = nlohmann::json::parse(ifs, nullptr, false);
+  if (!json.is_object()) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__ << ": Ignoring broken cache file "
+                        << cache_file_;
+    return;
+  }
+  for (auto it = json.begin(); it != json.end(); ++it) {
+    const nlohmann::json& value = it.value();
+    if (!value.is_object()) {
+      continue;
+    }
+    Entry entry;
+    entry.bitrate_bps = value.value("bitrate_bps", 0LL);
+    entry.rtt_ms = value.value("rtt_ms", 0LL);
+    entry.updated_at = value.value("updated_at", 0LL);
+    if (entry.bitrate_bps > 0) {
+      entries_[it.key()] = entry;
+    }
+  }
+  RTC_LOG(LS_INFO) << __FUNCTION__ << ": Loaded " << entries_.size()
+                   << " entries from " << cache_file_;
+}
+
+void BandwidthWarmStart::Save() {
+  dirty_ = false;
+  last_save_ms_ = rtc::TimeMillis();
+
+  nlohmann::json json = nlohmann::json::object();
+  int64_t now = time(nullptr);
+  for (const auto& entry : entries_) {
+    // 古いものはここで捨てて、ファイルが大きくならないようにする
+    if (now - entry.second.updated_at >= kMaxEntryAgeSec) {
+      continue;
+    }
+    json[entry.first] = {{"bitrate_bps", entry.second.bitrate_bps},
+                         {"rtt_ms", entry.second.rtt_ms},
+                         {"updated_at", entry.second.updated_at}};
+  }
+
+  // 書き込み途中で落ちても壊れないように、別のファイルに書いてから置き換える
+  std::string tmp = cache_file_ + ".tmp";
+  {
+    std::ofstream ofs(tmp);
+    if (!ofs) {
+      RTC_LOG(LS_WARNING) << __FUNCTION__ << ": Failed to open " << tmp;
+      return;
+    }
+    ofs << json.dump(2) << std::endl;
+  }
+  if (rename(tmp.c_str(), cache_file_.c_str()) != 0) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__ << ": Failed to write "
+                        << cache_file_;
+  }
+}
+
+std::string BandwidthWarmStart::MakeKey() const {
+  // 同じサーバでも有線と無線では帯域が違うので、インタフェース毎に分ける
+  std::string host = signaling_host_;
+  URLParts parts;
+  if (URLParts::parse(signaling_host_, parts)) {
+    host = parts.host;
+  }
+  std::string iface = DefaultRouteInterface();
+  return host + "@" + (iface.empty() ? "unknown" : iface);
+}
@@ -0,0 +1,89 @@
+#ifndef BANDWIDTH_WARM_START_H_
+#define BANDWIDTH_WARM_START_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "api/stats/rtc_stats_report.h"
+#include "connection.h"
+#include "rtc_base/critical_section.h"
+#include "rtc_base/message_handler.h"
+#include "rtc_base/thread.h"
+
+// 前回の接続で落ち着いた送信側の推定帯域と RTT を、シグナリングサーバと
+// ネットワークインタフェースの組毎にファイルに覚えておき、次の接続の
+// 開始ビットレートに使う。
+//
+// 接続毎に GetStats の availableOutgoingBitrate を一定間隔で見て、
+// 繋がってから推定帯域が最大値の 9 割に届くまでの時間を立ち上がり時間として記録する。
+// 処理は全て指定したスレッド (シグナリングスレッド) で行う。
+class BandwidthWarmStart
+    : public rtc::MessageHandler,
+      public std::enable_shared_from_this<BandwidthWarmStart> {
+ public:
+  // max_bitrate_kbps が 0 でなければ開始ビットレートをそれ以下にする
+  BandwidthWarmStart(rtc::Thread* thread,
+                     const std::string& cache_file,
+                     const std::string& signaling_host,
+                     int max_bitrate_kbps);
+  ~BandwidthWarmStart() override;
+
+  void Start();
+  // 覚えている推定帯域をファイルに書き出して止める
+  void Stop();
+
+  // 新しい接続に開始ビットレートを設定して、推定帯域を見始める
+  void Attach(std::shared_ptr<RTCConnection> connection);
+
+  // /metrics に立ち上がり時間などを書き足す
+  void AppendMetrics(std::string* out);
+
+ private:
+  struct Entry {
+    int64_t bitrate_bps = 0;
+    int64_t rtt_ms = 0;
+    // UNIX 時間 (秒)
+    int64_t updated_at = 0;
+  };
+  struct Tracked {
+    std::weak_ptr<RTCConnection> connection;
+    std::string key;
+    // 推定帯域が最初に取れた時刻。まだなら -1
+    int64_t connected_ms = -1;
+    std::vector<std::pair<int64_t, double>> samples;
+    bool ramped_up = false;
+  };
+
+  void OnMessage(rtc::Message* msg) override;
+  void Poll();
+  void OnStatsDelivered(
+      std::shared_ptr<Tracked> tracked,
+      const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report);
+  void Load();
+  void Save();
+  std::string MakeKey() const;
+
+  rtc::Thread* thread_;
+  const std::string cache_file_;
+  const std::string signaling_host_;
+  const int max_bitrate_kbps_;
+
+  // 以下は thread_ からしか触らない
+  bool running_;
+  std::map<std::string, Entry> entries_;
+  bool dirty_;
+  int64_t last_save_ms_;
+  std::vector<std::shared_ptr<Tracked>> tracked_;
+
+  rtc::CriticalSection stats_lock_;
+  uint64_t warm_starts_ RTC_GUARDED_BY(stats_lock_);
+  int64_t last_start_bitrate_bps_ RTC_GUARDED_BY(stats_lock_);
+  double last_ramp_up_seconds_ RTC_GUARDED_BY(stats_lock_);
+};
+
+#endif  // BANDWIDTH_WARM_START_H_
@@ -0,0 +1,68 @@
+#include "codec_filter_factory.h"
+
+#include "absl/strings/match.h"
+#include "rtc_base/logging.h"
+
+namespace {
+
+std::vector<webrtc::SdpVideoFormat> FilterFormats(
+    const std::vector<webrtc::SdpVideoFormat>& formats,
+    const std::string& codec) {
+  std::vector<webrtc::SdpVideoFormat> result;
+  for (const webrtc::SdpVideoFormat& format : formats) {
+    if (absl::EqualsIgnoreCase(format.name, codec)) {
+      result.push_back(format);
+    }
+  }
+  return result;
+}
+
+}  // namespace
+
+CodecFilterVideoEncoderFactory::CodecFilterVideoEncoderFactory(
+    std::unique_ptr<webrtc::VideoEncoderFactory> factory,
+    const std::string& codec)
+    : factory_(std::move(factory)), codec_(codec) {}
+
+std::vector<webrtc::SdpVideoFormat>
+CodecFilterVideoEncoderFactory::GetSupportedFormats() const {
+  return FilterFormats(factory_->GetSupportedFormats(), codec_);
+}
+
+webrtc::VideoEncoderFactory::CodecInfo
+CodecFilterVideoEncoderFactory::QueryVideoEncoder(
+    const webrtc::SdpVideoFormat& format) const {
+  return factory_->QueryVideoEncoder(format);
+}
+
+std::unique_ptr<webrtc::VideoEncoder>
+CodecFilterVideoEncoderFactory::CreateVideoEncoder(
+    const webrtc::SdpVideoFormat& format) {
+  if (!absl::EqualsIgnoreCase(format.name, codec_)) {
+    RTC_LOG(LS_ERROR) << "Encoder for " << format.name
+                      << " is disabled, only " << codec_ << " is available";
+    return nullptr;
+  }
+  return factory_->CreateVideoEncoder(format);
+}
+
+CodecFilterVideoDecoderFactory::CodecFilterVideoDecoderFactory(
+    std::unique_ptr<webrtc::VideoDecoderFactory> factory,
+    const std::string& codec)
+    : factory_(std::move(factory)), codec_(codec) {}
+
+std::vector<webrtc::SdpVideoFormat>
+CodecFilterVideoDecoderFactory::GetSupportedFormats() const {
+  return FilterFormats(factory_->GetSupportedFormats(), codec_);
+}
+
+std::unique_ptr<webrtc::VideoDecoder>
+CodecFilterVideoDecoderFactory::CreateVideoDecoder(
+    const webrtc::SdpVideoFormat& format) {
+  if (!absl::EqualsIgnoreCase(format.name, codec_)) {
+    RTC_LOG(LS_ERROR) << "Decoder for " << format.name
+                      << " is disabled, only " << codec_ << " is available";
+    return nullptr;
+  }
+  return factory_->CreateVideoDecoder(format);
+}
@@ -0,0 +1,50 @@
+#ifndef CODEC_FILTER_FACTORY_H_
+#define CODEC_FILTER_FACTORY_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "api/video_codecs/sdp_video_format.h"
+#include "api/video_codecs/video_decoder.h"
+#include "api/video_codecs/video_decoder_factory.h"
+#include "api/video_codecs/video_encoder.h"
+#include "api/video_codecs/video_encoder_factory.h"
+
+// 既存のファクトリをラップして、指定したコーデックだけを見せるファクトリ。
+// 省メモリモードで、使わないコーデックのエンコーダやデコーダが
+// 作られないようにするために使う。
+
+class CodecFilterVideoEncoderFactory : public webrtc::VideoEncoderFactory {
+ public:
+  CodecFilterVideoEncoderFactory(
+      std::unique_ptr<webrtc::VideoEncoderFactory> factory,
+      const std::string& codec);
+
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
+  CodecInfo QueryVideoEncoder(
+      const webrtc::SdpVideoFormat& format) const override;
+  std::unique_ptr<webrtc::VideoEncoder> CreateVideoEncoder(
+      const webrtc::SdpVideoFormat& format) override;
+
+ private:
+  std::unique_ptr<webrtc::VideoEncoderFactory> factory_;
+  const std::string codec_;
+};
+
+class CodecFilterVideoDecoderFactory : public webrtc::VideoDecoderFactory {
+ public:
+  CodecFilterVideoDecoderFactory(
+      std::unique_ptr<webrtc::VideoDecoderFactory> factory,
+      const std::string& codec);
+
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
+  std::unique_ptr<webrtc::VideoDecoder> CreateVideoDecoder(
+      const webrtc::SdpVideoFormat& format) override;
+
+ private:
+  std::unique_ptr<webrtc::VideoDecoderFactory> factory_;
+  const std::string codec_;
+};
+
+#endif  // CODEC_FILTER_FACTORY_H_
@@ -1,12 +1,13 @@
 #include "connection.h"
 
 #include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
 
 RTCConnection::~RTCConnection() {
   _connection->Close();
 }
 
-void RTCConnection::createOffer() {
+void RTCConnection::createOffer(bool ice_restart) {
   using RTCOfferAnswerOptions =
       webrtc::PeerConnectionInterface::RTCOfferAnswerOptions;
   RTCOfferAnswerOptions options = RTCOfferAnswerOptions();
@@ -14,6 +15,7 @@ void RTCConnection::createOffer() {
       RTCOfferAnswerOptions::kOfferToReceiveMediaTrue;
   options.offer_to_receive_audio =
       RTCOfferAnswerOptions::kOfferToReceiveMediaTrue;
+  options.ice_restart = ice_restart;
   _connection->CreateOffer(
       CreateSessionDescriptionObserver::Create(_sender, _connection), options);
 }
@@ -77,6 +79,42 @@ void RTCConnection::addIceCandidate(const std::string sdp_mid,
   }
 }
 
+bool RTCConnection::setIceServers(
+    const webrtc::PeerConnectionInterface::IceServers& servers) {
+  // 証明書などは作った時と同じでないと変更できないので、今の設定を元にする
+  webrtc::PeerConnectionInterface::RTCConfiguration config =
+      _connection->GetConfiguration();
+  // ICE サーバを変えると候補のプールが作り直されるので、同じなら何もしない
+  if (config.servers == servers) {
+    return true;
+  }
+  config.servers = servers;
+  webrtc::RTCError error = _connection->SetConfiguration(config);
+  if (!error.ok()) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__
+                        << ": Failed to set ICE servers: " << error.message();
+    return false;
+  }
+  _ice_pool_discarded = true;
+  return true;
+}
+
+void RTCConnection::reportPrewarmed() {
+  if (_prewarm_start_ms < 0) {
+    return;
+  }
+  // 作るのにかかった時間がオファーからの処理時間から無くなった分。
+  // ICE の候補は ICE サーバが変わっていなければ先に集めたものを使える
+  RTC_LOG(LS_INFO) << "Using pre-warmed PeerConnection: saved "
+                   << _prewarm_cost_ms << " ms of construction, created "
+                   << rtc::TimeMillis() - _prewarm_start_ms
+                   << " ms before the offer, ICE candidates "
+                   << (_ice_pool_discarded
+                           ? "are gathered again for the new ICE servers"
+                           : "were gathered in advance");
+  _prewarm_start_ms = -1;
+}
+
 bool RTCConnection::setAudioEnabled(bool enabled) {
   return setMediaEnabled(getLocalAudioTrack(), enabled);
 }
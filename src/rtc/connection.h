@@ -10,9 +10,13 @@ class RTCConnection {
                 rtc::scoped_refptr<webrtc::PeerConnectionInterface> connection)
       : _sender(sender),
         _observer(std::move(observer)),
-        _connection(connection){};
+        _connection(connection),
+        _prewarm_start_ms(-1),
+        _prewarm_cost_ms(0),
+        _ice_pool_discarded(false){};
   ~RTCConnection();
-  void createOffer();
+  // ice_restart が true の時は ICE の資格情報を変えたオファーを作る
+  void createOffer(bool ice_restart = false);
   void setOffer(const std::string sdp);
   void createAnswer();
   void setAnswer(const std::string sdp);
@@ -23,6 +27,21 @@ class RTCConnection {
   bool setVideoEnabled(bool enabled);
   bool isAudioEnabled();
   bool isVideoEnabled();
+  // 事前に作っておいた接続に、オファーと一緒に届いた ICE サーバを設定する。
+  // 作った時と ICE サーバが変わると、集めておいた候補は捨てられる
+  bool setIceServers(
+      const webrtc::PeerConnectionInterface::IceServers& servers);
+  // RTCManager::createPrewarmedConnection で作った時に、作り始めた時刻と
+  // 作るのにかかった時間を覚えておく
+  void setPrewarmed(int64_t start_ms, int64_t cost_ms) {
+    _prewarm_start_ms = start_ms;
+    _prewarm_cost_ms = cost_ms;
+  }
+  // 事前に作っておいた接続を使い始めた時に、短縮できた時間をログに出す
+  void reportPrewarmed();
+  rtc::scoped_refptr<webrtc::PeerConnectionInterface> getConnection() const {
+    return _connection;
+  }
 
  private:
   rtc::scoped_refptr<webrtc::MediaStreamInterface> getLocalStream();
@@ -37,5 +56,8 @@ class RTCConnection {
   RTCMessageSender* _sender;
   std::unique_ptr<PeerConnectionObserver> _observer;
   rtc::scoped_refptr<webrtc::PeerConnectionInterface> _connection;
+  int64_t _prewarm_start_ms;
+  int64_t _prewarm_cost_ms;
+  bool _ice_pool_discarded;
 };
 #endif
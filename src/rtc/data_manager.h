@@ -1,7 +1,11 @@
 #ifndef DATA_MANAGER_H_
 #define DATA_MANAGER_H_
 
+#include <string>
+#include <vector>
+
 #include "api/data_channel_interface.h"
+#include "api/peer_connection_interface.h"
 
 class RTCDataManager {
  public:
@@ -9,6 +13,41 @@ class RTCDataManager {
   // DataChannel は 必ず kClosed にステートが遷移するので OnRemove は不要
   virtual void OnDataChannel(
       rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) = 0;
+  // PeerConnection を作った直後に呼ばれる。
+  // 自分から DataChannel を作る場合はここで作る
+  virtual void OnConnectionCreated(
+      rtc::scoped_refptr<webrtc::PeerConnectionInterface> connection) {}
+  // 相手が開いた DataChannel を受け取るか。複数ある時に振り分けるのに使う
+  virtual bool IsTargetDataChannel(const std::string& label) { return true; }
+};
+
+// 複数の RTCDataManager に振り分ける。
+// 相手が開いた DataChannel は、追加した順に最初に受け取ると答えたものに渡す
+class RTCDataManagerDispatcher : public RTCDataManager {
+ public:
+  void Add(RTCDataManager* data_manager) {
+    data_managers_.push_back(data_manager);
+  }
+  bool empty() const { return data_managers_.empty(); }
+
+  void OnDataChannel(
+      rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) override {
+    for (RTCDataManager* data_manager : data_managers_) {
+      if (data_manager->IsTargetDataChannel(data_channel->label())) {
+        data_manager->OnDataChannel(data_channel);
+        return;
+      }
+    }
+  }
+  void OnConnectionCreated(
+      rtc::scoped_refptr<webrtc::PeerConnectionInterface> connection) override {
+    for (RTCDataManager* data_manager : data_managers_) {
+      data_manager->OnConnectionCreated(connection);
+    }
+  }
+
+ private:
+  std::vector<RTCDataManager*> data_managers_;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -4,6 +4,37 @@
 #include "absl/types/optional.h"
 #include "api/video_codecs/sdp_video_format.h"
 
+namespace {
+
+// H.264 の Table A-1 より、レベルごとの 1 秒あたりのマクロブロック数と
+// 1 フレームのマクロブロック数の上限
+struct LevelLimit {
+  webrtc::H264::Level level;
+  int max_macroblocks_per_second;
+  int max_frame_macroblocks;
+};
+
+const LevelLimit kLevelLimits[] = {
+    {webrtc::H264::kLevel1, 1485, 99},
+    {webrtc::H264::kLevel1_1, 3000, 396},
+    {webrtc::H264::kLevel1_2, 6000, 396},
+    {webrtc::H264::kLevel1_3, 11880, 396},
+    {webrtc::H264::kLevel2, 11880, 396},
+    {webrtc::H264::kLevel2_1, 19800, 792},
+    {webrtc::H264::kLevel2_2, 20250, 1620},
+    {webrtc::H264::kLevel3, 40500, 1620},
+    {webrtc::H264::kLevel3_1, 108000, 3600},
+    {webrtc::H264::kLevel3_2, 216000, 5120},
+    {webrtc::H264::kLevel4, 245760, 8192},
+    {webrtc::H264::kLevel4_1, 245760, 8192},
+    {webrtc::H264::kLevel4_2, 522240, 8704},
+    {webrtc::H264::kLevel5, 589824, 22080},
+    {webrtc::H264::kLevel5_1, 983040, 36864},
+    {webrtc::H264::kLevel5_2, 2073600, 36864},
+};
+
+}  // namespace
+
 // modules/video_coding/codecs/h264/h264.cc より
 webrtc::SdpVideoFormat CreateH264Format(webrtc::H264::Profile profile,
                                         webrtc::H264::Level level,
@@ -17,3 +48,45 @@ webrtc::SdpVideoFormat CreateH264Format(webrtc::H264::Profile profile,
        {cricket::kH264FmtpLevelAsymmetryAllowed, "1"},
        {cricket::kH264FmtpPacketizationMode, packetization_mode}});
 }
+
+std::vector<webrtc::SdpVideoFormat> CreateH264Formats(
+    const std::vector<webrtc::H264::ProfileLevelId>& profile_levels) {
+  std::vector<webrtc::SdpVideoFormat> formats;
+  for (const webrtc::H264::ProfileLevelId& profile_level : profile_levels) {
+    formats.push_back(
+        CreateH264Format(profile_level.profile, profile_level.level, "1"));
+    formats.push_back(
+        CreateH264Format(profile_level.profile, profile_level.level, "0"));
+  }
+  return formats;
+}
+
+webrtc::H264::ProfileLevelId H264ProfileLevelIdFromFormat(
+    const webrtc::SdpVideoFormat& format) {
+  absl::optional<webrtc::H264::ProfileLevelId> profile_level =
+      webrtc::H264::ParseSdpProfileLevelId(format.parameters);
+  if (!profile_level) {
+    return webrtc::H264::ProfileLevelId(
+        webrtc::H264::kProfileConstrainedBaseline, webrtc::H264::kLevel3_1);
+  }
+  return *profile_level;
+}
+
+webrtc::H264::Level H264LevelForResolution(int width,
+                                           int height,
+                                           int framerate) {
+  int frame_macroblocks = ((width + 15) / 16) * ((height + 15) / 16);
+  int macroblocks_per_second = frame_macroblocks * framerate;
+  for (const LevelLimit& limit : kLevelLimits) {
+    if (frame_macroblocks <= limit.max_frame_macroblocks &&
+        macroblocks_per_second <= limit.max_macroblocks_per_second) {
+      return limit.level;
+    }
+  }
+  return webrtc::H264::kLevel5_2;
+}
+
+bool IsH264BaselineProfile(webrtc::H264::Profile profile) {
+  return profile == webrtc::H264::kProfileBaseline ||
+         profile == webrtc::H264::kProfileConstrainedBaseline;
+}
@@ -2,7 +2,9 @@
 #define RTC_H264_FORMAT_H_
 
 #include <string>
+#include <vector>
 
+#include "api/video_codecs/sdp_video_format.h"
 #include "media/base/codec.h"
 #include "media/base/h264_profile_level_id.h"
 
@@ -10,4 +12,21 @@ webrtc::SdpVideoFormat CreateH264Format(webrtc::H264::Profile profile,
                                         webrtc::H264::Level level,
                                         const std::string& packetization_mode);
 
+// profile_levels のそれぞれを packetization-mode 1 と 0 で並べる
+std::vector<webrtc::SdpVideoFormat> CreateH264Formats(
+    const std::vector<webrtc::H264::ProfileLevelId>& profile_levels);
+
+// ネゴシエーションで決まった形式のプロファイルとレベル。
+// profile-level-id が無いか読めなければ Constrained Baseline 3.1 にする
+webrtc::H264::ProfileLevelId H264ProfileLevelIdFromFormat(
+    const webrtc::SdpVideoFormat& format);
+
+// width x height を framerate で送るのに必要な最小のレベル
+webrtc::H264::Level H264LevelForResolution(int width,
+                                           int height,
+                                           int framerate);
+
+// Baseline と Constrained Baseline は CABAC や 8x8 変換を使えない
+bool IsH264BaselineProfile(webrtc::H264::Profile profile);
+
 #endif  // RTC_H264_FORMAT_H_
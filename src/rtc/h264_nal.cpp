@@ -0,0 +1,32 @@
+#include "h264_nal.h"
+
+bool SplitH264Nals(const uint8_t* buffer,
+                   size_t size,
+                   std::vector<H264NalEntry>* nals) {
+  bool key_frame = false;
+  uint8_t zero_count = 0;
+  size_t nal_start_idx = 0;
+  for (size_t i = 0; i < size; i++) {
+    uint8_t data = buffer[i];
+    if ((i != 0) && (i == nal_start_idx)) {
+      if ((data & 0x1F) == 0x05) {
+        key_frame = true;
+      }
+    }
+    if (data == 0x01 && zero_count == 3) {
+      if (nal_start_idx != 0) {
+        nals->push_back({nal_start_idx, i - nal_start_idx + 1 - 4});
+      }
+      nal_start_idx = i + 1;
+    }
+    if (data == 0x00) {
+      zero_count++;
+    } else {
+      zero_count = 0;
+    }
+  }
+  if (nal_start_idx != 0) {
+    nals->push_back({nal_start_idx, size - nal_start_idx});
+  }
+  return key_frame;
+}
@@ -0,0 +1,20 @@
+#ifndef RTC_H264_NAL_H_
+#define RTC_H264_NAL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+struct H264NalEntry {
+  size_t offset;
+  size_t size;
+};
+
+// Annex B 形式のバイト列を 4 バイトのスタートコードで NAL ユニットに分割する。
+// IDR スライスが含まれていれば true を返す。
+bool SplitH264Nals(const uint8_t* buffer,
+                   size_t size,
+                   std::vector<H264NalEntry>* nals);
+
+#endif  // RTC_H264_NAL_H_
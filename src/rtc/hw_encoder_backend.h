@@ -0,0 +1,75 @@
+#ifndef HW_ENCODER_BACKEND_H_
+#define HW_ENCODER_BACKEND_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+
+#include "api/video/video_codec_type.h"
+#include "api/video/video_frame.h"
+#include "media/base/h264_profile_level_id.h"
+
+// HWVideoEncoder から使う、エンコーダの実装ごとの部分。
+//
+// フレームの情報の管理やレート制御、EncodedImage の組み立ては
+// HWVideoEncoder がやるので、ここではエンコーダを動かすことだけをする。
+// メソッドは全て HWVideoEncoder のエンコードスレッドから呼ばれる。
+//
+// Encode は非同期でいい。エンコードが終わったら、どのスレッドからでも
+// OutputCallback を呼ぶ。Configure し直した後や Release から戻った後に、
+// 前の callback を呼んではいけない。
+class HWEncoderBackend {
+ public:
+  struct Config {
+    webrtc::VideoCodecType codec_type = webrtc::kVideoCodecGeneric;
+    int width = 0;
+    int height = 0;
+    uint32_t bitrate_bps = 0;
+    uint32_t framerate = 30;
+    // WebRTC から渡されたキーフレームの間隔。0 なら実装に任せる
+    int key_frame_interval = 0;
+    // H264 のプロファイルとレベル。ネゴシエーションで決まったものを、
+    // 解像度に足りなければレベルだけ上げて渡す
+    webrtc::H264::Profile h264_profile =
+        webrtc::H264::kProfileConstrainedBaseline;
+    webrtc::H264::Level h264_level = webrtc::H264::kLevel3_1;
+    // 0 でなければ、定期的なキーフレームを出さずに、このフレーム数で
+    // 画面全体をイントラマクロブロックで少しずつ更新する。
+    // 1 フレームで全体を送らないので、キーフレームでビットレートが跳ねない
+    int intra_refresh_period = 0;
+  };
+
+  // timestamp には Encode に渡したフレームの timestamp() をそのまま返す。
+  // H264 は 4 バイトのスタートコードの Annex B 形式で、
+  // SPS と PPS だけを別に返してもいい (次のフレームの前に付けて送る)
+  typedef std::function<void(const uint8_t* data,
+                             size_t size,
+                             uint32_t timestamp,
+                             bool key_frame)>
+      OutputCallback;
+
+  enum class EncodeResult {
+    kOk,
+    // エンコーダが詰まっていて、このフレームを捨てた
+    kDropped,
+    kError,
+  };
+
+  virtual ~HWEncoderBackend() {}
+
+  // config の大きさでエンコーダを用意する。前のものがあれば取り替える
+  virtual bool Configure(const Config& config, OutputCallback callback) = 0;
+  virtual void Release() = 0;
+  virtual EncodeResult Encode(const webrtc::VideoFrame& frame,
+                              bool force_key_frame) = 0;
+  // 値が変わった時だけ呼ばれる
+  virtual void SetBitrate(uint32_t bitrate_bps) = 0;
+  virtual void SetFramerate(uint32_t framerate) = 0;
+
+  virtual const char* ImplementationName() const = 0;
+  virtual bool SupportsNativeHandle() const { return false; }
+  virtual bool IsHardwareAccelerated() const { return true; }
+};
+
+#endif  // HW_ENCODER_BACKEND_H_
@@ -0,0 +1,115 @@
+#ifndef HW_ENCODER_POOL_H_
+#define HW_ENCODER_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "rtc_base/critical_section.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+
+// 設定済みのハードウェアエンコーダのパイプラインを使い回すためのプール。
+//
+// パイプラインを作り直すと数百ミリ秒かかって映像が止まるので、
+// エンコーダを解放した時や解像度が変わった時に捨てずにここに戻しておき、
+// 同じ key (コーデックや解像度など、作る時に決まるもの) で次に作る時に渡す。
+// key はパイプラインを作る側で決めた文字列。
+//
+// 使っていないパイプラインは max_idle 個まで、kIdleTimeoutMs の間だけ残す。
+// 古いものは Acquire か Release を呼んだ時に、ロックの外で破棄する。
+template <typename Pipeline>
+class HWEncoderPool {
+ public:
+  static const int64_t kIdleTimeoutMs = 60 * 1000;
+
+  explicit HWEncoderPool(size_t max_idle) : max_idle_(max_idle) {}
+
+  // key のパイプラインが残っていれば取り出す。無ければ nullptr
+  std::unique_ptr<Pipeline> Acquire(const std::string& key) {
+    std::vector<std::unique_ptr<Pipeline>> expired;
+    std::unique_ptr<Pipeline> pipeline;
+    {
+      rtc::CritScope lock(&lock_);
+      TakeExpired(&expired);
+      // 最近戻したものから探す
+      for (auto it = idle_.rbegin(); it != idle_.rend(); ++it) {
+        if (it->key == key) {
+          pipeline = std::move(it->pipeline);
+          idle_.erase(std::next(it).base());
+          break;
+        }
+      }
+    }
+    RTC_LOG(LS_INFO) << "HWEncoderPool " << (pipeline ? "hit " : "miss ")
+                     << key;
+    return pipeline;
+  }
+
+  // 使い終わったパイプラインを戻す。入りきらなければ古いものから破棄する
+  void Release(const std::string& key, std::unique_ptr<Pipeline> pipeline) {
+    if (!pipeline) {
+      return;
+    }
+    std::vector<std::unique_ptr<Pipeline>> expired;
+    {
+      rtc::CritScope lock(&lock_);
+      TakeExpired(&expired);
+      if (max_idle_ == 0) {
+        expired.push_back(std::move(pipeline));
+      } else {
+        idle_.push_back(Entry{key, std::move(pipeline), rtc::TimeMillis()});
+        while (idle_.size() > max_idle_) {
+          expired.push_back(std::move(idle_.front().pipeline));
+          idle_.pop_front();
+        }
+      }
+    }
+  }
+
+  // 残っているパイプラインを全部破棄する。
+  // ハードウェアの数が足りなくて新しく作れなかった時に呼ぶ
+  void Clear() {
+    std::vector<std::unique_ptr<Pipeline>> expired;
+    {
+      rtc::CritScope lock(&lock_);
+      for (Entry& entry : idle_) {
+        expired.push_back(std::move(entry.pipeline));
+      }
+      idle_.clear();
+    }
+  }
+
+  size_t idle_count() {
+    rtc::CritScope lock(&lock_);
+    return idle_.size();
+  }
+
+ private:
+  struct Entry {
+    std::string key;
+    std::unique_ptr<Pipeline> pipeline;
+    int64_t released_ms;
+  };
+
+  void TakeExpired(std::vector<std::unique_ptr<Pipeline>>* expired)
+      RTC_EXCLUSIVE_LOCKS_REQUIRED(lock_) {
+    int64_t now_ms = rtc::TimeMillis();
+    while (!idle_.empty() &&
+           now_ms - idle_.front().released_ms >= kIdleTimeoutMs) {
+      expired->push_back(std::move(idle_.front().pipeline));
+      idle_.pop_front();
+    }
+  }
+
+  const size_t max_idle_;
+  rtc::CriticalSection lock_;
+  std::deque<Entry> idle_ RTC_GUARDED_BY(lock_);
+};
+
+#endif  // HW_ENCODER_POOL_H_
@@ -50,15 +50,14 @@ std::vector<webrtc::SdpVideoFormat> HWVideoDecoderFactory::GetSupportedFormats()
   for (const webrtc::SdpVideoFormat& format : webrtc::SupportedVP9Codecs())
     formats.push_back(format);
 
-  std::vector<webrtc::SdpVideoFormat> h264_codecs = {
-      CreateH264Format(webrtc::H264::kProfileBaseline, webrtc::H264::kLevel3_1,
-                       "1"),
-      CreateH264Format(webrtc::H264::kProfileBaseline, webrtc::H264::kLevel3_1,
-                       "0"),
-      CreateH264Format(webrtc::H264::kProfileConstrainedBaseline,
-                       webrtc::H264::kLevel3_1, "1"),
-      CreateH264Format(webrtc::H264::kProfileConstrainedBaseline,
-                       webrtc::H264::kLevel3_1, "0")};
+  // 送受信する時はエンコーダと共通のプロファイルしか使われないので、
+  // エンコーダが High や Main を出せるようにこちらにも並べておく
+  std::vector<webrtc::SdpVideoFormat> h264_codecs = CreateH264Formats({
+      {webrtc::H264::kProfileHigh, webrtc::H264::kLevel3_1},
+      {webrtc::H264::kProfileMain, webrtc::H264::kLevel3_1},
+      {webrtc::H264::kProfileBaseline, webrtc::H264::kLevel3_1},
+      {webrtc::H264::kProfileConstrainedBaseline, webrtc::H264::kLevel3_1},
+  });
 
   for (const webrtc::SdpVideoFormat& h264_format : h264_codecs)
     formats.push_back(h264_format);
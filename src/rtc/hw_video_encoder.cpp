@@ -0,0 +1,415 @@
+#include "hw_video_encoder.h"
+
+#include <string.h>
+
+#include <utility>
+
+#include "modules/video_coding/include/video_codec_interface.h"
+#include "metrics/encoded_frame_stats.h"
+#include "rtc/h264_format.h"
+#include "modules/video_coding/utility/vp8_header_parser.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+#include "thread_policy/thread_policy.h"
+
+namespace {
+
+const int kLowH264QpThreshold = 34;
+const int kHighH264QpThreshold = 40;
+const int kLowVp8QpThreshold = 29;
+const int kHighVp8QpThreshold = 95;
+// イントラリフレッシュの時に、キーフレームの要求に応える最短の間隔。
+// パケットロスで PLI が続けて来ても、IDR でビットレートが跳ね続けないようにする
+const int64_t kIntraRefreshKeyFrameIntervalMs = 1000;
+
+bool HasH264Slice(const uint8_t* data, const std::vector<H264NalEntry>& nals) {
+  for (const H264NalEntry& nal : nals) {
+    uint8_t type = data[nal.offset] & 0x1f;
+    if (type == 1 || type == 5) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+HWVideoEncoder::HWVideoEncoder(std::unique_ptr<HWEncoderBackend> backend,
+                               const webrtc::SdpVideoFormat& format,
+                               int intra_refresh_period)
+    : backend_(std::move(backend)),
+      h264_profile_level_(H264ProfileLevelIdFromFormat(format)),
+      intra_refresh_period_(intra_refresh_period),
+      stats_id_(EncodedFrameStats::AddEncoder(backend_->ImplementationName())),
+      callback_(nullptr),
+      codec_type_(webrtc::kVideoCodecGeneric),
+      key_frame_interval_(0),
+      bitrate_adjuster_(.5, .95),
+      target_bitrate_bps_(0),
+      configured_bitrate_bps_(0),
+      framerate_(30),
+      configured_framerate_(0),
+      configured_width_(0),
+      configured_height_(0),
+      last_key_frame_request_ms_(0),
+      key_frame_pending_(false),
+      generation_(0) {}
+
+HWVideoEncoder::~HWVideoEncoder() {
+  Release();
+  EncodedFrameStats::RemoveEncoder(stats_id_);
+}
+
+int32_t HWVideoEncoder::InitEncode(const webrtc::VideoCodec* codec_settings,
+                                   int32_t number_of_cores,
+                                   size_t max_payload_size) {
+  RTC_DCHECK(codec_settings);
+  RTC_DCHECK(codec_settings->codecType == webrtc::kVideoCodecH264 ||
+             codec_settings->codecType == webrtc::kVideoCodecVP8);
+
+  int32_t release_ret = Release();
+  if (release_ret != WEBRTC_VIDEO_CODEC_OK) {
+    return release_ret;
+  }
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  codec_type_ = codec_settings->codecType;
+  key_frame_interval_ = codec_type_ == webrtc::kVideoCodecH264
+                            ? codec_settings->H264().keyFrameInterval
+                            : codec_settings->VP8().keyFrameInterval;
+  framerate_ = codec_settings->maxFramerate;
+  target_bitrate_bps_ = codec_settings->startBitrate * 1000;
+  bitrate_adjuster_.SetTargetBitrateBps(target_bitrate_bps_);
+
+  RTC_LOG(LS_INFO) << "InitEncode " << backend_->ImplementationName() << " "
+                   << framerate_ << "fps " << target_bitrate_bps_
+                   << "bit/sec";
+
+  rtc::CritScope output_lock(&output_lock_);
+  encoded_image_._completeFrame = true;
+  encoded_image_._encodedWidth = 0;
+  encoded_image_._encodedHeight = 0;
+  encoded_image_.set_size(0);
+  encoded_image_.timing_.flags =
+      webrtc::VideoSendTiming::TimingFrameFlags::kInvalid;
+  encoded_image_.content_type_ =
+      (codec_settings->mode == webrtc::VideoCodecMode::kScreensharing)
+          ? webrtc::VideoContentType::SCREENSHARE
+          : webrtc::VideoContentType::UNSPECIFIED;
+
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t HWVideoEncoder::Release() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  backend_->Release();
+  configured_width_ = 0;
+  configured_height_ = 0;
+  rtc::CritScope params_lock(&frame_params_lock_);
+  frame_params_.clear();
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t HWVideoEncoder::Configure(int width, int height) {
+  int generation;
+  {
+    rtc::CritScope lock(&output_lock_);
+    generation = ++generation_;
+    header_buffer_.clear();
+  }
+  {
+    rtc::CritScope lock(&frame_params_lock_);
+    frame_params_.clear();
+  }
+
+  HWEncoderBackend::Config config;
+  config.codec_type = codec_type_;
+  config.width = width;
+  config.height = height;
+  config.bitrate_bps = bitrate_adjuster_.GetAdjustedBitrateBps();
+  config.framerate = framerate_;
+  config.key_frame_interval = key_frame_interval_;
+  config.intra_refresh_period = intra_refresh_period_;
+  if (codec_type_ == webrtc::kVideoCodecH264) {
+    config.h264_profile = h264_profile_level_.profile;
+    config.h264_level = h264_profile_level_.level;
+    // 相手が受け取れるレベルより上になってしまうが、レベルを偽って
+    // 規格外のストリームを送るよりはいい
+    webrtc::H264::Level required_level =
+        H264LevelForResolution(width, height, framerate_);
+    if (config.h264_level < required_level) {
+      RTC_LOG(LS_WARNING) << "H264 level " << config.h264_level
+                          << " is too low for " << width << "x" << height
+                          << "@" << framerate_ << ", using "
+                          << required_level;
+      config.h264_level = required_level;
+    }
+  }
+  auto callback = [this, generation](const uint8_t* data, size_t size,
+                                     uint32_t timestamp, bool key_frame) {
+    OnEncoded(generation, data, size, timestamp, key_frame);
+  };
+  if (!backend_->Configure(config, callback)) {
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
+  configured_width_ = width;
+  configured_height_ = height;
+  // 使い回したエンコーダは前の設定のままなので、次のフレームで設定し直す
+  configured_bitrate_bps_ = 0;
+  configured_framerate_ = 0;
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t HWVideoEncoder::RegisterEncodeCompleteCallback(
+    webrtc::EncodedImageCallback* callback) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  callback_ = callback;
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+void HWVideoEncoder::SetRates(const RateControlParameters& parameters) {
+  if (parameters.bitrate.get_sum_bps() <= 0 || parameters.framerate_fps <= 0)
+    return;
+
+  RTC_LOG(LS_INFO) << __FUNCTION__ << " framerate:" << parameters.framerate_fps
+                   << " bitrate:" << parameters.bitrate.get_sum_bps();
+  framerate_ = static_cast<uint32_t>(parameters.framerate_fps + 0.5);
+  target_bitrate_bps_ = parameters.bitrate.get_sum_bps();
+  bitrate_adjuster_.SetTargetBitrateBps(target_bitrate_bps_);
+}
+
+webrtc::VideoEncoder::EncoderInfo HWVideoEncoder::GetEncoderInfo() const {
+  EncoderInfo info;
+  info.supports_native_handle = backend_->SupportsNativeHandle();
+  info.implementation_name = backend_->ImplementationName();
+  if (codec_type_ == webrtc::kVideoCodecVP8) {
+    info.scaling_settings =
+        VideoEncoder::ScalingSettings(kLowVp8QpThreshold, kHighVp8QpThreshold);
+  } else {
+    info.scaling_settings = VideoEncoder::ScalingSettings(
+        kLowH264QpThreshold, kHighH264QpThreshold);
+  }
+  info.is_hardware_accelerated = backend_->IsHardwareAccelerated();
+  info.has_internal_source = false;
+  return info;
+}
+
+int32_t HWVideoEncoder::Encode(
+    const webrtc::VideoFrame& input_frame,
+    const std::vector<webrtc::VideoFrameType>* frame_types) {
+  ThreadPolicy::ApplyOnce("encoder", nullptr);
+  std::lock_guard<std::mutex> lock(mtx_);
+  if (!callback_) {
+    RTC_LOG(LS_WARNING)
+        << "InitEncode() has been called, but a callback function "
+        << "has not been set with RegisterEncodeCompleteCallback()";
+    return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+  }
+
+  bool force_key_frame = false;
+  if (frame_types != nullptr) {
+    RTC_DCHECK_EQ(frame_types->size(), static_cast<size_t>(1));
+    if ((*frame_types)[0] == webrtc::VideoFrameType::kEmptyFrame) {
+      return WEBRTC_VIDEO_CODEC_OK;
+    }
+    force_key_frame =
+        (*frame_types)[0] == webrtc::VideoFrameType::kVideoFrameKey;
+  }
+
+  int width = input_frame.width();
+  int height = input_frame.height();
+  if (width != configured_width_ || height != configured_height_) {
+    RTC_LOG(LS_INFO) << "Encoder reinitialized from " << configured_width_
+                     << "x" << configured_height_ << " to " << width << "x"
+                     << height << " framerate:" << framerate_;
+    // 失敗した時に次のフレームでもう一度作り直すようにしておく
+    configured_width_ = 0;
+    configured_height_ = 0;
+    if (Configure(width, height) != WEBRTC_VIDEO_CODEC_OK) {
+      RTC_LOG(LS_ERROR) << "Failed to configure "
+                        << backend_->ImplementationName();
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+    // 作り直した直後や使い回した直後はキーフレームになる
+    force_key_frame = false;
+    key_frame_pending_ = false;
+    last_key_frame_request_ms_ = rtc::TimeMillis();
+  }
+
+  if (intra_refresh_period_ > 0 && (force_key_frame || key_frame_pending_)) {
+    // 新しい受信者のためにキーフレームは出すが、続けて来た要求は
+    // 覚えておいて、間隔が空いてから 1 回だけ出す
+    int64_t now_ms = rtc::TimeMillis();
+    if (now_ms - last_key_frame_request_ms_ <
+        kIntraRefreshKeyFrameIntervalMs) {
+      if (force_key_frame) {
+        RTC_LOG(LS_VERBOSE) << "Key frame request deferred";
+      }
+      key_frame_pending_ = true;
+      force_key_frame = false;
+    } else {
+      key_frame_pending_ = false;
+      force_key_frame = true;
+      last_key_frame_request_ms_ = now_ms;
+    }
+  }
+
+  uint32_t bitrate_bps = bitrate_adjuster_.GetAdjustedBitrateBps();
+  if (bitrate_bps != configured_bitrate_bps_) {
+    backend_->SetBitrate(bitrate_bps);
+    configured_bitrate_bps_ = bitrate_bps;
+  }
+  if (framerate_ != configured_framerate_) {
+    backend_->SetFramerate(framerate_);
+    configured_framerate_ = framerate_;
+  }
+
+  // エンコードが終わる方が先になることがあるので、先に積んでおく
+  {
+    rtc::CritScope params_lock(&frame_params_lock_);
+    frame_params_.push_back({width, height, input_frame.render_time_ms(),
+                             input_frame.ntp_time_ms(),
+                             input_frame.timestamp(), input_frame.rotation(),
+                             input_frame.color_space()});
+  }
+  HWEncoderBackend::EncodeResult result =
+      backend_->Encode(input_frame, force_key_frame);
+  if (result != HWEncoderBackend::EncodeResult::kOk) {
+    rtc::CritScope params_lock(&frame_params_lock_);
+    // 他のフレームが先に出てきて消している場合もあるので探して消す
+    for (auto it = frame_params_.rbegin(); it != frame_params_.rend(); ++it) {
+      if (it->timestamp == input_frame.timestamp()) {
+        frame_params_.erase(std::next(it).base());
+        break;
+      }
+    }
+  }
+  if (result == HWEncoderBackend::EncodeResult::kError) {
+    RTC_LOG(LS_ERROR) << "Failed to encode with "
+                      << backend_->ImplementationName();
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  if (result == HWEncoderBackend::EncodeResult::kDropped) {
+    RTC_LOG(LS_VERBOSE) << backend_->ImplementationName()
+                        << " is busy, dropping frame";
+    if (force_key_frame && intra_refresh_period_ > 0) {
+      // 落としたのがキーフレームなら次のフレームで出し直す
+      key_frame_pending_ = true;
+      last_key_frame_request_ms_ = 0;
+    }
+  }
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+void HWVideoEncoder::OnEncoded(int generation,
+                               const uint8_t* data,
+                               size_t size,
+                               uint32_t timestamp,
+                               bool key_frame) {
+  if (size == 0) {
+    return;
+  }
+  rtc::CritScope lock(&output_lock_);
+  if (generation != generation_) {
+    return;
+  }
+
+  std::vector<H264NalEntry> nals;
+  if (codec_type_ == webrtc::kVideoCodecH264) {
+    key_frame = SplitH264Nals(data, size, &nals) || key_frame;
+    if (!HasH264Slice(data, nals)) {
+      header_buffer_.assign(data, data + size);
+      return;
+    }
+    if (!header_buffer_.empty()) {
+      frame_buffer_.resize(header_buffer_.size() + size);
+      memcpy(frame_buffer_.data(), header_buffer_.data(),
+             header_buffer_.size());
+      memcpy(frame_buffer_.data() + header_buffer_.size(), data, size);
+      header_buffer_.clear();
+      data = frame_buffer_.data();
+      size = frame_buffer_.size();
+      nals.clear();
+      SplitH264Nals(data, size, &nals);
+    }
+  } else {
+    // VP8 はフレームタグの最下位ビットが 0 ならキーフレーム
+    key_frame = (data[0] & 0x01) == 0 || key_frame;
+  }
+
+  FrameParams params;
+  {
+    rtc::CritScope params_lock(&frame_params_lock_);
+    auto it = frame_params_.begin();
+    while (it != frame_params_.end() && it->timestamp != timestamp) {
+      ++it;
+    }
+    // 待っている他のフレームを消さずにそれだけを捨てる
+    if (it == frame_params_.end()) {
+      RTC_LOG(LS_WARNING) << __FUNCTION__
+                          << " Frame parameter is not found. SkipFrame"
+                          << " timestamp:" << timestamp;
+      return;
+    }
+    params = *it;
+    // エンコーダが捨てたフレームの分は読み飛ばす
+    frame_params_.erase(frame_params_.begin(), it + 1);
+  }
+  SendFrame(params, data, size, nals, key_frame);
+}
+
+int32_t HWVideoEncoder::SendFrame(const FrameParams& params,
+                                  const uint8_t* data,
+                                  size_t size,
+                                  const std::vector<H264NalEntry>& nals,
+                                  bool key_frame) {
+  encoded_image_.set_buffer(const_cast<uint8_t*>(data), size);
+  encoded_image_.set_size(size);
+  encoded_image_._encodedWidth = params.width;
+  encoded_image_._encodedHeight = params.height;
+  encoded_image_.capture_time_ms_ = params.render_time_ms;
+  encoded_image_.ntp_time_ms_ = params.ntp_time_ms;
+  encoded_image_.SetTimestamp(params.timestamp);
+  encoded_image_.rotation_ = params.rotation;
+  encoded_image_.SetColorSpace(params.color_space);
+  encoded_image_._frameType = key_frame
+                                  ? webrtc::VideoFrameType::kVideoFrameKey
+                                  : webrtc::VideoFrameType::kVideoFrameDelta;
+
+  webrtc::CodecSpecificInfo codec_specific;
+  codec_specific.codecType = codec_type_;
+  std::unique_ptr<webrtc::RTPFragmentationHeader> frag_header;
+  if (codec_type_ == webrtc::kVideoCodecH264) {
+    codec_specific.codecSpecific.H264.packetization_mode =
+        webrtc::H264PacketizationMode::NonInterleaved;
+
+    frag_header.reset(new webrtc::RTPFragmentationHeader());
+    frag_header->VerifyAndAllocateFragmentationHeader(nals.size());
+    for (size_t i = 0; i < nals.size(); i++) {
+      frag_header->fragmentationOffset[i] = nals[i].offset;
+      frag_header->fragmentationLength[i] = nals[i].size;
+    }
+
+    h264_bitstream_parser_.ParseBitstream(data, size);
+    h264_bitstream_parser_.GetLastSliceQp(&encoded_image_.qp_);
+  } else {
+    codec_specific.codecSpecific.VP8.nonReference = false;
+    codec_specific.codecSpecific.VP8.temporalIdx = webrtc::kNoTemporalIdx;
+    codec_specific.codecSpecific.VP8.layerSync = false;
+    codec_specific.codecSpecific.VP8.keyIdx = webrtc::kNoKeyIdx;
+    webrtc::vp8::GetQp(data, size, &encoded_image_.qp_);
+  }
+
+  webrtc::EncodedImageCallback::Result result = callback_->OnEncodedImage(
+      encoded_image_, &codec_specific, frag_header.get());
+  if (result.error != webrtc::EncodedImageCallback::Result::OK) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__
+                      << " OnEncodedImage failed error:" << result.error;
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  bitrate_adjuster_.Update(size);
+  EncodedFrameStats::AddFrame(stats_id_, size, key_frame);
+  return WEBRTC_VIDEO_CODEC_OK;
+}
@@ -0,0 +1,108 @@
+#ifndef HW_VIDEO_ENCODER_H_
+#define HW_VIDEO_ENCODER_H_
+
+#include <stdint.h>
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "api/video_codecs/sdp_video_format.h"
+#include "api/video_codecs/video_encoder.h"
+#include "common_video/h264/h264_bitstream_parser.h"
+#include "common_video/include/bitrate_adjuster.h"
+#include "media/base/h264_profile_level_id.h"
+#include "rtc/h264_nal.h"
+#include "rtc/hw_encoder_backend.h"
+#include "rtc_base/critical_section.h"
+
+// ハードウェアエンコーダに共通する部分をまとめた VideoEncoder。
+//
+// 解像度が変わった時の作り直し、ビットレートの調整、キーフレームの要求、
+// エンコード中のフレームの情報の管理、NAL の分割と EncodedImage の組み立てを
+// ここでやり、エンコーダ自体は backend に任せる。
+// H264 のプロファイルとレベルはネゴシエーションで決まった format に従う。
+//
+// intra_refresh_period が 0 でなければイントラリフレッシュで送り、
+// 続けて来るキーフレームの要求はまとめて、間隔が空いた時に 1 回だけ出す。
+class HWVideoEncoder : public webrtc::VideoEncoder {
+ public:
+  HWVideoEncoder(std::unique_ptr<HWEncoderBackend> backend,
+                 const webrtc::SdpVideoFormat& format,
+                 int intra_refresh_period);
+  ~HWVideoEncoder() override;
+
+  int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
+                     int32_t number_of_cores,
+                     size_t max_payload_size) override;
+  int32_t RegisterEncodeCompleteCallback(
+      webrtc::EncodedImageCallback* callback) override;
+  int32_t Release() override;
+  int32_t Encode(
+      const webrtc::VideoFrame& frame,
+      const std::vector<webrtc::VideoFrameType>* frame_types) override;
+  void SetRates(const RateControlParameters& parameters) override;
+  webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const override;
+
+ private:
+  struct FrameParams {
+    int32_t width;
+    int32_t height;
+    int64_t render_time_ms;
+    int64_t ntp_time_ms;
+    uint32_t timestamp;
+    webrtc::VideoRotation rotation;
+    absl::optional<webrtc::ColorSpace> color_space;
+  };
+
+  int32_t Configure(int width, int height);
+  // 以下は backend のスレッドから呼ばれる
+  void OnEncoded(int generation,
+                 const uint8_t* data,
+                 size_t size,
+                 uint32_t timestamp,
+                 bool key_frame);
+  int32_t SendFrame(const FrameParams& params,
+                    const uint8_t* data,
+                    size_t size,
+                    const std::vector<H264NalEntry>& nals,
+                    bool key_frame);
+
+  const std::unique_ptr<HWEncoderBackend> backend_;
+  const webrtc::H264::ProfileLevelId h264_profile_level_;
+  const int intra_refresh_period_;
+  // EncodedFrameStats に渡すこのエンコーダの id
+  const int stats_id_;
+
+  std::mutex mtx_;
+  webrtc::EncodedImageCallback* callback_;
+  webrtc::VideoCodecType codec_type_;
+  int key_frame_interval_;
+  webrtc::BitrateAdjuster bitrate_adjuster_;
+  uint32_t target_bitrate_bps_;
+  uint32_t configured_bitrate_bps_;
+  uint32_t framerate_;
+  uint32_t configured_framerate_;
+  int32_t configured_width_;
+  int32_t configured_height_;
+  int64_t last_key_frame_request_ms_;
+  // イントラリフレッシュの時に、間隔が空くまで待たせているキーフレームの要求
+  bool key_frame_pending_;
+
+  rtc::CriticalSection frame_params_lock_;
+  std::deque<FrameParams> frame_params_ RTC_GUARDED_BY(frame_params_lock_);
+
+  // Configure し直す前の backend から遅れて出てきたものを捨てるために、
+  // Configure の度に増やして callback に持たせておく
+  rtc::CriticalSection output_lock_;
+  int generation_ RTC_GUARDED_BY(output_lock_);
+  webrtc::H264BitstreamParser h264_bitstream_parser_
+      RTC_GUARDED_BY(output_lock_);
+  webrtc::EncodedImage encoded_image_ RTC_GUARDED_BY(output_lock_);
+  // SPS と PPS だけが別のバッファで出てきた時に、次のフレームの前に付ける
+  std::vector<uint8_t> header_buffer_ RTC_GUARDED_BY(output_lock_);
+  std::vector<uint8_t> frame_buffer_ RTC_GUARDED_BY(output_lock_);
+};
+
+#endif  // HW_VIDEO_ENCODER_H_
@@ -8,6 +8,7 @@
 #include "modules/video_coding/codecs/h264/include/h264.h"
 #include "modules/video_coding/codecs/vp8/include/vp8.h"
 #include "modules/video_coding/codecs/vp9/include/vp9.h"
+#include "rtc/hw_video_encoder.h"
 #include "rtc_base/logging.h"
 
 #if USE_MMAL_ENCODER
@@ -16,9 +17,56 @@
 #if USE_JETSON_ENCODER
 #include "hwenc_jetson/jetson_h264_encoder.h"
 #endif
+#if USE_V4L2_M2M_ENCODER
+#include "hwenc_v4l2/v4l2_m2m_video_encoder.h"
+#endif
 
 #include "h264_format.h"
 
+namespace {
+
+// エンコーダが出せる H264 のプロファイルとレベル。
+// MMAL や Jetson が無くても、V4L2 M2M のエンコーダがあれば H264 を使える
+std::vector<webrtc::H264::ProfileLevelId> H264ProfileLevels() {
+#if USE_MMAL_ENCODER
+  return MMALH264Encoder::SupportedH264Profiles();
+#elif USE_JETSON_ENCODER
+  return JetsonH264Encoder::SupportedH264Profiles();
+#elif USE_V4L2_M2M_ENCODER
+  std::string device = V4L2M2MVideoEncoder::FindDevice(webrtc::kVideoCodecH264);
+  if (device.empty()) {
+    return {};
+  }
+  return V4L2M2MVideoEncoder::SupportedH264Profiles(device);
+#else
+  return {};
+#endif
+}
+
+bool HasV4L2M2MVP8Encoder() {
+#if USE_V4L2_M2M_ENCODER
+  return !V4L2M2MVideoEncoder::FindDevice(webrtc::kVideoCodecVP8).empty();
+#else
+  return false;
+#endif
+}
+
+}  // namespace
+
+HWVideoEncoderFactory::HWVideoEncoderFactory(size_t pool_size,
+                                             int intra_refresh_period)
+    : intra_refresh_period_(intra_refresh_period) {
+#if USE_MMAL_ENCODER
+  mmal_pool_ = std::make_shared<MMALH264PipelinePool>(pool_size);
+#endif
+#if USE_JETSON_ENCODER
+  jetson_pool_ = std::make_shared<JetsonH264PipelinePool>(pool_size);
+#endif
+#if USE_V4L2_M2M_ENCODER
+  v4l2_m2m_pool_ = std::make_shared<V4L2M2MDevicePool>(pool_size);
+#endif
+}
+
 std::vector<webrtc::SdpVideoFormat> HWVideoEncoderFactory::GetSupportedFormats()
     const {
   std::vector<webrtc::SdpVideoFormat> supported_codecs;
@@ -26,17 +74,9 @@ std::vector<webrtc::SdpVideoFormat> HWVideoEncoderFactory::GetSupportedFormats()
   for (const webrtc::SdpVideoFormat& format : webrtc::SupportedVP9Codecs())
     supported_codecs.push_back(format);
 
-  std::vector<webrtc::SdpVideoFormat> h264_codecs = {
-      CreateH264Format(webrtc::H264::kProfileBaseline, webrtc::H264::kLevel3_1,
-                       "1"),
-      CreateH264Format(webrtc::H264::kProfileBaseline, webrtc::H264::kLevel3_1,
-                       "0"),
-      CreateH264Format(webrtc::H264::kProfileConstrainedBaseline,
-                       webrtc::H264::kLevel3_1, "1"),
-      CreateH264Format(webrtc::H264::kProfileConstrainedBaseline,
-                       webrtc::H264::kLevel3_1, "0")};
-
-  for (const webrtc::SdpVideoFormat& format : h264_codecs)
+  // 先に並べたものが優先されるので、圧縮率の良い High から並べる
+  for (const webrtc::SdpVideoFormat& format :
+       CreateH264Formats(H264ProfileLevels()))
     supported_codecs.push_back(format);
 
   return supported_codecs;
@@ -48,6 +88,8 @@ webrtc::VideoEncoderFactory::CodecInfo HWVideoEncoderFactory::QueryVideoEncoder(
   info.has_internal_source = false;
   if (absl::EqualsIgnoreCase(format.name, cricket::kH264CodecName))
     info.is_hardware_accelerated = true;
+  else if (absl::EqualsIgnoreCase(format.name, cricket::kVp8CodecName))
+    info.is_hardware_accelerated = HasV4L2M2MVP8Encoder();
   else
     info.is_hardware_accelerated = false;
   return info;
@@ -55,20 +97,44 @@ webrtc::VideoEncoderFactory::CodecInfo HWVideoEncoderFactory::QueryVideoEncoder(
 
 std::unique_ptr<webrtc::VideoEncoder> HWVideoEncoderFactory::CreateVideoEncoder(
     const webrtc::SdpVideoFormat& format) {
-  if (absl::EqualsIgnoreCase(format.name, cricket::kVp8CodecName))
+  if (absl::EqualsIgnoreCase(format.name, cricket::kVp8CodecName)) {
+#if USE_V4L2_M2M_ENCODER
+    std::string device =
+        V4L2M2MVideoEncoder::FindDevice(webrtc::kVideoCodecVP8);
+    if (!device.empty())
+      return std::unique_ptr<webrtc::VideoEncoder>(
+          absl::make_unique<HWVideoEncoder>(
+              absl::make_unique<V4L2M2MVideoEncoder>(
+                  webrtc::kVideoCodecVP8, device, v4l2_m2m_pool_),
+              format, intra_refresh_period_));
+#endif
     return webrtc::VP8Encoder::Create();
+  }
 
   if (absl::EqualsIgnoreCase(format.name, cricket::kVp9CodecName))
     return webrtc::VP9Encoder::Create(cricket::VideoCodec(format));
 
+  // H264ProfileLevels() と同じ優先順位で選ぶ
   if (absl::EqualsIgnoreCase(format.name, cricket::kH264CodecName)) {
 #if USE_MMAL_ENCODER
     return std::unique_ptr<webrtc::VideoEncoder>(
-        absl::make_unique<MMALH264Encoder>(cricket::VideoCodec(format)));
-#endif
-#if USE_JETSON_ENCODER
+        absl::make_unique<HWVideoEncoder>(
+            absl::make_unique<MMALH264Encoder>(mmal_pool_), format,
+            intra_refresh_period_));
+#elif USE_JETSON_ENCODER
     return std::unique_ptr<webrtc::VideoEncoder>(
-        absl::make_unique<JetsonH264Encoder>(cricket::VideoCodec(format)));
+        absl::make_unique<HWVideoEncoder>(
+            absl::make_unique<JetsonH264Encoder>(jetson_pool_), format,
+            intra_refresh_period_));
+#elif USE_V4L2_M2M_ENCODER
+    std::string device =
+        V4L2M2MVideoEncoder::FindDevice(webrtc::kVideoCodecH264);
+    if (!device.empty())
+      return std::unique_ptr<webrtc::VideoEncoder>(
+          absl::make_unique<HWVideoEncoder>(
+              absl::make_unique<V4L2M2MVideoEncoder>(
+                  webrtc::kVideoCodecH264, device, v4l2_m2m_pool_),
+              format, intra_refresh_period_));
 #endif
   }
 
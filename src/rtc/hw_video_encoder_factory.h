@@ -7,10 +7,20 @@
 #include "api/video_codecs/sdp_video_format.h"
 #include "api/video_codecs/video_encoder.h"
 #include "api/video_codecs/video_encoder_factory.h"
+#include "rtc/hw_encoder_pool.h"
+
+struct MMALH264Pipeline;
+struct JetsonH264Pipeline;
+class V4L2M2MDevice;
 
 class HWVideoEncoderFactory : public webrtc::VideoEncoderFactory {
  public:
-  HWVideoEncoderFactory() {}
+  // pool_size は使い終わったハードウェアエンコーダを残しておく数。
+  // 0 なら使い終わったらすぐに解放する。
+  // intra_refresh_period が 0 でなければ、定期的なキーフレームの代わりに
+  // このフレーム数で一周するイントラリフレッシュを使う
+  explicit HWVideoEncoderFactory(size_t pool_size = 0,
+                                 int intra_refresh_period = 0);
   virtual ~HWVideoEncoderFactory() {}
 
   std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
@@ -20,6 +30,13 @@ class HWVideoEncoderFactory : public webrtc::VideoEncoderFactory {
 
   std::unique_ptr<webrtc::VideoEncoder> CreateVideoEncoder(
       const webrtc::SdpVideoFormat& format) override;
+
+ private:
+  // このファクトリで作ったエンコーダの間で使い回す
+  std::shared_ptr<HWEncoderPool<MMALH264Pipeline>> mmal_pool_;
+  std::shared_ptr<HWEncoderPool<JetsonH264Pipeline>> jetson_pool_;
+  std::shared_ptr<HWEncoderPool<V4L2M2MDevice>> v4l2_m2m_pool_;
+  const int intra_refresh_period_;
 };
 
 #endif  // HW_VIDEO_ENCODER_FACTORY_H_
\ No newline at end of file
@@ -0,0 +1,386 @@
+#include "lazy_audio_device_module.h"
+
+#include <utility>
+
+#include "media/engine/adm_helpers.h"
+#include "metrics/startup_report.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/ref_counted_object.h"
+#include "rtc_base/time_utils.h"
+
+// 録音や再生に関わる呼び出しは、本物の ADM を作ってから渡す
+#define ACTIVATE_OR_RETURN(value) \
+  {                               \
+    if (!Activate()) {            \
+      return value;               \
+    }                             \
+  }
+
+// 状態を問い合わせるだけの呼び出しでは ADM を作らない
+#define ACTIVATED_OR_RETURN(value) \
+  {                                \
+    if (!adm_) {                   \
+      return value;                \
+    }                              \
+  }
+
+rtc::scoped_refptr<LazyAudioDeviceModule> LazyAudioDeviceModule::Create(
+    CreateFunction create) {
+  return new rtc::RefCountedObject<LazyAudioDeviceModule>(std::move(create));
+}
+
+LazyAudioDeviceModule::LazyAudioDeviceModule(CreateFunction create)
+    : create_(std::move(create)),
+      audio_callback_(nullptr),
+      init_requested_(false),
+      failed_(false) {}
+
+bool LazyAudioDeviceModule::Activate() {
+  if (adm_) {
+    return true;
+  }
+  if (failed_) {
+    return false;
+  }
+
+  int64_t start_ms = rtc::TimeMillis();
+  adm_ = create_();
+  if (!adm_) {
+    RTC_LOG(LS_ERROR) << "Failed to create the audio device module";
+    failed_ = true;
+    return false;
+  }
+  if (audio_callback_ != nullptr) {
+    adm_->RegisterAudioCallback(audio_callback_);
+  }
+  if (init_requested_) {
+    // WebRtcVoiceEngine::Init() がやるのと同じ手順で初期化する
+    webrtc::adm_helpers::Init(adm_.get());
+  }
+  RTC_LOG(LS_INFO) << "Audio device module initialized in "
+                   << rtc::TimeMillis() - start_ms << " ms";
+  StartupReport::Mark("audio_device_ready");
+  return true;
+}
+
+int32_t LazyAudioDeviceModule::ActiveAudioLayer(AudioLayer* audioLayer) const {
+  ACTIVATED_OR_RETURN(-1);
+  return adm_->ActiveAudioLayer(audioLayer);
+}
+
+int32_t LazyAudioDeviceModule::RegisterAudioCallback(
+    webrtc::AudioTransport* audioCallback) {
+  audio_callback_ = audioCallback;
+  ACTIVATED_OR_RETURN(0);
+  return adm_->RegisterAudioCallback(audioCallback);
+}
+
+int32_t LazyAudioDeviceModule::Init() {
+  init_requested_ = true;
+  ACTIVATED_OR_RETURN(0);
+  return adm_->Init();
+}
+
+int32_t LazyAudioDeviceModule::Terminate() {
+  init_requested_ = false;
+  ACTIVATED_OR_RETURN(0);
+  return adm_->Terminate();
+}
+
+bool LazyAudioDeviceModule::Initialized() const {
+  ACTIVATED_OR_RETURN(init_requested_);
+  return adm_->Initialized();
+}
+
+int16_t LazyAudioDeviceModule::PlayoutDevices() {
+  ACTIVATE_OR_RETURN(-1);
+  return adm_->PlayoutDevices();
+}
+
+int16_t LazyAudioDeviceModule::RecordingDevices() {
+  ACTIVATE_OR_RETURN(-1);
+  return adm_->RecordingDevices();
+}
+
+int32_t LazyAudioDeviceModule::PlayoutDeviceName(
+    uint16_t index,
+    char name[webrtc::kAdmMaxDeviceNameSize],
+    char guid[webrtc::kAdmMaxGuidSize]) {
+  ACTIVATE_OR_RETURN(-1);
+  return adm_->PlayoutDeviceName(index, name, guid);
+}
+
+int32_t LazyAudioDeviceModule::RecordingDeviceName(
+    uint16_t index,
+    char name[webrtc::kAdmMaxDeviceNameSize],
+    char guid[webrtc::kAdmMaxGuidSize]) {
+  ACTIVATE_OR_RETURN(-1);
+  return adm_->RecordingDeviceName(index, name, guid);
+}
+
+// デバイスの選択やスピーカー、マイクの初期化は Activate() でやり直すので、
+// それまでは成功したことにしておく
+int32_t LazyAudioDeviceModule::SetPlayoutDevice(uint16_t index) {
+  ACTIVATED_OR_RETURN(0);
+  return adm_->SetPlayoutDevice(index);
+}
+
+int32_t LazyAudioDeviceModule::SetPlayoutDevice(WindowsDeviceType device) {
+  ACTIVATED_OR_RETURN(0);
+  return adm_->SetPlayoutDevice(device);
+}
+
+int32_t LazyAudioDeviceModule::SetRecordingDevice(uint16_t index) {
+  ACTIVATED_OR_RETURN(0);
+  return adm_->SetRecordingDevice(index);
+}
+
+int32_t LazyAudioDeviceModule::SetRecordingDevice(WindowsDeviceType device) {
+  ACTIVATED_OR_RETURN(0);
+  return adm_->SetRecordingDevice(device);
+}
+
+int32_t LazyAudioDeviceModule::PlayoutIsAvailable(bool* available) {
+  ACTIVATE_OR_RETURN(-1);
+  return adm_->PlayoutIsAvailable(available);
+}
+
+int32_t LazyAudioDeviceModule::InitPlayout() {
+  ACTIVATE_OR_RETURN(-1);
+  return adm_->InitPlayout();
+}
+
+bool LazyAudioDeviceModule::PlayoutIsInitialized() const {
+  ACTIVATED_OR_RETURN(false);
+  return adm_->PlayoutIsInitialized();
+}
+
+int32_t LazyAudioDeviceModule::RecordingIsAvailable(bool* available) {
+  ACTIVATE_OR_RETURN(-1);
+  return adm_->RecordingIsAvailable(available);
+}
+
+int32_t LazyAudioDeviceModule::InitRecording() {
+  ACTIVATE_OR_RETURN(-1);
+  return adm_->InitRecording();
+}
+
+bool LazyAudioDeviceModule::RecordingIsInitialized() const {
+  ACTIVATED_OR_RETURN(false);
+  return adm_->RecordingIsInitialized();
+}
+
+int32_t LazyAudioDeviceModule::StartPlayout() {
+  ACTIVATE_OR_RETURN(-1);
+  return adm_->StartPlayout();
+}
+
+int32_t LazyAudioDeviceModule::StopPlayout() {
+  ACTIVATED_OR_RETURN(0);
+  return adm_->StopPlayout();
+}
+
+bool LazyAudioDeviceModule::Playing() const {
+  ACTIVATED_OR_RETURN(false);
+  return adm_->Playing();
+}
+
+int32_t LazyAudioDeviceModule::StartRecording() {
+  ACTIVATE_OR_RETURN(-1);
+  return adm_->StartRecording();
+}
+
+int32_t LazyAudioDeviceModule::StopRecording() {
+  ACTIVATED_OR_RETURN(0);
+  return adm_->StopRecording();
+}
+
+bool LazyAudioDeviceModule::Recording() const {
+  ACTIVATED_OR_RETURN(false);
+  return adm_->Recording();
+}
+
+int32_t LazyAudioDeviceModule::InitSpeaker() {
+  ACTIVATED_OR_RETURN(0);
+  return adm_->InitSpeaker();
+}
+
+bool LazyAudioDeviceModule::SpeakerIsInitialized() const {
+  ACTIVATED_OR_RETURN(init_requested_);
+  return adm_->SpeakerIsInitialized();
+}
+
+int32_t LazyAudioDeviceModule::InitMicrophone() {
+  ACTIVATED_OR_RETURN(0);
+  return adm_->InitMicrophone();
+}
+
+bool LazyAudioDeviceModule::MicrophoneIsInitialized() const {
+  ACTIVATED_OR_RETURN(init_requested_);
+  return adm_->MicrophoneIsInitialized();
+}
+
+int32_t LazyAudioDeviceModule::SpeakerVolumeIsAvailable(bool* available) {
+  ACTIVATE_OR_RETURN(-1);
+  return adm_->SpeakerVolumeIsAvailable(available);
+}
+
+int32_t LazyAudioDeviceModule::SetSpeakerVolume(uint32_t volume) {
+  ACTIVATE_OR_RETURN(-1);
+  return adm_->SetSpeakerVolume(volume);
+}
+
+int32_t LazyAudioDeviceModule::SpeakerVolume(uint32_t* volume) const {
+  ACTIVATED_OR_RETURN(-1);
+  return adm_->SpeakerVolume(volume);
+}
+
+int32_t LazyAudioDeviceModule::MaxSpeakerVolume(uint32_t* maxVolume) const {
+  ACTIVATED_OR_RETURN(-1);
+  return adm_->MaxSpeakerVolume(maxVolume);
+}
+
+int32_t LazyAudioDeviceModule::MinSpeakerVolume(uint32_t* minVolume) const {
+  ACTIVATED_OR_RETURN(-1);
+  return adm_->MinSpeakerVolume(minVolume);
+}
+
+int32_t LazyAudioDeviceModule::MicrophoneVolumeIsAvailable(bool* available) {
+  ACTIVATE_OR_RETURN(-1);
+  return adm_->MicrophoneVolumeIsAvailable(available);
+}
+
+int32_t LazyAudioDeviceModule::SetMicrophoneVolume(uint32_t volume) {
+  ACTIVATE_OR_RETURN(-1);
+  return adm_->SetMicrophoneVolume(volume);
+}
+
+int32_t LazyAudioDeviceModule::MicrophoneVolume(uint32_t* volume) const {
+  ACTIVATED_OR_RETURN(-1);
+  return adm_->MicrophoneVolume(volume);
+}
+
+int32_t LazyAudioDeviceModule::MaxMicrophoneVolume(uint32_t* maxVolume) const {
+  ACTIVATED_OR_RETURN(-1);
+  return adm_->MaxMicrophoneVolume(maxVolume);
+}
+
+int32_t LazyAudioDeviceModule::MinMicrophoneVolume(uint32_t* minVolume) const {
+  ACTIVATED_OR_RETURN(-1);
+  return adm_->MinMicrophoneVolume(minVolume);
+}
+
+int32_t LazyAudioDeviceModule::SpeakerMuteIsAvailable(bool* available) {
+  ACTIVATE_OR_RETURN(-1);
+  return adm_->SpeakerMuteIsAvailable(available);
+}
+
+int32_t LazyAudioDeviceModule::SetSpeakerMute(bool enable) {
+  ACTIVATE_OR_RETURN(-1);
+  return adm_->SetSpeakerMute(enable);
+}
+
+int32_t LazyAudioDeviceModule::SpeakerMute(bool* enabled) const {
+  ACTIVATED_OR_RETURN(-1);
+  return adm_->SpeakerMute(enabled);
+}
+
+int32_t LazyAudioDeviceModule::MicrophoneMuteIsAvailable(bool* available) {
+  ACTIVATE_OR_RETURN(-1);
+  return adm_->MicrophoneMuteIsAvailable(available);
+}
+
+int32_t LazyAudioDeviceModule::SetMicrophoneMute(bool enable) {
+  ACTIVATE_OR_RETURN(-1);
+  return adm_->SetMicrophoneMute(enable);
+}
+
+int32_t LazyAudioDeviceModule::MicrophoneMute(bool* enabled) const {
+  ACTIVATED_OR_RETURN(-1);
+  return adm_->MicrophoneMute(enabled);
+}
+
+// ステレオに対応しているかどうかは Activate() で本物の ADM に聞き直す
+int32_t LazyAudioDeviceModule::StereoPlayoutIsAvailable(
+    bool* available) const {
+  *available = false;
+  ACTIVATED_OR_RETURN(0);
+  return adm_->StereoPlayoutIsAvailable(available);
+}
+
+int32_t LazyAudioDeviceModule::SetStereoPlayout(bool enable) {
+  ACTIVATED_OR_RETURN(0);
+  return adm_->SetStereoPlayout(enable);
+}
+
+int32_t LazyAudioDeviceModule::StereoPlayout(bool* enabled) const {
+  ACTIVATED_OR_RETURN(-1);
+  return adm_->StereoPlayout(enabled);
+}
+
+int32_t LazyAudioDeviceModule::StereoRecordingIsAvailable(
+    bool* available) const {
+  *available = false;
+  ACTIVATED_OR_RETURN(0);
+  return adm_->StereoRecordingIsAvailable(available);
+}
+
+int32_t LazyAudioDeviceModule::SetStereoRecording(bool enable) {
+  ACTIVATED_OR_RETURN(0);
+  return adm_->SetStereoRecording(enable);
+}
+
+int32_t LazyAudioDeviceModule::StereoRecording(bool* enabled) const {
+  ACTIVATED_OR_RETURN(-1);
+  return adm_->StereoRecording(enabled);
+}
+
+int32_t LazyAudioDeviceModule::PlayoutDelay(uint16_t* delayMS) const {
+  *delayMS = 0;
+  ACTIVATED_OR_RETURN(0);
+  return adm_->PlayoutDelay(delayMS);
+}
+
+bool LazyAudioDeviceModule::BuiltInAECIsAvailable() const {
+  ACTIVATED_OR_RETURN(false);
+  return adm_->BuiltInAECIsAvailable();
+}
+
+int32_t LazyAudioDeviceModule::EnableBuiltInAEC(bool enable) {
+  ACTIVATE_OR_RETURN(-1);
+  return adm_->EnableBuiltInAEC(enable);
+}
+
+bool LazyAudioDeviceModule::BuiltInAGCIsAvailable() const {
+  ACTIVATED_OR_RETURN(false);
+  return adm_->BuiltInAGCIsAvailable();
+}
+
+int32_t LazyAudioDeviceModule::EnableBuiltInAGC(bool enable) {
+  ACTIVATE_OR_RETURN(-1);
+  return adm_->EnableBuiltInAGC(enable);
+}
+
+bool LazyAudioDeviceModule::BuiltInNSIsAvailable() const {
+  ACTIVATED_OR_RETURN(false);
+  return adm_->BuiltInNSIsAvailable();
+}
+
+int32_t LazyAudioDeviceModule::EnableBuiltInNS(bool enable) {
+  ACTIVATE_OR_RETURN(-1);
+  return adm_->EnableBuiltInNS(enable);
+}
+
+#if defined(WEBRTC_IOS)
+int LazyAudioDeviceModule::GetPlayoutAudioParameters(
+    webrtc::AudioParameters* params) const {
+  ACTIVATED_OR_RETURN(-1);
+  return adm_->GetPlayoutAudioParameters(params);
+}
+
+int LazyAudioDeviceModule::GetRecordAudioParameters(
+    webrtc::AudioParameters* params) const {
+  ACTIVATED_OR_RETURN(-1);
+  return adm_->GetRecordAudioParameters(params);
+}
+#endif  // WEBRTC_IOS
@@ -0,0 +1,119 @@
+#ifndef LAZY_AUDIO_DEVICE_MODULE_H_
+#define LAZY_AUDIO_DEVICE_MODULE_H_
+
+#include <functional>
+
+#include "modules/audio_device/include/audio_device.h"
+
+// 本物の AudioDeviceModule の生成と初期化を最初の接続まで遅らせるラッパー。
+//
+// PeerConnectionFactory を作る時に WebRtcVoiceEngine が ADM の Init() や
+// デバイスの選択を呼ぶが、ALSA の初期化は時間がかかるので起動時にはやらない。
+// それまでの設定の呼び出しは覚えておくだけにして、Activate() が呼ばれるか
+// 録音や再生が始まる時に、本物の ADM を作って同じ手順で初期化する。
+//
+// ADM は全てワーカースレッドから呼ばれるので、Activate() もワーカースレッドで呼ぶ。
+class LazyAudioDeviceModule : public webrtc::AudioDeviceModule {
+ public:
+  typedef std::function<rtc::scoped_refptr<webrtc::AudioDeviceModule>()>
+      CreateFunction;
+
+  static rtc::scoped_refptr<LazyAudioDeviceModule> Create(
+      CreateFunction create);
+
+  explicit LazyAudioDeviceModule(CreateFunction create);
+
+  // 本物の ADM を作って初期化する。既に作ってあれば何もしない
+  bool Activate();
+
+  int32_t ActiveAudioLayer(AudioLayer* audioLayer) const override;
+  int32_t RegisterAudioCallback(webrtc::AudioTransport* audioCallback) override;
+
+  int32_t Init() override;
+  int32_t Terminate() override;
+  bool Initialized() const override;
+
+  int16_t PlayoutDevices() override;
+  int16_t RecordingDevices() override;
+  int32_t PlayoutDeviceName(uint16_t index,
+                            char name[webrtc::kAdmMaxDeviceNameSize],
+                            char guid[webrtc::kAdmMaxGuidSize]) override;
+  int32_t RecordingDeviceName(uint16_t index,
+                              char name[webrtc::kAdmMaxDeviceNameSize],
+                              char guid[webrtc::kAdmMaxGuidSize]) override;
+
+  int32_t SetPlayoutDevice(uint16_t index) override;
+  int32_t SetPlayoutDevice(WindowsDeviceType device) override;
+  int32_t SetRecordingDevice(uint16_t index) override;
+  int32_t SetRecordingDevice(WindowsDeviceType device) override;
+
+  int32_t PlayoutIsAvailable(bool* available) override;
+  int32_t InitPlayout() override;
+  bool PlayoutIsInitialized() const override;
+  int32_t RecordingIsAvailable(bool* available) override;
+  int32_t InitRecording() override;
+  bool RecordingIsInitialized() const override;
+
+  int32_t StartPlayout() override;
+  int32_t StopPlayout() override;
+  bool Playing() const override;
+  int32_t StartRecording() override;
+  int32_t StopRecording() override;
+  bool Recording() const override;
+
+  int32_t InitSpeaker() override;
+  bool SpeakerIsInitialized() const override;
+  int32_t InitMicrophone() override;
+  bool MicrophoneIsInitialized() const override;
+
+  int32_t SpeakerVolumeIsAvailable(bool* available) override;
+  int32_t SetSpeakerVolume(uint32_t volume) override;
+  int32_t SpeakerVolume(uint32_t* volume) const override;
+  int32_t MaxSpeakerVolume(uint32_t* maxVolume) const override;
+  int32_t MinSpeakerVolume(uint32_t* minVolume) const override;
+
+  int32_t MicrophoneVolumeIsAvailable(bool* available) override;
+  int32_t SetMicrophoneVolume(uint32_t volume) override;
+  int32_t MicrophoneVolume(uint32_t* volume) const override;
+  int32_t MaxMicrophoneVolume(uint32_t* maxVolume) const override;
+  int32_t MinMicrophoneVolume(uint32_t* minVolume) const override;
+
+  int32_t SpeakerMuteIsAvailable(bool* available) override;
+  int32_t SetSpeakerMute(bool enable) override;
+  int32_t SpeakerMute(bool* enabled) const override;
+
+  int32_t MicrophoneMuteIsAvailable(bool* available) override;
+  int32_t SetMicrophoneMute(bool enable) override;
+  int32_t MicrophoneMute(bool* enabled) const override;
+
+  int32_t StereoPlayoutIsAvailable(bool* available) const override;
+  int32_t SetStereoPlayout(bool enable) override;
+  int32_t StereoPlayout(bool* enabled) const override;
+  int32_t StereoRecordingIsAvailable(bool* available) const override;
+  int32_t SetStereoRecording(bool enable) override;
+  int32_t StereoRecording(bool* enabled) const override;
+
+  int32_t PlayoutDelay(uint16_t* delayMS) const override;
+
+  bool BuiltInAECIsAvailable() const override;
+  int32_t EnableBuiltInAEC(bool enable) override;
+  bool BuiltInAGCIsAvailable() const override;
+  int32_t EnableBuiltInAGC(bool enable) override;
+  bool BuiltInNSIsAvailable() const override;
+  int32_t EnableBuiltInNS(bool enable) override;
+
+#if defined(WEBRTC_IOS)
+  int GetPlayoutAudioParameters(webrtc::AudioParameters* params) const override;
+  int GetRecordAudioParameters(webrtc::AudioParameters* params) const override;
+#endif  // WEBRTC_IOS
+
+ private:
+  CreateFunction create_;
+  rtc::scoped_refptr<webrtc::AudioDeviceModule> adm_;
+  webrtc::AudioTransport* audio_callback_;
+  // Init() が呼ばれていれば、Activate() で本物の ADM も初期化する
+  bool init_requested_;
+  bool failed_;
+};
+
+#endif  // LAZY_AUDIO_DEVICE_MODULE_H_
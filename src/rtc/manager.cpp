@@ -4,21 +4,34 @@
 #include <iostream>
 
 #include "absl/memory/memory.h"
+#include "absl/strings/match.h"
 #include "api/audio_codecs/builtin_audio_decoder_factory.h"
 #include "api/audio_codecs/builtin_audio_encoder_factory.h"
 #include "api/create_peerconnection_factory.h"
 #include "api/rtc_event_log/rtc_event_log_factory.h"
 #include "api/task_queue/default_task_queue_factory.h"
 #include "api/video_track_source_proxy.h"
+#include "codec_filter_factory.h"
+#include "frame_metadata/frame_metadata_encoder_factory.h"
+#include "media/base/media_constants.h"
 #include "media/engine/webrtc_media_engine.h"
+#include "metrics/encoded_frame_stats.h"
+#include "metrics/memory_reporter.h"
+#include "metrics/recovery_stats.h"
+#include "metrics/startup_report.h"
 #include "modules/audio_device/include/audio_device.h"
 #include "modules/audio_processing/include/audio_processing.h"
 #include "modules/video_capture/video_capture.h"
 #include "modules/video_capture/video_capture_factory.h"
 #include "observer.h"
+#include "playout_delay_encoder_factory.h"
 #include "rtc_base/logging.h"
+#include "rtc_base/ref_counted_object.h"
+#include "rtc_base/rtc_certificate_generator.h"
 #include "rtc_base/ssl_adapter.h"
+#include "rtc_base/time_utils.h"
 #include "scalable_track_source.h"
+#include "thread_policy/thread_policy.h"
 #include "util.h"
 
 #ifdef __APPLE__
@@ -30,9 +43,16 @@
 
 #if USE_ROS
 #include "ros/ros_audio_device_module.h"
+#else
+#include "file_capturer/file_audio_capturer.h"
+#include "modules/audio_device/include/test_audio_device.h"
 #endif
 
-#if USE_MMAL_ENCODER || USE_JETSON_ENCODER
+#include "recorder/recording_audio_decoder_factory.h"
+#include "recorder/recording_video_decoder_factory.h"
+#include "recorder/recording_video_encoder_factory.h"
+
+#if USE_MMAL_ENCODER || USE_JETSON_ENCODER || USE_V4L2_M2M_ENCODER
 #include "api/video_codecs/video_encoder_factory.h"
 #include "hw_video_encoder_factory.h"
 #endif
@@ -43,19 +63,37 @@
 
 RTCManager::RTCManager(
     ConnectionSettings conn_settings,
-    rtc::scoped_refptr<ScalableVideoTrackSource> video_track_source,
+    std::future<rtc::scoped_refptr<ScalableVideoTrackSource>>
+        video_track_source_future,
     VideoTrackReceiver* receiver)
-    : _conn_settings(conn_settings),
+    : _audio_prepared(false),
+      _conn_settings(conn_settings),
       _receiver(receiver),
-      _data_manager(nullptr) {
+      _data_manager(nullptr),
+      _connection_count(0) {
   rtc::InitializeSSL();
 
+  // スレッド毎の CPU 使用率を見分けられるように名前を付けておく
   _networkThread = rtc::Thread::CreateWithSocketServer();
+  _networkThread->SetName("network_thread", nullptr);
   _networkThread->Start();
   _workerThread = rtc::Thread::Create();
+  _workerThread->SetName("worker_thread", nullptr);
   _workerThread->Start();
-  _signalingThread = rtc::Thread::Create();
-  _signalingThread->Start();
+  // 省メモリモードではシグナリングスレッドを作らずにワーカースレッドで兼ねる
+  if (!_conn_settings.low_footprint) {
+    _signalingThread = rtc::Thread::Create();
+    _signalingThread->SetName("signaling_thread", nullptr);
+    _signalingThread->Start();
+  }
+  _networkThread->Invoke<void>(RTC_FROM_HERE,
+                               [] { ThreadPolicy::Apply("network"); });
+  _workerThread->Invoke<void>(RTC_FROM_HERE,
+                              [] { ThreadPolicy::Apply("worker"); });
+  if (_signalingThread) {
+    _signalingThread->Invoke<void>(RTC_FROM_HERE,
+                                   [] { ThreadPolicy::Apply("signaling"); });
+  }
 
 #if defined(__linux__)
   webrtc::AudioDeviceModule::AudioLayer audio_layer =
@@ -64,6 +102,7 @@ RTCManager::RTCManager(
   webrtc::AudioDeviceModule::AudioLayer audio_layer =
       webrtc::AudioDeviceModule::kPlatformDefaultAudio;
 #endif
+  // 音声を使わない時は ALSA のスレッドを作らないようにダミーにする
   if (_conn_settings.no_audio) {
     audio_layer = webrtc::AudioDeviceModule::kDummyAudio;
   }
@@ -71,7 +110,7 @@ RTCManager::RTCManager(
   webrtc::PeerConnectionFactoryDependencies dependencies;
   dependencies.network_thread = _networkThread.get();
   dependencies.worker_thread = _workerThread.get();
-  dependencies.signaling_thread = _signalingThread.get();
+  dependencies.signaling_thread = signalingThread();
   dependencies.task_queue_factory = webrtc::CreateDefaultTaskQueueFactory();
   dependencies.call_factory = webrtc::CreateCallFactory();
   dependencies.event_log_factory =
@@ -85,8 +124,36 @@ RTCManager::RTCManager(
   media_dependencies.adm = ROSAudioDeviceModule::Create(
       _conn_settings, dependencies.task_queue_factory.get());
 #else
-  media_dependencies.adm = webrtc::AudioDeviceModule::Create(
-      audio_layer, dependencies.task_queue_factory.get());
+  if (!_conn_settings.no_audio && !_conn_settings.audio_input_file.empty()) {
+    // マイクの代わりにファイルから流す。受信した音声は捨てる
+    std::unique_ptr<webrtc::TestAudioDeviceModule::Capturer> audio_capturer =
+        FileAudioCapturer::Create(_conn_settings.audio_input_file,
+                                  _conn_settings.audio_input_rate,
+                                  _conn_settings.audio_input_channels);
+    if (audio_capturer) {
+      media_dependencies.adm = webrtc::TestAudioDeviceModule::Create(
+          dependencies.task_queue_factory.get(), std::move(audio_capturer),
+          webrtc::TestAudioDeviceModule::CreateDiscardRenderer(48000, 2));
+    } else {
+      RTC_LOG(LS_WARNING) << "Failed to open audio input file, "
+                          << "fall back to the audio device";
+    }
+  }
+  if (!media_dependencies.adm && !_conn_settings.no_audio) {
+    // ALSA の初期化は時間がかかるので、最初の接続まで遅らせる
+    webrtc::TaskQueueFactory* task_queue_factory =
+        dependencies.task_queue_factory.get();
+    _lazy_adm = LazyAudioDeviceModule::Create([audio_layer,
+                                               task_queue_factory]() {
+      return webrtc::AudioDeviceModule::Create(audio_layer,
+                                               task_queue_factory);
+    });
+    media_dependencies.adm = _lazy_adm;
+  }
+  if (!media_dependencies.adm) {
+    media_dependencies.adm = webrtc::AudioDeviceModule::Create(
+        audio_layer, dependencies.task_queue_factory.get());
+  }
 #endif
   media_dependencies.audio_encoder_factory =
       webrtc::CreateBuiltinAudioEncoderFactory();
@@ -96,10 +163,14 @@ RTCManager::RTCManager(
   media_dependencies.video_encoder_factory = CreateObjCEncoderFactory();
   media_dependencies.video_decoder_factory = CreateObjCDecoderFactory();
 #else
-#if USE_MMAL_ENCODER || USE_JETSON_ENCODER
+#if USE_MMAL_ENCODER || USE_JETSON_ENCODER || USE_V4L2_M2M_ENCODER
   media_dependencies.video_encoder_factory =
       std::unique_ptr<webrtc::VideoEncoderFactory>(
-          absl::make_unique<HWVideoEncoderFactory>());
+          absl::make_unique<HWVideoEncoderFactory>(
+              _conn_settings.low_footprint
+                  ? 0
+                  : _conn_settings.hw_encoder_pool_size,
+              _conn_settings.intra_refresh_period));
 #else
   media_dependencies.video_encoder_factory =
       webrtc::CreateBuiltinVideoEncoderFactory();
@@ -113,6 +184,65 @@ RTCManager::RTCManager(
       webrtc::CreateBuiltinVideoDecoderFactory();
 #endif
 #endif
+  if (_conn_settings.low_footprint) {
+    // 使わないコーデックのエンコーダやデコーダを作らないようにする
+    RTC_LOG(LS_INFO) << "Low footprint mode: only "
+                     << _conn_settings.low_footprint_video_codec
+                     << " is available";
+    media_dependencies.video_encoder_factory =
+        std::unique_ptr<webrtc::VideoEncoderFactory>(
+            absl::make_unique<CodecFilterVideoEncoderFactory>(
+                std::move(media_dependencies.video_encoder_factory),
+                _conn_settings.low_footprint_video_codec));
+    media_dependencies.video_decoder_factory =
+        std::unique_ptr<webrtc::VideoDecoderFactory>(
+            absl::make_unique<CodecFilterVideoDecoderFactory>(
+                std::move(media_dependencies.video_decoder_factory),
+                _conn_settings.low_footprint_video_codec));
+  }
+  if (_conn_settings.low_latency_receive) {
+    // 相手にジッタバッファで溜めずに表示してもらう。
+    // playout-delay は送信側が決めるもので、受信側から自分のジッタバッファを
+    // 縮める API は無い (SetJitterBufferMinimumDelay(0) は元の最小値と同じ)
+    media_dependencies.video_encoder_factory =
+        std::unique_ptr<webrtc::VideoEncoderFactory>(
+            absl::make_unique<PlayoutDelayVideoEncoderFactory>(
+                std::move(media_dependencies.video_encoder_factory), 0, 0));
+  }
+  if (_conn_settings.frame_metadata_port != 0) {
+    // フレームのメタデータを RTP タイムスタンプと対応付ける
+    media_dependencies.video_encoder_factory =
+        std::unique_ptr<webrtc::VideoEncoderFactory>(
+            absl::make_unique<FrameMetadataVideoEncoderFactory>(
+                std::move(media_dependencies.video_encoder_factory)));
+  }
+  if (!_conn_settings.record_dir.empty()) {
+    media_dependencies.video_encoder_factory =
+        std::unique_ptr<webrtc::VideoEncoderFactory>(
+            absl::make_unique<RecordingVideoEncoderFactory>(
+                std::move(media_dependencies.video_encoder_factory),
+                _conn_settings.record_dir,
+                _conn_settings.record_segment_duration,
+                static_cast<size_t>(_conn_settings.record_segment_size) *
+                    1024 * 1024));
+  }
+  if (!_conn_settings.record_remote_dir.empty()) {
+    size_t segment_size_bytes =
+        static_cast<size_t>(_conn_settings.record_segment_size) * 1024 * 1024;
+    media_dependencies.video_decoder_factory =
+        std::unique_ptr<webrtc::VideoDecoderFactory>(
+            absl::make_unique<RecordingVideoDecoderFactory>(
+                std::move(media_dependencies.video_decoder_factory),
+                _conn_settings.record_remote_dir,
+                _conn_settings.record_segment_duration, segment_size_bytes,
+                _conn_settings.record_remote_only));
+    media_dependencies.audio_decoder_factory =
+        new rtc::RefCountedObject<RecordingAudioDecoderFactory>(
+            media_dependencies.audio_decoder_factory,
+            _conn_settings.record_remote_dir,
+            _conn_settings.record_segment_duration, segment_size_bytes,
+            _conn_settings.record_remote_only));
+  }
   media_dependencies.audio_mixer = nullptr;
   media_dependencies.audio_processing =
       webrtc::AudioProcessingBuilder().Create();
@@ -133,33 +263,32 @@ RTCManager::RTCManager(
   factory_options.disable_encryption = false;
   factory_options.ssl_max_version = rtc::SSL_PROTOCOL_DTLS_12;
   _factory->SetOptions(factory_options);
+  StartupReport::Mark("factory_ready");
 
-  if (!_conn_settings.no_audio) {
-    cricket::AudioOptions ao;
-    if (_conn_settings.disable_echo_cancellation)
-      ao.echo_cancellation = false;
-    if (_conn_settings.disable_auto_gain_control)
-      ao.auto_gain_control = false;
-    if (_conn_settings.disable_noise_suppression)
-      ao.noise_suppression = false;
-    if (_conn_settings.disable_highpass_filter)
-      ao.highpass_filter = false;
-    if (_conn_settings.disable_typing_detection)
-      ao.typing_detection = false;
-    if (_conn_settings.disable_residual_echo_detector)
-      ao.residual_echo_detector = false;
-    RTC_LOG(LS_INFO) << __FUNCTION__ << ": " << ao.ToString();
-    _audio_track = _factory->CreateAudioTrack(Util::generateRandomChars(),
-                                              _factory->CreateAudioSource(ao));
-    if (!_audio_track) {
-      RTC_LOG(LS_WARNING) << __FUNCTION__ << ": Cannot create audio_track";
-    }
+  // 接続毎に作ると、オファーが来てから証明書ができるまで待つことになるので、
+  // キャプチャラを待っている間に作っておく
+  int64_t cert_start_ms = rtc::TimeMillis();
+  _certificate = rtc::RTCCertificateGenerator::GenerateCertificate(
+      rtc::KeyParams(rtc::KT_ECDSA), absl::nullopt);
+  if (_certificate) {
+    RTC_LOG(LS_INFO) << __FUNCTION__ << ": Generated a certificate in "
+                     << rtc::TimeMillis() - cert_start_ms << " ms";
+  } else {
+    RTC_LOG(LS_WARNING) << __FUNCTION__ << ": Failed to generate a certificate";
   }
 
+  int64_t wait_start_ms = rtc::TimeMillis();
+  rtc::scoped_refptr<ScalableVideoTrackSource> video_track_source =
+      video_track_source_future.valid() ? video_track_source_future.get()
+                                        : nullptr;
+  RTC_LOG(LS_INFO) << __FUNCTION__ << ": Waited "
+                   << rtc::TimeMillis() - wait_start_ms
+                   << " ms for the video capturer";
+
   if (video_track_source && !_conn_settings.no_video) {
     rtc::scoped_refptr<webrtc::VideoTrackSourceInterface> video_source =
         webrtc::VideoTrackSourceProxy::Create(
-            _signalingThread.get(), _workerThread.get(), video_track_source);
+            signalingThread(), _workerThread.get(), video_track_source);
     _video_track =
         _factory->CreateVideoTrack(Util::generateRandomChars(), video_source);
     if (_video_track) {
@@ -173,16 +302,80 @@ RTCManager::RTCManager(
     } else {
       RTC_LOG(LS_WARNING) << __FUNCTION__ << ": Cannot create video_track";
     }
+    _video_source = video_track_source;
   }
+
+  if (_conn_settings.metrics_interval > 0) {
+    _metrics_collector = std::make_shared<MetricsCollector>(
+        signalingThread(), _conn_settings.metrics_interval * 1000,
+        [this]() { return getConnections(); });
+    if (_video_source) {
+      // キャプチャスレッドの fps は統計情報に無いので自分で数える
+      rtc::scoped_refptr<ScalableVideoTrackSource> source = _video_source;
+      int64_t last_time_us = rtc::TimeMicros();
+      uint64_t last_frames = source->capturedFrames();
+      _metrics_collector->AddProvider(
+          [source, last_time_us, last_frames](std::string* out) mutable {
+            int64_t now_us = rtc::TimeMicros();
+            uint64_t frames = source->capturedFrames();
+            MetricsCollector::AppendHeader(out, "momo_capture_frames_total",
+                                           "counter", "Frames captured");
+            MetricsCollector::AppendSample(out, "momo_capture_frames_total",
+                                           "", frames);
+            if (now_us > last_time_us) {
+              MetricsCollector::AppendHeader(out, "momo_capture_fps", "gauge",
+                                             "Captured frames per second");
+              MetricsCollector::AppendSample(
+                  out, "momo_capture_fps", "",
+                  (frames - last_frames) * 1e6 / (now_us - last_time_us));
+            }
+            last_time_us = now_us;
+            last_frames = frames;
+          });
+    }
+    _metrics_collector->AddProvider([](std::string* out) {
+      size_t rss_bytes, peak_bytes;
+      if (!MemoryReporter::Get(&rss_bytes, &peak_bytes)) {
+        return;
+      }
+      MetricsCollector::AppendHeader(out, "momo_resident_memory_bytes",
+                                     "gauge", "Resident set size");
+      MetricsCollector::AppendSample(out, "momo_resident_memory_bytes", "",
+                                     rss_bytes);
+      MetricsCollector::AppendHeader(out, "momo_resident_memory_peak_bytes",
+                                     "gauge", "Peak resident set size");
+      MetricsCollector::AppendSample(out, "momo_resident_memory_peak_bytes",
+                                     "", peak_bytes);
+    });
+    _metrics_collector->AddProvider(&RecoveryStats::AppendMetrics);
+    _metrics_collector->AddProvider(&EncodedFrameStats::AppendMetrics);
+#if USE_ROS
+    _metrics_collector->AddProvider(&ROSAudioDevice::AppendMetrics);
+#endif
+    _metrics_collector->Start();
+  }
+  StartupReport::Mark("rtc_manager_ready");
 }
 
 RTCManager::~RTCManager() {
+  if (_bandwidth_warm_start) {
+    _bandwidth_warm_start->Stop();
+    _bandwidth_warm_start = nullptr;
+  }
+  if (_metrics_collector) {
+    _metrics_collector->Stop();
+    _metrics_collector = nullptr;
+  }
   _audio_track = nullptr;
+  _lazy_adm = nullptr;
+  _video_source = nullptr;
   _video_track = nullptr;
   _factory = nullptr;
   _networkThread->Stop();
   _workerThread->Stop();
-  _signalingThread->Stop();
+  if (_signalingThread) {
+    _signalingThread->Stop();
+  }
 
   rtc::CleanupSSL();
 }
@@ -191,11 +384,65 @@ void RTCManager::SetDataManager(RTCDataManager* data_manager) {
   _data_manager = data_manager;
 }
 
+// createConnection と claimPrewarmedConnection は io_context のスレッドから
+// しか呼ばれないのでロックしない
+void RTCManager::prepareAudio() {
+  if (_audio_prepared) {
+    return;
+  }
+  _audio_prepared = true;
+  StartupReport::Mark("first_connection");
+
+  if (_lazy_adm) {
+    // ADM はワーカースレッドから使われるので、初期化もワーカースレッドでやる
+    rtc::scoped_refptr<LazyAudioDeviceModule> adm = _lazy_adm;
+    _workerThread->Invoke<void>(RTC_FROM_HERE, [adm] { adm->Activate(); });
+  }
+
+  if (!_conn_settings.no_audio) {
+    // AudioOptions は音声処理 (APM) に反映されるので、音声ソースもここで作る
+    cricket::AudioOptions ao;
+    if (_conn_settings.disable_echo_cancellation)
+      ao.echo_cancellation = false;
+    if (_conn_settings.disable_auto_gain_control)
+      ao.auto_gain_control = false;
+    if (_conn_settings.disable_noise_suppression)
+      ao.noise_suppression = false;
+    if (_conn_settings.disable_highpass_filter)
+      ao.highpass_filter = false;
+    if (_conn_settings.disable_typing_detection)
+      ao.typing_detection = false;
+    if (_conn_settings.disable_residual_echo_detector)
+      ao.residual_echo_detector = false;
+    RTC_LOG(LS_INFO) << __FUNCTION__ << ": " << ao.ToString();
+    _audio_track = _factory->CreateAudioTrack(Util::generateRandomChars(),
+                                              _factory->CreateAudioSource(ao));
+    if (!_audio_track) {
+      RTC_LOG(LS_WARNING) << __FUNCTION__ << ": Cannot create audio_track";
+    }
+  }
+}
+
 std::shared_ptr<RTCConnection> RTCManager::createConnection(
     webrtc::PeerConnectionInterface::RTCConfiguration rtc_config,
     RTCMessageSender* sender) {
+  std::shared_ptr<RTCConnection> rtc_connection =
+      createPeerConnection(rtc_config, sender);
+  if (!rtc_connection) {
+    return nullptr;
+  }
+  attachConnection(rtc_connection);
+  return rtc_connection;
+}
+
+std::shared_ptr<RTCConnection> RTCManager::createPeerConnection(
+    webrtc::PeerConnectionInterface::RTCConfiguration rtc_config,
+    RTCMessageSender* sender) {
   rtc_config.enable_dtls_srtp = true;
   rtc_config.sdp_semantics = webrtc::SdpSemantics::kUnifiedPlan;
+  if (_certificate && rtc_config.certificates.empty()) {
+    rtc_config.certificates.push_back(_certificate);
+  }
   std::unique_ptr<PeerConnectionObserver> observer(
       new PeerConnectionObserver(sender, _receiver, _data_manager));
   rtc::scoped_refptr<webrtc::PeerConnectionInterface> connection =
@@ -206,6 +453,16 @@ std::shared_ptr<RTCConnection> RTCManager::createConnection(
     return nullptr;
   }
 
+  return std::make_shared<RTCConnection>(sender, std::move(observer),
+                                         connection);
+}
+
+void RTCManager::attachConnection(
+    std::shared_ptr<RTCConnection> rtc_connection) {
+  prepareAudio();
+
+  rtc::scoped_refptr<webrtc::PeerConnectionInterface> connection =
+      rtc_connection->getConnection();
   std::string stream_id = Util::generateRandomChars();
 
   if (_audio_track) {
@@ -230,6 +487,118 @@ std::shared_ptr<RTCConnection> RTCManager::createConnection(
     }
   }
 
-  return std::make_shared<RTCConnection>(sender, std::move(observer),
-                                         connection);
+  // トラックの後に作って、オファーでは映像と音声の m-line を先にする
+  if (_data_manager != nullptr) {
+    _data_manager->OnConnectionCreated(connection);
+  }
+
+  {
+    rtc::CritScope lock(&_connections_lock);
+    _connections.push_back(
+        std::make_pair(_connection_count++, std::weak_ptr<RTCConnection>(
+                                                rtc_connection)));
+  }
+  if (_bandwidth_warm_start) {
+    _bandwidth_warm_start->Attach(rtc_connection);
+  }
+}
+
+std::shared_ptr<RTCConnection> RTCManager::createPrewarmedConnection(
+    RTCMessageSender* sender,
+    const webrtc::PeerConnectionInterface::IceServers& servers) {
+  int64_t start_ms = rtc::TimeMillis();
+  webrtc::PeerConnectionInterface::RTCConfiguration rtc_config;
+  rtc_config.servers = servers;
+  // 候補を先に集めておく。ICE サーバが後で変わった場合は集め直しになる
+  rtc_config.ice_candidate_pool_size = 1;
+  std::shared_ptr<RTCConnection> connection =
+      createPeerConnection(rtc_config, sender);
+  if (!connection) {
+    return nullptr;
+  }
+  int64_t cost_ms = rtc::TimeMillis() - start_ms;
+  connection->setPrewarmed(start_ms, cost_ms);
+  RTC_LOG(LS_INFO) << __FUNCTION__ << ": Created in " << cost_ms << " ms";
+  StartupReport::Mark("connection_prewarmed");
+  return connection;
+}
+
+void RTCManager::claimPrewarmedConnection(
+    std::shared_ptr<RTCConnection> connection) {
+  attachConnection(connection);
+  connection->reportPrewarmed();
+}
+
+bool RTCManager::setVideoCodecPreferences(
+    std::shared_ptr<RTCConnection> connection,
+    const std::string& codec) {
+  webrtc::RtpCapabilities capabilities =
+      _factory->GetRtpSenderCapabilities(cricket::MEDIA_TYPE_VIDEO);
+  std::vector<webrtc::RtpCodecCapability> codecs;
+  for (const webrtc::RtpCodecCapability& c : capabilities.codecs) {
+    // 再送や FEC は指定したコーデックと一緒に使うので残しておく
+    if (absl::EqualsIgnoreCase(c.name, codec) ||
+        absl::EqualsIgnoreCase(c.name, cricket::kRtxCodecName) ||
+        absl::EqualsIgnoreCase(c.name, cricket::kRedCodecName) ||
+        absl::EqualsIgnoreCase(c.name, cricket::kUlpfecCodecName)) {
+      codecs.push_back(c);
+    }
+  }
+  if (codecs.empty()) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": " << codec << " is not supported";
+    return false;
+  }
+
+  for (auto transceiver : connection->getConnection()->GetTransceivers()) {
+    if (transceiver->media_type() != cricket::MEDIA_TYPE_VIDEO) {
+      continue;
+    }
+    webrtc::RTCError error = transceiver->SetCodecPreferences(codecs);
+    if (!error.ok()) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__
+                        << ": SetCodecPreferences failed: " << error.message();
+      return false;
+    }
+  }
+  return true;
+}
+
+MetricsCollector::Connections RTCManager::getConnections() {
+  MetricsCollector::Connections connections;
+  rtc::CritScope lock(&_connections_lock);
+  // 破棄された接続はここで取り除く
+  auto it = _connections.begin();
+  while (it != _connections.end()) {
+    std::shared_ptr<RTCConnection> connection = it->second.lock();
+    if (connection) {
+      connections.push_back(std::make_pair(it->first, connection));
+      ++it;
+    } else {
+      it = _connections.erase(it);
+    }
+  }
+  return connections;
+}
+
+void RTCManager::startBandwidthWarmStart(const std::string& signaling_host) {
+  if (_conn_settings.bwe_cache_file.empty() || _bandwidth_warm_start) {
+    return;
+  }
+  _bandwidth_warm_start = std::make_shared<BandwidthWarmStart>(
+      signalingThread(), _conn_settings.bwe_cache_file, signaling_host,
+      _conn_settings.video_bitrate);
+  _bandwidth_warm_start->Start();
+  if (_metrics_collector) {
+    std::weak_ptr<BandwidthWarmStart> weak = _bandwidth_warm_start;
+    _metrics_collector->AddProvider([weak](std::string* out) {
+      auto bandwidth_warm_start = weak.lock();
+      if (bandwidth_warm_start) {
+        bandwidth_warm_start->AppendMetrics(out);
+      }
+    });
+  }
+}
+
+std::shared_ptr<MetricsCollector> RTCManager::getMetricsCollector() {
+  return _metrics_collector;
 }
@@ -1,33 +1,93 @@
 #ifndef RTC_MANAGER_H_
 #define RTC_MANAGER_H_
+#include <future>
+#include <memory>
+#include <utility>
+#include <vector>
+
 #include "api/peer_connection_interface.h"
+#include "bandwidth_warm_start.h"
 #include "connection.h"
 #include "connection_settings.h"
 #include "data_manager.h"
+#include "lazy_audio_device_module.h"
+#include "metrics/metrics_collector.h"
 #include "pc/video_track_source.h"
+#include "rtc_base/rtc_certificate.h"
 #include "scalable_track_source.h"
 #include "video_track_receiver.h"
 
 class RTCManager {
  public:
+  // カメラの検索と開始は時間がかかるので、PeerConnectionFactory を作っている間に
+  // 別のスレッドで進めておいて、映像トラックを作る時に待つ
   RTCManager(ConnectionSettings conn_settings,
-             rtc::scoped_refptr<ScalableVideoTrackSource> video_track_source,
+             std::future<rtc::scoped_refptr<ScalableVideoTrackSource>>
+                 video_track_source,
              VideoTrackReceiver* receiver);
   ~RTCManager();
   void SetDataManager(RTCDataManager* data_manager);
   std::shared_ptr<RTCConnection> createConnection(
       webrtc::PeerConnectionInterface::RTCConfiguration rtc_config,
       RTCMessageSender* sender);
+  // シグナリングサーバに繋がった時点で PeerConnection を作って ICE の候補を
+  // 集め始めておく。ICE サーバはオファーが来た時に RTCConnection::setIceServers
+  // で設定する。servers と違う ICE サーバを設定すると集めた候補は捨てられて、
+  // 短縮できるのは PeerConnection を作る時間だけになる。
+  // 音声デバイスの初期化やトラックの追加は claimPrewarmedConnection まで
+  // 行わず、それまでは接続の数にも含めない
+  std::shared_ptr<RTCConnection> createPrewarmedConnection(
+      RTCMessageSender* sender,
+      const webrtc::PeerConnectionInterface::IceServers& servers =
+          webrtc::PeerConnectionInterface::IceServers());
+  // 事前に作っておいた接続を使い始める
+  void claimPrewarmedConnection(std::shared_ptr<RTCConnection> connection);
+  // 映像の送信に指定したコーデックだけを使うように、トランシーバの優先順位を設定する
+  bool setVideoCodecPreferences(std::shared_ptr<RTCConnection> connection,
+                                const std::string& codec);
+  // 生きている接続の一覧。番号は作られた順に振られる
+  MetricsCollector::Connections getConnections();
+  // --metrics-interval が 0 の場合は nullptr
+  std::shared_ptr<MetricsCollector> getMetricsCollector();
+  // 前回の推定帯域を使って接続を始めるようにする。
+  // --bwe-cache-file が空の場合は何もしない
+  void startBandwidthWarmStart(const std::string& signaling_host);
+  // キャプチャラを作れなかった時は false
+  bool hasVideoSource() const { return _video_source != nullptr; }
 
  private:
+  // 省メモリモードではワーカースレッドがシグナリングスレッドを兼ねる
+  rtc::Thread* signalingThread() {
+    return _signalingThread ? _signalingThread.get() : _workerThread.get();
+  }
+  // 音声デバイスの初期化と音声トラックの作成は最初の接続まで遅らせる
+  void prepareAudio();
+  // PeerConnection だけを作る
+  std::shared_ptr<RTCConnection> createPeerConnection(
+      webrtc::PeerConnectionInterface::RTCConfiguration rtc_config,
+      RTCMessageSender* sender);
+  // 音声と映像のトラックを追加して、接続の一覧に加える
+  void attachConnection(std::shared_ptr<RTCConnection> rtc_connection);
+
   rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> _factory;
   rtc::scoped_refptr<webrtc::AudioTrackInterface> _audio_track;
+  rtc::scoped_refptr<LazyAudioDeviceModule> _lazy_adm;
+  // DTLS の証明書は起動時に 1 回だけ作って全ての接続で使う
+  rtc::scoped_refptr<rtc::RTCCertificate> _certificate;
+  bool _audio_prepared;
   rtc::scoped_refptr<webrtc::VideoTrackInterface> _video_track;
+  rtc::scoped_refptr<ScalableVideoTrackSource> _video_source;
   std::unique_ptr<rtc::Thread> _networkThread;
   std::unique_ptr<rtc::Thread> _workerThread;
   std::unique_ptr<rtc::Thread> _signalingThread;
   ConnectionSettings _conn_settings;
   VideoTrackReceiver* _receiver;
   RTCDataManager* _data_manager;
+
+  rtc::CriticalSection _connections_lock;
+  std::vector<std::pair<int, std::weak_ptr<RTCConnection>>> _connections;
+  int _connection_count;
+  std::shared_ptr<MetricsCollector> _metrics_collector;
+  std::shared_ptr<BandwidthWarmStart> _bandwidth_warm_start;
 };
 #endif
@@ -12,11 +12,30 @@ int ArgbDataSize(int height, int width) {
   return width * height * 4;
 }
 
+// MJPEG は圧縮後のサイズが分からないので ARGB の大きさを確保しておく
+size_t DataSize(webrtc::VideoType video_type, int height, int width) {
+  if (video_type == webrtc::VideoType::kMJPEG ||
+      video_type == webrtc::VideoType::kUnknown) {
+    return ArgbDataSize(height, width);
+  }
+  return webrtc::CalcBufferSize(video_type, width, height);
+}
+
 }  // namespace
 
 rtc::scoped_refptr<NativeBuffer>
 NativeBuffer::Create(webrtc::VideoType video_type, int width, int height) {
-  return new rtc::RefCountedObject<NativeBuffer>(video_type, width, height);
+  return new rtc::RefCountedObject<NativeBuffer>(
+      video_type, width, height, DataSize(video_type, height, width));
+}
+
+rtc::scoped_refptr<NativeBuffer> NativeBuffer::Create(
+    webrtc::VideoType video_type,
+    int width,
+    int height,
+    size_t capacity) {
+  return new rtc::RefCountedObject<NativeBuffer>(video_type, width, height,
+                                                 capacity);
 }
 
 webrtc::VideoFrameBuffer::Type NativeBuffer::type() const {
@@ -24,7 +43,7 @@ webrtc::VideoFrameBuffer::Type NativeBuffer::type() const {
 }
 
 void NativeBuffer::InitializeData() {
-  memset(data_.get(), 0, ArgbDataSize(raw_height_, raw_width_));
+  memset(data_.get(), 0, capacity_);
 }
 
 int NativeBuffer::width() const {
@@ -83,15 +102,18 @@ uint8_t* NativeBuffer::MutableData() {
   return const_cast<uint8_t*>(Data());
 }
 
-NativeBuffer::NativeBuffer(webrtc::VideoType video_type, int width, int height)
+NativeBuffer::NativeBuffer(webrtc::VideoType video_type,
+                           int width,
+                           int height,
+                           size_t capacity)
     : raw_width_(width),
       raw_height_(height),
       scaled_width_(width),
       scaled_height_(height),
-      length_(ArgbDataSize(height, width)),
+      capacity_(capacity),
+      length_(capacity),
       video_type_(video_type),
       data_(static_cast<uint8_t*>(
-          webrtc::AlignedMalloc(ArgbDataSize(height, width),
-                                kBufferAlignment))) {}
+          webrtc::AlignedMalloc(capacity, kBufferAlignment))) {}
 
 NativeBuffer::~NativeBuffer() {}
\ No newline at end of file
@@ -11,6 +11,11 @@ class NativeBuffer : public webrtc::VideoFrameBuffer {
   static rtc::scoped_refptr<NativeBuffer> Create(webrtc::VideoType video_type,
                                                  int width,
                                                  int height);
+  // 実際のデータの大きさが分かっている場合はその分だけ確保する
+  static rtc::scoped_refptr<NativeBuffer> Create(webrtc::VideoType video_type,
+                                                 int width,
+                                                 int height,
+                                                 size_t capacity);
 
   void InitializeData();
 
@@ -29,7 +34,10 @@ class NativeBuffer : public webrtc::VideoFrameBuffer {
   uint8_t* MutableData();
 
  protected:
-  NativeBuffer(webrtc::VideoType video_type, int width, int height);
+  NativeBuffer(webrtc::VideoType video_type,
+               int width,
+               int height,
+               size_t capacity);
   ~NativeBuffer() override;
 
  private:
@@ -37,6 +45,7 @@ class NativeBuffer : public webrtc::VideoFrameBuffer {
   const int raw_height_;
   int scaled_width_;
   int scaled_height_;
+  const size_t capacity_;
   size_t length_;
   const webrtc::VideoType video_type_;
   const std::unique_ptr<uint8_t, webrtc::AlignedFreeDeleter> data_;
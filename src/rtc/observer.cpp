@@ -2,6 +2,7 @@
 
 #include <iostream>
 
+#include "metrics/startup_report.h"
 #include "rtc_base/logging.h"
 
 PeerConnectionObserver::~PeerConnectionObserver() {
@@ -20,7 +21,13 @@ void PeerConnectionObserver::OnStandardizedIceConnectionChange(
     webrtc::PeerConnectionInterface::IceConnectionState new_state) {
   RTC_LOG(LS_INFO) << __FUNCTION__ << " :" << new_state;
   if (new_state == webrtc::PeerConnectionInterface::IceConnectionState::
-                       kIceConnectionDisconnected) {
+                       kIceConnectionConnected) {
+    StartupReport::Mark("ice_connected");
+  }
+  // 切れても ICE リスタートで同じトラックのまま戻ることがあるので、
+  // 閉じられるまではトラックを残しておく
+  if (new_state == webrtc::PeerConnectionInterface::IceConnectionState::
+                       kIceConnectionClosed) {
     ClearAllRegisteredTracks();
   }
   if (_sender != nullptr) {
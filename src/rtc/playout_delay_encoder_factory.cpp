@@ -0,0 +1,104 @@
+#include "playout_delay_encoder_factory.h"
+
+#include "absl/memory/memory.h"
+
+PlayoutDelayVideoEncoder::PlayoutDelayVideoEncoder(
+    std::unique_ptr<webrtc::VideoEncoder> encoder,
+    int min_ms,
+    int max_ms)
+    : encoder_(std::move(encoder)),
+      min_ms_(min_ms),
+      max_ms_(max_ms),
+      callback_(nullptr) {}
+
+int32_t PlayoutDelayVideoEncoder::InitEncode(
+    const webrtc::VideoCodec* codec_settings,
+    int32_t number_of_cores,
+    size_t max_payload_size) {
+  return encoder_->InitEncode(codec_settings, number_of_cores,
+                              max_payload_size);
+}
+
+int32_t PlayoutDelayVideoEncoder::RegisterEncodeCompleteCallback(
+    webrtc::EncodedImageCallback* callback) {
+  callback_ = callback;
+  return encoder_->RegisterEncodeCompleteCallback(callback ? this : nullptr);
+}
+
+int32_t PlayoutDelayVideoEncoder::Release() {
+  return encoder_->Release();
+}
+
+int32_t PlayoutDelayVideoEncoder::Encode(
+    const webrtc::VideoFrame& frame,
+    const std::vector<webrtc::VideoFrameType>* frame_types) {
+  return encoder_->Encode(frame, frame_types);
+}
+
+void PlayoutDelayVideoEncoder::SetRates(
+    const RateControlParameters& parameters) {
+  encoder_->SetRates(parameters);
+}
+
+void PlayoutDelayVideoEncoder::OnPacketLossRateUpdate(float packet_loss_rate) {
+  encoder_->OnPacketLossRateUpdate(packet_loss_rate);
+}
+
+void PlayoutDelayVideoEncoder::OnRttUpdate(int64_t rtt_ms) {
+  encoder_->OnRttUpdate(rtt_ms);
+}
+
+void PlayoutDelayVideoEncoder::OnLossNotification(
+    const LossNotification& loss_notification) {
+  encoder_->OnLossNotification(loss_notification);
+}
+
+webrtc::VideoEncoder::EncoderInfo PlayoutDelayVideoEncoder::GetEncoderInfo()
+    const {
+  return encoder_->GetEncoderInfo();
+}
+
+webrtc::EncodedImageCallback::Result PlayoutDelayVideoEncoder::OnEncodedImage(
+    const webrtc::EncodedImage& encoded_image,
+    const webrtc::CodecSpecificInfo* codec_specific_info,
+    const webrtc::RTPFragmentationHeader* fragmentation) {
+  // EncodedImage のコピーはビットストリームを共有するので軽い
+  webrtc::EncodedImage image(encoded_image);
+  image.playout_delay_.min_ms = min_ms_;
+  image.playout_delay_.max_ms = max_ms_;
+  return callback_->OnEncodedImage(image, codec_specific_info, fragmentation);
+}
+
+void PlayoutDelayVideoEncoder::OnDroppedFrame(DropReason reason) {
+  callback_->OnDroppedFrame(reason);
+}
+
+PlayoutDelayVideoEncoderFactory::PlayoutDelayVideoEncoderFactory(
+    std::unique_ptr<webrtc::VideoEncoderFactory> factory,
+    int min_ms,
+    int max_ms)
+    : factory_(std::move(factory)), min_ms_(min_ms), max_ms_(max_ms) {}
+
+std::vector<webrtc::SdpVideoFormat>
+PlayoutDelayVideoEncoderFactory::GetSupportedFormats() const {
+  return factory_->GetSupportedFormats();
+}
+
+webrtc::VideoEncoderFactory::CodecInfo
+PlayoutDelayVideoEncoderFactory::QueryVideoEncoder(
+    const webrtc::SdpVideoFormat& format) const {
+  return factory_->QueryVideoEncoder(format);
+}
+
+std::unique_ptr<webrtc::VideoEncoder>
+PlayoutDelayVideoEncoderFactory::CreateVideoEncoder(
+    const webrtc::SdpVideoFormat& format) {
+  std::unique_ptr<webrtc::VideoEncoder> encoder =
+      factory_->CreateVideoEncoder(format);
+  if (!encoder) {
+    return nullptr;
+  }
+  return std::unique_ptr<webrtc::VideoEncoder>(
+      absl::make_unique<PlayoutDelayVideoEncoder>(std::move(encoder), min_ms_,
+                                                  max_ms_));
+}
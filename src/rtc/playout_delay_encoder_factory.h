@@ -0,0 +1,72 @@
+#ifndef PLAYOUT_DELAY_ENCODER_FACTORY_H_
+#define PLAYOUT_DELAY_ENCODER_FACTORY_H_
+
+#include <memory>
+#include <vector>
+
+#include "api/video_codecs/sdp_video_format.h"
+#include "api/video_codecs/video_encoder.h"
+#include "api/video_codecs/video_encoder_factory.h"
+
+// エンコーダをラップして、出力したフレームに playout-delay 拡張ヘッダの
+// 値 (最小と最大) を付けるエンコーダ。
+// min=max=0 にすると、受信側はジッタバッファで溜めずに届いた順に表示する。
+class PlayoutDelayVideoEncoder : public webrtc::VideoEncoder,
+                                 public webrtc::EncodedImageCallback {
+ public:
+  PlayoutDelayVideoEncoder(std::unique_ptr<webrtc::VideoEncoder> encoder,
+                           int min_ms,
+                           int max_ms);
+
+  // webrtc::VideoEncoder
+  int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
+                     int32_t number_of_cores,
+                     size_t max_payload_size) override;
+  int32_t RegisterEncodeCompleteCallback(
+      webrtc::EncodedImageCallback* callback) override;
+  int32_t Release() override;
+  int32_t Encode(
+      const webrtc::VideoFrame& frame,
+      const std::vector<webrtc::VideoFrameType>* frame_types) override;
+  void SetRates(const RateControlParameters& parameters) override;
+  void OnPacketLossRateUpdate(float packet_loss_rate) override;
+  void OnRttUpdate(int64_t rtt_ms) override;
+  void OnLossNotification(const LossNotification& loss_notification) override;
+  webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const override;
+
+  // webrtc::EncodedImageCallback
+  webrtc::EncodedImageCallback::Result OnEncodedImage(
+      const webrtc::EncodedImage& encoded_image,
+      const webrtc::CodecSpecificInfo* codec_specific_info,
+      const webrtc::RTPFragmentationHeader* fragmentation) override;
+  void OnDroppedFrame(DropReason reason) override;
+
+ private:
+  std::unique_ptr<webrtc::VideoEncoder> encoder_;
+  const int min_ms_;
+  const int max_ms_;
+  webrtc::EncodedImageCallback* callback_;
+};
+
+// 既存のエンコーダファクトリをラップして、作ったエンコーダを
+// PlayoutDelayVideoEncoder で包むファクトリ
+class PlayoutDelayVideoEncoderFactory : public webrtc::VideoEncoderFactory {
+ public:
+  PlayoutDelayVideoEncoderFactory(
+      std::unique_ptr<webrtc::VideoEncoderFactory> factory,
+      int min_ms,
+      int max_ms);
+
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
+  CodecInfo QueryVideoEncoder(
+      const webrtc::SdpVideoFormat& format) const override;
+  std::unique_ptr<webrtc::VideoEncoder> CreateVideoEncoder(
+      const webrtc::SdpVideoFormat& format) override;
+
+ private:
+  std::unique_ptr<webrtc::VideoEncoderFactory> factory_;
+  const int min_ms_;
+  const int max_ms_;
+};
+
+#endif  // PLAYOUT_DELAY_ENCODER_FACTORY_H_
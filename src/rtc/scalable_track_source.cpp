@@ -16,11 +16,13 @@
 #include "api/video/i420_buffer.h"
 #include "api/video/video_frame_buffer.h"
 #include "api/video/video_rotation.h"
+#include "frame_metadata/frame_metadata.h"
+#include "metrics/startup_report.h"
 #include "native_buffer.h"
 #include "rtc_base/logging.h"
 
 ScalableVideoTrackSource::ScalableVideoTrackSource()
-    : AdaptedVideoTrackSource(4) {}
+    : AdaptedVideoTrackSource(4), captured_frames_(0) {}
 ScalableVideoTrackSource::~ScalableVideoTrackSource() {}
 
 bool ScalableVideoTrackSource::is_screencast() const {
@@ -42,6 +44,9 @@ bool ScalableVideoTrackSource::remote() const {
 
 void ScalableVideoTrackSource::OnCapturedFrame(
     const webrtc::VideoFrame& frame) {
+  if (captured_frames_++ == 0) {
+    StartupReport::Mark("first_frame_captured");
+  }
   const int64_t timestamp_us = frame.timestamp_us();
   const int64_t translated_timestamp_us =
       timestamp_aligner_.TranslateTimestamp(timestamp_us, rtc::TimeMicros());
@@ -63,6 +68,7 @@ void ScalableVideoTrackSource::OnCapturedFrame(
     NativeBuffer* frame_buffer =
         dynamic_cast<NativeBuffer*>(frame.video_frame_buffer().get());
     frame_buffer->SetScaledSize(adapted_width, adapted_height);
+    FrameMetadataSender::OnCapturedFrame(frame.timestamp_us());
     OnFrame(frame);
     return;
   }
@@ -79,6 +85,7 @@ void ScalableVideoTrackSource::OnCapturedFrame(
     buffer = i420_buffer;
   }
 
+  FrameMetadataSender::OnCapturedFrame(translated_timestamp_us);
   OnFrame(webrtc::VideoFrame::Builder()
               .set_video_frame_buffer(buffer)
               .set_rotation(frame.rotation())
@@ -12,6 +12,7 @@
 
 #include <stddef.h>
 
+#include <atomic>
 #include <memory>
 
 #include "media/base/adapted_video_track_source.h"
@@ -29,8 +30,11 @@ class ScalableVideoTrackSource : public rtc::AdaptedVideoTrackSource {
   bool remote() const override;
   void OnCapturedFrame(const webrtc::VideoFrame& frame);
   virtual bool useNativeBuffer() { return false; }
+  // キャプチャスレッドから渡されたフレームの累計。メトリクス用
+  uint64_t capturedFrames() const { return captured_frames_; }
 
  private:
+  std::atomic<uint64_t> captured_frames_;
   rtc::TimestampAligner timestamp_aligner_;
 
   cricket::VideoAdapter video_adapter_;
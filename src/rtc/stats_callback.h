@@ -0,0 +1,31 @@
+#ifndef STATS_CALLBACK_H_
+#define STATS_CALLBACK_H_
+
+#include <functional>
+#include <utility>
+
+#include "api/scoped_refptr.h"
+#include "api/stats/rtc_stats_collector_callback.h"
+#include "api/stats/rtc_stats_report.h"
+
+// PeerConnectionInterface::GetStats の結果を関数で受け取るためのアダプタ。
+// rtc::RefCountedObject<StatsCallback> として作って渡す。
+// 結果はシグナリングスレッドから呼ばれる。
+class StatsCallback : public webrtc::RTCStatsCollectorCallback {
+ public:
+  typedef std::function<void(
+      const rtc::scoped_refptr<const webrtc::RTCStatsReport>&)>
+      Callback;
+  explicit StatsCallback(Callback callback) : callback_(std::move(callback)) {}
+
+ protected:
+  void OnStatsDelivered(
+      const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report) override {
+    callback_(report);
+  }
+
+ private:
+  Callback callback_;
+};
+
+#endif  // STATS_CALLBACK_H_
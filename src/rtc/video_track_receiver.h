@@ -1,14 +1,23 @@
 #ifndef VIDEO_TRACK_RECEIVER_HANDLER_H_
 #define VIDEO_TRACK_RECEIVER_HANDLER_H_
 
+#include <stdint.h>
+
 #include <string>
 
 #include "api/media_stream_interface.h"
+#include "api/video/video_frame.h"
 
 class VideoTrackReceiver {
  public:
   virtual void AddTrack(webrtc::VideoTrackInterface* track) = 0;
   virtual void RemoveTrack(webrtc::VideoTrackInterface* track) = 0;
+  // 送信側がフレームに付けたメタデータを、デコードしたフレームと一緒に受け取る。
+  // デコードのスレッドから呼ばれる
+  virtual void OnFrameMetadata(webrtc::VideoTrackInterface* track,
+                               const webrtc::VideoFrame& frame,
+                               const uint8_t* data,
+                               size_t size) {}
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -7,13 +7,18 @@
 #include "rtc_base/logging.h"
 #include "third_party/libyuv/include/libyuv/convert_from.h"
 #include "third_party/libyuv/include/libyuv/video_common.h"
+#include "thread_policy/thread_policy.h"
 
 #define STD_ASPECT 1.33
 #define WIDE_ASPECT 1.78
 #define FRAME_INTERVAL (1000 / 30)
 
-SDLRenderer::SDLRenderer(int width, int height, bool fullscreen)
+SDLRenderer::SDLRenderer(int width,
+                         int height,
+                         bool fullscreen,
+                         bool render_on_decode)
     : running_(true),
+      render_on_decode_(render_on_decode),
       window_(nullptr),
       renderer_(nullptr),
       dispatch_(nullptr),
@@ -45,6 +50,7 @@ SDLRenderer::SDLRenderer(int width, int height, bool fullscreen)
 
 SDLRenderer::~SDLRenderer() {
   running_ = false;
+  frame_arrived_.Set();
   int ret = 0;
   SDL_WaitThread(thread_, &ret);
   if (ret != 0) {
@@ -98,11 +104,18 @@ void SDLRenderer::SetDispatchFunction(
   dispatch_ = std::move(dispatch);
 }
 
+void SDLRenderer::OnFrameArrived() {
+  if (render_on_decode_) {
+    frame_arrived_.Set();
+  }
+}
+
 int SDLRenderer::RenderThreadExec(void* data) {
   return ((SDLRenderer*)data)->RenderThread();
 }
 
 int SDLRenderer::RenderThread() {
+  ThreadPolicy::Apply("render");
   renderer_ = SDL_CreateRenderer(window_, -1, SDL_RENDERER_ACCELERATED);
   if (renderer_ == nullptr) {
     RTC_LOG(LS_ERROR) << __FUNCTION__ << ": SDL_CreateRenderer failed "
@@ -153,7 +166,12 @@ int SDLRenderer::RenderThread() {
       }
     }
     duration = SDL_GetTicks() - start_time;
-    SDL_Delay(FRAME_INTERVAL - (duration % FRAME_INTERVAL));
+    if (render_on_decode_) {
+      // フレームが無くてもウィンドウのイベントは処理したいので、待つのは最大 1 フレーム分
+      frame_arrived_.Wait(FRAME_INTERVAL);
+    } else {
+      SDL_Delay(FRAME_INTERVAL - (duration % FRAME_INTERVAL));
+    }
   }
 
   SDL_DestroyRenderer(renderer_);
@@ -216,10 +234,19 @@ void SDLRenderer::Sink::OnFrame(const webrtc::VideoFrame& frame) {
     RTC_LOG(LS_VERBOSE) << __FUNCTION__ << ": scaled_=" << scaled_;
     outline_changed_ = false;
   }
+  ConvertToARGB(frame, scaled_, width_, height_, image_.get());
+  renderer_->OnFrameArrived();
+}
+
+void SDLRenderer::Sink::ConvertToARGB(const webrtc::VideoFrame& frame,
+                                      bool scaled,
+                                      int width,
+                                      int height,
+                                      uint8_t* image) {
   rtc::scoped_refptr<webrtc::I420BufferInterface> buffer_if;
-  if (scaled_) {
+  if (scaled) {
     rtc::scoped_refptr<webrtc::I420Buffer> buffer =
-        webrtc::I420Buffer::Create(width_, height_);
+        webrtc::I420Buffer::Create(width, height);
     buffer->ScaleFrom(*frame.video_frame_buffer()->ToI420());
     if (frame.rotation() != webrtc::kVideoRotation_0) {
       buffer = webrtc::I420Buffer::Rotate(*buffer, frame.rotation());
@@ -230,8 +257,8 @@ void SDLRenderer::Sink::OnFrame(const webrtc::VideoFrame& frame) {
   }
   libyuv::ConvertFromI420(
       buffer_if->DataY(), buffer_if->StrideY(), buffer_if->DataU(),
-      buffer_if->StrideU(), buffer_if->DataV(), buffer_if->StrideV(),
-      image_.get(), (scaled_ ? width_ : input_width_) * 4, buffer_if->width(),
+      buffer_if->StrideU(), buffer_if->DataV(), buffer_if->StrideV(), image,
+      (scaled ? width : frame.width()) * 4, buffer_if->width(),
       buffer_if->height(), libyuv::FOURCC_ARGB);
 }
 
@@ -14,10 +14,12 @@
 #include "api/video/video_sink_interface.h"
 #include "rtc/video_track_receiver.h"
 #include "rtc_base/critical_section.h"
+#include "rtc_base/event.h"
 
 class SDLRenderer : public VideoTrackReceiver {
  public:
-  SDLRenderer(int width, int height, bool fullscreen);
+  // render_on_decode が true の時は、一定間隔ではなくフレームが届く度に描画する
+  SDLRenderer(int width, int height, bool fullscreen, bool render_on_decode);
   ~SDLRenderer();
 
   void SetDispatchFunction(std::function<void(std::function<void()>)> dispatch);
@@ -37,6 +39,14 @@ class SDLRenderer : public VideoTrackReceiver {
 
     void OnFrame(const webrtc::VideoFrame& frame) override;
 
+    // frame を描画用の ARGB にして image に書き出す。
+    // scaled の時は width x height に縮小してから変換する
+    static void ConvertToARGB(const webrtc::VideoFrame& frame,
+                              bool scaled,
+                              int width,
+                              int height,
+                              uint8_t* image);
+
     void SetOutlineRect(int x, int y, int width, int height);
 
     rtc::CriticalSection* GetCriticalSection();
@@ -73,6 +83,7 @@ class SDLRenderer : public VideoTrackReceiver {
   bool IsFullScreen();
   void SetFullScreen(bool fullscreen);
   void PollEvent();
+  void OnFrameArrived();
 
   rtc::CriticalSection sinks_lock_;
   typedef std::vector<
@@ -80,6 +91,8 @@ class SDLRenderer : public VideoTrackReceiver {
       VideoTrackSinkVector;
   VideoTrackSinkVector sinks_;
   std::atomic<bool> running_;
+  const bool render_on_decode_;
+  rtc::Event frame_arrived_;
   SDL_Thread* thread_;
   SDL_Window* window_;
   SDL_Renderer* renderer_;
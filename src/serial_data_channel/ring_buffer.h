@@ -0,0 +1,106 @@
+#ifndef SERIAL_RING_BUFFER_H_
+#define SERIAL_RING_BUFFER_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+
+// 固定長のバイト列のリングバッファ。
+// シリアルの読み書きは io_context のスレッドだけで行うのでロックはしない。
+// 容量は 2 のべき乗に切り上げる。
+class SerialRingBuffer {
+ public:
+  explicit SerialRingBuffer(size_t capacity)
+      : capacity_(RoundUp(capacity)),
+        data_(new uint8_t[capacity_]),
+        head_(0),
+        tail_(0) {}
+
+  size_t capacity() const { return capacity_; }
+  size_t size() const { return tail_ - head_; }
+  size_t space() const { return capacity_ - size(); }
+  bool empty() const { return head_ == tail_; }
+
+  // 先頭から offset 番目のバイト
+  uint8_t At(size_t offset) const {
+    return data_[(head_ + offset) & (capacity_ - 1)];
+  }
+
+  // offset から length バイトが折り返さずに並んでいればその先頭。
+  // 折り返している場合は nullptr
+  const uint8_t* Data(size_t offset, size_t length) const {
+    size_t pos = (head_ + offset) & (capacity_ - 1);
+    return length <= capacity_ - pos ? &data_[pos] : nullptr;
+  }
+
+  // from 番目以降で最初に value が現れる位置。無ければ size()
+  size_t Find(uint8_t value, size_t from) const {
+    while (from < size()) {
+      size_t pos = (head_ + from) & (capacity_ - 1);
+      size_t length = std::min(size() - from, capacity_ - pos);
+      const void* found = memchr(&data_[pos], value, length);
+      if (found != nullptr) {
+        return from + (static_cast<const uint8_t*>(found) - &data_[pos]);
+      }
+      from += length;
+    }
+    return size();
+  }
+
+  // 入るだけ書き込んで、書き込んだバイト数を返す
+  size_t Write(const uint8_t* data, size_t length) {
+    length = std::min(length, space());
+    size_t pos = tail_ & (capacity_ - 1);
+    size_t first = std::min(length, capacity_ - pos);
+    memcpy(&data_[pos], data, first);
+    memcpy(&data_[0], data + first, length - first);
+    tail_ += length;
+    return length;
+  }
+
+  // 先頭から length バイトを out にコピーする。取り除きはしない
+  void Peek(size_t offset, uint8_t* out, size_t length) const {
+    size_t pos = (head_ + offset) & (capacity_ - 1);
+    size_t first = std::min(length, capacity_ - pos);
+    memcpy(out, &data_[pos], first);
+    memcpy(out + first, &data_[0], length - first);
+  }
+
+  void Consume(size_t length) { head_ += std::min(length, size()); }
+
+  void Clear() { head_ = tail_ = 0; }
+
+  // 読み出せる連続した領域。折り返している場合は前半だけ返す
+  size_t ReadableSpan(const uint8_t** data) const {
+    size_t pos = head_ & (capacity_ - 1);
+    *data = &data_[pos];
+    return std::min(size(), capacity_ - pos);
+  }
+
+  // 書き込める連続した領域。書き込んだら Commit する
+  size_t WritableSpan(uint8_t** data) {
+    size_t pos = tail_ & (capacity_ - 1);
+    *data = &data_[pos];
+    return std::min(space(), capacity_ - pos);
+  }
+  void Commit(size_t length) { tail_ += std::min(length, space()); }
+
+ private:
+  static size_t RoundUp(size_t n) {
+    size_t capacity = 1;
+    while (capacity < n) {
+      capacity <<= 1;
+    }
+    return capacity;
+  }
+
+  const size_t capacity_;
+  std::unique_ptr<uint8_t[]> data_;
+  // 書き込んだ位置と読み出した位置の累積。差がそのままデータ量になる
+  size_t head_;
+  size_t tail_;
+};
+
+#endif  // SERIAL_RING_BUFFER_H_
@@ -28,7 +28,17 @@ void SerialDataChannel::OnMessage(const webrtc::DataBuffer& buffer) {
   serial_data_manager_->Send(data, length);
 }
 
-void SerialDataChannel::Send(uint8_t* data, size_t length) {
+void SerialDataChannel::OnBufferedAmountChange(uint64_t previous_amount) {
+  if (data_channel_->buffered_amount() < previous_amount) {
+    serial_data_manager_->OnBufferedAmountDecreased();
+  }
+}
+
+uint64_t SerialDataChannel::BufferedAmount() {
+  return data_channel_->buffered_amount();
+}
+
+void SerialDataChannel::Send(const uint8_t* data, size_t length) {
   if (data_channel_->state() != webrtc::DataChannelInterface::kOpen) {
     return;
   }
@@ -14,11 +14,12 @@ class SerialDataChannel : public webrtc::DataChannelObserver {
       rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel);
   ~SerialDataChannel();
 
-  void Send(uint8_t* data, size_t length);
+  void Send(const uint8_t* data, size_t length);
+  uint64_t BufferedAmount();
 
   void OnStateChange() override;
   void OnMessage(const webrtc::DataBuffer& buffer) override;
-  void OnBufferedAmountChange(uint64_t previous_amount) override {}
+  void OnBufferedAmountChange(uint64_t previous_amount) override;
 
  private:
   SerialDataManager* serial_data_manager_;
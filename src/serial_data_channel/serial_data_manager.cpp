@@ -3,16 +3,28 @@
 
 #include "serial_data_manager.h"
 
+#include <algorithm>
+#include <array>
 #include <iostream>
 #include <boost/bind.hpp>
 
 #include "rtc_base/log_sinks.h"
 
-#define SERIAL_TX_BUFFER_SIZE 16
-#define SERIAL_RX_BUFFER_SIZE 256
-
-SerialDataManager::SerialDataManager(boost::asio::io_context& ioc)
-    : serial_port_(ioc), read_buffer_size_(SERIAL_RX_BUFFER_SIZE) {
+SerialDataManager::SerialDataManager(boost::asio::io_context& ioc,
+                                     std::unique_ptr<SerialFramer> framer,
+                                     int idle_gap_ms)
+    : serial_port_(ioc),
+      idle_timer_(ioc),
+      framer_(std::move(framer)),
+      idle_gap_ms_(idle_gap_ms),
+      rx_buffer_(kRingBufferSize),
+      reading_(false),
+      idle_timer_running_(false),
+      tx_buffer_(kRingBufferSize),
+      write_length_(0),
+      tx_dropped_(0),
+      paused_(false),
+      resume_posted_(false) {
   post_ = [&ioc](std::function<void()> f) {
     if (ioc.stopped())
       return;
@@ -38,12 +50,23 @@ void SerialDataManager::OnDataChannel(
 }
 
 void SerialDataManager::OnClosed(SerialDataChannel* serial_data_channel) {
-  rtc::CritScope lock(&channels_lock_);
-  serial_data_channels_.erase(
-      std::remove(serial_data_channels_.begin(), serial_data_channels_.end(),
-                  serial_data_channel),
-      serial_data_channels_.end());
-  delete serial_data_channel;
+  {
+    rtc::CritScope lock(&channels_lock_);
+    serial_data_channels_.erase(
+        std::remove(serial_data_channels_.begin(), serial_data_channels_.end(),
+                    serial_data_channel),
+        serial_data_channels_.end());
+    delete serial_data_channel;
+  }
+  // 詰まっていた DataChannel が無くなったので再開できるかもしれない
+  OnBufferedAmountDecreased();
+}
+
+void SerialDataManager::OnBufferedAmountDecreased() {
+  if (!paused_.load() || resume_posted_.exchange(true)) {
+    return;
+  }
+  post_(std::bind(&SerialDataManager::onResume, this));
 }
 
 bool SerialDataManager::Connect(std::string device, unsigned int rate) {
@@ -90,7 +113,6 @@ bool SerialDataManager::Connect(std::string device, unsigned int rate) {
     return false;
   }
 
-  read_buffer_.reset(new uint8_t[read_buffer_size_]);
   post_(std::bind(&SerialDataManager::doRead, this));
   return true;
 }
@@ -105,16 +127,25 @@ void SerialDataManager::doCloseSerial() {
     return;
   }
   boost::system::error_code error;
+  idle_timer_.cancel(error);
   serial_port_.cancel(error);
   serial_port_.close(error);
 }
 
 void SerialDataManager::doRead() {
-  if (!serial_port_.is_open()) {
+  if (!serial_port_.is_open() || reading_) {
+    return;
+  }
+  // リングバッファの空きに直接読み込む
+  uint8_t* data;
+  size_t length = rx_buffer_.WritableSpan(&data);
+  if (length == 0) {
+    // 一杯なので、DataChannel に送れて空くまで読まない
     return;
   }
+  reading_ = true;
   serial_port_.async_read_some(
-      boost::asio::buffer(read_buffer_.get(), read_buffer_size_),
+      boost::asio::buffer(data, length),
       boost::bind(&SerialDataManager::onRead, this,
                   boost::asio::placeholders::error,
                   boost::asio::placeholders::bytes_transferred));
@@ -122,54 +153,105 @@ void SerialDataManager::doRead() {
 
 void SerialDataManager::onRead(const boost::system::error_code& error,
                                size_t bytes_transferred) {
+  reading_ = false;
   if (error) {
     RTC_LOG(LS_ERROR) << __FUNCTION__
                       << " async_read_some failed  error :" << error;
     doCloseSerial();
     return;
   }
-  read_line_buffer_.insert(read_line_buffer_.end(), read_buffer_.get(),
-                           read_buffer_.get() + bytes_transferred);
-  {
-    rtc::CritScope lock(&channels_lock_);
-    sendLineFromSerial();
+  rx_buffer_.Commit(bytes_transferred);
+  sendFramesFromSerial(false);
+
+  if (framer_->NeedsIdleFlush() && !rx_buffer_.empty()) {
+    // 次のデータが idle_gap_ms_ の間来なければ、そこまでを送る
+    idle_timer_running_ = true;
+    idle_timer_.expires_from_now(
+        boost::posix_time::milliseconds(idle_gap_ms_));
+    idle_timer_.async_wait(boost::bind(&SerialDataManager::onIdle, this,
+                                       boost::asio::placeholders::error));
+  }
+  doRead();
+}
+
+void SerialDataManager::onIdle(const boost::system::error_code& error) {
+  if (error == boost::asio::error::operation_aborted) {
+    return;
   }
+  idle_timer_running_ = false;
+  sendFramesFromSerial(true);
+}
+
+void SerialDataManager::onResume() {
+  resume_posted_.store(false);
+  if (!paused_.load()) {
+    return;
+  }
+  sendFramesFromSerial(!idle_timer_running_ && framer_->NeedsIdleFlush());
   doRead();
 }
 
-void SerialDataManager::sendLineFromSerial() {
-  auto delimiter_iterator =
-      std::find(read_line_buffer_.begin(), read_line_buffer_.end(), '\n');
-  if (delimiter_iterator != read_line_buffer_.end()) {
-    size_t delimiter_index =
-        std::distance(read_line_buffer_.begin(), delimiter_iterator);
+void SerialDataManager::sendFramesFromSerial(bool flush) {
+  rtc::CritScope lock(&channels_lock_);
+
+  // buffered_amount() はシグナリングスレッドを経由するので、まとめて 1 回だけ見て
+  // そこから送れる量を決める
+  uint64_t buffered = 0;
+  for (SerialDataChannel* serial_data_channel : serial_data_channels_) {
+    buffered = std::max(buffered, serial_data_channel->BufferedAmount());
+  }
+  uint64_t budget = buffered < kHighWatermark ? kHighWatermark - buffered : 0;
+  bool paused = false;
+  SerialFramer::FrameHandler on_frame = [this, &budget, &paused](
+                                            const uint8_t* data,
+                                            size_t length) {
+    if (length > budget) {
+      paused = true;
+      return false;
+    }
+    budget -= length;
     for (SerialDataChannel* serial_data_channel : serial_data_channels_) {
-      serial_data_channel->Send(read_line_buffer_.data(), delimiter_index);
+      serial_data_channel->Send(data, length);
     }
-    read_line_buffer_.erase(read_line_buffer_.begin(), delimiter_iterator + 1);
-    sendLineFromSerial();
+    return true;
+  };
+  if (flush) {
+    framer_->Flush(&rx_buffer_, on_frame);
+  } else {
+    framer_->Decode(&rx_buffer_, on_frame);
   }
+  // 止めた時は送信バッファに 1 メッセージ分以上残っているので、
+  // 再開のきっかけになる OnBufferedAmountChange は必ずまた来る
+  paused_.store(paused);
 }
 
 void SerialDataManager::startWrite(std::vector<uint8_t> v) {
   if (!serial_port_.is_open()) {
     return;
   }
-  bool empty = write_buffer_.empty();
-  write_buffer_.insert(write_buffer_.end(), v.begin(), v.end());
-  if (empty && !write_buffer_.empty()) {
+  if (!framer_->Encode(v.data(), v.size(), &tx_buffer_)) {
+    // DataChannel 側は止められないので、シリアルの書き込みが追いつかない時は捨てる
+    if (tx_dropped_++ % 100 == 0) {
+      RTC_LOG(LS_WARNING) << __FUNCTION__ << ": Dropped " << tx_dropped_
+                          << " messages because the serial port is too slow";
+    }
+    return;
+  }
+  if (write_length_ == 0) {
     doWrite();
   }
 }
 
 void SerialDataManager::doWrite() {
-  if (write_buffer_.size() < SERIAL_TX_BUFFER_SIZE) {
-    write_length_ = write_buffer_.size();
-  } else {
-    write_length_ = SERIAL_TX_BUFFER_SIZE;
-  }
-  async_write(serial_port_,
-              boost::asio::buffer(write_buffer_.data(), write_length_),
+  // 溜まっている分を折り返しも含めて 1 回の async_write で書く
+  write_length_ = tx_buffer_.size();
+  const uint8_t* first;
+  size_t first_length = tx_buffer_.ReadableSpan(&first);
+  const uint8_t* second = tx_buffer_.Data(first_length, 0);
+  std::array<boost::asio::const_buffer, 2> buffers = {
+      boost::asio::buffer(first, first_length),
+      boost::asio::buffer(second, write_length_ - first_length)};
+  async_write(serial_port_, buffers,
               boost::bind(&SerialDataManager::onWrite, this,
                           boost::asio::placeholders::error));
 }
@@ -178,13 +260,14 @@ void SerialDataManager::onWrite(const boost::system::error_code& error) {
   if (error) {
     RTC_LOG(LS_ERROR) << __FUNCTION__
                       << " async_write failed  error :" << error;
+    write_length_ = 0;
     doCloseSerial();
     return;
   }
-  write_buffer_.erase(write_buffer_.begin(),
-                      write_buffer_.begin() + write_length_);
-  if (write_buffer_.empty()) {
+  tx_buffer_.Consume(write_length_);
+  write_length_ = 0;
+  if (tx_buffer_.empty()) {
     return;
   }
   doWrite();
-}
\ No newline at end of file
+}
@@ -1,21 +1,42 @@
 #ifndef SERIAL_DATA_MANAGER_H_
 #define SERIAL_DATA_MANAGER_H_
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include <boost/asio.hpp>
 
 #include "rtc/data_manager.h"
 #include "rtc_base/critical_section.h"
+#include "ring_buffer.h"
 #include "serial_data_channel.h"
+#include "serial_framer.h"
 
 class SerialDataChannel;
 
+// シリアルポートと DataChannel の間でデータを中継するクラス。
+//
+// 読み書きはどちらも固定長のリングバッファを通して io_context のスレッドで行う。
+// DataChannel の送信バッファが溜まっている間はシリアルからの取り出しを止めて、
+// リングバッファが一杯になったら読み込みも止める。
 class SerialDataManager : public RTCDataManager {
  public:
+  // framing は newline, length, cobs, raw のどれか。
+  // idle_gap_ms は raw の時にメッセージを区切る無通信時間
   static std::unique_ptr<SerialDataManager> Create(boost::asio::io_context& ioc,
-                                   std::string device,
-                                   unsigned int rate) {
-    std::unique_ptr<SerialDataManager> data_manager(new SerialDataManager(ioc));
+                                                   std::string device,
+                                                   unsigned int rate,
+                                                   std::string framing,
+                                                   int idle_gap_ms) {
+    std::unique_ptr<SerialFramer> framer =
+        SerialFramer::Create(framing, kMaxFrameSize);
+    if (!framer) {
+      return nullptr;
+    }
+    std::unique_ptr<SerialDataManager> data_manager(
+        new SerialDataManager(ioc, std::move(framer), idle_gap_ms));
     if (!data_manager->Connect(device, rate)) {
       return nullptr;
     }
@@ -28,29 +49,51 @@ class SerialDataManager : public RTCDataManager {
   void OnDataChannel(
       rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) override;
   void OnClosed(SerialDataChannel* serial_data_channel);
+  // DataChannel の送信バッファが減った時に呼ばれる。どのスレッドからでもいい
+  void OnBufferedAmountDecreased();
 
  private:
-  SerialDataManager(boost::asio::io_context& ioc);
+  // DataChannel の 1 メッセージの最大サイズ
+  static const size_t kMaxFrameSize = 64 * 1024;
+  // 3 Mbaud で 0.5 秒程度溜められる大きさ
+  static const size_t kRingBufferSize = 256 * 1024;
+  // DataChannel の送信バッファがこれを超えたらシリアルからの取り出しを止める
+  static const uint64_t kHighWatermark = 1024 * 1024;
+
+  SerialDataManager(boost::asio::io_context& ioc,
+                    std::unique_ptr<SerialFramer> framer,
+                    int idle_gap_ms);
   bool Connect(std::string device, unsigned int rate);
   void doCloseSerial();
   void doRead();
   void onRead(const boost::system::error_code& error, size_t bytes_transferred);
-  void sendLineFromSerial();
+  void sendFramesFromSerial(bool flush);
+  void onIdle(const boost::system::error_code& error);
+  void onResume();
   void startWrite(std::vector<uint8_t> v);
   void doWrite();
   void onWrite(const boost::system::error_code& error);
 
   boost::asio::serial_port serial_port_;
+  boost::asio::deadline_timer idle_timer_;
   std::function<void(std::function<void()>)> post_;
   rtc::CriticalSection channels_lock_;
   std::vector<SerialDataChannel*> serial_data_channels_;
 
-  std::unique_ptr<uint8_t[]> read_buffer_;
-  size_t read_buffer_size_;
-  std::vector<uint8_t> read_line_buffer_;
+  std::unique_ptr<SerialFramer> framer_;
+  const int idle_gap_ms_;
 
-  std::vector<uint8_t> write_buffer_;
+  // 以下は io_context のスレッドからしか触らない
+  SerialRingBuffer rx_buffer_;
+  bool reading_;
+  bool idle_timer_running_;
+  SerialRingBuffer tx_buffer_;
   size_t write_length_;
+  uint64_t tx_dropped_;
+
+  // DataChannel の送信バッファが溜まっていて取り出しを止めている
+  std::atomic<bool> paused_;
+  std::atomic<bool> resume_posted_;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,243 @@
+#include "serial_framer.h"
+
+#include <algorithm>
+
+namespace {
+
+class NewlineFramer : public SerialFramer {
+ public:
+  explicit NewlineFramer(size_t max_frame_size)
+      : SerialFramer(max_frame_size), scanned_(0) {}
+
+  void Decode(SerialRingBuffer* rx, const FrameHandler& on_frame) override {
+    for (;;) {
+      // 前回見た所から探すので、改行が来るまで何度呼ばれても O(n) で済む
+      size_t pos = rx->Find('\n', scanned_);
+      if (pos == rx->size()) {
+        scanned_ = pos;
+        // 改行が来ないまま長くなった行は、そこまでで 1 メッセージにする
+        if (pos >= max_frame_size_) {
+          if (!on_frame(Contiguous(rx, 0, max_frame_size_), max_frame_size_)) {
+            return;
+          }
+          rx->Consume(max_frame_size_);
+          scanned_ = 0;
+          continue;
+        }
+        return;
+      }
+      scanned_ = pos;
+      if (!on_frame(Contiguous(rx, 0, pos), pos)) {
+        return;
+      }
+      rx->Consume(pos + 1);
+      scanned_ = 0;
+    }
+  }
+
+  bool Encode(const uint8_t* data,
+              size_t length,
+              SerialRingBuffer* tx) override {
+    if (tx->space() < length) {
+      return false;
+    }
+    tx->Write(data, length);
+    return true;
+  }
+
+ private:
+  size_t scanned_;
+};
+
+class LengthPrefixedFramer : public SerialFramer {
+ public:
+  static const size_t kHeaderSize = 2;
+
+  explicit LengthPrefixedFramer(size_t max_frame_size)
+      : SerialFramer(std::min<size_t>(max_frame_size, 0xffff)) {}
+
+  void Decode(SerialRingBuffer* rx, const FrameHandler& on_frame) override {
+    while (rx->size() >= kHeaderSize) {
+      size_t length = (rx->At(0) << 8) | rx->At(1);
+      if (length > max_frame_size_) {
+        // 長さがおかしい時は 1 バイトずらして同期を取り直す
+        rx->Consume(1);
+        continue;
+      }
+      if (rx->size() < kHeaderSize + length) {
+        return;
+      }
+      if (!on_frame(Contiguous(rx, kHeaderSize, length), length)) {
+        return;
+      }
+      rx->Consume(kHeaderSize + length);
+    }
+  }
+
+  bool Encode(const uint8_t* data,
+              size_t length,
+              SerialRingBuffer* tx) override {
+    if (length > max_frame_size_ || tx->space() < kHeaderSize + length) {
+      return false;
+    }
+    uint8_t header[kHeaderSize] = {static_cast<uint8_t>(length >> 8),
+                                   static_cast<uint8_t>(length & 0xff)};
+    tx->Write(header, kHeaderSize);
+    tx->Write(data, length);
+    return true;
+  }
+};
+
+// Consistent Overhead Byte Stuffing
+// 0x00 を含まないようにエンコードして、0x00 をメッセージの区切りに使う
+class CobsFramer : public SerialFramer {
+ public:
+  explicit CobsFramer(size_t max_frame_size)
+      : SerialFramer(max_frame_size), scanned_(0) {}
+
+  void Decode(SerialRingBuffer* rx, const FrameHandler& on_frame) override {
+    for (;;) {
+      size_t pos = rx->Find(0, scanned_);
+      if (pos == rx->size()) {
+        scanned_ = pos;
+        // 区切りが来ないまま長くなったものは壊れているので捨てる
+        if (pos > MaxEncodedSize(max_frame_size_)) {
+          rx->Consume(pos);
+          scanned_ = 0;
+        }
+        return;
+      }
+      scanned_ = pos;
+      if (pos > 0 && Unstuff(Contiguous(rx, 0, pos), pos)) {
+        if (!on_frame(decoded_.data(), decoded_.size())) {
+          return;
+        }
+      }
+      rx->Consume(pos + 1);
+      scanned_ = 0;
+    }
+  }
+
+  bool Encode(const uint8_t* data,
+              size_t length,
+              SerialRingBuffer* tx) override {
+    if (length > max_frame_size_ || tx->space() < MaxEncodedSize(length)) {
+      return false;
+    }
+    encoded_.clear();
+    size_t code_pos = 0;
+    encoded_.push_back(0);
+    uint8_t code = 1;
+    for (size_t i = 0; i < length; i++) {
+      if (data[i] != 0) {
+        encoded_.push_back(data[i]);
+        code++;
+      }
+      if (data[i] == 0 || code == 0xff) {
+        encoded_[code_pos] = code;
+        code_pos = encoded_.size();
+        encoded_.push_back(0);
+        code = 1;
+      }
+    }
+    encoded_[code_pos] = code;
+    encoded_.push_back(0);
+    tx->Write(encoded_.data(), encoded_.size());
+    return true;
+  }
+
+ private:
+  // 254 バイト毎に 1 バイト増えて、先頭のコードと区切りで 2 バイト増える
+  static size_t MaxEncodedSize(size_t length) {
+    return length + length / 254 + 2;
+  }
+
+  bool Unstuff(const uint8_t* data, size_t length) {
+    decoded_.clear();
+    size_t i = 0;
+    while (i < length) {
+      uint8_t code = data[i++];
+      if (code == 0 || i + code - 1 > length) {
+        return false;
+      }
+      decoded_.insert(decoded_.end(), data + i, data + i + code - 1);
+      i += code - 1;
+      if (code != 0xff && i < length) {
+        decoded_.push_back(0);
+      }
+    }
+    return true;
+  }
+
+  size_t scanned_;
+  std::vector<uint8_t> decoded_;
+  std::vector<uint8_t> encoded_;
+};
+
+class RawFramer : public SerialFramer {
+ public:
+  explicit RawFramer(size_t max_frame_size) : SerialFramer(max_frame_size) {}
+
+  void Decode(SerialRingBuffer* rx, const FrameHandler& on_frame) override {
+    // 途切れるのを待たずに、溜まった分は最大サイズ毎に送る
+    while (rx->size() >= max_frame_size_) {
+      if (!on_frame(Contiguous(rx, 0, max_frame_size_), max_frame_size_)) {
+        return;
+      }
+      rx->Consume(max_frame_size_);
+    }
+  }
+
+  void Flush(SerialRingBuffer* rx, const FrameHandler& on_frame) override {
+    Decode(rx, on_frame);
+    size_t length = std::min(rx->size(), max_frame_size_);
+    if (length > 0 && rx->size() < max_frame_size_ &&
+        on_frame(Contiguous(rx, 0, length), length)) {
+      rx->Consume(length);
+    }
+  }
+
+  bool NeedsIdleFlush() const override { return true; }
+
+  bool Encode(const uint8_t* data,
+              size_t length,
+              SerialRingBuffer* tx) override {
+    if (tx->space() < length) {
+      return false;
+    }
+    tx->Write(data, length);
+    return true;
+  }
+};
+
+}  // namespace
+
+std::unique_ptr<SerialFramer> SerialFramer::Create(const std::string& name,
+                                                   size_t max_frame_size) {
+  if (name == "newline") {
+    return std::unique_ptr<SerialFramer>(new NewlineFramer(max_frame_size));
+  }
+  if (name == "length") {
+    return std::unique_ptr<SerialFramer>(
+        new LengthPrefixedFramer(max_frame_size));
+  }
+  if (name == "cobs") {
+    return std::unique_ptr<SerialFramer>(new CobsFramer(max_frame_size));
+  }
+  if (name == "raw") {
+    return std::unique_ptr<SerialFramer>(new RawFramer(max_frame_size));
+  }
+  return nullptr;
+}
+
+const uint8_t* SerialFramer::Contiguous(const SerialRingBuffer* rx,
+                                        size_t offset,
+                                        size_t length) {
+  const uint8_t* data = rx->Data(offset, length);
+  if (data != nullptr) {
+    return data;
+  }
+  frame_.resize(length);
+  rx->Peek(offset, frame_.data(), length);
+  return frame_.data();
+}
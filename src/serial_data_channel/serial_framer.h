@@ -0,0 +1,55 @@
+#ifndef SERIAL_FRAMER_H_
+#define SERIAL_FRAMER_H_
+
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ring_buffer.h"
+
+// シリアルのバイト列と DataChannel のメッセージの境界を決めるクラス。
+//
+// - newline: 改行までを 1 メッセージにする (改行は含めない)。送信はそのまま書く
+// - length: 2 バイトのビッグエンディアンの長さの後にデータが続く
+// - cobs: COBS でエンコードして 0x00 で区切る
+// - raw: 区切りは無く、一定時間データが来なかったらそこまでを 1 メッセージにする
+class SerialFramer {
+ public:
+  // false を返すと取り出すのを止める
+  typedef std::function<bool(const uint8_t* data, size_t length)> FrameHandler;
+
+  // 対応していない名前の場合は nullptr
+  static std::unique_ptr<SerialFramer> Create(const std::string& name,
+                                              size_t max_frame_size);
+  virtual ~SerialFramer() {}
+
+  // rx から取り出せるだけメッセージを取り出して on_frame に渡す。
+  // on_frame が false を返したらそこで止めて、残りは rx に残す
+  virtual void Decode(SerialRingBuffer* rx, const FrameHandler& on_frame) = 0;
+  // データが途切れた時に呼ばれる。raw 以外は何もしない
+  virtual void Flush(SerialRingBuffer* rx, const FrameHandler& on_frame) {}
+  // データが途切れるのを待つ必要があるか
+  virtual bool NeedsIdleFlush() const { return false; }
+  // 1 メッセージを tx に書き込む。入りきらない時は何も書かずに false を返す
+  virtual bool Encode(const uint8_t* data,
+                      size_t length,
+                      SerialRingBuffer* tx) = 0;
+
+ protected:
+  explicit SerialFramer(size_t max_frame_size)
+      : max_frame_size_(max_frame_size) {}
+
+  // rx の offset から length バイトを連続した領域にして返す。
+  // 折り返している時だけ frame_ にコピーする
+  const uint8_t* Contiguous(const SerialRingBuffer* rx,
+                            size_t offset,
+                            size_t length);
+
+  const size_t max_frame_size_;
+  std::vector<uint8_t> frame_;
+};
+
+#endif  // SERIAL_FRAMER_H_
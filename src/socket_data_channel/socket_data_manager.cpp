@@ -0,0 +1,599 @@
+#include "socket_data_manager.h"
+
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+#include "metrics/metrics_collector.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+#include "util.h"
+
+namespace {
+
+// UDP の最大ペイロード
+const size_t kMaxDatagramSize = 65507;
+// seq を指定した時のヘッダ。4 バイトの通し番号と 8 バイトの送信時刻
+const size_t kSeqSize = 4;
+const size_t kHeaderSize = kSeqSize + 8;
+// 受信遅延のヒストグラムのバケツの上限 (秒)。Prometheus の le に使う
+const double kLatencyBuckets[] = {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+                                  0.1,   0.25,   0.5,   1.0,  2.5};
+const size_t kNumLatencyBuckets =
+    sizeof(kLatencyBuckets) / sizeof(kLatencyBuckets[0]);
+// 信頼性の無いチャネルで、DataChannel の送信バッファがこれを超えていたら
+// 古いデータを溜めても意味が無いので捨てる
+const uint64_t kMaxUnreliableBufferedAmount = 64 * 1024;
+
+void WriteBE(uint8_t* out, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    out[i] = static_cast<uint8_t>(value >> (8 * (bytes - 1 - i)));
+  }
+}
+
+uint64_t ReadBE(const uint8_t* data, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; i++) {
+    value = (value << 8) | data[i];
+  }
+  return value;
+}
+
+bool ParseHostPort(const std::string& text, std::string* host, int* port) {
+  size_t colon = text.rfind(':');
+  if (colon == std::string::npos) {
+    return false;
+  }
+  *host = text.substr(0, colon);
+  boost::system::error_code ec;
+  boost::asio::ip::make_address(*host, ec);
+  return !ec && Util::parseInt(text.substr(colon + 1), 1, 65535, port);
+}
+
+}  // namespace
+
+// 1 つの名前の DataChannel と 1 つのソケットを繋ぐ。
+// 複数の接続で同じ名前の DataChannel がある時は全てに送る。
+class SocketDataManager::Bridge {
+ public:
+  struct Stats {
+    uint64_t to_remote_messages = 0;
+    uint64_t to_remote_bytes = 0;
+    uint64_t to_remote_dropped = 0;
+    uint64_t from_remote_messages = 0;
+    uint64_t from_remote_bytes = 0;
+    uint64_t from_remote_dropped = 0;
+    uint64_t lost = 0;
+    double forward_seconds = 0;
+    // 受信遅延のヒストグラム。バケツ毎の数で、最後は上限を超えたもの
+    uint64_t latency_buckets[kNumLatencyBuckets + 1] = {};
+    uint64_t latency_count = 0;
+    double latency_seconds = 0;
+  };
+
+  Bridge(boost::asio::io_context& ioc, const ChannelConfig& config)
+      : config_(config),
+        socket_(ioc),
+        has_peer_(false),
+        header_size_(config.seq ? kHeaderSize : 0),
+        tx_seq_(0) {}
+
+  ~Bridge() {
+    boost::system::error_code ec;
+    socket_.close(ec);
+    if (config_.unix_socket) {
+      unlink(config_.path.c_str());
+    }
+    rtc::CritScope lock(&channels_lock_);
+    channels_.clear();
+  }
+
+  const ChannelConfig& config() const { return config_; }
+
+  bool Open(std::string* error) {
+    namespace generic = boost::asio::generic;
+    generic::datagram_protocol::endpoint endpoint;
+    if (config_.unix_socket) {
+      // 前回のプロセスが残したソケットファイルがあると bind できない
+      unlink(config_.path.c_str());
+      endpoint = boost::asio::local::datagram_protocol::endpoint(config_.path);
+      if (!config_.peer_path.empty()) {
+        peer_ = boost::asio::local::datagram_protocol::endpoint(
+            config_.peer_path);
+        has_peer_ = true;
+      }
+    } else {
+      endpoint = boost::asio::ip::udp::endpoint(
+          boost::asio::ip::address_v4::loopback(), config_.port);
+      if (config_.peer_port != 0) {
+        peer_ = boost::asio::ip::udp::endpoint(
+            boost::asio::ip::make_address(config_.peer_host),
+            config_.peer_port);
+        has_peer_ = true;
+      }
+    }
+
+    boost::system::error_code ec;
+    socket_.open(endpoint.protocol(), ec);
+    if (!ec) {
+      socket_.bind(endpoint, ec);
+    }
+    if (ec) {
+      *error = "failed to bind " + config_.label + ": " + ec.message();
+      return false;
+    }
+    doReceive();
+    return true;
+  }
+
+  void AddChannel(rtc::scoped_refptr<webrtc::DataChannelInterface> channel) {
+    RTC_LOG(LS_INFO) << "Bridging data channel " << channel->label()
+                     << " (ordered=" << channel->ordered()
+                     << ", max_retransmits=" << channel->maxRetransmits()
+                     << ")";
+    rtc::CritScope lock(&channels_lock_);
+    channels_.push_back(std::unique_ptr<Channel>(new Channel(this, channel)));
+  }
+
+  Stats GetStats() {
+    Stats stats;
+    stats.to_remote_messages = to_remote_messages_.load();
+    stats.to_remote_bytes = to_remote_bytes_.load();
+    stats.to_remote_dropped = to_remote_dropped_.load();
+    stats.from_remote_messages = from_remote_messages_.load();
+    stats.from_remote_bytes = from_remote_bytes_.load();
+    stats.from_remote_dropped = from_remote_dropped_.load();
+    stats.lost = lost_.load();
+    stats.forward_seconds = forward_us_.load() / 1e6;
+    for (size_t i = 0; i <= kNumLatencyBuckets; i++) {
+      stats.latency_buckets[i] = latency_buckets_[i].load();
+      stats.latency_count += stats.latency_buckets[i];
+    }
+    stats.latency_seconds = latency_us_.load() / 1e6;
+    return stats;
+  }
+
+ private:
+  class Channel : public webrtc::DataChannelObserver {
+   public:
+    Channel(Bridge* bridge,
+            rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel)
+        : bridge_(bridge),
+          data_channel_(data_channel),
+          has_seq_(false),
+          expected_seq_(0) {
+      data_channel_->RegisterObserver(this);
+    }
+    ~Channel() { data_channel_->UnregisterObserver(); }
+
+    rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel() const {
+      return data_channel_;
+    }
+
+    void OnStateChange() override {
+      if (data_channel_->state() == webrtc::DataChannelInterface::kClosed) {
+        bridge_->RemoveChannel(this);
+      }
+    }
+    void OnMessage(const webrtc::DataBuffer& buffer) override {
+      bridge_->OnChannelMessage(this, buffer);
+    }
+    void OnBufferedAmountChange(uint64_t previous_amount) override {}
+
+    // 通し番号を見て、欠けた数を返す。遅れて届いたものは数えない
+    uint64_t CheckSeq(uint32_t seq) {
+      uint64_t lost = 0;
+      if (has_seq_ && static_cast<int32_t>(seq - expected_seq_) < 0) {
+        return 0;
+      }
+      if (has_seq_) {
+        lost = seq - expected_seq_;
+      }
+      has_seq_ = true;
+      expected_seq_ = seq + 1;
+      return lost;
+    }
+
+   private:
+    Bridge* bridge_;
+    rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel_;
+    // OnMessage はシグナリングスレッドからしか呼ばれない
+    bool has_seq_;
+    uint32_t expected_seq_;
+  };
+
+  void RemoveChannel(Channel* channel) {
+    rtc::CritScope lock(&channels_lock_);
+    for (auto it = channels_.begin(); it != channels_.end(); ++it) {
+      if (it->get() == channel) {
+        channels_.erase(it);
+        return;
+      }
+    }
+  }
+
+  void doReceive() {
+    // 送信用のバッファに直接受け取る。libwebrtc がバッファを持ったままでなければ
+    // 確保し直しは起きない
+    send_buffer_.SetSize(header_size_ + kMaxDatagramSize);
+    socket_.async_receive_from(
+        boost::asio::buffer(send_buffer_.data() + header_size_,
+                            kMaxDatagramSize),
+        sender_,
+        [this](const boost::system::error_code& error, size_t length) {
+          onReceive(error, length);
+        });
+  }
+
+  void onReceive(const boost::system::error_code& error, size_t length) {
+    if (error == boost::asio::error::operation_aborted) {
+      return;
+    }
+    if (error) {
+      RTC_LOG(LS_WARNING) << __FUNCTION__ << ": " << config_.label << ": "
+                          << error.message();
+      doReceive();
+      return;
+    }
+    int64_t received_us = rtc::TimeMicros();
+
+    if (!config_.peer_port && config_.peer_path.empty()) {
+      // 送り先の指定が無ければ、最後に送ってきた相手に返す
+      rtc::CritScope lock(&peer_lock_);
+      peer_ = sender_;
+      has_peer_ = true;
+    }
+
+    if (config_.seq) {
+      uint8_t* header = send_buffer_.data();
+      WriteBE(header, tx_seq_, kSeqSize);
+      WriteBE(header + kSeqSize, rtc::TimeUTCMicros(), kHeaderSize - kSeqSize);
+      tx_seq_++;
+    }
+    send_buffer_.SetSize(header_size_ + length);
+
+    // Send はシグナリングスレッドを待つので、ロックを持ったまま呼ばない
+    targets_.clear();
+    {
+      rtc::CritScope lock(&channels_lock_);
+      for (const auto& channel : channels_) {
+        targets_.push_back(channel->data_channel());
+      }
+    }
+    bool reliable = config_.max_retransmits < 0 &&
+                    config_.max_packet_life_time < 0;
+    webrtc::DataBuffer data_buffer(send_buffer_, true);
+    for (const auto& target : targets_) {
+      if (target->state() != webrtc::DataChannelInterface::kOpen ||
+          (!reliable &&
+           target->buffered_amount() > kMaxUnreliableBufferedAmount) ||
+          !target->Send(data_buffer)) {
+        to_remote_dropped_++;
+        continue;
+      }
+      to_remote_messages_++;
+      to_remote_bytes_ += length;
+    }
+    targets_.clear();
+    forward_us_ += rtc::TimeMicros() - received_us;
+    doReceive();
+  }
+
+  void OnChannelMessage(Channel* channel, const webrtc::DataBuffer& buffer) {
+    const uint8_t* data = buffer.data.cdata();
+    size_t length = buffer.data.size();
+    if (config_.seq) {
+      if (length < kHeaderSize) {
+        from_remote_dropped_++;
+        return;
+      }
+      uint32_t seq = static_cast<uint32_t>(ReadBE(data, kSeqSize));
+      lost_ += channel->CheckSeq(seq);
+      int64_t sent_us =
+          static_cast<int64_t>(ReadBE(data + kSeqSize, kHeaderSize - kSeqSize));
+      AddLatency(rtc::TimeUTCMicros() - sent_us);
+      data += kHeaderSize;
+      length -= kHeaderSize;
+    }
+
+    // 受信側の async_receive_from と並行して送れるように、ソケットに直接書く
+    ssize_t sent;
+    {
+      rtc::CritScope lock(&peer_lock_);
+      if (!has_peer_) {
+        from_remote_dropped_++;
+        return;
+      }
+      sent = ::sendto(socket_.native_handle(), data, length, MSG_DONTWAIT,
+                      peer_.data(), peer_.size());
+    }
+    if (sent < 0) {
+      from_remote_dropped_++;
+      return;
+    }
+    from_remote_messages_++;
+    from_remote_bytes_ += length;
+  }
+
+  void AddLatency(int64_t latency_us) {
+    // 時計のずれで負になったものは 0 とみなす
+    latency_us = std::max<int64_t>(latency_us, 0);
+    double latency = latency_us / 1e6;
+    size_t index = 0;
+    while (index < kNumLatencyBuckets && latency > kLatencyBuckets[index]) {
+      index++;
+    }
+    latency_buckets_[index]++;
+    latency_us_ += latency_us;
+  }
+
+  const ChannelConfig config_;
+  boost::asio::generic::datagram_protocol::socket socket_;
+  boost::asio::generic::datagram_protocol::endpoint sender_;
+  rtc::CriticalSection peer_lock_;
+  boost::asio::generic::datagram_protocol::endpoint peer_
+      RTC_GUARDED_BY(peer_lock_);
+  bool has_peer_ RTC_GUARDED_BY(peer_lock_);
+
+  // 以下は io_context のスレッドからしか触らない
+  const size_t header_size_;
+  rtc::CopyOnWriteBuffer send_buffer_;
+  uint32_t tx_seq_;
+  std::vector<rtc::scoped_refptr<webrtc::DataChannelInterface>> targets_;
+
+  rtc::CriticalSection channels_lock_;
+  std::vector<std::unique_ptr<Channel>> channels_ RTC_GUARDED_BY(
+      channels_lock_);
+
+  std::atomic<uint64_t> to_remote_messages_{0};
+  std::atomic<uint64_t> to_remote_bytes_{0};
+  std::atomic<uint64_t> to_remote_dropped_{0};
+  std::atomic<uint64_t> from_remote_messages_{0};
+  std::atomic<uint64_t> from_remote_bytes_{0};
+  std::atomic<uint64_t> from_remote_dropped_{0};
+  std::atomic<uint64_t> lost_{0};
+  std::atomic<int64_t> forward_us_{0};
+  std::atomic<uint64_t> latency_buckets_[kNumLatencyBuckets + 1] = {};
+  std::atomic<int64_t> latency_us_{0};
+};
+
+bool SocketDataManager::ParseConfig(const std::string& spec,
+                                    ChannelConfig* config,
+                                    std::string* error) {
+  *config = ChannelConfig();
+  size_t eq = spec.find('=');
+  if (eq == std::string::npos || eq == 0) {
+    *error = "invalid data channel bridge: " + spec;
+    return false;
+  }
+  config->label = spec.substr(0, eq);
+
+  std::vector<std::string> items;
+  size_t begin = eq + 1;
+  for (;;) {
+    size_t comma = spec.find(',', begin);
+    items.push_back(spec.substr(begin, comma - begin));
+    if (comma == std::string::npos) {
+      break;
+    }
+    begin = comma + 1;
+  }
+
+  const std::string& address = items[0];
+  if (address.compare(0, 4, "udp:") == 0) {
+    if (!Util::parseInt(address.substr(4), 1, 65535, &config->port)) {
+      *error = "invalid UDP port for " + config->label + ": " + address;
+      return false;
+    }
+  } else if (address.compare(0, 5, "unix:") == 0 && address.size() > 5) {
+    config->unix_socket = true;
+    config->path = address.substr(5);
+  } else {
+    *error = "invalid socket for " + config->label + ": " + address;
+    return false;
+  }
+
+  for (size_t i = 1; i < items.size(); i++) {
+    const std::string& item = items[i];
+    size_t item_eq = item.find('=');
+    std::string key = item.substr(0, item_eq);
+    std::string value =
+        item_eq == std::string::npos ? "" : item.substr(item_eq + 1);
+    bool ok = true;
+    if (key == "peer") {
+      if (config->unix_socket) {
+        config->peer_path = value;
+        ok = !value.empty();
+      } else {
+        ok = ParseHostPort(value, &config->peer_host, &config->peer_port);
+      }
+    } else if (key == "unordered") {
+      config->ordered = false;
+      config->create = true;
+    } else if (key == "max-retransmits") {
+      ok = Util::parseInt(value, 0, 65535, &config->max_retransmits);
+      config->create = true;
+    } else if (key == "max-packet-life-time") {
+      ok = Util::parseInt(value, 0, 65535, &config->max_packet_life_time);
+      config->create = true;
+    } else if (key == "unreliable") {
+      config->ordered = false;
+      config->max_retransmits = 0;
+      config->create = true;
+    } else if (key == "seq") {
+      config->seq = true;
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      *error = "invalid option for " + config->label + ": " + item;
+      return false;
+    }
+  }
+  if (config->max_retransmits >= 0 && config->max_packet_life_time >= 0) {
+    *error = "max-retransmits and max-packet-life-time are exclusive: " +
+             config->label;
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<SocketDataManager> SocketDataManager::Create(
+    boost::asio::io_context& ioc,
+    const std::vector<std::string>& specs) {
+  std::unique_ptr<SocketDataManager> data_manager(new SocketDataManager());
+  for (const std::string& spec : specs) {
+    ChannelConfig config;
+    std::string error;
+    if (!ParseConfig(spec, &config, &error)) {
+      std::cerr << error << std::endl;
+      return nullptr;
+    }
+    for (const auto& bridge : data_manager->bridges_) {
+      if (bridge->config().label == config.label) {
+        std::cerr << "duplicated data channel bridge: " << config.label
+                  << std::endl;
+        return nullptr;
+      }
+    }
+    std::unique_ptr<Bridge> bridge(new Bridge(ioc, config));
+    if (!bridge->Open(&error)) {
+      std::cerr << error << std::endl;
+      return nullptr;
+    }
+    data_manager->bridges_.push_back(std::move(bridge));
+  }
+  return data_manager;
+}
+
+SocketDataManager::~SocketDataManager() {}
+
+void SocketDataManager::OnDataChannel(
+    rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) {
+  for (const auto& bridge : bridges_) {
+    if (bridge->config().label == data_channel->label()) {
+      bridge->AddChannel(data_channel);
+      return;
+    }
+  }
+}
+
+void SocketDataManager::OnConnectionCreated(
+    rtc::scoped_refptr<webrtc::PeerConnectionInterface> connection) {
+  for (const auto& bridge : bridges_) {
+    const ChannelConfig& config = bridge->config();
+    if (!config.create) {
+      continue;
+    }
+    webrtc::DataChannelInit init;
+    init.ordered = config.ordered;
+    if (config.max_retransmits >= 0) {
+      init.maxRetransmits = config.max_retransmits;
+    }
+    if (config.max_packet_life_time >= 0) {
+      init.maxRetransmitTime = config.max_packet_life_time;
+    }
+    rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel =
+        connection->CreateDataChannel(config.label, &init);
+    if (!data_channel) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__ << ": Failed to create data channel "
+                        << config.label;
+      continue;
+    }
+    bridge->AddChannel(data_channel);
+  }
+}
+
+bool SocketDataManager::IsTargetDataChannel(const std::string& label) {
+  for (const auto& bridge : bridges_) {
+    if (bridge->config().label == label) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void SocketDataManager::AppendMetrics(std::string* out) {
+  std::vector<std::pair<std::string, Bridge::Stats>> stats;
+  for (const auto& bridge : bridges_) {
+    stats.push_back(std::make_pair("label=\"" + bridge->config().label + "\"",
+                                   bridge->GetStats()));
+  }
+
+  MetricsCollector::AppendHeader(out, "momo_datachannel_messages_total",
+                                 "counter", "Messages forwarded");
+  for (const auto& s : stats) {
+    MetricsCollector::AppendSample(out, "momo_datachannel_messages_total",
+                                   s.first + ",direction=\"to_remote\"",
+                                   s.second.to_remote_messages);
+    MetricsCollector::AppendSample(out, "momo_datachannel_messages_total",
+                                   s.first + ",direction=\"from_remote\"",
+                                   s.second.from_remote_messages);
+  }
+  MetricsCollector::AppendHeader(out, "momo_datachannel_bytes_total",
+                                 "counter", "Payload bytes forwarded");
+  for (const auto& s : stats) {
+    MetricsCollector::AppendSample(out, "momo_datachannel_bytes_total",
+                                   s.first + ",direction=\"to_remote\"",
+                                   s.second.to_remote_bytes);
+    MetricsCollector::AppendSample(out, "momo_datachannel_bytes_total",
+                                   s.first + ",direction=\"from_remote\"",
+                                   s.second.from_remote_bytes);
+  }
+  MetricsCollector::AppendHeader(
+      out, "momo_datachannel_dropped_total", "counter",
+      "Messages dropped by the bridge (channel not open, congested or "
+      "socket error)");
+  for (const auto& s : stats) {
+    MetricsCollector::AppendSample(out, "momo_datachannel_dropped_total",
+                                   s.first + ",direction=\"to_remote\"",
+                                   s.second.to_remote_dropped);
+    MetricsCollector::AppendSample(out, "momo_datachannel_dropped_total",
+                                   s.first + ",direction=\"from_remote\"",
+                                   s.second.from_remote_dropped);
+  }
+  MetricsCollector::AppendHeader(
+      out, "momo_datachannel_lost_total", "counter",
+      "Messages from the remote missing in the sequence (seq option only)");
+  for (const auto& s : stats) {
+    MetricsCollector::AppendSample(out, "momo_datachannel_lost_total",
+                                   s.first, s.second.lost);
+  }
+  MetricsCollector::AppendHeader(
+      out, "momo_datachannel_forward_seconds_total", "counter",
+      "Time from receiving a datagram to handing it to the data channel");
+  for (const auto& s : stats) {
+    MetricsCollector::AppendSample(out,
+                                   "momo_datachannel_forward_seconds_total",
+                                   s.first, s.second.forward_seconds);
+  }
+  MetricsCollector::AppendHeader(
+      out, "momo_datachannel_receive_latency_seconds", "histogram",
+      "Time from the remote bridge receiving a datagram to this bridge "
+      "receiving the message (seq option only, needs synchronized clocks)");
+  for (const auto& s : stats) {
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i <= kNumLatencyBuckets; i++) {
+      cumulative += s.second.latency_buckets[i];
+      char le[32];
+      if (i < kNumLatencyBuckets) {
+        snprintf(le, sizeof(le), "%g", kLatencyBuckets[i]);
+      } else {
+        snprintf(le, sizeof(le), "+Inf");
+      }
+      MetricsCollector::AppendSample(
+          out, "momo_datachannel_receive_latency_seconds_bucket",
+          s.first + ",le=\"" + le + "\"", cumulative);
+    }
+    MetricsCollector::AppendSample(
+        out, "momo_datachannel_receive_latency_seconds_sum", s.first,
+        s.second.latency_seconds);
+    MetricsCollector::AppendSample(
+        out, "momo_datachannel_receive_latency_seconds_count", s.first,
+        s.second.latency_count);
+  }
+}
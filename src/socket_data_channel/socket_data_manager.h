@@ -0,0 +1,85 @@
+#ifndef SOCKET_DATA_MANAGER_H_
+#define SOCKET_DATA_MANAGER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "api/data_channel_interface.h"
+#include "rtc/data_manager.h"
+#include "rtc_base/copy_on_write_buffer.h"
+#include "rtc_base/critical_section.h"
+
+// 名前を付けた DataChannel とローカルの UDP ポートや Unix ドメインの
+// データグラムソケットを繋ぐクラス。
+//
+// 設定は 1 チャネル毎に次の書式で書く。
+//   LABEL=udp:PORT[,OPTION...]
+//   LABEL=unix:PATH[,OPTION...]
+//
+// UDP は 127.0.0.1:PORT で受け取る。DataChannel から届いたメッセージは
+// peer= で指定した宛先か、無ければ最後にデータグラムを送ってきた相手に送る。
+//
+// OPTION:
+//   peer=HOST:PORT | peer=PATH  DataChannel から届いたメッセージの送り先
+//   unordered                   順序を保証しない
+//   max-retransmits=N           再送回数の上限
+//   max-packet-life-time=MS     再送する期間の上限
+//   unreliable                  unordered,max-retransmits=0 と同じ
+//   seq                         メッセージの先頭に 4 バイトの通し番号と
+//                               8 バイトの送信時刻 (UTC のマイクロ秒) を付けて、
+//                               受信側で欠けた数と遅延を数える (両側で指定する)。
+//                               遅延を正しく測るには両側の時計を NTP などで
+//                               合わせておく
+//
+// unordered や max-retransmits などを指定したチャネルは、相手が開くのを待たずに
+// PeerConnection を作った時にこちらから作る。指定が無いチャネルは
+// 相手が同じ名前で開いたものを繋ぐ。
+class SocketDataManager : public RTCDataManager {
+ public:
+  struct ChannelConfig {
+    std::string label;
+    bool unix_socket = false;
+    int port = 0;
+    std::string path;
+    std::string peer_host;
+    int peer_port = 0;
+    std::string peer_path;
+    bool create = false;
+    bool ordered = true;
+    int max_retransmits = -1;
+    int max_packet_life_time = -1;
+    bool seq = false;
+  };
+
+  static bool ParseConfig(const std::string& spec,
+                          ChannelConfig* config,
+                          std::string* error);
+  static std::unique_ptr<SocketDataManager> Create(
+      boost::asio::io_context& ioc,
+      const std::vector<std::string>& specs);
+  ~SocketDataManager();
+
+  void OnDataChannel(
+      rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) override;
+  void OnConnectionCreated(
+      rtc::scoped_refptr<webrtc::PeerConnectionInterface> connection) override;
+  bool IsTargetDataChannel(const std::string& label) override;
+
+  // /metrics にチャネル毎の転送数と欠落数、受信遅延のヒストグラムを書き足す
+  void AppendMetrics(std::string* out);
+
+ private:
+  class Bridge;
+
+  SocketDataManager() {}
+
+  std::vector<std::unique_ptr<Bridge>> bridges_;
+};
+
+#endif
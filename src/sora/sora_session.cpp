@@ -52,6 +52,15 @@ void SoraSession::onRead(boost::system::error_code ec,
           Util::iceConnectionStateToString(ws_client_->getRTCConnectionState());
       json json_message = {{"state", state}};
       sendResponse(createOKwithJson(req_, std::move(json_message)));
+    } else if (req_.target() == "/metrics") {
+      std::shared_ptr<MetricsCollector> collector =
+          rtc_manager_->getMetricsCollector();
+      if (collector) {
+        sendResponse(Util::okText(req_, MetricsCollector::kContentType,
+                                  collector->GetText()));
+      } else {
+        sendResponse(Util::notFound(req_, req_.target()));
+      }
     } else if (req_.target() == "/mute/status") {
       std::shared_ptr<RTCConnection> rtc_conn = ws_client_->getRTCConnection();
       if (rtc_conn) {
@@ -9,12 +9,22 @@
 // json
 #include <nlohmann/json.hpp>
 
+#include "metrics/recovery_stats.h"
+#include "metrics/startup_report.h"
 #include "momo_version.h"
+#include "rtc_base/time_utils.h"
 #include "url_parts.h"
 #include "util.h"
 
 using json = nlohmann::json;
 
+namespace {
+
+// ICE が切れてから自然に戻るのを待つ時間 (秒)。過ぎたら作り直す
+const int kIceRecoveryTimeoutSec = 10;
+
+}  // namespace
+
 bool SoraWebsocketClient::parseURL(URLParts& parts) const {
   std::string url = conn_settings_.sora_signaling_host;
 
@@ -64,12 +74,19 @@ SoraWebsocketClient::SoraWebsocketClient(boost::asio::io_context& ioc,
       manager_(manager),
       retry_count_(0),
       conn_settings_(conn_settings),
-      watchdog_(ioc, std::bind(&SoraWebsocketClient::onWatchdogExpired, this)) {
+      watchdog_(ioc, std::bind(&SoraWebsocketClient::onWatchdogExpired, this)),
+      ice_recovery_watchdog_(
+          ioc,
+          std::bind(&SoraWebsocketClient::onIceRecoveryWatchdogExpired, this)),
+      reconnecting_(false),
+      disconnected_at_ms_(-1) {
   reset();
 }
 
 void SoraWebsocketClient::reset() {
   connection_ = nullptr;
+  prewarmed_connection_ = nullptr;
+  ice_recovery_watchdog_.disable();
   connected_ = false;
 
   if (parseURL(parts_)) {
@@ -94,6 +111,7 @@ void SoraWebsocketClient::reset() {
 
 void SoraWebsocketClient::release() {
   connection_ = nullptr;
+  prewarmed_connection_ = nullptr;
 }
 
 bool SoraWebsocketClient::connect() {
@@ -139,6 +157,37 @@ void SoraWebsocketClient::onWatchdogExpired() {
   connect();
 }
 
+void SoraWebsocketClient::onIceDisconnected() {
+  if (disconnected_at_ms_ < 0) {
+    disconnected_at_ms_ = rtc::TimeMillis();
+  }
+  // ICE が failed になるまで待つと 30 秒以上かかるので、先に見切りをつける
+  ice_recovery_watchdog_.enable(kIceRecoveryTimeoutSec);
+}
+
+void SoraWebsocketClient::onIceRecoveryWatchdogExpired() {
+  RTC_LOG(LS_WARNING) << __FUNCTION__ << ": reconnecting without waiting";
+  reconnecting_ = true;
+  RecoveryStats::CountReconnect();
+  retry_count_ = 0;
+  reset();
+  connect();
+}
+
+void SoraWebsocketClient::onIceRecovered() {
+  ice_recovery_watchdog_.disable();
+  if (disconnected_at_ms_ >= 0) {
+    int64_t duration_ms = rtc::TimeMillis() - disconnected_at_ms_;
+    RTC_LOG(LS_INFO) << __FUNCTION__ << ": recovered in " << duration_ms
+                     << " ms" << (reconnecting_ ? " by reconnecting" : "");
+    RecoveryStats::AddRecovery(reconnecting_ ? RecoveryStats::Kind::kReconnect
+                                             : RecoveryStats::Kind::kSelf,
+                               duration_ms);
+  }
+  disconnected_at_ms_ = -1;
+  reconnecting_ = false;
+}
+
 void SoraWebsocketClient::onResolve(
     boost::system::error_code ec,
     boost::asio::ip::tcp::resolver::results_type results) {
@@ -215,12 +264,18 @@ void SoraWebsocketClient::onHandshake(boost::system::error_code ec) {
   }
 
   connected_ = true;
+  StartupReport::Mark("signaling_connected");
 
   ws_->startToRead(std::bind(&SoraWebsocketClient::onRead, this,
                              std::placeholders::_1, std::placeholders::_2,
                              std::placeholders::_3));
 
   doSendConnect();
+
+  // offer を待っている間に PeerConnection を作っておく
+  if (conn_settings_.prewarm_connection) {
+    prewarmed_connection_ = manager_->createPrewarmedConnection(this);
+  }
 }
 
 void SoraWebsocketClient::doSendConnect() {
@@ -246,7 +301,11 @@ void SoraWebsocketClient::doSendConnect() {
     json_message["metadata"] = conn_settings_.sora_metadata;
   }
 
-  json_message["video"]["codec_type"] = conn_settings_.video_codec;
+  // 省メモリモードでは他のコーデックのエンコーダを作れないので、
+  // 使えるコーデックを要求する
+  json_message["video"]["codec_type"] =
+      conn_settings_.low_footprint ? conn_settings_.low_footprint_video_codec
+                                   : conn_settings_.video_codec;
   if (conn_settings_.video_bitrate != 0) {
     json_message["video"]["bit_rate"] = conn_settings_.video_bitrate;
   }
@@ -281,6 +340,14 @@ void SoraWebsocketClient::createPeerFromConfig(json jconfig) {
     }
   }
 
+  if (prewarmed_connection_ &&
+      prewarmed_connection_->setIceServers(ice_servers)) {
+    manager_->claimPrewarmedConnection(prewarmed_connection_);
+    connection_ = std::move(prewarmed_connection_);
+    return;
+  }
+  prewarmed_connection_ = nullptr;
+
   rtc_config.servers = ice_servers;
 
   connection_ = manager_->createConnection(rtc_config, this);
@@ -406,9 +473,20 @@ void SoraWebsocketClient::doIceConnectionStateChange(
         kIceConnectionConnected:
       retry_count_ = 0;
       watchdog_.enable(60);
+      onIceRecovered();
+      break;
+    case webrtc::PeerConnectionInterface::IceConnectionState::
+        kIceConnectionDisconnected:
+      onIceDisconnected();
       break;
     case webrtc::PeerConnectionInterface::IceConnectionState::
         kIceConnectionFailed:
+      ice_recovery_watchdog_.disable();
+      if (disconnected_at_ms_ < 0) {
+        disconnected_at_ms_ = rtc::TimeMillis();
+      }
+      reconnecting_ = true;
+      RecoveryStats::CountReconnect();
       reconnectAfter();
       break;
     default:
@@ -31,12 +31,20 @@ class SoraWebsocketClient
 
   RTCManager* manager_;
   std::shared_ptr<RTCConnection> connection_;
+  // --prewarm-connection の時に、オファーが来る前に作っておく接続
+  std::shared_ptr<RTCConnection> prewarmed_connection_;
   ConnectionSettings conn_settings_;
 
   int retry_count_;
   webrtc::PeerConnectionInterface::IceConnectionState rtc_state_;
 
   WatchDog watchdog_;
+  // ICE が切れた後、自然に戻るのを待つ時間のタイムアウトに使う
+  WatchDog ice_recovery_watchdog_;
+  // 作り直しで回復しようとしている。reset() では戻さない
+  bool reconnecting_;
+  // ICE が切れた時刻。切れていなければ -1。reset() では戻さない
+  int64_t disconnected_at_ms_;
 
   bool connected_;
   bool answer_sent_ = false;
@@ -69,6 +77,13 @@ class SoraWebsocketClient
   void reconnectAfter();
   void onWatchdogExpired();
 
+ private:
+  // Sora ではクライアントから ICE リスタートを始められないので、
+  // ICE が切れたらしばらく待って、戻らなければすぐに作り直す
+  void onIceDisconnected();
+  void onIceRecoveryWatchdogExpired();
+  void onIceRecovered();
+
  private:
   void onResolve(boost::system::error_code ec,
                  boost::asio::ip::tcp::resolver::results_type results);
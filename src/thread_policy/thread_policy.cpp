@@ -0,0 +1,347 @@
+#include "thread_policy.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fstream>
+#include <sstream>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+
+#include "rtc_base/logging.h"
+#include "rtc_base/platform_thread_types.h"
+#include "util.h"
+
+namespace {
+
+const char* const kRoles[] = {"capture", "encoder",   "decoder", "render",
+                              "network", "worker", "signaling", "ros"};
+
+std::string Trim(const std::string& s) {
+  size_t begin = s.find_first_not_of(" \t\r\n");
+  if (begin == std::string::npos) {
+    return "";
+  }
+  size_t end = s.find_last_not_of(" \t\r\n");
+  return s.substr(begin, end - begin + 1);
+}
+
+#if defined(__linux__)
+std::string CpusToString(const cpu_set_t& set) {
+  std::string result;
+  int start = -1;
+  for (int cpu = 0; cpu <= CPU_SETSIZE; cpu++) {
+    bool on = cpu < CPU_SETSIZE && CPU_ISSET(cpu, &set);
+    if (on && start < 0) {
+      start = cpu;
+    } else if (!on && start >= 0) {
+      if (!result.empty()) {
+        result += "+";
+      }
+      result += std::to_string(start);
+      if (cpu - 1 > start) {
+        result += "-" + std::to_string(cpu - 1);
+      }
+      start = -1;
+    }
+  }
+  return result;
+}
+
+const char* PolicyName(int policy) {
+  switch (policy) {
+    case SCHED_FIFO:
+      return "fifo";
+    case SCHED_RR:
+      return "rr";
+    case SCHED_OTHER:
+      return "other";
+    default:
+      return "unknown";
+  }
+}
+#endif
+
+}  // namespace
+
+std::vector<ThreadPolicy::Rule> ThreadPolicy::rules_;
+bool ThreadPolicy::lock_memory_ = false;
+std::string ThreadPolicy::lock_memory_result_;
+rtc::CriticalSection ThreadPolicy::applied_lock_;
+std::map<int, std::string> ThreadPolicy::applied_;
+
+bool ThreadPolicy::Init(const std::string& spec,
+                        const std::string& file,
+                        bool lock_memory,
+                        std::string* error) {
+  rules_.clear();
+  if (!file.empty()) {
+    std::ifstream ifs(file);
+    if (!ifs) {
+      *error = "failed to open " + file;
+      return false;
+    }
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    if (!ParseSpec(ss.str(), error)) {
+      return false;
+    }
+  }
+  // ファイルとコマンドラインの両方にある場合はコマンドラインを優先する
+  if (!ParseSpec(spec, error)) {
+    return false;
+  }
+
+#if defined(__linux__)
+  lock_memory_ = lock_memory;
+  if (lock_memory) {
+    // ページフォルトでリアルタイムスレッドが止まらないようにする
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+      lock_memory_result_ = "locked";
+    } else {
+      lock_memory_result_ = std::string("failed: ") + strerror(errno);
+    }
+  }
+#else
+  if (!rules_.empty() || lock_memory) {
+    *error = "thread policy is only supported on Linux";
+    return false;
+  }
+#endif
+  return true;
+}
+
+bool ThreadPolicy::ParseSpec(const std::string& spec, std::string* error) {
+  std::string text;
+  for (char c : spec) {
+    text += c == ';' ? '\n' : c;
+  }
+  std::istringstream iss(text);
+  std::string line;
+  while (std::getline(iss, line)) {
+    size_t comment = line.find('#');
+    if (comment != std::string::npos) {
+      line = line.substr(0, comment);
+    }
+    line = Trim(line);
+    if (line.empty()) {
+      continue;
+    }
+    Rule rule;
+    if (!ParseRule(line, &rule, error)) {
+      return false;
+    }
+    // 同じ役割は後から書いたものを使う
+    for (auto it = rules_.begin(); it != rules_.end(); ++it) {
+      if (it->role == rule.role) {
+        rules_.erase(it);
+        break;
+      }
+    }
+    rules_.push_back(rule);
+  }
+  return true;
+}
+
+bool ThreadPolicy::ParseRule(const std::string& text,
+                             Rule* rule,
+                             std::string* error) {
+  size_t colon = text.find(':');
+  rule->role = Trim(text.substr(0, colon));
+  rule->policy = 0;
+  rule->priority = 0;
+  rule->has_nice = false;
+  rule->nice = 0;
+
+  bool valid_role = false;
+  for (const char* role : kRoles) {
+    valid_role |= rule->role == role;
+  }
+  if (!valid_role) {
+    *error = "unknown thread role: " + rule->role;
+    return false;
+  }
+  if (colon == std::string::npos) {
+    return true;
+  }
+
+  std::istringstream iss(text.substr(colon + 1));
+  std::string item;
+  while (std::getline(iss, item, ',')) {
+    item = Trim(item);
+    if (item.empty()) {
+      continue;
+    }
+    size_t eq = item.find('=');
+    std::string key = Trim(item.substr(0, eq));
+    std::string value = eq == std::string::npos ? "" : Trim(item.substr(eq + 1));
+    bool ok = false;
+    if (key == "cpus") {
+      ok = ParseCpus(value, &rule->cpus);
+    } else if (key == "fifo" || key == "rr") {
+#if defined(__linux__)
+      rule->policy = key == "fifo" ? SCHED_FIFO : SCHED_RR;
+#endif
+      ok = Util::parseInt(value, 1, 99, &rule->priority);
+    } else if (key == "nice") {
+      rule->has_nice = true;
+      ok = Util::parseInt(value, -20, 19, &rule->nice);
+    }
+    if (!ok) {
+      *error = "invalid thread policy for " + rule->role + ": " + item;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ThreadPolicy::ParseCpus(const std::string& text, std::vector<int>* cpus) {
+  cpus->clear();
+  std::istringstream iss(text);
+  std::string range;
+  while (std::getline(iss, range, '+')) {
+    size_t dash = range.find('-');
+    int first, last;
+    if (!Util::parseInt(range.substr(0, dash), 0, 1023, &first)) {
+      return false;
+    }
+    last = first;
+    if (dash != std::string::npos &&
+        !Util::parseInt(range.substr(dash + 1), first, 1023, &last)) {
+      return false;
+    }
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus->push_back(cpu);
+    }
+  }
+  return !cpus->empty();
+}
+
+const ThreadPolicy::Rule* ThreadPolicy::FindRule(const std::string& role) {
+  for (const Rule& rule : rules_) {
+    if (rule.role == role) {
+      return &rule;
+    }
+  }
+  return nullptr;
+}
+
+void ThreadPolicy::Apply(const char* role) {
+  int tid = static_cast<int>(rtc::CurrentThreadId());
+  {
+    rtc::CritScope lock(&applied_lock_);
+    applied_[tid] = role;
+  }
+
+#if defined(__linux__)
+  const Rule* rule = FindRule(role);
+  if (rule == nullptr) {
+    return;
+  }
+
+  if (!rule->cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : rule->cpus) {
+      CPU_SET(cpu, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+      RTC_LOG(LS_WARNING) << "Failed to set CPU affinity for " << role << ": "
+                          << strerror(errno);
+    }
+  }
+
+  if (rule->policy == SCHED_FIFO || rule->policy == SCHED_RR) {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = rule->priority;
+    int err = pthread_setschedparam(pthread_self(), rule->policy, &param);
+    if (err != 0) {
+      // 権限が無い時 (CAP_SYS_NICE が無いなど) はここで失敗する
+      RTC_LOG(LS_WARNING) << "Failed to set " << PolicyName(rule->policy)
+                          << " scheduling for " << role << ": "
+                          << strerror(err);
+    }
+  }
+
+  // Linux では nice 値はスレッド毎に設定できる
+  if (rule->has_nice && setpriority(PRIO_PROCESS, tid, rule->nice) != 0) {
+    RTC_LOG(LS_WARNING) << "Failed to set nice " << rule->nice << " for "
+                        << role << ": " << strerror(errno);
+  }
+#endif
+}
+
+void ThreadPolicy::ApplyOnce(const char* role, const char* name) {
+  static thread_local bool applied = false;
+  if (applied) {
+    return;
+  }
+  applied = true;
+#if defined(__linux__)
+  if (name != nullptr) {
+    pthread_setname_np(pthread_self(), name);
+  }
+#endif
+  Apply(role);
+}
+
+void ThreadPolicy::Report() {
+#if defined(__linux__)
+  if (lock_memory_) {
+    RTC_LOG(LS_INFO) << "Thread policy: mlockall " << lock_memory_result_;
+  }
+
+  DIR* dir = opendir("/proc/self/task");
+  if (dir == nullptr) {
+    return;
+  }
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    int tid = atoi(entry->d_name);
+
+    std::string name;
+    std::ifstream comm(std::string("/proc/self/task/") + entry->d_name +
+                       "/comm");
+    std::getline(comm, name);
+
+    std::string role;
+    {
+      rtc::CritScope lock(&applied_lock_);
+      auto it = applied_.find(tid);
+      if (it != applied_.end()) {
+        role = it->second;
+      }
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    std::string cpus = sched_getaffinity(tid, sizeof(set), &set) == 0
+                           ? CpusToString(set)
+                           : "?";
+    int policy = sched_getscheduler(tid);
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    sched_getparam(tid, &param);
+    errno = 0;
+    int nice = getpriority(PRIO_PROCESS, tid);
+
+    RTC_LOG(LS_INFO) << "Thread policy: tid=" << tid << " name=" << name
+                     << " role=" << (role.empty() ? "-" : role)
+                     << " cpus=" << cpus << " policy=" << PolicyName(policy)
+                     << " priority=" << param.sched_priority
+                     << " nice=" << nice;
+  }
+  closedir(dir);
+#endif
+}
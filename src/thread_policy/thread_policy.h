@@ -0,0 +1,70 @@
+#ifndef THREAD_POLICY_H_
+#define THREAD_POLICY_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "rtc_base/critical_section.h"
+
+// momo のスレッドを役割毎に CPU へ割り当てたり、スケジューリングポリシーを
+// 変えたりするための設定。
+//
+// 設定は "役割:キー=値,キー=値" を ';' か改行で区切って並べる。
+//   capture:cpus=2,fifo=50;encoder:cpus=3;network:cpus=0-1,nice=-5
+//
+// 役割: capture, encoder, decoder, render, network, worker, signaling, ros
+// キー:
+//   cpus  使う CPU。"0-1" のような範囲を '+' で繋げられる (例: 0+2-3)
+//   fifo  SCHED_FIFO にして優先度 (1-99) を設定する
+//   rr    SCHED_RR にして優先度 (1-99) を設定する
+//   nice  nice 値 (-20-19) を設定する
+//
+// 各スレッドは起動時に自分の役割で Apply を呼んで、自分自身に設定を適用する。
+// 設定は Init でスレッドを作る前に読み込んでおき、それ以降は変更しない。
+// Linux 以外では何もしない。
+class ThreadPolicy {
+ public:
+  // spec と file (どちらも空でもいい) から設定を読み込む。
+  // lock_memory が true なら mlockall でメモリをロックする。
+  static bool Init(const std::string& spec,
+                   const std::string& file,
+                   bool lock_memory,
+                   std::string* error);
+
+  // 呼び出したスレッドに role の設定を適用する
+  static void Apply(const char* role);
+  // ライブラリが作ったスレッドのコールバックから呼ぶ。
+  // スレッド毎に最初の 1 回だけ Apply する。name が nullptr で無ければ
+  // スレッドに名前も付ける。
+  static void ApplyOnce(const char* role, const char* name);
+
+  // プロセス内の全スレッドの実際の配置をログに出す
+  static void Report();
+
+ private:
+  struct Rule {
+    std::string role;
+    std::vector<int> cpus;
+    // SCHED_OTHER, SCHED_FIFO, SCHED_RR
+    int policy;
+    int priority;
+    bool has_nice;
+    int nice;
+  };
+
+  static bool ParseSpec(const std::string& spec, std::string* error);
+  static bool ParseRule(const std::string& text, Rule* rule, std::string* error);
+  static bool ParseCpus(const std::string& text, std::vector<int>* cpus);
+  static const Rule* FindRule(const std::string& role);
+
+  static std::vector<Rule> rules_;
+  static bool lock_memory_;
+  static std::string lock_memory_result_;
+
+  // Report で役割も出せるように、Apply したスレッドを覚えておく
+  static rtc::CriticalSection applied_lock_;
+  static std::map<int, std::string> applied_ RTC_GUARDED_BY(applied_lock_);
+};
+
+#endif  // THREAD_POLICY_H_
@@ -0,0 +1,131 @@
+#include "timecode.h"
+
+#include <algorithm>
+
+#include "system_wrappers/include/clock.h"
+
+namespace {
+
+const int kSyncBlocks = 2;
+const int kTimecodeBits = 32;
+const int kCrcBits = 8;
+const int kTotalBlocks = kSyncBlocks + kTimecodeBits + kCrcBits;
+// 幅をこの数で割った大きさを 1 ブロックにする。右側に余白を残しておく
+const int kBlocksPerWidth = 48;
+const int kMinBlockSize = 4;
+
+const uint8_t kWhite = 235;
+const uint8_t kBlack = 16;
+// 同期ブロックの明るさの差がこれより小さければタイムコードが無いとみなす
+const int kMinContrast = 64;
+
+uint8_t Crc8(uint32_t value) {
+  uint8_t crc = 0;
+  for (int i = 0; i < 4; i++) {
+    crc ^= static_cast<uint8_t>(value >> (24 - i * 8));
+    for (int j = 0; j < 8; j++) {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+double BlockSize(int width) {
+  return static_cast<double>(width) / kBlocksPerWidth;
+}
+
+bool GetBit(int index, uint32_t timecode, uint8_t crc) {
+  if (index == 0) {
+    return true;
+  } else if (index == 1) {
+    return false;
+  } else if (index < kSyncBlocks + kTimecodeBits) {
+    return (timecode >> (kTimecodeBits - 1 - (index - kSyncBlocks))) & 1;
+  }
+  return (crc >> (kCrcBits - 1 - (index - kSyncBlocks - kTimecodeBits))) & 1;
+}
+
+}  // namespace
+
+uint32_t Timecode::Now() {
+  return static_cast<uint32_t>(
+      webrtc::Clock::GetRealTimeClock()->CurrentNtpInMilliseconds());
+}
+
+void Timecode::Stamp(webrtc::I420Buffer* buffer, uint32_t timecode) {
+  double block_size = BlockSize(buffer->width());
+  if (block_size < kMinBlockSize || buffer->height() < block_size) {
+    return;
+  }
+  int block_height = static_cast<int>(block_size);
+  uint8_t crc = Crc8(timecode);
+
+  for (int i = 0; i < kTotalBlocks; i++) {
+    int x0 = static_cast<int>(i * block_size);
+    int x1 = static_cast<int>((i + 1) * block_size);
+    uint8_t value = GetBit(i, timecode, crc) ? kWhite : kBlack;
+    for (int y = 0; y < block_height; y++) {
+      uint8_t* row = buffer->MutableDataY() + y * buffer->StrideY();
+      std::fill(row + x0, row + x1, value);
+    }
+  }
+
+  // 色が付いていると読み取りにくくなるので、色差もグレーにしておく
+  int chroma_width = static_cast<int>(kTotalBlocks * block_size + 1) / 2;
+  int chroma_height = (block_height + 1) / 2;
+  chroma_width = std::min(chroma_width, buffer->ChromaWidth());
+  for (int y = 0; y < chroma_height; y++) {
+    std::fill_n(buffer->MutableDataU() + y * buffer->StrideU(), chroma_width,
+                128);
+    std::fill_n(buffer->MutableDataV() + y * buffer->StrideV(), chroma_width,
+                128);
+  }
+}
+
+bool Timecode::Detect(const webrtc::I420BufferInterface& buffer,
+                      uint32_t* timecode) {
+  double block_size = BlockSize(buffer.width());
+  if (block_size < kMinBlockSize || buffer.height() < block_size) {
+    return false;
+  }
+
+  // ブロックの端はエンコードで滲むので、中央の半分だけを見る
+  int levels[kTotalBlocks];
+  int margin = static_cast<int>(block_size / 4);
+  int y0 = margin;
+  int y1 = static_cast<int>(block_size) - margin;
+  for (int i = 0; i < kTotalBlocks; i++) {
+    int x0 = static_cast<int>(i * block_size) + margin;
+    int x1 = static_cast<int>((i + 1) * block_size) - margin;
+    int sum = 0;
+    int count = 0;
+    for (int y = y0; y < y1; y++) {
+      const uint8_t* row = buffer.DataY() + y * buffer.StrideY();
+      for (int x = x0; x < x1; x++) {
+        sum += row[x];
+        count++;
+      }
+    }
+    levels[i] = count == 0 ? 0 : sum / count;
+  }
+
+  if (levels[0] - levels[1] < kMinContrast) {
+    return false;
+  }
+  int threshold = (levels[0] + levels[1]) / 2;
+
+  uint32_t value = 0;
+  for (int i = 0; i < kTimecodeBits; i++) {
+    value = (value << 1) | (levels[kSyncBlocks + i] > threshold ? 1 : 0);
+  }
+  uint8_t crc = 0;
+  for (int i = 0; i < kCrcBits; i++) {
+    crc = (crc << 1) |
+          (levels[kSyncBlocks + kTimecodeBits + i] > threshold ? 1 : 0);
+  }
+  if (crc != Crc8(value)) {
+    return false;
+  }
+  *timecode = value;
+  return true;
+}
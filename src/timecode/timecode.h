@@ -0,0 +1,24 @@
+#ifndef TIMECODE_H_
+#define TIMECODE_H_
+
+#include <stdint.h>
+
+#include "api/video/i420_buffer.h"
+
+// 映像の輝度面の左上に、機械で読み取れるタイムコードを埋め込む。
+//
+// 白と黒の同期ブロックに続けて 32 ビットの時刻と CRC-8 を
+// 1 ビット 1 ブロックで横に並べる。ブロックの大きさは映像の幅に比例するので、
+// 途中で解像度が下げられても読み取れる。読み取り時はブロックの中央付近の
+// 平均を取って同期ブロックの明るさと比べるので、非可逆圧縮にも強い。
+class Timecode {
+ public:
+  // 時刻は壁時計のミリ秒の下位 32 ビット。送信側と受信側の時計は
+  // 同じホストで動かすか NTP で合わせておく必要がある
+  static uint32_t Now();
+  static void Stamp(webrtc::I420Buffer* buffer, uint32_t timecode);
+  static bool Detect(const webrtc::I420BufferInterface& buffer,
+                     uint32_t* timecode);
+};
+
+#endif  // TIMECODE_H_
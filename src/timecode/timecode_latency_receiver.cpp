@@ -0,0 +1,215 @@
+#include "timecode_latency_receiver.h"
+
+#include <algorithm>
+#include <fstream>
+#include <nlohmann/json.hpp>
+
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+#include "timecode.h"
+
+using json = nlohmann::json;
+
+namespace {
+
+const int kBucketWidthMs = 5;
+// これを超える遅延は最後のバケツにまとめる
+const int kMaxLatencyMs = 2000;
+const int kNumBuckets = kMaxLatencyMs / kBucketWidthMs + 1;
+const int64_t kWriteIntervalMs = 10000;
+// タイムコードを読み取る間隔。遅延の分布を見るには 10fps で十分
+const int64_t kSampleIntervalMs = 100;
+
+}  // namespace
+
+TimecodeLatencyReceiver::Sink::Sink(TimecodeLatencyReceiver* receiver,
+                                    webrtc::VideoTrackInterface* track)
+    : receiver_(receiver), track_(track), last_sample_ms_(0) {
+  track_->AddOrUpdateSink(this, rtc::VideoSinkWants());
+}
+
+TimecodeLatencyReceiver::Sink::~Sink() {
+  track_->RemoveSink(this);
+}
+
+void TimecodeLatencyReceiver::Sink::OnFrame(const webrtc::VideoFrame& frame) {
+  int64_t now_ms = rtc::TimeMillis();
+  if (now_ms - last_sample_ms_ < kSampleIntervalMs) {
+    return;
+  }
+  last_sample_ms_ = now_ms;
+
+  uint32_t now = Timecode::Now();
+  // I420 ならコピーせずに、タイムコードのある上端の帯だけを読む。
+  // ネイティブバッファは変換するしかないが、間引いたフレームだけで済む
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+      frame.video_frame_buffer();
+  const webrtc::I420BufferInterface* i420 = buffer->GetI420();
+  rtc::scoped_refptr<webrtc::I420BufferInterface> converted;
+  if (i420 == nullptr) {
+    converted = buffer->ToI420();
+    i420 = converted.get();
+  }
+  uint32_t timecode;
+  if (i420 == nullptr || !Timecode::Detect(*i420, &timecode)) {
+    receiver_->AddSample(-1);
+    return;
+  }
+  // 32 ビットで一周しても差分は正しく求まる
+  receiver_->AddSample(static_cast<int32_t>(now - timecode));
+}
+
+TimecodeLatencyReceiver::TimecodeLatencyReceiver(
+    VideoTrackReceiver* receiver,
+    const std::string& histogram_file)
+    : receiver_(receiver), histogram_file_(histogram_file), quit_(false) {
+  histogram_.buckets.resize(kNumBuckets);
+  histogram_.count = 0;
+  histogram_.missed = 0;
+  histogram_.sum_ms = 0;
+  writer_thread_.reset(new rtc::PlatformThread(
+      TimecodeLatencyReceiver::WriterThread, this, "TimecodeWriter",
+      rtc::kLowPriority));
+  writer_thread_->Start();
+}
+
+TimecodeLatencyReceiver::~TimecodeLatencyReceiver() {
+  {
+    rtc::CritScope lock(&sinks_lock_);
+    sinks_.clear();
+  }
+  // 最後の書き出しは書き込みスレッドが終わる前に行う
+  {
+    rtc::CritScope lock(&lock_);
+    quit_ = true;
+  }
+  wakeup_.Set();
+  writer_thread_->Stop();
+  writer_thread_.reset();
+}
+
+void TimecodeLatencyReceiver::AddTrack(webrtc::VideoTrackInterface* track) {
+  if (receiver_ != nullptr) {
+    receiver_->AddTrack(track);
+  }
+  std::unique_ptr<Sink> sink(new Sink(this, track));
+  rtc::CritScope lock(&sinks_lock_);
+  sinks_.push_back(std::make_pair(track, std::move(sink)));
+}
+
+void TimecodeLatencyReceiver::RemoveTrack(webrtc::VideoTrackInterface* track) {
+  {
+    rtc::CritScope lock(&sinks_lock_);
+    sinks_.erase(
+        std::remove_if(sinks_.begin(), sinks_.end(),
+                       [track](const std::pair<webrtc::VideoTrackInterface*,
+                                               std::unique_ptr<Sink>>& sink) {
+                         return sink.first == track;
+                       }),
+        sinks_.end());
+  }
+  if (receiver_ != nullptr) {
+    receiver_->RemoveTrack(track);
+  }
+}
+
+void TimecodeLatencyReceiver::OnFrameMetadata(
+    webrtc::VideoTrackInterface* track,
+    const webrtc::VideoFrame& frame,
+    const uint8_t* data,
+    size_t size) {
+  if (receiver_ != nullptr) {
+    receiver_->OnFrameMetadata(track, frame, data, size);
+  }
+}
+
+void TimecodeLatencyReceiver::AddSample(int64_t latency_ms) {
+  rtc::CritScope lock(&lock_);
+  // 読み取れなかったフレームや、時計がずれていて負になったものは数えるだけ
+  if (latency_ms < 0) {
+    histogram_.missed++;
+  } else {
+    int index = static_cast<int>(
+        std::min<int64_t>(latency_ms / kBucketWidthMs, kNumBuckets - 1));
+    histogram_.buckets[index]++;
+    histogram_.count++;
+    histogram_.sum_ms += latency_ms;
+  }
+}
+
+void TimecodeLatencyReceiver::WriterThread(void* obj) {
+  static_cast<TimecodeLatencyReceiver*>(obj)->WriterProcess();
+}
+
+void TimecodeLatencyReceiver::WriterProcess() {
+  while (true) {
+    wakeup_.Wait(kWriteIntervalMs);
+    // ロックを持ったままファイルに書くと AddSample を止めてしまうので、
+    // 写しを取ってから書く
+    Histogram histogram;
+    bool quit;
+    {
+      rtc::CritScope lock(&lock_);
+      histogram = histogram_;
+      quit = quit_;
+    }
+    WriteHistogram(histogram);
+    if (quit) {
+      return;
+    }
+  }
+}
+
+void TimecodeLatencyReceiver::WriteHistogram(const Histogram& histogram) {
+  const uint64_t count = histogram.count;
+  const uint64_t missed = histogram.missed;
+  const int64_t sum_ms = histogram.sum_ms;
+  // 中央値と 99 パーセンタイルはバケツの上端で近似する
+  int64_t p50 = 0;
+  int64_t p99 = 0;
+  uint64_t rank50 = (count + 1) / 2;
+  uint64_t rank99 = (count * 99 + 99) / 100;
+  uint64_t accumulated = 0;
+  json buckets = json::array();
+  for (int i = 0; i < kNumBuckets; i++) {
+    if (histogram.buckets[i] == 0) {
+      continue;
+    }
+    uint64_t before = accumulated;
+    accumulated += histogram.buckets[i];
+    int64_t upper_ms = static_cast<int64_t>(i + 1) * kBucketWidthMs;
+    if (before < rank50 && accumulated >= rank50) {
+      p50 = upper_ms;
+    }
+    if (before < rank99 && accumulated >= rank99) {
+      p99 = upper_ms;
+    }
+    buckets.push_back({{"lower_ms", i * kBucketWidthMs},
+                       {"upper_ms", i == kNumBuckets - 1 ? -1 : upper_ms},
+                       {"count", histogram.buckets[i]}});
+  }
+
+  RTC_LOG(LS_INFO) << "Timecode latency: count=" << count
+                   << " missed=" << missed << " mean="
+                   << (count == 0 ? 0 : sum_ms / static_cast<int64_t>(count))
+                   << "ms p50<=" << p50 << "ms p99<=" << p99 << "ms";
+
+  if (histogram_file_.empty()) {
+    return;
+  }
+  json result = {
+      {"bucket_width_ms", kBucketWidthMs},
+      {"count", count},
+      {"missed", missed},
+      {"mean_ms", count == 0 ? 0.0 : static_cast<double>(sum_ms) / count},
+      {"p50_ms", p50},
+      {"p99_ms", p99},
+      {"buckets", buckets},
+  };
+  std::ofstream ofs(histogram_file_, std::ios::trunc);
+  if (!ofs) {
+    RTC_LOG(LS_WARNING) << "Failed to open " << histogram_file_;
+    return;
+  }
+  ofs << result.dump(2) << std::endl;
+}
@@ -0,0 +1,80 @@
+#ifndef TIMECODE_LATENCY_RECEIVER_H_
+#define TIMECODE_LATENCY_RECEIVER_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "api/media_stream_interface.h"
+#include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
+#include "rtc/video_track_receiver.h"
+#include "rtc_base/critical_section.h"
+#include "rtc_base/event.h"
+#include "rtc_base/platform_thread.h"
+
+// 受信した映像からタイムコードを読み取って、キャプチャから表示までの
+// 遅延をヒストグラムに集計する。
+// 元の VideoTrackReceiver (SDL の描画など) をラップするので、
+// 描画と一緒に使える。
+//
+// デコードや描画のスレッドを止めないように、タイムコードは一定間隔で
+// 間引いたフレームからだけ読み取る。ヒストグラムは専用のスレッドから
+// 一定時間毎にファイルへ書き出す。
+class TimecodeLatencyReceiver : public VideoTrackReceiver {
+ public:
+  TimecodeLatencyReceiver(VideoTrackReceiver* receiver,
+                          const std::string& histogram_file);
+  ~TimecodeLatencyReceiver();
+
+  void AddTrack(webrtc::VideoTrackInterface* track) override;
+  void RemoveTrack(webrtc::VideoTrackInterface* track) override;
+  void OnFrameMetadata(webrtc::VideoTrackInterface* track,
+                       const webrtc::VideoFrame& frame,
+                       const uint8_t* data,
+                       size_t size) override;
+
+ private:
+  class Sink : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+   public:
+    Sink(TimecodeLatencyReceiver* receiver,
+         webrtc::VideoTrackInterface* track);
+    ~Sink();
+    void OnFrame(const webrtc::VideoFrame& frame) override;
+
+   private:
+    TimecodeLatencyReceiver* receiver_;
+    rtc::scoped_refptr<webrtc::VideoTrackInterface> track_;
+    // OnFrame はデコードのスレッドからしか呼ばれない
+    int64_t last_sample_ms_;
+  };
+
+  struct Histogram {
+    std::vector<uint64_t> buckets;
+    uint64_t count;
+    uint64_t missed;
+    int64_t sum_ms;
+  };
+
+  void AddSample(int64_t latency_ms);
+  static void WriterThread(void* obj);
+  void WriterProcess();
+  void WriteHistogram(const Histogram& histogram);
+
+  VideoTrackReceiver* receiver_;
+  const std::string histogram_file_;
+
+  rtc::CriticalSection sinks_lock_;
+  std::vector<std::pair<webrtc::VideoTrackInterface*, std::unique_ptr<Sink>>>
+      sinks_ RTC_GUARDED_BY(sinks_lock_);
+
+  rtc::CriticalSection lock_;
+  Histogram histogram_ RTC_GUARDED_BY(lock_);
+  bool quit_ RTC_GUARDED_BY(lock_);
+  rtc::Event wakeup_;
+  std::unique_ptr<rtc::PlatformThread> writer_thread_;
+};
+
+#endif  // TIMECODE_LATENCY_RECEIVER_H_
@@ -1,5 +1,7 @@
 #include "util.h"
 
+#include <stdlib.h>
+
 #include <regex>
 
 // external libraries
@@ -15,6 +17,9 @@
 #if USE_ROS
 #include "ros/ros.h"
 #endif
+#if MOMO_NODELET
+#include "ros/momo_nodelet.h"
+#endif
 
 // HWA を効かせる場合は 1 になる
 #if USE_MMAL_ENCODER
@@ -34,7 +39,7 @@ using json = nlohmann::json;
 
 #if USE_ROS
 
-void Util::parseArgs(int argc,
+bool Util::parseArgs(int argc,
                      char* argv[],
                      bool& is_daemon,
                      bool& use_test,
@@ -42,13 +47,20 @@ void Util::parseArgs(int argc,
                      bool& use_sora,
                      int& log_level,
                      ConnectionSettings& cs) {
+#if MOMO_NODELET
+  // nodelet manager が ros::init を済ませているので、nodelet の名前空間を使う
+  ros::NodeHandle nh = MomoNodelet::GetNodeHandle();
+  ros::NodeHandle local_nh = MomoNodelet::GetPrivateNodeHandle();
+#else
   ros::init(argc, argv, "momo", ros::init_options::AnonymousName);
 
   ros::NodeHandle nh;
+  ros::NodeHandle local_nh("~");
+#endif
   cs.camera_name = nh.resolveName("image");
   cs.audio_topic_name = nh.resolveName("audio");
+  cs.audio_playout_topic_name = nh.resolveName("audio_out");
 
-  ros::NodeHandle local_nh("~");
   local_nh.param<bool>("compressed", cs.image_compressed, cs.image_compressed);
 
   local_nh.param<bool>("use_test", use_test, use_test);
@@ -74,6 +86,46 @@ void Util::parseArgs(int argc,
   local_nh.param<std::string>("priority", cs.priority, cs.priority);
   local_nh.param<int>("port", cs.port, cs.port);
   local_nh.param<int>("log_level", log_level, log_level);
+  local_nh.param<std::string>("record_dir", cs.record_dir, cs.record_dir);
+  local_nh.param<std::string>("record_remote_dir", cs.record_remote_dir,
+                              cs.record_remote_dir);
+  local_nh.param<bool>("record_remote_only", cs.record_remote_only,
+                       cs.record_remote_only);
+  local_nh.param<int>("record_segment_duration", cs.record_segment_duration,
+                      cs.record_segment_duration);
+  local_nh.param<int>("record_segment_size", cs.record_segment_size,
+                      cs.record_segment_size);
+  local_nh.param<int>("metrics_interval", cs.metrics_interval,
+                      cs.metrics_interval);
+  local_nh.param<std::string>("thread_policy", cs.thread_policy,
+                              cs.thread_policy);
+  local_nh.param<std::string>("thread_policy_file", cs.thread_policy_file,
+                              cs.thread_policy_file);
+  local_nh.param<bool>("lock_memory", cs.lock_memory, cs.lock_memory);
+  local_nh.param<bool>("low_footprint", cs.low_footprint, cs.low_footprint);
+  local_nh.param<std::string>("low_footprint_video_codec",
+                              cs.low_footprint_video_codec,
+                              cs.low_footprint_video_codec);
+  local_nh.param<int>("hw_encoder_pool_size", cs.hw_encoder_pool_size,
+                      cs.hw_encoder_pool_size);
+  local_nh.param<int>("intra_refresh_period", cs.intra_refresh_period,
+                      cs.intra_refresh_period);
+  local_nh.param<bool>("startup_report", cs.startup_report,
+                       cs.startup_report);
+  local_nh.param<bool>("prewarm_connection", cs.prewarm_connection,
+                       cs.prewarm_connection);
+  local_nh.param<std::string>("bwe_cache_file", cs.bwe_cache_file,
+                              cs.bwe_cache_file);
+  local_nh.param<bool>("low_latency_receive", cs.low_latency_receive,
+                       cs.low_latency_receive);
+  local_nh.param<std::vector<std::string> >(
+      "data_channel_bridges", cs.data_channel_bridges,
+      cs.data_channel_bridges);
+  local_nh.param<int>("frame_metadata_port", cs.frame_metadata_port,
+                      cs.frame_metadata_port);
+  local_nh.param<std::string>("frame_metadata_output",
+                              cs.frame_metadata_output,
+                              cs.frame_metadata_output);
 
   // オーディオフラグ
   local_nh.param<bool>("disable_echo_cancellation",
@@ -117,14 +169,22 @@ void Util::parseArgs(int argc,
                                 cs.ayame_client_id);
     local_nh.param<std::string>("signaling_key", cs.ayame_signaling_key,
                                 cs.ayame_signaling_key);
+  } else if (use_sora) {
+    ROS_ERROR("momo: use_sora requires SIGNALING_URL and CHANNEL_ID");
+    return false;
+  } else if (use_ayame) {
+    ROS_ERROR("momo: use_ayame requires SIGNALING_URL and ROOM_ID");
+    return false;
   } else {
-    exit(1);
+    ROS_ERROR("momo: one of use_sora, use_ayame or use_test is required");
+    return false;
   }
+  return true;
 }
 
 #else
 
-void Util::parseArgs(int argc,
+bool Util::parseArgs(int argc,
                      char* argv[],
                      bool& is_daemon,
                      bool& use_test,
@@ -248,12 +308,122 @@ void Util::parseArgs(int argc,
   app.add_flag("--fullscreen", cs.fullscreen,
                "Use fullscreen window for videos (if SDL is available)")
       ->check(is_sdl_available);
+  app.add_option("--video-input-file", cs.video_input_file,
+                 "Use a Y4M, raw I420 (.yuv) or MJPEG file instead of a camera")
+      ->check(CLI::ExistingFile);
+  app.add_flag("--video-input-pattern", cs.video_input_pattern,
+               "Use a deterministic test pattern instead of a camera");
+  app.add_flag("--video-input-fast", cs.video_input_fast,
+               "Feed the video input as fast as possible instead of "
+               "in real time");
+  app.add_option("--audio-input-file", cs.audio_input_file,
+                 "Use a WAV or raw 16-bit PCM file instead of a microphone")
+      ->check(CLI::ExistingFile);
+  app.add_option("--audio-input-rate", cs.audio_input_rate,
+                 "Sampling rate of a raw PCM audio input file "
+                 "(default: 48000)")
+      ->check(CLI::Range(8000, 48000));
+  app.add_option("--audio-input-channels", cs.audio_input_channels,
+                 "Number of channels of a raw PCM audio input file "
+                 "(default: 1)")
+      ->check(CLI::Range(1, 2));
+  app.add_option("--record-dir", cs.record_dir,
+                 "Directory to record the encoded video being sent "
+                 "(recording is disabled if not specified)");
+  app.add_option("--record-remote-dir", cs.record_remote_dir,
+                 "Directory to record the received video and audio without "
+                 "decoding (recording is disabled if not specified)");
+  app.add_flag("--record-remote-only", cs.record_remote_only,
+               "Only record the received tracks that can be recorded and "
+               "never decode or play them (other tracks are played as usual)");
+  app.add_option("--record-segment-duration", cs.record_segment_duration,
+                 "Duration of each recorded segment in seconds "
+                 "(0 means unlimited, default: 60)")
+      ->check(CLI::Range(0, 86400));
+  app.add_option("--record-segment-size", cs.record_segment_size,
+                 "Maximum size of each recorded segment in MB "
+                 "(0 means unlimited, default: 0)")
+      ->check(CLI::Range(0, 65536));
+  app.add_option("--metrics-interval", cs.metrics_interval,
+                 "Interval in seconds to collect stats for the /metrics "
+                 "endpoint (0 disables it, default: 5)")
+      ->check(CLI::Range(0, 3600));
+  app.add_flag("--timecode-stamp", cs.timecode_stamp,
+               "Stamp a machine-readable timecode into the captured video "
+               "(not available with --use-native)");
+  app.add_flag("--timecode-detect", cs.timecode_detect,
+               "Detect timecodes in the received video and measure "
+               "capture-to-display latency");
+  app.add_option("--timecode-histogram-file", cs.timecode_histogram_file,
+                 "File to write the latency histogram as JSON "
+                 "(use with --timecode-detect)");
+  app.add_flag("--benchmark-loopback", cs.benchmark_loopback,
+               "Connect two peers in-process without signaling and report "
+               "latency, fps and CPU usage as JSON");
+  app.add_option("--benchmark-duration", cs.benchmark_duration,
+                 "Duration of the loopback benchmark in seconds "
+                 "(default: 10)")
+      ->check(CLI::Range(1, 3600));
+  app.add_set("--benchmark-video-codec", cs.benchmark_video_codec,
+              {"VP8", "VP9", "H264"},
+              "Video codec for the loopback benchmark (default: VP8)")
+      ->check(is_valid_h264);
+  app.add_flag("--low-footprint", cs.low_footprint,
+               "Reduce memory usage for devices like Raspberry Pi Zero "
+               "(only the codec set by --low-footprint-video-codec is used)");
+  app.add_set("--low-footprint-video-codec", cs.low_footprint_video_codec,
+              {"VP8", "VP9", "H264"},
+              "The only video codec available with --low-footprint, also "
+              "requested from Sora instead of --video-codec "
+              "(default: H264 if available, otherwise VP8)")
+      ->check(is_valid_h264);
+  app.add_option("--hw-encoder-pool-size", cs.hw_encoder_pool_size,
+                 "Number of idle hardware encoder pipelines kept for reuse "
+                 "across reconnects and resolution changes (default: 1, "
+                 "0 with --low-footprint)")
+      ->check(CLI::Range(0, 8));
+  app.add_option("--intra-refresh-period", cs.intra_refresh_period,
+                 "Refresh the picture with intra macroblocks over this many "
+                 "frames instead of sending periodic key frames, to avoid "
+                 "bitrate spikes on hardware encoders (default: 0, disabled). "
+                 "The software VP8 and VP9 encoders ignore this and do not "
+                 "report frame size metrics")
+      ->check(CLI::Range(0, 600));
+  app.add_flag("--startup-report", cs.startup_report,
+               "Print the time taken by each startup phase to stderr");
+  app.add_flag("--prewarm-connection", cs.prewarm_connection,
+               "Create a PeerConnection as soon as the signaling connection "
+               "is established (ICE candidates gathered in advance are kept "
+               "only if the ICE servers do not change, as in test mode)");
+  app.add_option("--bwe-cache-file", cs.bwe_cache_file,
+                 "File to remember the bandwidth estimate per signaling host "
+                 "and network interface to warm-start new connections");
+  app.add_flag("--low-latency-receive", cs.low_latency_receive,
+               "Stamp zero playout delay on the sent video so that the remote "
+               "receiver does not hold it in its jitter buffer, and draw "
+               "received frames in SDL as soon as they are decoded. momo's "
+               "own receive jitter buffer is not changed by this flag");
   app.add_flag("--daemon", is_daemon, "Run as a daemon process");
   app.add_flag("--version", version, "Show version information");
   auto log_level_map = std::vector<std::pair<std::string, int> >(
       {{"verbose", 0}, {"info", 1}, {"warning", 2}, {"error", 3}, {"none", 4}});
   app.add_option("--log-level", log_level, "Log severity level threshold")
       ->transform(CLI::CheckedTransformer(log_level_map, CLI::ignore_case));
+  app.add_option("--thread-policy", cs.thread_policy,
+                 "CPU affinity and scheduling for each thread role "
+                 "(e.g. capture:cpus=2,fifo=50;encoder:cpus=3;network:nice=-5)");
+  app.add_option("--thread-policy-file", cs.thread_policy_file,
+                 "File containing --thread-policy rules, one per line")
+      ->check(CLI::ExistingFile);
+  app.add_flag("--mlockall", cs.lock_memory,
+               "Lock all current and future memory pages with mlockall");
+  app.add_flag("--binary-log", cs.binary_log,
+               "Write logs in a compact binary format from a background "
+               "thread (decode with momo_log_decode)");
+  app.add_option("--log-rate-limit", cs.log_rate_limit,
+                 "Maximum info logs per second from each call site with "
+                 "--binary-log (0 means unlimited, default: 10)")
+      ->check(CLI::Range(0, 100000));
 
   // オーディオフラグ
   app.add_flag("--disable-echo-cancellation", cs.disable_echo_cancellation,
@@ -291,6 +461,27 @@ void Util::parseArgs(int argc,
          "--serial", serial_setting,
          "Serial port settings for datachannel passthrough [DEVICE],[BAUDRATE]")
       ->check(is_serial_setting_format);
+  app.add_set("--serial-framing", cs.serial_framing,
+              {"newline", "length", "cobs", "raw"},
+              "How serial data is split into datachannel messages "
+              "(default: newline)");
+  app.add_option("--serial-idle-gap", cs.serial_idle_gap,
+                 "Idle time in milliseconds that ends a message with "
+                 "--serial-framing raw (default: 5)")
+      ->check(CLI::Range(1, 1000));
+  app.add_option("--data-channel-bridge", cs.data_channel_bridges,
+                 "Bridge a named datachannel to a local socket "
+                 "LABEL=udp:PORT|unix:PATH[,peer=ADDR][,unordered]"
+                 "[,max-retransmits=N][,max-packet-life-time=MS]"
+                 "[,unreliable][,seq] (can be repeated)");
+  app.add_option("--frame-metadata-port", cs.frame_metadata_port,
+                 "Local UDP port whose datagrams are attached to the next "
+                 "captured frame and sent with its RTP timestamp "
+                 "(max 256 bytes, 0 to disable)")
+      ->check(CLI::Range(0, 65535));
+  app.add_option("--frame-metadata-output", cs.frame_metadata_output,
+                 "HOST:PORT to send received frame metadata to, prefixed "
+                 "with the RTP timestamp of the decoded frame");
 
   auto test_app = app.add_subcommand(
       "test", "Mode for momo development with simple HTTP server");
@@ -383,7 +574,8 @@ void Util::parseArgs(int argc,
     exit(0);
   }
 
-  if (!test_app->parsed() && !sora_app->parsed() && !ayame_app->parsed()) {
+  if (!test_app->parsed() && !sora_app->parsed() && !ayame_app->parsed() &&
+      !cs.benchmark_loopback) {
     std::cout << app.help() << std::endl;
     exit(1);
   }
@@ -399,6 +591,7 @@ void Util::parseArgs(int argc,
   if (ayame_app->parsed()) {
     use_ayame = true;
   }
+  return true;
 }
 
 #endif
@@ -424,6 +617,19 @@ std::string Util::generateRandomNumericChars(size_t length) {
   return result;
 }
 
+bool Util::parseInt(const std::string& text, int min, int max, int* value) {
+  if (text.empty()) {
+    return false;
+  }
+  char* end = nullptr;
+  long v = strtol(text.c_str(), &end, 10);
+  if (*end != '\0' || v < min || v > max) {
+    return false;
+  }
+  *value = static_cast<int>(v);
+  return true;
+}
+
 std::string Util::iceConnectionStateToString(
     webrtc::PeerConnectionInterface::IceConnectionState state) {
   switch (state) {
@@ -504,6 +710,19 @@ string_view Util::mimeType(string_view path) {
   return "application/text";
 }
 
+http::response<http::string_body> Util::okText(
+    const http::request<http::string_body>& req,
+    string_view content_type,
+    std::string body) {
+  http::response<http::string_body> res{http::status::ok, req.version()};
+  res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+  res.set(http::field::content_type, content_type);
+  res.keep_alive(req.keep_alive());
+  res.body() = std::move(body);
+  res.prepare_payload();
+  return res;
+}
+
 http::response<http::string_body> Util::badRequest(
     const http::request<http::string_body>& req,
     string_view why) {
@@ -10,7 +10,9 @@
 
 class Util {
  public:
-  static void parseArgs(int argc,
+  // ROS で必須のパラメータが足りない場合は false を返す。
+  // nodelet ではプロセスを巻き込まないように exit しない。
+  static bool parseArgs(int argc,
                         char* argv[],
                         bool& is_daemon,
                         bool& use_test,
@@ -23,10 +25,18 @@ class Util {
   static std::string generateRandomNumericChars(size_t length);
   static std::string iceConnectionStateToString(
       webrtc::PeerConnectionInterface::IceConnectionState state);
+  // text 全体を 10 進数として読んで、min 以上 max 以下なら value に入れる
+  static bool parseInt(const std::string& text, int min, int max, int* value);
 
   // MIME type をファイル名の拡張子から調べる
   static boost::beast::string_view mimeType(boost::beast::string_view path);
 
+  // 200 OK で任意のテキストを返すレスポンスを作る
+  static boost::beast::http::response<boost::beast::http::string_body> okText(
+      const boost::beast::http::request<boost::beast::http::string_body>& req,
+      boost::beast::string_view content_type,
+      std::string body);
+
   // エラーレスポンスをいい感じに作る便利関数
   static boost::beast::http::response<boost::beast::http::string_body>
   badRequest(
@@ -23,47 +23,32 @@
 
 #include <new>
 #include <string>
+#include <vector>
 
 #include "api/scoped_refptr.h"
 #include "api/video/i420_buffer.h"
 #include "media/base/video_common.h"
-#include "modules/video_capture/video_capture.h"
-#include "modules/video_capture/video_capture_factory.h"
 #include "rtc/native_buffer.h"
 #include "rtc_base/logging.h"
 #include "rtc_base/ref_counted_object.h"
 #include "third_party/libyuv/include/libyuv.h"
+#include "thread_policy/thread_policy.h"
+#include "timecode/timecode.h"
 
 rtc::scoped_refptr<V4L2VideoCapture> V4L2VideoCapture::Create(
     ConnectionSettings cs) {
-  rtc::scoped_refptr<V4L2VideoCapture> capturer;
-  std::unique_ptr<webrtc::VideoCaptureModule::DeviceInfo> device_info(
-      webrtc::VideoCaptureFactory::CreateDeviceInfo());
-  if (!device_info) {
-    RTC_LOG(LS_ERROR) << "Failed to CreateDeviceInfo";
-    return nullptr;
-  }
-
-  // 便利なのでデバイスの一覧をログに出力しておく
-  int num_devices = device_info->NumberOfDevices();
-  for (int i = 0; i < num_devices; ++i) {
-    char device_name[256];
-    char unique_name[256];
-    if (device_info->GetDeviceName(static_cast<uint32_t>(i), device_name,
-                                   sizeof(device_name), unique_name,
-                                   sizeof(unique_name)) != 0) {
-      RTC_LOG(LS_WARNING) << "Failed to GetDeviceName(" << i << ")";
-      continue;
-    }
-    RTC_LOG(LS_INFO) << "GetDeviceName(" << i
-                     << "): device_name=" << device_name
-                     << ", unique_name=" << unique_name;
+  // video_device が指定されてる場合はそれだけ調べる
+  std::vector<std::string> devices;
+  if (cs.video_device.empty()) {
+    devices = FindDevices();
+  } else {
+    devices.push_back(cs.video_device);
   }
 
-  for (int i = 0; i < num_devices; ++i) {
-    capturer = Create(device_info.get(), cs, i);
+  for (const std::string& device : devices) {
+    rtc::scoped_refptr<V4L2VideoCapture> capturer = Create(device, cs);
     if (capturer) {
-      RTC_LOG(LS_INFO) << "Get Capture";
+      RTC_LOG(LS_INFO) << "Get Capture: " << device;
       return capturer;
     }
   }
@@ -72,34 +57,56 @@ rtc::scoped_refptr<V4L2VideoCapture> V4L2VideoCapture::Create(
 }
 
 rtc::scoped_refptr<V4L2VideoCapture> V4L2VideoCapture::Create(
-    webrtc::VideoCaptureModule::DeviceInfo* device_info,
-    ConnectionSettings cs,
-    size_t capture_device_index) {
-  char device_name[256];
-  char unique_name[256];
-  if (device_info->GetDeviceName(static_cast<uint32_t>(capture_device_index),
-                                 device_name, sizeof(device_name), unique_name,
-                                 sizeof(unique_name)) != 0) {
-    RTC_LOG(LS_WARNING) << "Failed to GetDeviceName";
-    return nullptr;
-  }
+    const std::string& device,
+    ConnectionSettings cs) {
   rtc::scoped_refptr<V4L2VideoCapture> v4l2_capturer(
       new rtc::RefCountedObject<V4L2VideoCapture>());
-  if (v4l2_capturer->Init((const char*)&unique_name, cs.video_device) < 0) {
-    RTC_LOG(LS_WARNING) << "Failed to create V4L2VideoCapture(" << unique_name
-                        << ")";
-    return nullptr;
-  }
+  v4l2_capturer->_videoDevice = device;
   if (v4l2_capturer->StartCapture(cs) < 0) {
     auto size = cs.getSize();
-    RTC_LOG(LS_WARNING) << "Failed to start V4L2VideoCapture(w = " << size.width
-                        << ", h = " << size.height << ", fps = " << cs.framerate
-                        << ")";
+    RTC_LOG(LS_WARNING) << "Failed to start V4L2VideoCapture(" << device
+                        << ", w = " << size.width << ", h = " << size.height
+                        << ", fps = " << cs.framerate << ")";
     return nullptr;
   }
   return v4l2_capturer;
 }
 
+// DeviceInfo で一覧を作ってから各デバイスの bus_info を /dev/video* から
+// 探し直すと、デバイスの数だけ全部のノードを開くことになるので、
+// /dev/video* を 1 回だけ開いて映像を取り込めるものを順番に返す
+std::vector<std::string> V4L2VideoCapture::FindDevices() {
+  std::vector<std::string> devices;
+  char device[32];
+  for (int n = 0; n < 64; n++) {
+    sprintf(device, "/dev/video%d", n);
+    int fd = open(device, O_RDONLY | O_NONBLOCK);
+    if (fd == -1) {
+      continue;
+    }
+    struct v4l2_capability cap;
+    memset(&cap, 0, sizeof(cap));
+    if (ioctl(fd, VIDIOC_QUERYCAP, &cap) == 0) {
+      uint32_t caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS)
+                          ? cap.device_caps
+                          : cap.capabilities;
+      // ハードウェアエンコーダなどの M2M デバイスは映像の入力には使えない
+      bool capture = (caps & V4L2_CAP_VIDEO_CAPTURE) != 0 &&
+                     (caps & V4L2_CAP_STREAMING) != 0;
+      // 便利なのでデバイスの一覧をログに出力しておく
+      RTC_LOG(LS_INFO) << "V4L2 device: " << device
+                       << ", card=" << (const char*)cap.card
+                       << ", bus_info=" << (const char*)cap.bus_info
+                       << (capture ? "" : " (not a capture device)");
+      if (capture) {
+        devices.push_back(device);
+      }
+    }
+    close(fd);
+  }
+  return devices;
+}
+
 V4L2VideoCapture::V4L2VideoCapture()
     : _deviceFd(-1),
       _buffersAllocatedByDevice(-1),
@@ -107,65 +114,11 @@ V4L2VideoCapture::V4L2VideoCapture()
       _currentHeight(-1),
       _currentFrameRate(-1),
       _useNative(false),
+      _timecode(false),
       _captureStarted(false),
       _captureVideoType(webrtc::VideoType::kI420),
       _pool(NULL) {}
 
-bool V4L2VideoCapture::FindDevice(const char* deviceUniqueIdUTF8,
-                                  const std::string& device) {
-  int fd;
-  if ((fd = open(device.c_str(), O_RDONLY)) != -1) {
-    // query device capabilities
-    struct v4l2_capability cap;
-    if (ioctl(fd, VIDIOC_QUERYCAP, &cap) == 0) {
-      if (cap.bus_info[0] != 0) {
-        if (strncmp((const char*)cap.bus_info, (const char*)deviceUniqueIdUTF8,
-                    strlen((const char*)deviceUniqueIdUTF8)) ==
-            0)  // match with device id
-        {
-          close(fd);
-          return true;
-        }
-      }
-    }
-    close(fd);  // close since this is not the matching device
-  }
-  return false;
-}
-
-int32_t V4L2VideoCapture::Init(const char* deviceUniqueIdUTF8,
-                               const std::string& specifiedVideoDevice) {
-  int fd;
-  bool found = false;
-
-  if (!specifiedVideoDevice.empty()) {
-    // specifiedVideoDevice が指定されてる場合はそれだけ調べる
-    if (FindDevice(deviceUniqueIdUTF8, specifiedVideoDevice)) {
-      found = true;
-      _videoDevice = specifiedVideoDevice;
-    }
-  } else {
-    // specifiedVideoDevice が指定されてない場合は頑張って探す
-    /* detect /dev/video [0-63] entries */
-    char device[32];
-    int n;
-    for (n = 0; n < 64; n++) {
-      sprintf(device, "/dev/video%d", n);
-      if (FindDevice(deviceUniqueIdUTF8, device)) {
-        found = true;
-        _videoDevice = device;  // store the video device
-        break;
-      }
-    }
-  }
-
-  if (!found) {
-    RTC_LOG(LS_INFO) << "no matching device found";
-    return -1;
-  }
-  return 0;
-}
-
 V4L2VideoCapture::~V4L2VideoCapture() {
   StopCapture();
   if (_deviceFd != -1)
@@ -324,6 +277,10 @@ int32_t V4L2VideoCapture::StartCapture(ConnectionSettings cs) {
   }
 
   _useNative = cs.use_native;
+  _timecode = cs.timecode_stamp;
+  if (_timecode && useNativeBuffer()) {
+    RTC_LOG(LS_WARNING) << "Timecode can not be stamped into native buffers";
+  }
   _captureStarted = true;
   return 0;
 }
@@ -427,10 +384,32 @@ bool V4L2VideoCapture::DeAllocateVideoBuffers() {
 
 void V4L2VideoCapture::CaptureThread(void* obj) {
   V4L2VideoCapture* capture = static_cast<V4L2VideoCapture*>(obj);
+  ThreadPolicy::Apply("capture");
   while (capture->CaptureProcess()) {
   }
 }
 
+rtc::scoped_refptr<webrtc::I420Buffer> V4L2VideoCapture::ConvertToI420(
+    const uint8_t* data,
+    size_t size,
+    int width,
+    int height,
+    webrtc::VideoType video_type) {
+  rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer(
+      webrtc::I420Buffer::Create(width, height));
+  i420_buffer->InitializeData();
+  if (libyuv::ConvertToI420(
+          data, size, i420_buffer->MutableDataY(), i420_buffer->StrideY(),
+          i420_buffer->MutableDataU(), i420_buffer->StrideU(),
+          i420_buffer->MutableDataV(), i420_buffer->StrideV(), 0, 0, width,
+          height, width, height, libyuv::kRotate0,
+          ConvertVideoType(video_type)) < 0) {
+    RTC_LOG(LS_ERROR) << "ConvertToI420 Failed";
+    return nullptr;
+  }
+  return i420_buffer;
+}
+
 bool V4L2VideoCapture::CaptureProcess() {
   int retVal = 0;
   fd_set rSet;
@@ -478,26 +457,22 @@ bool V4L2VideoCapture::CaptureProcess() {
 
       rtc::scoped_refptr<webrtc::VideoFrameBuffer> dst_buffer = nullptr;
       if (useNativeBuffer()) {
-        rtc::scoped_refptr<NativeBuffer> native_buffer(NativeBuffer::Create(
-            _captureVideoType, _currentWidth, _currentHeight));
+        // MJPEG は 1 フレームが小さいので、ARGB の大きさで確保しないようにする
+        rtc::scoped_refptr<NativeBuffer> native_buffer(
+            NativeBuffer::Create(_captureVideoType, _currentWidth,
+                                 _currentHeight, buf.bytesused));
         memcpy(native_buffer->MutableData(),
                (unsigned char*)_pool[buf.index].start, buf.bytesused);
         native_buffer->SetLength(buf.bytesused);
         dst_buffer = native_buffer;
       } else {
-        rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer(
-            webrtc::I420Buffer::Create(_currentWidth, _currentHeight));
-        i420_buffer->InitializeData();
-        if (libyuv::ConvertToI420(
-                (unsigned char*)_pool[buf.index].start, buf.bytesused,
-                i420_buffer.get()->MutableDataY(), i420_buffer.get()->StrideY(),
-                i420_buffer.get()->MutableDataU(), i420_buffer.get()->StrideU(),
-                i420_buffer.get()->MutableDataV(), i420_buffer.get()->StrideV(),
-                0, 0, _currentWidth, _currentHeight, _currentWidth,
-                _currentHeight, libyuv::kRotate0,
-                ConvertVideoType(_captureVideoType)) < 0) {
-          RTC_LOG(LS_ERROR) << "ConvertToI420 Failed";
-        } else {
+        rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer = ConvertToI420(
+            static_cast<const uint8_t*>(_pool[buf.index].start),
+            buf.bytesused, _currentWidth, _currentHeight, _captureVideoType);
+        if (i420_buffer) {
+          if (_timecode) {
+            Timecode::Stamp(i420_buffer.get(), Timecode::Now());
+          }
           dst_buffer = i420_buffer;
         }
       }
@@ -15,7 +15,10 @@
 #include <stdint.h>
 
 #include <memory>
+#include <string>
+#include <vector>
 
+#include "api/video/i420_buffer.h"
 #include "connection_settings.h"
 #include "modules/video_capture/video_capture_defines.h"
 #include "modules/video_capture/video_capture_impl.h"
@@ -27,20 +30,24 @@ class V4L2VideoCapture : public ScalableVideoTrackSource {
  public:
   static rtc::scoped_refptr<V4L2VideoCapture> Create(ConnectionSettings cs);
   static rtc::scoped_refptr<V4L2VideoCapture> Create(
-      webrtc::VideoCaptureModule::DeviceInfo* device_info,
-      ConnectionSettings cs,
-      size_t capture_device_index);
+      const std::string& device,
+      ConnectionSettings cs);
+  // 映像を取り込める /dev/video* の一覧
+  static std::vector<std::string> FindDevices();
+  // キャプチャしたデータを同じ大きさの I420 に変換する。失敗したら nullptr
+  static rtc::scoped_refptr<webrtc::I420Buffer> ConvertToI420(
+      const uint8_t* data,
+      size_t size,
+      int width,
+      int height,
+      webrtc::VideoType video_type);
   V4L2VideoCapture();
   ~V4L2VideoCapture();
-  int32_t Init(const char* deviceUniqueId,
-               const std::string& specifiedVideoDevice);
   int32_t StartCapture(ConnectionSettings cs);
 
   bool useNativeBuffer() override;
 
  private:
-  bool FindDevice(const char* deviceUniqueIdUTF8, const std::string& device);
-
   enum { kNoOfV4L2Bufffers = 4 };
 
   int32_t StopCapture();
@@ -61,6 +68,7 @@ class V4L2VideoCapture : public ScalableVideoTrackSource {
   int32_t _currentHeight;
   int32_t _currentFrameRate;
   bool _useNative;
+  bool _timecode;
   bool _captureStarted;
   webrtc::VideoType _captureVideoType;
   struct Buffer {
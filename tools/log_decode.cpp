@@ -0,0 +1,101 @@
+// AsyncLogSink が書き出したバイナリログをテキストに戻すツール。
+//
+// 使い方:
+//   momo_log_decode momo_log_1.blog momo_log_0.blog
+//   momo_log_decode < momo_log_0.blog
+//
+// 引数に複数のファイルを渡すと順番に出力するので、古いファイルから並べる。
+// webrtc には依存しないので、ホスト側でビルドして使える。
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#include "log/binary_log_format.h"
+
+namespace {
+
+// rtc::LoggingSeverity と同じ並び
+const char* SeverityName(uint8_t severity) {
+  switch (severity) {
+    case 0:
+      return "VERBOSE";
+    case 1:
+      return "INFO";
+    case 2:
+      return "WARNING";
+    case 3:
+      return "ERROR";
+    default:
+      return "NONE";
+  }
+}
+
+bool Decode(FILE* in, const char* name) {
+  char magic[sizeof(kBinaryLogMagic)];
+  uint32_t version;
+  if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+      memcmp(magic, kBinaryLogMagic, sizeof(magic)) != 0 ||
+      fread(&version, sizeof(version), 1, in) != 1) {
+    fprintf(stderr, "%s: not a momo binary log\n", name);
+    return false;
+  }
+  if (version != kBinaryLogVersion) {
+    fprintf(stderr, "%s: unsupported version %u\n", name, version);
+    return false;
+  }
+
+  BinaryLogRecordHeader header;
+  std::vector<char> data;
+  while (fread(&header, sizeof(header), 1, in) == 1) {
+    data.resize(header.length);
+    if (header.length > 0 &&
+        fread(data.data(), 1, header.length, in) != header.length) {
+      // 書き込み途中で止まったファイルは最後のレコードが欠けている
+      fprintf(stderr, "%s: truncated record\n", name);
+      break;
+    }
+
+    time_t sec = static_cast<time_t>(header.time_us / 1000000);
+    struct tm tm;
+    gmtime_r(&sec, &tm);
+    char time_str[32];
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &tm);
+
+    printf("%s.%06d [%u] %s ", time_str,
+           static_cast<int>(header.time_us % 1000000), header.thread_id,
+           SeverityName(header.severity));
+    if (header.suppressed > 0) {
+      printf("(%u suppressed) ", header.suppressed);
+    }
+    fwrite(data.data(), 1, data.size(), stdout);
+    putchar('\n');
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    return Decode(stdin, "stdin") ? 0 : 1;
+  }
+
+  int result = 0;
+  for (int i = 1; i < argc; i++) {
+    FILE* in = fopen(argv[i], "rb");
+    if (in == nullptr) {
+      fprintf(stderr, "%s: failed to open\n", argv[i]);
+      result = 1;
+      continue;
+    }
+    if (!Decode(in, argv[i])) {
+      result = 1;
+    }
+    fclose(in);
+  }
+  return result;
+}